@@ -0,0 +1,74 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "opencl_runtime.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BENCH_DEFAULT_WARMUP 2        // runs discarded before the measured ones
+#define BENCH_DEFAULT_REPETITIONS 10  // measured runs per input size
+#define BENCH_MAX_REPETITIONS 1000
+
+/**
+ * Summary of the repeated samples of one phase, in seconds.
+ * stddev is the sample standard deviation, p95 and p99 the nearest-rank 95th and 99th percentiles.
+ */
+typedef struct BenchStats {
+    int count;
+    double min;
+    double median;
+    double p95;
+    double p99;
+    double mean;
+    double stddev;
+    double max;
+} BenchStats;
+
+/**
+ * Summarize count samples (sorts them in place).
+ */
+void bench_stats(double* samples, int count, BenchStats* stats);
+
+/**
+ * Throughput in GB/s (10^9 bytes per second), 0 if seconds is not positive.
+ */
+double bench_throughput(size_t bytes, double seconds);
+
+/**
+ * One JSON results file of a benchmark run: the host and device metadata and the run
+ * configuration first, then one entry per input size and phase.
+ */
+typedef struct BenchReport {
+    FILE* file;
+    int result_count;
+} BenchReport;
+
+/**
+ * Create the results file and write the metadata.
+ *
+ * runtime: the device the OpenCL phases run on, NULL if there is none
+ *
+ * Returns 0 on success, -1 if the file cannot be created.
+ */
+int bench_report_open(BenchReport* report, const char* path, const OpenCLRuntime* runtime,
+                      int warmup, int repetitions, uint64_t seed);
+
+/**
+ * Add the result of one phase.
+ *
+ * clock: "wall" for the monotonic host clock, "device" for OpenCL event profiling
+ * bytes: bytes the phase processes per run, the throughput is left out if 0
+ */
+void bench_report_add(BenchReport* report, size_t input_size, const char* phase, const char* clock,
+                      size_t bytes, const BenchStats* stats);
+
+/**
+ * Finish the JSON document and close the file.
+ *
+ * Returns 0 on success, -1 on write error.
+ */
+int bench_report_close(BenchReport* report);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include "huffman.h"
+
+#define BLOCK_INDEX_DEFAULT_BLOCK_SIZE 65536
+
+/**
+ * Start of one block of the bitstream: where its first code begins and which input byte it encodes.
+ */
+typedef struct BlockIndexEntry {
+    uint64_t bit_offset;
+    uint64_t byte_offset;
+} BlockIndexEntry;
+
+/**
+ * Entry points into a Huffman bitstream at every block_size-th symbol, so that blocks can be
+ * decoded independently of each other.
+ */
+typedef struct BlockIndex {
+    size_t block_size;
+    uint64_t total_bytes;  // length of the whole input
+    size_t count;
+    BlockIndexEntry* entries;
+} BlockIndex;
+
+/**
+ * Build the block index of the bitstream encode_input_with_huffman produces for input.
+ *
+ * block_size: number of symbols per block, 0 = BLOCK_INDEX_DEFAULT_BLOCK_SIZE
+ *
+ * Returns 0 on success, -1 on allocation failure or if a byte of the input has no code.
+ */
+int block_index_build(const char* input, size_t input_len, const HuffmanCode table[256],
+                      size_t block_size, BlockIndex* index);
+
+/**
+ * encode_input_with_huffman that also emits the block index of the stream.
+ */
+int encode_input_with_index(const char* input, size_t input_len, const HuffmanCode table[256], size_t block_size,
+                            uint8_t* output, size_t* bit_len, BlockIndex* index);
+
+void block_index_free(BlockIndex* index);
+
+/**
+ * Size of the index in bytes when stored next to the stream.
+ */
+size_t block_index_size(const BlockIndex* index);
+
+/**
+ * Decode the whole stream, the blocks spread over thread_count threads (0 = cpu_count()).
+ *
+ * Returns 0 on success, -1 if the stream is corrupt or a thread could not be started.
+ */
+int huffman_decode_parallel(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                            const BlockIndex* index, uint8_t* output, size_t output_len, int thread_count);
+
+/**
+ * Decode the input bytes [begin, begin + length) only, touching just the blocks that cover them.
+ *
+ * Returns 0 on success, -1 if the range is out of bounds or the stream is corrupt.
+ */
+int huffman_decode_range(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                         const BlockIndex* index, size_t begin, size_t length, uint8_t* output);
+
+#endif
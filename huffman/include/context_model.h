@@ -0,0 +1,100 @@
+#ifndef CONTEXT_MODEL_H
+#define CONTEXT_MODEL_H
+
+#include "huffman.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONTEXT_TABLES 257                               // the shared table + one per previous byte
+#define CONTEXT_SHARED_TABLE 0
+#define CONTEXT_MAX_CODE_LENGTH HUFFMAN_DECODE_BITS      // every code is decoded with one lookup
+#define CONTEXT_MODEL_MAX_SIZE (32 + CONTEXT_TABLES * (32 + 128))  // bytes of the largest stored model
+
+/**
+ * Order-1 Huffman model: every byte is coded with the table of the byte before it (0 before
+ * the first byte). Contexts whose own table would not pay for its place in the header share
+ * one table built from the order-0 histogram, so rare contexts cost nothing.
+ *
+ * table_of: the table of each previous byte, CONTEXT_SHARED_TABLE or an own table
+ * table_count: used tables, the shared one included
+ * lengths: code lengths of the tables, at most CONTEXT_MAX_CODE_LENGTH bits
+ * codes: the canonical codes of the lengths
+ */
+typedef struct ContextModel {
+    uint16_t table_of[256];
+    int table_count;
+    uint8_t lengths[CONTEXT_TABLES][256];
+    HuffmanCode codes[CONTEXT_TABLES][256];
+} ContextModel;
+
+/**
+ * Lookup tables of the decoder: entry = byte | code length << 8, indexed by the next
+ * CONTEXT_MAX_CODE_LENGTH bits of the stream; length 0 marks a bit pattern that is no code.
+ */
+typedef struct ContextDecoder {
+    uint16_t table_of[256];
+    uint16_t entries[CONTEXT_TABLES][1 << CONTEXT_MAX_CODE_LENGTH];
+} ContextDecoder;
+
+/**
+ * Build the model of a pair histogram (see pair_histogram). A context gets its own table only
+ * if the bits it saves over the shared table exceed the size of the table in the header.
+ *
+ * Returns 0 on success, -1 if a table cannot be built.
+ */
+int context_model_build(const uint64_t* pair_freq, ContextModel* model);
+
+/**
+ * Exact number of bits the input of the pair histogram encodes to with the model.
+ */
+size_t context_encoded_bits(const ContextModel* model, const uint64_t* pair_freq);
+
+/**
+ * Size of the stored model in bytes, at most CONTEXT_MODEL_MAX_SIZE.
+ *
+ * Layout: 32-byte bitmap of the contexts with an own table, then the shared table and the own
+ * tables in context order, each as a 32-byte bitmap of its coded bytes followed by their 4-bit
+ * code lengths (two per byte, the first in the high nibble, padded to a whole byte).
+ */
+size_t context_model_size(const ContextModel* model);
+
+/**
+ * Store the model in output (context_model_size bytes).
+ *
+ * Returns the number of bytes written.
+ */
+size_t context_model_write(const ContextModel* model, uint8_t* output);
+
+/**
+ * Load a model stored by context_model_write.
+ *
+ * used: number of bytes the model took
+ *
+ * Returns 0 on success, -1 if the data is truncated or not a valid model.
+ */
+int context_model_read(ContextModel* model, const uint8_t* input, size_t input_len, size_t* used);
+
+/**
+ * Encode input into a packed bitstream, most significant bit of each byte first.
+ *
+ * output: at least (context_encoded_bits(...) + 7) / 8 bytes
+ * bit_len: number of valid bits written to output (the last byte is zero padded)
+ *
+ * Returns 0 on success, -1 if a byte has no code in the table of its context.
+ */
+int context_encode(const ContextModel* model, const uint8_t* input, size_t input_len, uint8_t* output, size_t* bit_len);
+
+void context_decoder_init(ContextDecoder* decoder, const ContextModel* model);
+
+/**
+ * Decode exactly output_len bytes from a bitstream produced by context_encode.
+ *
+ * bit_len: number of valid bits in input
+ *
+ * Returns 0 on success, -1 if the stream is corrupt or ends too early.
+ */
+int context_decode(const ContextDecoder* decoder, const uint8_t* input, size_t bit_len,
+                   uint8_t* output, size_t output_len);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CPU_HISTOGRAM_H
+#define CPU_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CPU_HISTOGRAM_MAX_THREADS 256
+#define CPU_HISTOGRAM_MIN_THREAD_BYTES (1 << 20)  // smaller inputs use fewer threads
+#define PAIR_HISTOGRAM_SIZE (256 * 256)             // counters of a pair histogram, see pair_histogram
+
+/**
+ * Byte histogram on the calling thread.
+ * Consecutive bytes are counted into separate interleaved tables, so a run of the same byte
+ * does not wait for its own previous increment; the input is read 16 bytes at a time with two
+ * 64-bit loads. Wider SIMD loads do not help, every byte still needs its own scalar increment.
+ *
+ * freq: the histogram, overwritten
+ */
+void byte_histogram(const uint8_t* input, size_t input_len, uint64_t freq[256]);
+
+/**
+ * byte_histogram on thread_count threads, each counting its own range, and the partial
+ * histograms added up at the end.
+ *
+ * thread_count: number of threads, 0 = one per processor (cpu_count)
+ *
+ * Returns 0 on success, -1 if a thread could not be started (freq is still complete then,
+ * the calling thread counts the ranges of the missing threads).
+ */
+int byte_histogram_parallel(const uint8_t* input, size_t input_len, uint64_t freq[256], int thread_count);
+
+/**
+ * Histogram of the byte pairs of the input: freq[previous * 256 + byte] counts how often byte
+ * follows previous, the order-1 statistics of a context model.
+ *
+ * previous: the byte before the input, the context of its first byte
+ * freq: PAIR_HISTOGRAM_SIZE counters, overwritten
+ */
+void pair_histogram(const uint8_t* input, size_t input_len, uint8_t previous, uint64_t* freq);
+
+/**
+ * pair_histogram with previous = 0 on thread_count threads; every range takes the byte before
+ * it as its first context, so the result is the same as on one thread.
+ *
+ * thread_count: number of threads, 0 = one per processor (cpu_count)
+ *
+ * Returns 0 on success, -1 on allocation failure or if a thread could not be started (freq is
+ * still complete then, the calling thread counts the ranges it could not hand out).
+ */
+int pair_histogram_parallel(const uint8_t* input, size_t input_len, uint64_t* freq, int thread_count);
+
+/**
+ * Name of the counting path of byte_histogram, "scalar", recorded in the bench results.
+ */
+const char* byte_histogram_path(void);
+
+#endif
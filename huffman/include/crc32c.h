@@ -0,0 +1,24 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC-32C (Castagnoli) of length bytes, continuing from crc (0 for the first piece), so that
+ * crc32c(crc32c(0, a, n), b, m) is the checksum of a followed by b. Uses the SSE4.2 crc32
+ * instruction where the processor has it (chosen at run time), slicing-by-8 tables otherwise.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+/**
+ * The same with the table implementation only, for comparison.
+ */
+uint32_t crc32c_portable(uint32_t crc, const void* data, size_t length);
+
+/**
+ * Name of the implementation crc32c uses on this processor: "sse4.2" or "slicing-by-8".
+ */
+const char* crc32c_path(void);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "bench.h"
+#include "dispatch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DAEMON_DEFAULT_SOCKET "huffman.sock"
+#define DAEMON_MAGIC_REQUEST "HUFQ"
+#define DAEMON_MAGIC_RESPONSE "HUFR"
+#define DAEMON_HEADER_SIZE 16
+#define DAEMON_MAX_PAYLOAD ((uint64_t)1 << 30)  // requests and results
+#define DAEMON_MAX_THREADS 64
+#define DAEMON_LATENCY_SAMPLES 8192             // latest requests per operation kept for the percentiles
+
+/*
+ * Protocol over a local (Unix domain) stream socket, all integers little-endian. A connection
+ * carries any number of requests, each answered before the next one is read:
+ *
+ *   request:  "HUFQ", u8 operation, u8 order, u8 streams, u8 0, u64 payload size, payload
+ *   response: "HUFR", i32 status (0 = done, -1 = failed or malformed), u64 payload size, payload
+ *
+ * A malformed request header is answered with -1 and the connection is closed.
+ */
+typedef enum DaemonOperation {
+    DAEMON_COMPRESS,    // data -> .huf stream (order, streams as in huffman_stream_encoder_init)
+    DAEMON_DECOMPRESS,  // .huf stream -> data
+    DAEMON_HISTOGRAM,   // data -> 256 u64 byte counts, on the backend the dispatcher chooses
+    DAEMON_STATS,       // -> text: requests, failures and latency percentiles per operation
+    DAEMON_SHUTDOWN,    // -> nothing; the daemon stops once the open connections are closed
+    DAEMON_OPERATION_COUNT
+} DaemonOperation;
+
+typedef struct DaemonServer DaemonServer;
+typedef struct DaemonClient DaemonClient;
+
+/**
+ * Listen on socket_path; a stale socket file left by a daemon that is gone is replaced.
+ * The socket file is readable and writable by its owner only (0600), whatever the umask.
+ *
+ * thread_count: connections served at once, 0 = cpu_count()
+ * dispatcher: backend choice of histogram jobs, with the warm runtime; the device is used by one job at a time
+ * log: startup and shutdown messages, may be NULL
+ *
+ * Returns the server, or NULL if the socket cannot be created or another daemon is listening on it.
+ */
+DaemonServer* daemon_open(const char* socket_path, int thread_count, Dispatcher* dispatcher, FILE* log);
+
+/**
+ * Serve requests on thread_count threads (the calling thread among them) until a shutdown request.
+ *
+ * Returns 0 after a shutdown request, -1 if a thread could not be started.
+ */
+int daemon_run(DaemonServer* server);
+
+/**
+ * Print the latency table and remove the socket file.
+ */
+void daemon_close(DaemonServer* server);
+
+/**
+ * Returns the connection, or NULL if no daemon listens on socket_path.
+ */
+DaemonClient* daemon_client_connect(const char* socket_path);
+
+/**
+ * Send one request and wait for its answer.
+ *
+ * response: receives a malloc'd copy of the result (free it), NULL if there is none
+ *
+ * Returns the status of the response (0 or -1), -1 on a broken connection.
+ */
+int daemon_client_request(DaemonClient* client, DaemonOperation operation, int order, int streams,
+                          const uint8_t* payload, size_t payload_size, uint8_t** response, size_t* response_size);
+
+void daemon_client_close(DaemonClient* client);
+
+/**
+ * Result of daemon_load_generate, latencies in seconds as seen by the clients.
+ */
+typedef struct DaemonLoadStats {
+    int requests;
+    int failures;   // failed requests, and answers that differ from the local result
+    double time;
+    BenchStats latency;
+} DaemonLoadStats;
+
+/**
+ * Load generator: connections clients, each on its own thread and connection, send requests
+ * requests of one operation back to back on size bytes of generated data (for decompress, its
+ * compressed form) and check every answer against the result computed locally.
+ *
+ * Returns 0 if every client connected, -1 otherwise.
+ */
+int daemon_load_generate(const char* socket_path, DaemonOperation operation, int connections, int requests,
+                         size_t size, DaemonLoadStats* stats);
+
+const char* daemon_operation_name(DaemonOperation operation);
+
+/**
+ * Returns the operation called name, or -1.
+ */
+int daemon_operation_parse(const char* name);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "opencl_runtime.h"
+#include "huffman.h"
+#include "random_bytes.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DISPATCH_PROFILE_PATH OPENCL_RUNTIME_CACHE_DIR "/dispatch_profile.txt"
+#define DISPATCH_CALIBRATION_MIN_SIZE ((size_t)4 << 10)   // calibrated sizes: 4 KiB, 16 KiB, ... 64 MiB
+#define DISPATCH_CALIBRATION_MAX_SIZE ((size_t)64 << 20)
+#define DISPATCH_CALIBRATION_RUNS 5                       // measured runs per size and backend, after one warmup
+
+typedef enum DispatchOperation {
+    DISPATCH_GENERATE,   // random_bytes
+    DISPATCH_HISTOGRAM,  // byte histogram
+    DISPATCH_ENCODE,     // Huffman encode with a given table
+    DISPATCH_OPERATION_COUNT
+} DispatchOperation;
+
+typedef enum DispatchBackend {
+    DISPATCH_CPU,           // one thread
+    DISPATCH_CPU_PARALLEL,  // every core
+    DISPATCH_OPENCL,        // the device of the runtime, including the transfers
+    DISPATCH_BACKEND_COUNT
+} DispatchBackend;
+
+/**
+ * Crossover points of one machine: an operation runs on the CPU below parallel_from bytes,
+ * on all cores from parallel_from, and on the device from opencl_from (SIZE_MAX = never).
+ *
+ * device: name of the OpenCL device the profile was measured with, "none" without one
+ * calibrated: false for the built-in defaults
+ */
+typedef struct DispatchProfile {
+    size_t parallel_from[DISPATCH_OPERATION_COUNT];
+    size_t opencl_from[DISPATCH_OPERATION_COUNT];
+    char device[256];
+    bool calibrated;
+} DispatchProfile;
+
+/**
+ * Chooses the backend of every call by its size, so callers get the fastest path without
+ * choosing one. Without a runtime the OpenCL backend is never chosen.
+ */
+typedef struct Dispatcher {
+    OpenCLRuntime* runtime;
+    DispatchProfile profile;
+} Dispatcher;
+
+/**
+ * Set up a dispatcher with the profile stored at profile_path if it was calibrated on the same
+ * device, otherwise with defaults that never choose OpenCL.
+ *
+ * runtime: may be NULL
+ * profile_path: NULL = defaults only
+ *
+ * Returns 0 if the stored profile was loaded, -1 if the defaults are used.
+ */
+int dispatcher_init(Dispatcher* dispatcher, OpenCLRuntime* runtime, const char* profile_path);
+
+/**
+ * Measure every operation with every backend over the calibration sizes and derive the
+ * crossover points from the medians. The profile of the dispatcher is replaced.
+ *
+ * log: receives one CSV line per size and operation (Size,Operation,Cpu,CpuParallel,OpenCL,Best), may be NULL
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int dispatch_calibrate(Dispatcher* dispatcher, FILE* log);
+
+/**
+ * Returns 0 on success, -1 if the file cannot be written.
+ */
+int dispatch_profile_save(const DispatchProfile* profile, const char* path);
+
+DispatchBackend dispatch_backend(const Dispatcher* dispatcher, DispatchOperation operation, size_t size);
+
+const char* dispatch_backend_name(DispatchBackend backend);
+
+/**
+ * Print the crossover points of every operation.
+ */
+void dispatch_print_profile(const Dispatcher* dispatcher, FILE* out);
+
+/**
+ * Print the backend chosen for each operation at the given size.
+ */
+void dispatch_print_decision(const Dispatcher* dispatcher, size_t size, FILE* out);
+
+/**
+ * The operations on the backend the dispatcher chooses. If the device fails they fall back
+ * to all cores, so they only fail where the CPU functions do.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int dispatch_generate(const Dispatcher* dispatcher, const RandomTables* tables, uint64_t seed,
+                      uint8_t* output, size_t length);
+
+int dispatch_histogram(const Dispatcher* dispatcher, const uint8_t* input, size_t input_len, uint64_t freq[256]);
+
+int dispatch_encode(const Dispatcher* dispatcher, const char* input, size_t input_len, const HuffmanCode table[256],
+                    uint8_t* output, size_t* bit_len);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef GPU_ENCODE_H
+#define GPU_ENCODE_H
+
+#include "opencl_runtime.h"
+#include "huffman.h"
+
+#define GPU_ENCODE_SEGMENT_SIZE 1024  // input bytes encoded by one work-item
+#define GPU_ENCODE_LOCAL_SIZE 256
+
+/**
+ * Huffman encode an input that is already on the device with the kernels of kernels/huffman_encode.cl.
+ * The output is byte-for-byte identical to encode_input_with_huffman.
+ *
+ * runtime: its context, queue and encode kernels are used
+ * input_buffer: the input bytes, e.g. the buffer byte_frequency_kernel ran on
+ * table: code table, every code at most 32 bits long
+ * output: at least (huffman_encoded_bits(...) + 7) / 8 bytes
+ * bit_len: number of valid bits in output
+ * kernel_time: device time of the encode kernels in seconds
+ *
+ * Returns 0 on success, -1 on OpenCL error or if a code is longer than 32 bits.
+ */
+int gpu_huffman_encode(OpenCLRuntime* runtime, cl_mem input_buffer, cl_ulong input_len,
+                       const HuffmanCode table[256], uint8_t* output, size_t* bit_len, double* kernel_time);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef GPU_HISTOGRAM_H
+#define GPU_HISTOGRAM_H
+
+#include "opencl_runtime.h"
+#include "random_bytes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPU_HISTOGRAM_CHUNK_SIZE (16 << 20)  // bytes uploaded and counted at once
+#define GPU_HISTOGRAM_BUFFERS 2              // chunks in flight
+#define GPU_HISTOGRAM_BYTES_PER_ITEM 1024    // input bytes per work-item of byte_frequency_kernel
+#define GPU_HISTOGRAM_LOCAL_SIZE 256
+#define GPU_HISTOGRAM_VECTORS_PER_ITEM 16    // 16-byte loads per work-item of byte_frequency_vec_kernel
+#define GPU_HISTOGRAM_GROUPS_PER_UNIT 8      // work-groups per compute unit at most, the rest is grid-stride
+
+typedef enum GpuHistogramKernel {
+    GPU_HISTOGRAM_ATOMIC,  // byte_frequency_kernel: one local histogram, byte loads, counts read back per chunk
+    GPU_HISTOGRAM_VECTOR,  // byte_frequency_vec_kernel: replicated local histograms, 16-byte loads,
+                           // 64-bit totals kept on the device and read back once
+} GpuHistogramKernel;
+
+/**
+ * Time split of one histogram run.
+ *
+ * setup_time: host time of creating the device buffers, before the first upload
+ * transfer_time: device time of the uploads, summed over the chunks (about 0 in place)
+ * kernel_time: device time of the histogram kernels, summed over the chunks
+ * readback_time: device time of reading the counts back, summed over the chunks
+ * wall_time: host time of the whole run; less than the sum of the others when they overlap
+ */
+typedef struct GpuHistogramTiming {
+    double setup_time;
+    double transfer_time;
+    double kernel_time;
+    double readback_time;
+    double wall_time;
+} GpuHistogramTiming;
+
+/**
+ * Byte histogram of a host buffer on the device, in a pipeline of chunks:
+ * while the kernel counts chunk k on runtime->queue, chunk k + 1 is uploaded on
+ * runtime->transfer_queue into the other device buffer. Device memory use is
+ * GPU_HISTOGRAM_BUFFERS * chunk_size regardless of the input size. If opencl_zero_copy allows
+ * it for input (and chunk_size keeps the chunks aligned), the kernels read the chunks in place
+ * and nothing is uploaded.
+ *
+ * kernel: the histogram kernel variant
+ * chunk_size: bytes per chunk, 0 = GPU_HISTOGRAM_CHUNK_SIZE (clamped to 1 GiB, the kernel counts in int)
+ * freq: the histogram
+ * timing: may be NULL
+ *
+ * Returns 0 on success, -1 on OpenCL error.
+ */
+int gpu_byte_histogram(OpenCLRuntime* runtime, GpuHistogramKernel kernel, const uint8_t* input, size_t input_len,
+                       size_t chunk_size, uint64_t freq[256], GpuHistogramTiming* timing);
+
+/**
+ * pair_histogram (previous = 0) on the device, in the same chunk pipeline; the 64-bit totals
+ * stay on the device and are read back once.
+ *
+ * freq: PAIR_HISTOGRAM_SIZE counters
+ *
+ * Returns 0 on success, -1 on OpenCL error.
+ */
+int gpu_pair_histogram(OpenCLRuntime* runtime, const uint8_t* input, size_t input_len, size_t chunk_size,
+                       uint64_t* freq, GpuHistogramTiming* timing);
+
+/**
+ * Byte histogram of data that is already on the device, e.g. made by gpu_random_buffer, with
+ * byte_frequency_vec_kernel; nothing but the 256 totals crosses to the host. Inputs over 1 GiB are
+ * counted in sub-buffers.
+ *
+ * timing: transfer_time stays 0, may be NULL
+ *
+ * Returns 0 on success, -1 on OpenCL error.
+ */
+int gpu_buffer_histogram(OpenCLRuntime* runtime, cl_mem input_buffer, size_t input_len, uint64_t freq[256],
+                         GpuHistogramTiming* timing);
+
+/**
+ * Byte histogram of random_bytes(tables, seed, first, ..., length) without storing the bytes
+ * anywhere: random_frequency_kernel counts them as it generates them. Neither host nor device
+ * memory limits length, which makes it a synthetic load of any size.
+ *
+ * timing: transfer_time stays 0, may be NULL
+ *
+ * Returns 0 on success, -1 on OpenCL error.
+ */
+int gpu_random_histogram(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                         uint64_t length, uint64_t freq[256], GpuHistogramTiming* timing);
+
+#endif
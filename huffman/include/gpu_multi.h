@@ -0,0 +1,73 @@
+#ifndef GPU_MULTI_H
+#define GPU_MULTI_H
+
+#include "opencl_runtime.h"
+#include "random_bytes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define GPU_MULTI_MAX_DEVICES 16
+#define GPU_MULTI_CALIBRATION_SIZE (16 << 20)  // bytes each device processes when its throughput is measured
+#define GPU_MULTI_ALIGNMENT OPENCL_ZERO_COPY_ALIGNMENT  // device ranges start at multiples of this (in place use)
+
+/**
+ * Several OpenCL devices working on one input, each with its own runtime (context, queues,
+ * programs). An input is split into one contiguous range per device, in proportion to the
+ * device's weight for the operation.
+ *
+ * histogram_weights, generate_weights: shares of the devices, each set sums to 1
+ */
+typedef struct GpuDeviceSet {
+    OpenCLRuntime runtimes[GPU_MULTI_MAX_DEVICES];
+    double histogram_weights[GPU_MULTI_MAX_DEVICES];
+    double generate_weights[GPU_MULTI_MAX_DEVICES];
+    int count;
+} GpuDeviceSet;
+
+/**
+ * Create a runtime on every device of the given types on every platform, with equal weights.
+ * Devices whose programs cannot be built are left out.
+ *
+ * types: e.g. CL_DEVICE_TYPE_ALL
+ * sub_device_units: if not 0, CPU devices are partitioned with clCreateSubDevices into
+ *                   sub-devices of this many compute units, each used as a separate device
+ *                   (a CPU-only OpenCL implementation then already gives several devices)
+ * cache_dir: binary cache of the programs, see opencl_runtime_init_device
+ *
+ * Returns the number of devices, 0 if there is none.
+ */
+int gpu_device_set_init(GpuDeviceSet* set, cl_device_type types, cl_uint sub_device_units, const char* cache_dir);
+
+void gpu_device_set_release(GpuDeviceSet* set);
+
+/**
+ * Set the weights from the throughput of every device on sample_size bytes of test data,
+ * measured one device at a time (transfers included). A device that fails gets weight 0.
+ */
+void gpu_device_set_calibrate(GpuDeviceSet* set, const RandomTables* tables, size_t sample_size);
+
+/**
+ * Print the devices, their compute units and weights.
+ */
+void gpu_device_set_print(const GpuDeviceSet* set, FILE* out);
+
+/**
+ * Byte histogram split over all devices, each counting its range concurrently on its own host
+ * thread; the partial histograms are added up at the end.
+ *
+ * Returns 0 on success, -1 if a device failed (freq is still complete then, the failed ranges
+ * are counted on the CPU).
+ */
+int gpu_multi_histogram(GpuDeviceSet* set, const uint8_t* input, size_t input_len, uint64_t freq[256]);
+
+/**
+ * random_bytes(tables, seed, 0, output, length) split over all devices the same way.
+ *
+ * Returns 0 on success, -1 if a device failed (the output is still complete then).
+ */
+int gpu_multi_random_bytes(GpuDeviceSet* set, const RandomTables* tables, uint64_t seed,
+                           uint8_t* output, size_t length);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef GPU_RANDOM_H
+#define GPU_RANDOM_H
+
+#include "opencl_runtime.h"
+#include "random_bytes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPU_RANDOM_PAIRS_PER_ITEM 32  // byte pairs per work-item of generate_random_kernel
+#define GPU_RANDOM_LOCAL_SIZE 256
+
+/**
+ * Bytes first .. first + length - 1 of the random stream of seed, generated on the device with
+ * generate_random_kernel and read back; byte-for-byte identical to random_bytes with the same arguments.
+ * If opencl_zero_copy allows it for output, the kernel writes into output in place and nothing is read back.
+ *
+ * time: host time of the kernel and the read back (or map) in seconds, may be NULL
+ *
+ * Returns 0 on success, -1 on OpenCL error.
+ */
+int gpu_random_bytes(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                     uint8_t* output, size_t length, double* time);
+
+/**
+ * The same bytes into a device buffer, where they stay: gpu_buffer_histogram and
+ * gpu_huffman_encode can use it without the data ever crossing to the host.
+ *
+ * first: even, the kernel starts at a pair boundary
+ * output_buffer: at least length bytes
+ * time: host time of the kernel in seconds, may be NULL
+ *
+ * Returns 0 on success, -1 on OpenCL error or odd first.
+ */
+int gpu_random_buffer(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                      cl_mem output_buffer, size_t length, double* time);
+
+#endif
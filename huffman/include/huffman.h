@@ -4,14 +4,190 @@
 #include <stddef.h> // size_t miatt kell
 #include <stdint.h> // ha uint8_t-t használnál
 
+#define HUFFMAN_MAX_NODES 511   // 256 leaves + 255 internal nodes
+#define HUFFMAN_DECODE_BITS 11  // index width of the decoder lookup table
+#define HUFFMAN_DECODE_SYMBOLS 4
+#define HUFFMAN_DECODE_MAX_CODE_LENGTH 57     // longest code a 64-bit window holds at any bit offset
+#define HUFFMAN_MAX_CODE_LENGTH 32            // upper bound of the canonical code lengths
+#define HUFFMAN_DEFAULT_MAX_CODE_LENGTH 11    // = HUFFMAN_DECODE_BITS, no code needs the slow decoder path
+#define HUFFMAN_MAX_STREAMS 8                 // sub-streams of huffman_encode_streams
+#define HUFFMAN_DEFAULT_STREAMS 4
+
 typedef struct Node {
     char charValue;
-    int freq;
+    uint64_t freq;
     struct Node* left;
     struct Node* right;
 } Node;
 
-void huffmanEncoding2(const int freq[256], char codes[256][256]);
-void encode_input_with_huffman(const char* input, size_t input_len, char codes[256][256], char* output_bits, size_t* bit_len);
+/**
+ * Packed form of one Huffman code.
+ *
+ * code: the code bits, right-aligned (the first bit of the code is the most significant one)
+ * length: number of valid bits in code, 0 if the byte has no code
+ */
+typedef struct HuffmanCode {
+    uint64_t code;
+    uint8_t length;
+} HuffmanCode;
+
+/**
+ * One entry of the decoder lookup table, indexed by the next HUFFMAN_DECODE_BITS bits of the stream.
+ *
+ * symbols: the bytes whose codes fit completely into the index bits, in order
+ * count: number of valid symbols, 0 if the first code is longer than HUFFMAN_DECODE_BITS
+ * bits: total length of the codes of the decoded symbols (0 with count 0)
+ * padding: 8 bytes per entry, so the index scales in the address of the load
+ */
+typedef struct HuffmanDecodeEntry {
+    uint8_t symbols[HUFFMAN_DECODE_SYMBOLS];
+    uint8_t count;
+    uint8_t bits;
+    uint8_t padding[2];
+} HuffmanDecodeEntry;
+
+/**
+ * Decoder state built from a code table.
+ * Codes longer than HUFFMAN_DECODE_BITS are resolved by walking the flattened code tree:
+ * a child value > 0 is the index of an internal node, < 0 is a leaf holding -(byte + 1).
+ */
+typedef struct HuffmanDecoder {
+    HuffmanDecodeEntry table[1 << HUFFMAN_DECODE_BITS];
+    int16_t tree[HUFFMAN_MAX_NODES][2];
+    int tree_size;
+} HuffmanDecoder;
+
+/**
+ * Build the Huffman tree of a byte histogram in a caller-owned node arena.
+ * No heap allocation and no shared state, so it can run on several threads at once.
+ *
+ * arena: storage of the nodes, leaves first, the root is one of its elements
+ *
+ * Returns the root, or NULL if every frequency is 0. A lone used byte is a leaf root.
+ */
+Node* huffman_build_tree(const uint64_t freq[256], Node arena[HUFFMAN_MAX_NODES]);
+
+void huffmanEncoding2(const uint64_t freq[256], char codes[256][256]);
+
+/**
+ * Canonical Huffman codes with every code length limited to max_length bits.
+ * The table is fully described by the code lengths, see huffman_canonical_codes.
+ *
+ * Returns 0 on success, -1 if max_length is out of range or too small for the number of used bytes.
+ */
+int huffmanEncodingCanonical(const uint64_t freq[256], int max_length, HuffmanCode table[256]);
+
+/**
+ * Huffman code lengths limited to max_length bits (0 for unused bytes).
+ * Codes over the limit are shortened and the Kraft inequality is restored by lengthening
+ * the deepest shorter codes, then the lengths are reassigned by descending frequency.
+ *
+ * Returns 0 on success, -1 if max_length is out of range or too small for the number of used bytes.
+ */
+int huffman_limit_code_lengths(const uint64_t freq[256], int max_length, uint8_t lengths[256]);
+
+/**
+ * Assign canonical codes to the given code lengths: shorter codes first, equal lengths in byte order.
+ *
+ * Returns 0 on success, -1 if the lengths do not form a valid prefix code.
+ */
+int huffman_canonical_codes(const uint8_t lengths[256], HuffmanCode table[256]);
+
+/**
+ * Convert the '0'/'1' string codes produced by huffmanEncoding2 into a packed code table.
+ *
+ * Returns 0 on success, -1 if a code is longer than 64 bits.
+ */
+int build_code_table(char codes[256][256], HuffmanCode table[256]);
+
+/**
+ * Exact number of bits the encoded form of an input with the given byte histogram takes.
+ * Use it to size the output buffer of encode_input_with_huffman: (bits + 7) / 8 bytes.
+ */
+size_t huffman_encoded_bits(const uint64_t freq[256], const HuffmanCode table[256]);
+
+/**
+ * Encode input into a packed bitstream, most significant bit of each byte first.
+ *
+ * output: at least (huffman_encoded_bits(...) + 7) / 8 bytes
+ * bit_len: number of valid bits written to output (the last byte is zero padded)
+ *
+ * Returns 0 on success, -1 if a byte of the input has no code.
+ */
+int encode_input_with_huffman(const char* input, size_t input_len, const HuffmanCode table[256], uint8_t* output, size_t* bit_len);
+
+/**
+ * Encode input into output starting at bit position bit_offset, for encoding ranges concurrently.
+ * Only whole bytes are written: the first one gets zeros in the bits ahead of bit_offset, and the
+ * bits of the last, partial byte are returned in tail (left-aligned) instead of being stored, so
+ * that two neighbouring ranges never write the same byte. The caller ORs the tail into place.
+ *
+ * bit_len: number of bits the range encoded to
+ *
+ * Returns 0 on success, -1 if a byte of the input has no code.
+ */
+int huffman_encode_range(const char* input, size_t input_len, const HuffmanCode table[256],
+                         uint8_t* output, size_t bit_offset, size_t* bit_len, uint8_t* tail);
+
+/**
+ * Build the lookup tables of a decoder.
+ *
+ * Returns 0 on success, -1 if the table is not a valid prefix code or has a code longer than
+ * HUFFMAN_DECODE_MAX_CODE_LENGTH bits.
+ */
+int huffman_decoder_init(HuffmanDecoder* decoder, const HuffmanCode table[256]);
+
+/**
+ * Decode exactly output_len bytes from a bitstream produced by encode_input_with_huffman.
+ *
+ * bit_len: number of valid bits in input
+ *
+ * Returns 0 on success, -1 if the stream is corrupt or ends too early.
+ */
+int huffman_decode(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len, uint8_t* output, size_t output_len);
+
+/**
+ * Same as huffman_decode, but starts at an arbitrary bit position of the stream.
+ *
+ * position: the bit position to start at, updated to the position after the last decoded code
+ */
+int huffman_decode_from(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                        size_t* position, uint8_t* output, size_t output_len);
+
+/**
+ * Interleaved form: input split into stream_count contiguous segments (segment s starts at
+ * input_len * s / stream_count), each encoded into its own bitstream. The encoder writes all of them
+ * in one pass and the decoder keeps a lookup of every stream in flight at once, so neither is
+ * limited by the serial dependency of a single bitstream.
+ *
+ * Layout: u32 bit count per stream (little-endian), then the streams, each padded to whole bytes.
+ */
+
+/**
+ * Size of the interleaved form of an input that encodes to bit_len bits as a single stream.
+ */
+size_t huffman_streams_size(size_t bit_len, int stream_count);
+
+/**
+ * Encode input in the interleaved form.
+ *
+ * stream_count: 1 .. HUFFMAN_MAX_STREAMS
+ * output: at least huffman_streams_size(huffman_encoded_bits(...), stream_count) bytes
+ * output_size: bytes written
+ *
+ * Returns 0 on success, -1 if stream_count is out of range, a byte of the input has no code or a
+ * stream would be longer than 2^32 - 1 bits.
+ */
+int huffman_encode_streams(const uint8_t* input, size_t input_len, const HuffmanCode table[256], int stream_count,
+                           uint8_t* output, size_t* output_size);
+
+/**
+ * Decode exactly output_len bytes from the interleaved form (input_size bytes, as written by
+ * huffman_encode_streams with the same stream_count).
+ *
+ * Returns 0 on success, -1 if the streams are corrupt, end too early or do not fill input_size.
+ */
+int huffman_decode_streams(const HuffmanDecoder* decoder, const uint8_t* input, size_t input_size, int stream_count,
+                           uint8_t* output, size_t output_len);
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Read-only view of a whole input file.
+ * Memory-mapped sources are served straight from the page cache: nothing is copied up front,
+ * pages are read in on first access, so processing can start before the whole file is read.
+ */
+typedef struct InputSource {
+    const uint8_t* data;
+    size_t size;
+    int mapped;      // 1: data is a file mapping, 0: data is a heap buffer filled with fread
+    void* handle;    // platform mapping handle (Windows only)
+} InputSource;
+
+/**
+ * Open path as an input source.
+ *
+ * use_mmap: 1 = map the file (sequential access hint, transparent huge pages where available),
+ *           0 = read it into a heap buffer with fread
+ *
+ * Returns 0 on success, -1 if the file cannot be opened, mapped or read.
+ */
+int input_source_open(InputSource* source, const char* path, int use_mmap);
+
+void input_source_close(InputSource* source);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef OPENCL_RUNTIME_H
+#define OPENCL_RUNTIME_H
+
+#define CL_TARGET_OPENCL_VERSION 220
+
+#include <CL/cl.h>
+#include <stdbool.h>
+
+#define OPENCL_RUNTIME_CACHE_DIR "cache"  // compiled program binaries, one file per program
+#define OPENCL_MAX_PLATFORMS 16
+#define OPENCL_ZERO_COPY_ALIGNMENT 4096  // host memory used in place by the device starts at a page boundary
+
+/**
+ * Programs of the kernels/ directory, every one built once by opencl_runtime_init.
+ */
+typedef enum OpenCLProgramId {
+    OPENCL_PROGRAM_RANDOM,     // kernels/random_generator.cl
+    OPENCL_PROGRAM_FREQUENCY,  // kernels/byte_frequency.cl
+    OPENCL_PROGRAM_ENCODE,     // kernels/huffman_encode.cl
+    OPENCL_PROGRAM_COUNT
+} OpenCLProgramId;
+
+typedef enum OpenCLKernelId {
+    OPENCL_KERNEL_RANDOM,            // generate_random_kernel
+    OPENCL_KERNEL_RANDOM_FREQUENCY,  // random_frequency_kernel
+    OPENCL_KERNEL_FREQUENCY,         // byte_frequency_kernel
+    OPENCL_KERNEL_FREQUENCY_VECTOR,  // byte_frequency_vec_kernel
+    OPENCL_KERNEL_FREQUENCY_REDUCE,  // byte_frequency_reduce_kernel
+    OPENCL_KERNEL_PAIR_FREQUENCY,    // pair_frequency_kernel
+    OPENCL_KERNEL_PAIR_REDUCE,       // pair_frequency_reduce_kernel
+    OPENCL_KERNEL_BIT_COUNT,         // huffman_bit_count_kernel
+    OPENCL_KERNEL_SCAN,              // huffman_scan_kernel
+    OPENCL_KERNEL_ENCODE,            // huffman_encode_kernel
+    OPENCL_KERNEL_COUNT
+} OpenCLKernelId;
+
+/**
+ * Long-lived OpenCL state: one device with its context, two profiling command queues and every
+ * program and kernel, created once and shared by all runs instead of being rebuilt for each.
+ * Uploads can go to transfer_queue, so that they overlap the kernels running on queue.
+ *
+ * startup_time: seconds opencl_runtime_init took
+ * cached_programs: number of programs loaded from the binary cache instead of compiled from source
+ * zero_copy: the device shares the host's memory (a CPU or an integrated GPU), so page-aligned
+ *            host buffers are used in place (CL_MEM_USE_HOST_PTR) instead of being copied;
+ *            set by the init functions, may be changed to compare both ways
+ */
+typedef struct OpenCLRuntime {
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_command_queue transfer_queue;
+    cl_program programs[OPENCL_PROGRAM_COUNT];
+    cl_kernel kernels[OPENCL_KERNEL_COUNT];
+    double startup_time;
+    int cached_programs;
+    bool zero_copy;
+} OpenCLRuntime;
+
+/**
+ * Devices of the given types (e.g. CL_DEVICE_TYPE_ALL) on every platform, in platform order.
+ *
+ * platforms: the platform of each device
+ * max_devices: capacity of platforms and devices
+ *
+ * Returns the number of devices found, 0 if there is none or no OpenCL platform.
+ */
+int opencl_find_devices(cl_device_type types, cl_platform_id* platforms, cl_device_id* devices, int max_devices);
+
+/**
+ * opencl_runtime_init_device on the first GPU of any platform, or on the first device of any
+ * type if there is no GPU.
+ */
+int opencl_runtime_init(OpenCLRuntime* runtime, const char* cache_dir, bool rebuild);
+
+/**
+ * Create the context and queues of a device and build every program.
+ * A program binary is looked up in cache_dir under a hash of the device, the driver version,
+ * the build options and the kernel source, so a changed kernel or driver never loads a stale
+ * binary. Programs compiled from source are stored there for the next start.
+ *
+ * device: a root device or a sub-device; the runtime takes over the reference of a sub-device
+ * cache_dir: directory of the binary cache (created if missing), NULL = no cache
+ * rebuild: compile every program from source even if a cached binary exists, and refresh the cache
+ *
+ * Returns 0 on success, -1 on OpenCL error or if a kernel source cannot be loaded or built.
+ */
+int opencl_runtime_init_device(OpenCLRuntime* runtime, cl_platform_id platform, cl_device_id device,
+                               const char* cache_dir, bool rebuild);
+
+void opencl_runtime_release(OpenCLRuntime* runtime);
+
+/**
+ * Whether the device can use the host memory at host in place: runtime->zero_copy is set and
+ * host is aligned to OPENCL_ZERO_COPY_ALIGNMENT (see aligned_malloc; mapped files are too).
+ */
+bool opencl_zero_copy(const OpenCLRuntime* runtime, const void* host);
+
+/**
+ * Read-only device buffer with the contents of host: the host memory itself if
+ * opencl_zero_copy allows it, otherwise a copy. In the first case host must stay valid and
+ * unchanged until the buffer is released.
+ *
+ * Returns the buffer, NULL on error (err receives the error code, may be NULL).
+ */
+cl_mem opencl_input_buffer(OpenCLRuntime* runtime, const void* host, size_t size, cl_int* err);
+
+/**
+ * Seconds between the start and the end of a command on a profiling queue.
+ *
+ * Returns the time, 0 if the profiling info is not available (the command has not completed,
+ * the queue does not profile, or event is not valid).
+ */
+double opencl_event_time(cl_event event);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef PARALLEL_ENCODE_H
+#define PARALLEL_ENCODE_H
+
+#include "huffman.h"
+
+#define PARALLEL_ENCODE_MAX_THREADS 256
+
+/**
+ * Multithreaded version of encode_input_with_huffman with bit-identical output.
+ *
+ * The input is split into one chunk per thread. Every thread counts the bytes of its chunk to get
+ * the exact encoded bit length, an exclusive prefix sum of the lengths gives the bit offset of each
+ * chunk, then the threads encode straight into the shared output. Only the bytes on the chunk
+ * boundaries are merged afterwards.
+ *
+ * output: at least (huffman_encoded_bits(...) + 7) / 8 bytes
+ * thread_count: number of worker threads, 0 = cpu_count()
+ *
+ * Returns 0 on success, -1 if a byte of the input has no code or a thread could not be started.
+ */
+int encode_input_parallel(const char* input, size_t input_len, const HuffmanCode table[256],
+                          uint8_t* output, size_t* bit_len, int thread_count);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPELINE_MAX_THREADS 64  // per worker pool
+
+typedef enum PipelineStage {
+    PIPELINE_READ,       // one thread, fread of whole blocks
+    PIPELINE_HISTOGRAM,  // pool: byte histogram and code table (or context model) of a block
+    PIPELINE_ENCODE,     // pool: the bitstream of a block with its table
+    PIPELINE_WRITE,      // the calling thread, fwrite in block order and the index at the end
+    PIPELINE_STAGE_COUNT
+} PipelineStage;
+
+/**
+ * threads: threads of the stage
+ * busy: seconds spent on the work itself, summed over the threads (not waiting for blocks)
+ * utilization: busy / (threads * time of the whole run), 0..1
+ */
+typedef struct PipelineStageStats {
+    int threads;
+    double busy;
+    double utilization;
+} PipelineStageStats;
+
+/**
+ * Occupancy of the queue in front of a stage, sampled at every push: the blocks waiting for it.
+ */
+typedef struct PipelineQueueStats {
+    size_t capacity;
+    double mean;
+    size_t max;
+} PipelineQueueStats;
+
+/**
+ * queues: in front of the histogram, encode and write stages
+ * buffers, memory: the pooled block buffers and the bytes of their input and output, fixed for the whole run
+ */
+typedef struct PipelineStats {
+    double time;
+    uint64_t input_size;
+    uint64_t output_size;
+    size_t blocks;
+    int buffers;
+    size_t memory;
+    PipelineStageStats stages[PIPELINE_STAGE_COUNT];
+    PipelineQueueStats queues[PIPELINE_STAGE_COUNT - 1];
+} PipelineStats;
+
+/**
+ * huffman_compress_stream with the stages overlapped: a reader thread, a histogram pool, an encoder
+ * pool and the writer on the calling thread, connected by bounded lock-free queues. The blocks
+ * travel through them in a fixed pool of buffers, which the writer hands back to the reader, so
+ * memory use does not depend on the input size. The output is byte-identical to huffman_compress_stream.
+ *
+ * thread_count: encoder threads, 0 = cpu_count(); the histogram pool gets an eighth of them (at least 1)
+ * stats: filled in when not NULL
+ *
+ * Returns 0 on success, -1 on I/O or allocation error, an unsupported order or stream count, or
+ * if a thread could not be started.
+ */
+int huffman_compress_pipeline(FILE* in, FILE* out, size_t block_size, int order, int streams, int thread_count,
+                              PipelineStats* stats);
+
+/**
+ * Human-readable summary of a run: throughput, utilization of every stage and queue occupancy.
+ */
+void pipeline_stats_print(const PipelineStats* stats, FILE* file);
+
+#endif
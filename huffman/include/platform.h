@@ -0,0 +1,45 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stddef.h>
+
+/**
+ * Number of logical processors available to the process (at least 1).
+ */
+int cpu_count(void);
+
+/**
+ * Monotonic wall-clock time in seconds, for measuring elapsed time.
+ * Unlike clock() it keeps running while the process waits and does not add up the time of threads.
+ */
+double wall_time(void);
+
+/**
+ * Suspend the calling thread for about microseconds (rounded up to the timer resolution);
+ * 0 only gives up the rest of its time slice.
+ */
+void sleep_microseconds(unsigned microseconds);
+
+/**
+ * Current resident set size of the process in bytes (0 if unknown).
+ */
+size_t current_rss(void);
+
+/**
+ * Create a directory if it does not exist yet (the parent must exist).
+ *
+ * Returns 0 if the directory exists afterwards, -1 otherwise.
+ */
+int make_directory(const char* path);
+
+/**
+ * Heap memory whose address is a multiple of alignment (a power of two, at least sizeof(void*)),
+ * e.g. for buffers an OpenCL device uses in place. Free it with aligned_free.
+ *
+ * Returns NULL on allocation failure.
+ */
+void* aligned_malloc(size_t size, size_t alignment);
+
+void aligned_free(void* memory);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef RANDOM_BYTES_H
+#define RANDOM_BYTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RANDOM_DEFAULT_SEED 0x48554646ULL  // "HUFF"
+#define RANDOM_BUCKET_BITS 12
+#define RANDOM_MAX_THREADS 256
+
+/**
+ * Inverse-CDF lookup tables of the test data distribution, byte = 1 + floor(254 * r^2.5) for
+ * a uniform r in [0, 1). Computed once on the host and used both by random_bytes and by
+ * generate_random_kernel, so that the two produce the same bytes.
+ *
+ * thresholds: thresholds[k] is the smallest 32-bit uniform value that maps to byte k + 1
+ *             (k = 1..253); entries from 254 on are UINT32_MAX
+ * buckets: the byte of the smallest uniform value of each of the 2^RANDOM_BUCKET_BITS
+ *          equal buckets; a bucket is narrower than any byte, so the byte of a value is either
+ *          its bucket's byte or the next one
+ */
+typedef struct RandomTables {
+    uint32_t thresholds[256];
+    uint8_t buckets[1 << RANDOM_BUCKET_BITS];
+} RandomTables;
+
+void random_tables_init(RandomTables* tables);
+
+/**
+ * Returns the byte a 32-bit uniform value maps to (1..254), as in random_bytes and the kernels.
+ */
+uint8_t random_byte_of(const RandomTables* tables, uint32_t u);
+
+/**
+ * Bytes first .. first + length - 1 of the random stream of seed.
+ * Counter-based: byte i only depends on seed and i (splitmix64 of seed and i / 2, one 32-bit
+ * half per byte), so any range can be generated independently, on any thread or on the device.
+ */
+void random_bytes(const RandomTables* tables, uint64_t seed, uint64_t first, uint8_t* output, size_t length);
+
+/**
+ * random_bytes from byte 0, split over thread_count threads (0 = one per processor).
+ *
+ * Returns 0 on success, -1 if a thread could not be started (the output is still complete then).
+ */
+int random_bytes_parallel(const RandomTables* tables, uint64_t seed, uint8_t* output, size_t length, int thread_count);
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_MAGIC "HUFS"
+#define STREAM_INDEX_MAGIC "HUFX"
+#define STREAM_VERSION 2
+#define STREAM_HEADER_SIZE 8
+#define STREAM_DEFAULT_BLOCK_SIZE (1 << 20)
+#define STREAM_MAX_BLOCK_SIZE (64 << 20)
+#define STREAM_MAX_ORDER 1
+#define STREAM_INDEX_ENTRY_SIZE 12
+#define STREAM_TRAILER_SIZE 20
+#define STREAM_MAX_THREADS 256
+#define STREAM_TAIL_SIZE(count) (4 + (count) * STREAM_INDEX_ENTRY_SIZE + STREAM_TRAILER_SIZE)
+
+/*
+ * Compressed file layout (all integers little-endian):
+ *
+ *   header:  "HUFS", u8 version, u8 order (0 in files written before order 1),
+ *            u8 sub-streams of the order-0 blocks (0 in files written before them = 1), 1 reserved byte
+ *   blocks:  u32 uncompressed size, u32 encoded bit count, u32 CRC-32C of the uncompressed bytes,
+ *            order 0: 128 bytes of code lengths (two 4-bit lengths per byte, byte 2i in the high nibble)
+ *            order 1: u32 model size, the model (see context_model_size)
+ *            (bit count + 7) / 8 bytes of bitstream; with more than one sub-stream the bit count is
+ *            8 * the size of the interleaved form of huffman_encode_streams
+ *   end:     u32 0
+ *   index:   per block: u64 offset of the block in the file, u32 uncompressed size
+ *   trailer: u32 block count, u64 offset of the index, u32 CRC-32C of the index and the two
+ *            fields before it, "HUFX"
+ *
+ * Every block has its own canonical code table (at most 15-bit codes), or with order 1 its own
+ * context model (a table per previous byte, at most 11-bit codes), so the data is processed in
+ * fixed-size blocks and memory use does not depend on the input size. The trailer has a fixed
+ * size, so a reader finds the index from the end of the file and can decode any block on its own.
+ *
+ * Version 1 files (no checksums, no index, the file ends after the end mark) are still read.
+ */
+
+/**
+ * Where the blocks of a file are, read from its index.
+ *
+ * offset: position of the block in the file
+ * data_offset: position of its first byte in the uncompressed data
+ */
+typedef struct StreamIndexEntry {
+    uint64_t offset;
+    uint64_t data_offset;
+    uint32_t size;
+} StreamIndexEntry;
+
+typedef struct StreamIndex {
+    int order;
+    int streams;
+    size_t count;
+    uint64_t total_size;   // uncompressed bytes of the whole file
+    uint64_t index_offset; // the blocks end 4 bytes (the end mark) before it
+    StreamIndexEntry* entries;
+} StreamIndex;
+
+#define HUFFMAN_STREAM_OK 0      // progress made, call again with more input or output space
+#define HUFFMAN_STREAM_END 1     // flush / finish / decoding complete, nothing left to hand out
+#define HUFFMAN_STREAM_ERROR -1  // corrupt input, allocation failure or a call after finish
+
+/**
+ * Memory functions of a stream context, for embedding with a custom heap.
+ *
+ * alloc: size bytes or NULL, free: releases what alloc returned (never called with NULL)
+ * opaque: passed to both unchanged
+ */
+typedef struct HuffmanAllocator {
+    void* (*alloc)(void* opaque, size_t size);
+    void (*free)(void* opaque, void* memory);
+    void* opaque;
+} HuffmanAllocator;
+
+/**
+ * Incremental encoder and decoder of the format above. Everything lives in the context: there
+ * is no global state, so any number of streams can be processed at once, each on one thread.
+ *
+ * The calls follow zlib: input / input_len and output / output_len describe the caller's
+ * buffers and are advanced past the bytes consumed and produced. A call returns when the input
+ * is used up or the output is full; the memory of a context is bounded by the block size,
+ * whatever the length of the stream.
+ */
+typedef struct HuffmanStreamEncoder HuffmanStreamEncoder;
+typedef struct HuffmanStreamDecoder HuffmanStreamDecoder;
+
+/**
+ * block_size: uncompressed bytes per block, 0 = STREAM_DEFAULT_BLOCK_SIZE
+ * order: 0 = one table per block, 1 = a table per previous byte (better on text, slower)
+ * streams: sub-streams of an order-0 block, decoded side by side (see huffman_encode_streams),
+ *          0 = HUFFMAN_DEFAULT_STREAMS, 1 = a single bitstream; order 1 always uses one
+ * allocator: NULL = malloc / free
+ *
+ * Returns the encoder, or NULL on allocation failure or an unsupported order or stream count.
+ */
+HuffmanStreamEncoder* huffman_stream_encoder_init(size_t block_size, int order, int streams,
+                                                  const HuffmanAllocator* allocator);
+
+/**
+ * Feed input. A block is encoded as soon as it is complete; whole blocks are encoded straight
+ * from input without being copied. Output that does not fit is kept for the next call, and no
+ * more input is taken until it has been handed out.
+ *
+ * Returns HUFFMAN_STREAM_OK or HUFFMAN_STREAM_ERROR.
+ */
+int huffman_stream_encoder_update(HuffmanStreamEncoder* encoder, const uint8_t** input, size_t* input_len,
+                                  uint8_t** output, size_t* output_len);
+
+/**
+ * Encode the buffered input as a (shorter) block, so everything fed so far can be decoded.
+ *
+ * Returns HUFFMAN_STREAM_END once all of it is in output, HUFFMAN_STREAM_OK if output
+ * filled up first (call again), HUFFMAN_STREAM_ERROR on error.
+ */
+int huffman_stream_encoder_flush(HuffmanStreamEncoder* encoder, uint8_t** output, size_t* output_len);
+
+/**
+ * Flush and end the stream with the index (12 bytes per block, kept until now); no update is
+ * accepted afterwards.
+ *
+ * Returns HUFFMAN_STREAM_END once the whole stream is in output, HUFFMAN_STREAM_OK if output
+ * filled up first (call again), HUFFMAN_STREAM_ERROR on error.
+ */
+int huffman_stream_encoder_finish(HuffmanStreamEncoder* encoder, uint8_t** output, size_t* output_len);
+
+void huffman_stream_encoder_release(HuffmanStreamEncoder* encoder);
+
+/**
+ * allocator: NULL = malloc / free
+ *
+ * Returns the decoder, or NULL on allocation failure.
+ */
+HuffmanStreamDecoder* huffman_stream_decoder_init(const HuffmanAllocator* allocator);
+
+/**
+ * Feed compressed input, any split of the stream is accepted. A block is decoded once all of
+ * it has arrived, so the decoder buffers at most one block, and checked against its CRC-32C;
+ * the index at the end is checked against the blocks seen. Input after the end of the stream
+ * is left unconsumed.
+ *
+ * Returns HUFFMAN_STREAM_END once the end of the stream has been read and all of the data is
+ * in output, HUFFMAN_STREAM_OK if more input or output space is needed, HUFFMAN_STREAM_ERROR
+ * on corrupt input or allocation failure (every later call fails too).
+ */
+int huffman_stream_decoder_update(HuffmanStreamDecoder* decoder, const uint8_t** input, size_t* input_len,
+                                  uint8_t** output, size_t* output_len);
+
+void huffman_stream_decoder_release(HuffmanStreamDecoder* decoder);
+
+/**
+ * Read and check the index of a whole compressed file in memory (e.g. mapped with input_source_open).
+ * The blocks themselves are not read.
+ *
+ * Returns 0 on success, -1 if the file has no index (version 1) or the index is corrupt.
+ */
+int huffman_index_read(const uint8_t* data, size_t size, StreamIndex* index);
+
+void huffman_index_free(StreamIndex* index);
+
+/**
+ * Decompress the uncompressed bytes [begin, begin + length) of a file read by huffman_index_read,
+ * decoding only the blocks that cover them. The blocks are spread over thread_count threads
+ * (0 = cpu_count()) and each one is checked against its CRC-32C.
+ *
+ * Returns 0 on success, -1 if the range is out of bounds, a block is corrupt or a thread could not be started.
+ */
+int huffman_decompress_range(const uint8_t* data, size_t size, const StreamIndex* index, uint64_t begin,
+                             size_t length, uint8_t* output, int thread_count);
+
+/**
+ * The two halves of encoding one block, for callers that schedule the blocks themselves and run
+ * the halves on different threads (see pipeline.h). A stream written from them is the same as the
+ * one the encoder above writes: huffman_stream_header, the blocks in order, then huffman_stream_tail.
+ *
+ * A model holds the code table of one block (order 0) or its context model (order 1, about 2.6 MiB).
+ */
+typedef struct HuffmanBlockModel HuffmanBlockModel;
+
+/**
+ * allocator: NULL = malloc / free
+ *
+ * Returns the model, or NULL on allocation failure or an unsupported order.
+ */
+HuffmanBlockModel* huffman_block_model_init(int order, const HuffmanAllocator* allocator);
+
+void huffman_block_model_release(HuffmanBlockModel* model);
+
+/**
+ * Count the bytes of a block (at most STREAM_MAX_BLOCK_SIZE) and build its table or context model.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int huffman_block_model_build(HuffmanBlockModel* model, const uint8_t* data, size_t length);
+
+/**
+ * Largest encoded size of a block of length bytes.
+ */
+size_t huffman_block_bound(size_t length);
+
+/**
+ * Encode the block the model was built from, with its block header.
+ *
+ * streams: as in huffman_stream_encoder_init, the same for every block of a stream
+ * output: huffman_block_bound(length) bytes
+ * size: the bytes written
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int huffman_block_encode(const HuffmanBlockModel* model, const uint8_t* data, size_t length, int streams,
+                         uint8_t* output, size_t* size);
+
+/**
+ * The STREAM_HEADER_SIZE bytes that start a stream of the given order and sub-streams.
+ */
+void huffman_stream_header(int order, int streams, uint8_t header[STREAM_HEADER_SIZE]);
+
+/**
+ * The end mark, index and trailer that end a stream (STREAM_TAIL_SIZE(count) bytes).
+ *
+ * entries: offset and size of every block (data_offset is not used)
+ * end: stream position right after the last block
+ *
+ * Returns the bytes written.
+ */
+size_t huffman_stream_tail(const StreamIndexEntry* entries, size_t count, uint64_t end, uint8_t* output);
+
+/**
+ * Compress in to out block by block.
+ *
+ * block_size: uncompressed bytes per block, 0 = STREAM_DEFAULT_BLOCK_SIZE
+ * order: 0 = one table per block, 1 = a table per previous byte (better on text, slower)
+ * streams: sub-streams of an order-0 block, see huffman_stream_encoder_init
+ *
+ * Returns 0 on success, -1 on I/O or allocation error or an unsupported order or stream count.
+ */
+int huffman_compress_stream(FILE* in, FILE* out, size_t block_size, int order, int streams);
+
+/**
+ * Compress a buffer that is already in memory into the same format; the blocks are encoded in place.
+ */
+int huffman_compress_buffer(const uint8_t* data, size_t length, FILE* out, size_t block_size, int order,
+                            int streams);
+
+/**
+ * Decompress a stream written by huffman_compress_stream, checking the CRC-32C of every block and the index.
+ *
+ * Returns 0 on success, -1 on I/O error or corrupt input.
+ */
+int huffman_decompress_stream(FILE* in, FILE* out);
+
+#endif
@@ -23,3 +23,98 @@ __kernel void byte_frequency_kernel(__global const char* input, __global int* gl
         atomic_add(&global_freq[local_id], local_freq[local_id]);
     }
 }
+
+// Replicated sub-histograms: neighbouring work-items count into different copies, so a skewed
+// input does not make a whole wavefront wait on the same local counter. The stride is 257
+// instead of 256 so the same byte of different copies falls into different local memory banks.
+#define HISTOGRAM_COPIES 8
+#define HISTOGRAM_STRIDE 257
+
+// Grid-stride loop over 16-byte vectors, correct for any global size; every work-group writes
+// its 256 counts to partial_freq[group * 256 + byte], byte_frequency_reduce_kernel adds them up.
+// The input buffer must be 4-byte aligned (device buffers are).
+__kernel void byte_frequency_vec_kernel(__global const uchar* input, const ulong length, __global uint* partial_freq) {
+    const size_t local_id = get_local_id(0);
+    const size_t local_size = get_local_size(0);
+    const size_t global_id = get_global_id(0);
+    const size_t global_size = get_global_size(0);
+
+    __local uint local_freq[HISTOGRAM_COPIES * HISTOGRAM_STRIDE];
+    for (size_t i = local_id; i < HISTOGRAM_COPIES * HISTOGRAM_STRIDE; i += local_size) {
+        local_freq[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local uint* freq = local_freq + (local_id % HISTOGRAM_COPIES) * HISTOGRAM_STRIDE;
+    const ulong vectors = length / 16;
+    for (ulong v = global_id; v < vectors; v += global_size) {
+        uint4 words = vload4(v, (__global const uint*)input);
+        for (int shift = 0; shift < 32; shift += 8) {
+            atomic_inc(&freq[(words.x >> shift) & 0xFF]);
+            atomic_inc(&freq[(words.y >> shift) & 0xFF]);
+            atomic_inc(&freq[(words.z >> shift) & 0xFF]);
+            atomic_inc(&freq[(words.w >> shift) & 0xFF]);
+        }
+    }
+    for (ulong i = vectors * 16 + global_id; i < length; i += global_size) {
+        atomic_inc(&freq[input[i]]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (size_t byte = local_id; byte < 256; byte += local_size) {
+        uint sum = 0;
+        for (int copy = 0; copy < HISTOGRAM_COPIES; copy++) {
+            sum += local_freq[copy * HISTOGRAM_STRIDE + byte];
+        }
+        partial_freq[get_group_id(0) * 256 + byte] = sum;
+    }
+}
+
+// One work-item per byte value: adds the per-group counts to the 64-bit totals, which
+// keep accumulating over the chunks of an input.
+__kernel void byte_frequency_reduce_kernel(__global const uint* partial_freq, const uint group_count, __global ulong* freq) {
+    const size_t byte = get_global_id(0);
+    if (byte >= 256) {
+        return;
+    }
+
+    ulong sum = 0;
+    for (uint group = 0; group < group_count; group++) {
+        sum += partial_freq[group * 256 + byte];
+    }
+    freq[byte] += sum;
+}
+
+// Order-1 statistics: counts[previous * 256 + byte] over the pairs of one chunk. The 65536
+// counters do not fit into local memory, so they are counted with global atomics; spread over
+// that many counters the atomics rarely collide. previous is the byte before the chunk.
+__kernel void pair_frequency_kernel(__global const uchar* input, const ulong length, const uint previous,
+                                    __global uint* counts) {
+    const size_t global_id = get_global_id(0);
+    const size_t global_size = get_global_size(0);
+
+    const ulong vectors = length / 16;
+    for (ulong v = global_id; v < vectors; v += global_size) {
+        uchar bytes[16];
+        vstore16(vload16(v, input), 0, bytes);
+        uint context = v > 0 ? input[v * 16 - 1] : previous;
+        for (int i = 0; i < 16; i++) {
+            atomic_inc(&counts[(context << 8) | bytes[i]]);
+            context = bytes[i];
+        }
+    }
+    for (ulong i = vectors * 16 + global_id; i < length; i += global_size) {
+        uint context = i > 0 ? input[i - 1] : previous;
+        atomic_inc(&counts[(context << 8) | input[i]]);
+    }
+}
+
+// Adds the counts of a chunk to the 64-bit totals and clears them for the next chunk
+__kernel void pair_frequency_reduce_kernel(__global uint* counts, __global ulong* freq) {
+    const size_t pair = get_global_id(0);
+    if (pair >= 256 * 256) {
+        return;
+    }
+    freq[pair] += counts[pair];
+    counts[pair] = 0;
+}
@@ -0,0 +1,123 @@
+// Huffman encoding in three steps:
+//  1. every work-item counts the encoded bits of one segment of the input, the work-group
+//     scans them into item offsets and writes its own total
+//  2. the work-group totals are scanned into work-group bit offsets
+//  3. every work-item encodes its segment at group offset + item offset
+// Codes are at most 32 bits long. The output is a packed bitstream, most significant bit of
+// each byte first, stored as 32-bit words in big-endian byte order so that it is byte-for-byte
+// identical to the CPU encoder.
+
+__kernel void huffman_bit_count_kernel(__global const uchar* input, const ulong length,
+                                       __global const uchar* code_lengths, const uint segment_size,
+                                       __global uint* item_offsets, __global ulong* group_bits,
+                                       __local uint* scratch) {
+    const size_t global_id = get_global_id(0);
+    const uint local_id = get_local_id(0);
+    const uint local_size = get_local_size(0);
+
+    __local uchar lengths[256];
+    for (uint i = local_id; i < 256; i += local_size) {
+        lengths[i] = code_lengths[i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const ulong begin = (ulong)global_id * segment_size;
+    const ulong end = min(begin + segment_size, length);
+    uint bits = 0;
+    for (ulong i = begin; i < end; i++) {
+        bits += lengths[input[i]];
+    }
+
+    // Inclusive scan of the item bit counts within the work-group
+    scratch[local_id] = bits;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint stride = 1; stride < local_size; stride <<= 1) {
+        uint add = local_id >= stride ? scratch[local_id - stride] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[local_id] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    item_offsets[global_id] = scratch[local_id] - bits;
+    if (local_id == local_size - 1) {
+        group_bits[get_group_id(0)] = scratch[local_id];
+    }
+}
+
+// Exclusive scan of the work-group totals in place. There is one total per
+// local_size * segment_size input bytes, so a single work-item is enough.
+__kernel void huffman_scan_kernel(__global ulong* group_bits, const uint group_count, __global ulong* total_bits) {
+    if (get_global_id(0) != 0) {
+        return;
+    }
+
+    ulong sum = 0;
+    for (uint i = 0; i < group_count; i++) {
+        ulong bits = group_bits[i];
+        group_bits[i] = sum;
+        sum += bits;
+    }
+    *total_bits = sum;
+}
+
+inline uint to_big_endian(uint word) {
+#ifdef __ENDIAN_LITTLE__
+    return as_uint(as_uchar4(word).wzyx);
+#else
+    return word;
+#endif
+}
+
+__kernel void huffman_encode_kernel(__global const uchar* input, const ulong length,
+                                    __global const uint* codes, __global const uchar* code_lengths,
+                                    const uint segment_size,
+                                    __global const uint* item_offsets, __global const ulong* group_offsets,
+                                    __global uint* output) {
+    const size_t global_id = get_global_id(0);
+    const uint local_id = get_local_id(0);
+    const uint local_size = get_local_size(0);
+
+    __local uint local_codes[256];
+    __local uchar lengths[256];
+    for (uint i = local_id; i < 256; i += local_size) {
+        local_codes[i] = codes[i];
+        lengths[i] = code_lengths[i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const ulong begin = (ulong)global_id * segment_size;
+    const ulong end = min(begin + segment_size, length);
+    if (begin >= end) {
+        return;
+    }
+
+    const ulong bit_offset = group_offsets[get_group_id(0)] + item_offsets[global_id];
+    ulong word = bit_offset >> 5;
+    ulong acc = 0;
+    uint count = (uint)(bit_offset & 31);
+    // The first word is shared with the previous segment unless the segment starts on a word boundary
+    bool shared = count != 0;
+
+    for (ulong i = begin; i < end; i++) {
+        uchar byte_val = input[i];
+        uint len = lengths[byte_val];
+        acc = (acc << len) | local_codes[byte_val];
+        count += len;
+        if (count >= 32) {
+            count -= 32;
+            uint bits = to_big_endian((uint)(acc >> count));
+            if (shared) {
+                atomic_or(&output[word], bits);
+                shared = false;
+            } else {
+                output[word] = bits;
+            }
+            word++;
+        }
+    }
+
+    // The last, partial word is shared with the next segment
+    if (count > 0) {
+        atomic_or(&output[word], to_big_endian((uint)(acc << (32 - count))));
+    }
+}
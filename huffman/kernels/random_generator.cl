@@ -1,44 +1,97 @@
-__kernel void generate_random_kernel(__global uchar* output, ulong seed, ulong length) {
-    ulong gid = get_global_id(0);
-    ulong stride = get_global_size(0);
+// Same stream as random_bytes (src/random_bytes.c): byte i comes from one 32-bit half of
+// splitmix64(seed, i / 2), mapped by the host-computed inverse-CDF tables. Integer arithmetic
+// only, so the output is identical to the CPU generator byte for byte. Byte 254 is never raised
+// to 255: its threshold is UINT32_MAX, which the largest uniform value would pass.
 
-    // ulong array[256*128];
-    // int e = 1;
-    // for (int i = 0; i < 256; i++) {
-    //     for (int j = 0; j < e; j++) {
-    //         array[i+j] = e;
-    //     }
-    //     e++;
-    // }
+#define RANDOM_BUCKET_BITS 12
 
+inline ulong splitmix64(ulong seed, ulong counter) {
+    ulong z = seed + (counter + 1) * 0x9E3779B97F4A7C15UL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
 
-    
+// Bytes first .. first + length - 1 of the stream (first even) into output[0 .. length - 1].
+// Every work-item makes 2 bytes per step of a grid-stride loop; the tables are copied
+// to local memory first (5 KiB)
+__kernel void generate_random_kernel(__global uchar* output, ulong seed, ulong first, ulong length,
+                                     __global const uint* thresholds, __global const uchar* buckets) {
+    __local uint local_thresholds[256];
+    __local uchar local_buckets[1 << RANDOM_BUCKET_BITS];
 
-    // Lineáris kongruens generátor (LCG)
-    ulong a = 1664525;
-    ulong c = 1013904223;
+    for (size_t i = get_local_id(0); i < 256; i += get_local_size(0)) {
+        local_thresholds[i] = thresholds[i];
+    }
+    for (size_t i = get_local_id(0); i < (1 << RANDOM_BUCKET_BITS); i += get_local_size(0)) {
+        local_buckets[i] = buckets[i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    ulong local_seed = seed ^ (gid * 0x5DEECE66DULL + 0xB);
+    const ulong pairs = (length + 1) / 2;
+    for (ulong pair = get_global_id(0); pair < pairs; pair += get_global_size(0)) {
+        ulong hash = splitmix64(seed, first / 2 + pair);
+        uint low = (uint)hash;
+        uint high = (uint)(hash >> 32);
 
-    // Warm up (csak keverés)
-    for (int i = 0; i < 10; i++) {
-        local_seed = a * local_seed + c;
+        uchar byte = local_buckets[low >> (32 - RANDOM_BUCKET_BITS)];
+        output[2 * pair] = byte + (byte < 254 && low >= local_thresholds[byte]);
+        if (2 * pair + 1 < length) {
+            byte = local_buckets[high >> (32 - RANDOM_BUCKET_BITS)];
+            output[2 * pair + 1] = byte + (byte < 254 && high >= local_thresholds[byte]);
+        }
     }
+}
+
+// Same local histogram layout as byte_frequency_vec_kernel
+#define HISTOGRAM_COPIES 8
+#define HISTOGRAM_STRIDE 257
 
-    for (ulong i = gid; i < length; i += stride) {
-        local_seed = a * local_seed + c;
+// generate_random_kernel and byte_frequency_vec_kernel in one pass: the bytes of the stream are
+// counted as they are made and never stored, so the length is not limited by device memory.
+// Every work-group writes its 256 counts to partial_freq[group * 256 + byte] for
+// byte_frequency_reduce_kernel; the counts are 32-bit, so length must stay below 2^32.
+__kernel void random_frequency_kernel(ulong seed, ulong first, ulong length, __global const uint* thresholds,
+                                      __global const uchar* buckets, __global uint* partial_freq) {
+    const size_t local_id = get_local_id(0);
+    const size_t local_size = get_local_size(0);
 
-        // Bit mixing
-        ulong mixed = local_seed;
-        mixed ^= mixed >> 33;
-        mixed ^= mixed << 21;
-        mixed ^= mixed >> 11;
+    __local uint local_thresholds[256];
+    __local uchar local_buckets[1 << RANDOM_BUCKET_BITS];
+    __local uint local_freq[HISTOGRAM_COPIES * HISTOGRAM_STRIDE];
 
-        float r = (float)(mixed & 0xFFFFFFFF) / 4294967295.0f;
+    for (size_t i = local_id; i < 256; i += local_size) {
+        local_thresholds[i] = thresholds[i];
+    }
+    for (size_t i = local_id; i < (1 << RANDOM_BUCKET_BITS); i += local_size) {
+        local_buckets[i] = buckets[i];
+    }
+    for (size_t i = local_id; i < HISTOGRAM_COPIES * HISTOGRAM_STRIDE; i += local_size) {
+        local_freq[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-        float r_updated = pow(r, 2.5f);
+    __local uint* freq = local_freq + (local_id % HISTOGRAM_COPIES) * HISTOGRAM_STRIDE;
+    const ulong pairs = (length + 1) / 2;
+    for (ulong pair = get_global_id(0); pair < pairs; pair += get_global_size(0)) {
+        ulong hash = splitmix64(seed, first / 2 + pair);
+        uint low = (uint)hash;
+        uint high = (uint)(hash >> 32);
+
+        uchar byte = local_buckets[low >> (32 - RANDOM_BUCKET_BITS)];
+        atomic_inc(&freq[byte + (byte < 254 && low >= local_thresholds[byte])]);
+        if (2 * pair + 1 < length) {
+            byte = local_buckets[high >> (32 - RANDOM_BUCKET_BITS)];
+            atomic_inc(&freq[byte + (byte < 254 && high >= local_thresholds[byte])]);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-        uchar val = (uchar)(r_updated * 254.0f) + 1;
-        output[i] = val;
+    for (size_t byte = local_id; byte < 256; byte += local_size) {
+        uint sum = 0;
+        for (int copy = 0; copy < HISTOGRAM_COPIES; copy++) {
+            sum += local_freq[copy * HISTOGRAM_STRIDE + byte];
+        }
+        partial_freq[get_group_id(0) * 256 + byte] = sum;
     }
 }
@@ -0,0 +1,201 @@
+#include "bench.h"
+#include "cpu_histogram.h"
+#include "platform.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void bench_stats(double* samples, int count, BenchStats* stats) {
+    BenchStats result = {0};
+    result.count = count;
+    if (count <= 0) {
+        *stats = result;
+        return;
+    }
+
+    qsort(samples, count, sizeof(samples[0]), compare_double);
+    result.min = samples[0];
+    result.max = samples[count - 1];
+    result.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+    result.p95 = samples[(int)ceil(0.95 * count) - 1];
+    result.p99 = samples[(int)ceil(0.99 * count) - 1];
+
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    result.mean = sum / count;
+
+    double squares = 0.0;
+    for (int i = 0; i < count; i++) {
+        squares += (samples[i] - result.mean) * (samples[i] - result.mean);
+    }
+    result.stddev = count > 1 ? sqrt(squares / (count - 1)) : 0.0;
+    *stats = result;
+}
+
+double bench_throughput(size_t bytes, double seconds) {
+    return seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0;
+}
+
+// JSON string with quotes, backslashes and control characters escaped
+static void write_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void write_device_string(FILE* file, const char* key, cl_device_id device, cl_device_info param) {
+    char value[256] = "unknown";
+    if (clGetDeviceInfo(device, param, sizeof(value), value, NULL) != CL_SUCCESS) {
+        snprintf(value, sizeof(value), "unknown");
+    }
+    fprintf(file, "    \"%s\": ", key);
+    write_string(file, value);
+    fprintf(file, ",\n");
+}
+
+static const char* os_name(void) {
+#if defined(_WIN32)
+    return "windows";
+#elif defined(__APPLE__)
+    return "macos";
+#elif defined(__linux__)
+    return "linux";
+#else
+    return "unknown";
+#endif
+}
+
+static void write_host(FILE* file) {
+    fprintf(file, "  \"host\": {\n");
+    fprintf(file, "    \"os\": \"%s\",\n", os_name());
+#ifdef __VERSION__
+    fprintf(file, "    \"compiler\": ");
+    write_string(file, __VERSION__);
+    fprintf(file, ",\n");
+#endif
+#ifdef HUFFMAN_BUILD_FLAGS
+    fprintf(file, "    \"build_flags\": ");
+    write_string(file, HUFFMAN_BUILD_FLAGS);
+    fprintf(file, ",\n");
+#endif
+#ifdef __OPTIMIZE__
+    fprintf(file, "    \"optimized\": true,\n");
+#else
+    fprintf(file, "    \"optimized\": false,\n");
+#endif
+    fprintf(file, "    \"logical_processors\": %d,\n", cpu_count());
+    fprintf(file, "    \"cpu_histogram_path\": \"%s\"\n", byte_histogram_path());
+    fprintf(file, "  },\n");
+}
+
+static void write_device(FILE* file, const OpenCLRuntime* runtime) {
+    if (!runtime) {
+        fprintf(file, "  \"opencl\": null,\n");
+        return;
+    }
+
+    char platform[256] = "unknown";
+    if (clGetPlatformInfo(runtime->platform, CL_PLATFORM_NAME, sizeof(platform), platform, NULL) != CL_SUCCESS) {
+        snprintf(platform, sizeof(platform), "unknown");
+    }
+    cl_uint compute_units = 0, clock_mhz = 0;
+    cl_ulong global_memory = 0;
+    cl_bool unified_memory = CL_FALSE;
+    clGetDeviceInfo(runtime->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+    clGetDeviceInfo(runtime->device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock_mhz), &clock_mhz, NULL);
+    clGetDeviceInfo(runtime->device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_memory), &global_memory, NULL);
+    clGetDeviceInfo(runtime->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified_memory), &unified_memory, NULL);
+
+    fprintf(file, "  \"opencl\": {\n");
+    fprintf(file, "    \"platform\": ");
+    write_string(file, platform);
+    fprintf(file, ",\n");
+    write_device_string(file, "device", runtime->device, CL_DEVICE_NAME);
+    write_device_string(file, "vendor", runtime->device, CL_DEVICE_VENDOR);
+    write_device_string(file, "device_version", runtime->device, CL_DEVICE_VERSION);
+    write_device_string(file, "driver_version", runtime->device, CL_DRIVER_VERSION);
+    fprintf(file, "    \"compute_units\": %u,\n", compute_units);
+    fprintf(file, "    \"max_clock_mhz\": %u,\n", clock_mhz);
+    fprintf(file, "    \"global_memory_bytes\": %llu,\n", (unsigned long long)global_memory);
+    fprintf(file, "    \"host_unified_memory\": %s,\n", unified_memory ? "true" : "false");
+    fprintf(file, "    \"zero_copy\": %s,\n", runtime->zero_copy ? "true" : "false");
+    fprintf(file, "    \"startup_time\": %.9g,\n", runtime->startup_time);
+    fprintf(file, "    \"cached_programs\": %d\n", runtime->cached_programs);
+    fprintf(file, "  },\n");
+}
+
+int bench_report_open(BenchReport* report, const char* path, const OpenCLRuntime* runtime,
+                      int warmup, int repetitions, uint64_t seed) {
+    report->result_count = 0;
+    report->file = fopen(path, "w");
+    if (!report->file) {
+        perror(path);
+        return -1;
+    }
+
+    char timestamp[32] = "unknown";
+    time_t now = time(NULL);
+    struct tm* utc = gmtime(&now);
+    if (utc) {
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", utc);
+    }
+
+    FILE* file = report->file;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"format\": 1,\n");
+    fprintf(file, "  \"timestamp\": \"%s\",\n", timestamp);
+    write_host(file);
+    write_device(file, runtime);
+    fprintf(file, "  \"config\": {\n");
+    fprintf(file, "    \"warmup\": %d,\n", warmup);
+    fprintf(file, "    \"repetitions\": %d,\n", repetitions);
+    fprintf(file, "    \"seed\": %llu,\n", (unsigned long long)seed);
+    fprintf(file, "    \"clocks\": {\"wall\": \"monotonic host clock\", \"device\": \"OpenCL event profiling, command start to end\"},\n");
+    fprintf(file, "    \"unit\": \"seconds\",\n");
+    fprintf(file, "    \"throughput_unit\": \"GB/s (1e9 bytes per second, of the median)\"\n");
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"results\": [");
+    return 0;
+}
+
+void bench_report_add(BenchReport* report, size_t input_size, const char* phase, const char* clock,
+                      size_t bytes, const BenchStats* stats) {
+    FILE* file = report->file;
+    fprintf(file, "%s\n    {\"size\": %zu, \"phase\": \"%s\", \"clock\": \"%s\", \"samples\": %d, ",
+            report->result_count > 0 ? "," : "", input_size, phase, clock, stats->count);
+    fprintf(file, "\"min\": %.9g, \"median\": %.9g, \"p95\": %.9g, \"p99\": %.9g, \"mean\": %.9g, \"stddev\": %.9g, "
+            "\"max\": %.9g, ", stats->min, stats->median, stats->p95, stats->p99, stats->mean, stats->stddev, stats->max);
+    if (bytes > 0) {
+        fprintf(file, "\"bytes\": %zu, \"gbps\": %.6g}", bytes, bench_throughput(bytes, stats->median));
+    } else {
+        fprintf(file, "\"bytes\": 0, \"gbps\": null}");
+    }
+    report->result_count++;
+}
+
+int bench_report_close(BenchReport* report) {
+    fprintf(report->file, "\n  ]\n}\n");
+    int rc = ferror(report->file) ? -1 : 0;
+    if (fclose(report->file) != 0) {
+        rc = -1;
+    }
+    report->file = NULL;
+    return rc;
+}
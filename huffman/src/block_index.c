@@ -0,0 +1,169 @@
+#include "block_index.h"
+#include "platform.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define DECODE_MAX_THREADS 256
+
+int block_index_build(const char* input, size_t input_len, const HuffmanCode table[256],
+                      size_t block_size, BlockIndex* index) {
+    if (block_size == 0) {
+        block_size = BLOCK_INDEX_DEFAULT_BLOCK_SIZE;
+    }
+
+    index->block_size = block_size;
+    index->total_bytes = input_len;
+    index->count = (input_len + block_size - 1) / block_size;
+    index->entries = malloc((index->count > 0 ? index->count : 1) * sizeof(BlockIndexEntry));
+    if (!index->entries) {
+        index->count = 0;
+        return -1;
+    }
+
+    uint64_t bit_offset = 0;
+    for (size_t block = 0; block < index->count; block++) {
+        size_t begin = block * block_size;
+        size_t end = begin + block_size < input_len ? begin + block_size : input_len;
+
+        index->entries[block].bit_offset = bit_offset;
+        index->entries[block].byte_offset = begin;
+        for (size_t i = begin; i < end; i++) {
+            unsigned length = table[(unsigned char)input[i]].length;
+            if (length == 0) {
+                block_index_free(index);
+                return -1;
+            }
+            bit_offset += length;
+        }
+    }
+    return 0;
+}
+
+int encode_input_with_index(const char* input, size_t input_len, const HuffmanCode table[256], size_t block_size,
+                            uint8_t* output, size_t* bit_len, BlockIndex* index) {
+    if (encode_input_with_huffman(input, input_len, table, output, bit_len) != 0) {
+        return -1;
+    }
+    return block_index_build(input, input_len, table, block_size, index);
+}
+
+void block_index_free(BlockIndex* index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+size_t block_index_size(const BlockIndex* index) {
+    return index->count * sizeof(BlockIndexEntry);
+}
+
+static size_t block_length(const BlockIndex* index, size_t block) {
+    uint64_t begin = index->entries[block].byte_offset;
+    uint64_t end = begin + index->block_size;
+    return (size_t)((end < index->total_bytes ? end : index->total_bytes) - begin);
+}
+
+typedef struct DecodeTask {
+    const HuffmanDecoder* decoder;
+    const uint8_t* input;
+    size_t bit_len;
+    const BlockIndex* index;
+    uint8_t* output;
+    size_t first_block;
+    size_t last_block;  // exclusive
+    int status;
+} DecodeTask;
+
+static void* decode_blocks(void* arg) {
+    DecodeTask* task = (DecodeTask*)arg;
+    task->status = 0;
+
+    for (size_t block = task->first_block; block < task->last_block; block++) {
+        const BlockIndexEntry* entry = &task->index->entries[block];
+        size_t position = (size_t)entry->bit_offset;
+        if (huffman_decode_from(task->decoder, task->input, task->bit_len, &position,
+                                task->output + entry->byte_offset, block_length(task->index, block)) != 0) {
+            task->status = -1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+int huffman_decode_parallel(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                            const BlockIndex* index, uint8_t* output, size_t output_len, int thread_count) {
+    DecodeTask tasks[DECODE_MAX_THREADS];
+    pthread_t threads[DECODE_MAX_THREADS];
+
+    if (output_len != index->total_bytes) {
+        return -1;
+    }
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > DECODE_MAX_THREADS) {
+        thread_count = DECODE_MAX_THREADS;
+    }
+    if ((size_t)thread_count > index->count) {
+        thread_count = index->count > 0 ? (int)index->count : 1;
+    }
+
+    // Contiguous runs of blocks, so every thread writes one continuous part of the output
+    for (int i = 0; i < thread_count; i++) {
+        tasks[i].decoder = decoder;
+        tasks[i].input = input;
+        tasks[i].bit_len = bit_len;
+        tasks[i].index = index;
+        tasks[i].output = output;
+        tasks[i].first_block = index->count * i / thread_count;
+        tasks[i].last_block = index->count * (i + 1) / thread_count;
+    }
+
+    int started = 0;
+    int status = 0;
+    for (int i = 1; i < thread_count; i++) {
+        if (pthread_create(&threads[i], NULL, decode_blocks, &tasks[i]) != 0) {
+            status = -1;
+            break;
+        }
+        started = i;
+    }
+    decode_blocks(&tasks[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i <= started; i++) {
+        if (tasks[i].status != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int huffman_decode_range(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                         const BlockIndex* index, size_t begin, size_t length, uint8_t* output) {
+    if (begin > index->total_bytes || length > index->total_bytes - begin) {
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    size_t block = begin / index->block_size;
+    size_t position = (size_t)index->entries[block].bit_offset;
+
+    // Decode and drop the symbols between the block start and begin
+    uint8_t scratch[4096];
+    size_t skip = begin - (size_t)index->entries[block].byte_offset;
+    while (skip > 0) {
+        size_t count = skip < sizeof(scratch) ? skip : sizeof(scratch);
+        if (huffman_decode_from(decoder, input, bit_len, &position, scratch, count) != 0) {
+            return -1;
+        }
+        skip -= count;
+    }
+
+    return huffman_decode_from(decoder, input, bit_len, &position, output, length);
+}
@@ -0,0 +1,286 @@
+#include "context_model.h"
+
+#include <string.h>
+
+#define BITMAP_BYTES 32
+
+static uint64_t row_bits(const uint64_t freq[256], const uint8_t lengths[256]) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 256; i++) {
+        bits += freq[i] * lengths[i];
+    }
+    return bits;
+}
+
+// Stored size of one table: the bitmap of its coded bytes and a nibble per coded byte
+static size_t table_size(const uint8_t lengths[256]) {
+    size_t used = 0;
+    for (int i = 0; i < 256; i++) {
+        used += lengths[i] > 0;
+    }
+    return BITMAP_BYTES + (used + 1) / 2;
+}
+
+static int build_table(const uint64_t freq[256], uint8_t lengths[256], HuffmanCode codes[256]) {
+    if (huffman_limit_code_lengths(freq, CONTEXT_MAX_CODE_LENGTH, lengths) != 0) {
+        return -1;
+    }
+    return huffman_canonical_codes(lengths, codes);
+}
+
+int context_model_build(const uint64_t* pair_freq, ContextModel* model) {
+    uint64_t order0[256] = {0};
+    for (int context = 0; context < 256; context++) {
+        for (int i = 0; i < 256; i++) {
+            order0[i] += pair_freq[context * 256 + i];
+        }
+    }
+
+    for (int context = 0; context < 256; context++) {
+        model->table_of[context] = CONTEXT_SHARED_TABLE;
+    }
+    model->table_count = 1;
+    if (build_table(order0, model->lengths[CONTEXT_SHARED_TABLE], model->codes[CONTEXT_SHARED_TABLE]) != 0) {
+        return -1;
+    }
+
+    // The shared table codes every byte of the input, so any context can fall back to it
+    for (int context = 0; context < 256; context++) {
+        const uint64_t* row = pair_freq + context * 256;
+        uint64_t row_total = 0;
+        for (int i = 0; i < 256; i++) {
+            row_total += row[i];
+        }
+        if (row_total == 0) {
+            continue;
+        }
+
+        int table = model->table_count;
+        if (build_table(row, model->lengths[table], model->codes[table]) != 0) {
+            return -1;
+        }
+
+        uint64_t own_bits = row_bits(row, model->lengths[table]) + 8 * table_size(model->lengths[table]);
+        if (own_bits < row_bits(row, model->lengths[CONTEXT_SHARED_TABLE])) {
+            model->table_of[context] = (uint16_t)table;
+            model->table_count++;
+        }
+    }
+    return 0;
+}
+
+size_t context_encoded_bits(const ContextModel* model, const uint64_t* pair_freq) {
+    size_t bits = 0;
+    for (int context = 0; context < 256; context++) {
+        bits += (size_t)row_bits(pair_freq + context * 256, model->lengths[model->table_of[context]]);
+    }
+    return bits;
+}
+
+size_t context_model_size(const ContextModel* model) {
+    size_t size = BITMAP_BYTES;
+    for (int table = 0; table < model->table_count; table++) {
+        size += table_size(model->lengths[table]);
+    }
+    return size;
+}
+
+static size_t write_table(const uint8_t lengths[256], uint8_t* output) {
+    uint8_t* nibbles = output + BITMAP_BYTES;
+    size_t used = 0;
+
+    memset(output, 0, table_size(lengths));
+    for (int i = 0; i < 256; i++) {
+        if (lengths[i] == 0) {
+            continue;
+        }
+        output[i >> 3] |= (uint8_t)(1 << (i & 7));
+        nibbles[used / 2] |= (uint8_t)(used % 2 ? lengths[i] : lengths[i] << 4);
+        used++;
+    }
+    return BITMAP_BYTES + (used + 1) / 2;
+}
+
+size_t context_model_write(const ContextModel* model, uint8_t* output) {
+    memset(output, 0, BITMAP_BYTES);
+    for (int context = 0; context < 256; context++) {
+        if (model->table_of[context] != CONTEXT_SHARED_TABLE) {
+            output[context >> 3] |= (uint8_t)(1 << (context & 7));
+        }
+    }
+
+    // Own tables are numbered in context order, the order they are stored in
+    size_t size = BITMAP_BYTES;
+    for (int table = 0; table < model->table_count; table++) {
+        size += write_table(model->lengths[table], output + size);
+    }
+    return size;
+}
+
+static int read_table(const uint8_t* input, size_t input_len, uint8_t lengths[256], size_t* used) {
+    if (input_len < BITMAP_BYTES) {
+        return -1;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < 256; i++) {
+        count += (input[i >> 3] >> (i & 7)) & 1;
+    }
+    size_t size = BITMAP_BYTES + (count + 1) / 2;
+    if (input_len < size) {
+        return -1;
+    }
+
+    const uint8_t* nibbles = input + BITMAP_BYTES;
+    size_t n = 0;
+    for (int i = 0; i < 256; i++) {
+        lengths[i] = 0;
+        if ((input[i >> 3] >> (i & 7)) & 1) {
+            lengths[i] = n % 2 ? nibbles[n / 2] & 0x0F : nibbles[n / 2] >> 4;
+            n++;
+            if (lengths[i] == 0 || lengths[i] > CONTEXT_MAX_CODE_LENGTH) {
+                return -1;
+            }
+        }
+    }
+    *used = size;
+    return 0;
+}
+
+int context_model_read(ContextModel* model, const uint8_t* input, size_t input_len, size_t* used) {
+    if (input_len < BITMAP_BYTES) {
+        return -1;
+    }
+
+    model->table_count = 1;
+    for (int context = 0; context < 256; context++) {
+        model->table_of[context] = CONTEXT_SHARED_TABLE;
+        if ((input[context >> 3] >> (context & 7)) & 1) {
+            model->table_of[context] = (uint16_t)model->table_count++;
+        }
+    }
+
+    size_t size = BITMAP_BYTES;
+    for (int table = 0; table < model->table_count; table++) {
+        size_t table_bytes;
+        if (read_table(input + size, input_len - size, model->lengths[table], &table_bytes) != 0 ||
+            huffman_canonical_codes(model->lengths[table], model->codes[table]) != 0) {
+            return -1;
+        }
+        size += table_bytes;
+    }
+    *used = size;
+    return 0;
+}
+
+static inline void store_be32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+int context_encode(const ContextModel* model, const uint8_t* input, size_t input_len, uint8_t* output, size_t* bit_len) {
+    // Codes of at most 11 bits collected right-aligned in acc, written out 32 bits at a time
+    uint64_t acc = 0;
+    unsigned count = 0;
+    size_t total_bits = 0;
+    unsigned context = 0;
+
+    for (size_t i = 0; i < input_len; i++) {
+        const HuffmanCode* code = &model->codes[model->table_of[context]][input[i]];
+        if (code->length == 0) {
+            *bit_len = total_bits;
+            return -1;
+        }
+        acc = (acc << code->length) | code->code;
+        count += code->length;
+        total_bits += code->length;
+        if (count >= 32) {
+            count -= 32;
+            store_be32(output, (uint32_t)(acc >> count));
+            output += 4;
+        }
+        context = input[i];
+    }
+
+    while (count >= 8) {
+        count -= 8;
+        *output++ = (uint8_t)(acc >> count);
+    }
+    if (count > 0) {
+        *output = (uint8_t)(acc << (8 - count));
+    }
+    *bit_len = total_bits;
+    return 0;
+}
+
+void context_decoder_init(ContextDecoder* decoder, const ContextModel* model) {
+    memcpy(decoder->table_of, model->table_of, sizeof(decoder->table_of));
+    for (int table = 0; table < model->table_count; table++) {
+        uint16_t* entries = decoder->entries[table];
+        memset(entries, 0, sizeof(decoder->entries[table]));
+
+        // A valid prefix code never fills the same entry twice
+        for (int i = 0; i < 256; i++) {
+            unsigned length = model->lengths[table][i];
+            if (length == 0) {
+                continue;
+            }
+            unsigned shift = CONTEXT_MAX_CODE_LENGTH - length;
+            size_t first = (size_t)model->codes[table][i].code << shift;
+            for (size_t j = 0; j < ((size_t)1 << shift); j++) {
+                entries[first + j] = (uint16_t)(i | length << 8);
+            }
+        }
+    }
+}
+
+static inline uint64_t load_be64(const uint8_t* p) {
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+int context_decode(const ContextDecoder* decoder, const uint8_t* input, size_t bit_len,
+                   uint8_t* output, size_t output_len) {
+    const size_t input_bytes = (bit_len + 7) / 8;
+    size_t bit_pos = 0;
+    size_t out = 0;
+    unsigned context = 0;
+
+    // Fast path: one 64-bit load serves five lookups (5 * 11 bits <= 57 bits); every lookup
+    // depends on the byte before it, so only one code is taken per lookup
+    while (out + 5 <= output_len && (bit_pos >> 3) + 8 <= input_bytes) {
+        uint64_t window = load_be64(input + (bit_pos >> 3)) << (bit_pos & 7);
+        for (int lookup = 0; lookup < 5; lookup++) {
+            uint16_t entry = decoder->entries[decoder->table_of[context]][window >> (64 - CONTEXT_MAX_CODE_LENGTH)];
+            unsigned length = entry >> 8;
+            if (length == 0) {
+                return -1;
+            }
+            context = entry & 0xFF;
+            output[out++] = (uint8_t)context;
+            window <<= length;
+            bit_pos += length;
+        }
+    }
+
+    // Tail: one code at a time with bounds checks
+    while (out < output_len) {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < 3; i++) {
+            size_t byte = (bit_pos >> 3) + i;
+            bits = (bits << 8) | (byte < input_bytes ? input[byte] : 0);
+        }
+        bits = (bits << (bit_pos & 7)) & 0xFFFFFF;
+        uint16_t entry = decoder->entries[decoder->table_of[context]][bits >> (24 - CONTEXT_MAX_CODE_LENGTH)];
+        unsigned length = entry >> 8;
+        if (length == 0 || bit_pos + length > bit_len) {
+            return -1;
+        }
+        context = entry & 0xFF;
+        output[out++] = (uint8_t)context;
+        bit_pos += length;
+    }
+    return bit_pos <= bit_len ? 0 : -1;
+}
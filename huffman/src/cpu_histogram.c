@@ -0,0 +1,203 @@
+#include "cpu_histogram.h"
+#include "platform.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTOGRAM_TABLES 8
+#define HISTOGRAM_BLOCK_SIZE ((size_t)1 << 28)  // bytes counted in 32-bit tables before they are added to freq
+
+typedef uint32_t HistogramTables[HISTOGRAM_TABLES][256];
+
+// The 8 bytes of a word go to 4 tables starting at base; consecutive words alternate between
+// the two halves, so up to 8 increments are in flight without depending on each other
+#define COUNT_WORD(tables, word, base)                  \
+    do {                                                \
+        uint64_t w_ = (word);                           \
+        tables[(base) + 0][w_ & 0xFF]++;                \
+        tables[(base) + 1][(w_ >> 8) & 0xFF]++;         \
+        tables[(base) + 2][(w_ >> 16) & 0xFF]++;        \
+        tables[(base) + 3][(w_ >> 24) & 0xFF]++;        \
+        tables[(base) + 0][(w_ >> 32) & 0xFF]++;        \
+        tables[(base) + 1][(w_ >> 40) & 0xFF]++;        \
+        tables[(base) + 2][(w_ >> 48) & 0xFF]++;        \
+        tables[(base) + 3][w_ >> 56]++;                 \
+    } while (0)
+
+static void count_scalar(const uint8_t* input, size_t length, HistogramTables tables) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint64_t first, second;
+        memcpy(&first, input + i, 8);
+        memcpy(&second, input + i + 8, 8);
+        COUNT_WORD(tables, first, 0);
+        COUNT_WORD(tables, second, 4);
+    }
+    for (; i < length; i++) {
+        tables[i % HISTOGRAM_TABLES][input[i]]++;
+    }
+}
+
+const char* byte_histogram_path(void) {
+    return "scalar";
+}
+
+void byte_histogram(const uint8_t* input, size_t input_len, uint64_t freq[256]) {
+    HistogramTables tables;
+
+    memset(freq, 0, 256 * sizeof(freq[0]));
+    for (size_t offset = 0; offset < input_len; offset += HISTOGRAM_BLOCK_SIZE) {
+        size_t length = input_len - offset < HISTOGRAM_BLOCK_SIZE ? input_len - offset : HISTOGRAM_BLOCK_SIZE;
+        memset(tables, 0, sizeof(tables));
+        count_scalar(input + offset, length, tables);
+        for (int t = 0; t < HISTOGRAM_TABLES; t++) {
+            for (int i = 0; i < 256; i++) {
+                freq[i] += tables[t][i];
+            }
+        }
+    }
+}
+
+typedef struct HistogramRange {
+    const uint8_t* input;
+    size_t length;
+    uint64_t freq[256];
+} HistogramRange;
+
+static void* count_range(void* arg) {
+    HistogramRange* range = (HistogramRange*)arg;
+    byte_histogram(range->input, range->length, range->freq);
+    return NULL;
+}
+
+int byte_histogram_parallel(const uint8_t* input, size_t input_len, uint64_t freq[256], int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > CPU_HISTOGRAM_MAX_THREADS) {
+        thread_count = CPU_HISTOGRAM_MAX_THREADS;
+    }
+    if ((size_t)thread_count > input_len / CPU_HISTOGRAM_MIN_THREAD_BYTES) {
+        thread_count = (int)(input_len / CPU_HISTOGRAM_MIN_THREAD_BYTES);
+    }
+
+    // 2 KiB of counters per range, too much for the stack with many threads
+    HistogramRange* ranges = thread_count > 1 ? malloc(thread_count * sizeof(*ranges)) : NULL;
+    if (!ranges) {
+        byte_histogram(input, input_len, freq);
+        return 0;
+    }
+
+    pthread_t threads[CPU_HISTOGRAM_MAX_THREADS];
+    bool started[CPU_HISTOGRAM_MAX_THREADS];
+    size_t range_size = input_len / thread_count;
+    int status = 0;
+
+    for (int i = 0; i < thread_count; i++) {
+        ranges[i].input = input + i * range_size;
+        ranges[i].length = i == thread_count - 1 ? input_len - i * range_size : range_size;
+    }
+    for (int i = 1; i < thread_count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, count_range, &ranges[i]) == 0;
+        if (!started[i]) {
+            status = -1;
+        }
+    }
+
+    count_range(&ranges[0]);
+    memcpy(freq, ranges[0].freq, sizeof(ranges[0].freq));
+    for (int i = 1; i < thread_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            count_range(&ranges[i]);
+        }
+        for (int b = 0; b < 256; b++) {
+            freq[b] += ranges[i].freq[b];
+        }
+    }
+
+    free(ranges);
+    return status;
+}
+
+void pair_histogram(const uint8_t* input, size_t input_len, uint8_t previous, uint64_t* freq) {
+    memset(freq, 0, PAIR_HISTOGRAM_SIZE * sizeof(freq[0]));
+    unsigned context = previous;
+    for (size_t i = 0; i < input_len; i++) {
+        freq[(context << 8) | input[i]]++;
+        context = input[i];
+    }
+}
+
+typedef struct PairRange {
+    const uint8_t* input;
+    size_t length;
+    uint8_t previous;
+    uint64_t* freq;
+} PairRange;
+
+static void* count_pair_range(void* arg) {
+    PairRange* range = (PairRange*)arg;
+    pair_histogram(range->input, range->length, range->previous, range->freq);
+    return NULL;
+}
+
+int pair_histogram_parallel(const uint8_t* input, size_t input_len, uint64_t* freq, int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > CPU_HISTOGRAM_MAX_THREADS) {
+        thread_count = CPU_HISTOGRAM_MAX_THREADS;
+    }
+    if ((size_t)thread_count > input_len / CPU_HISTOGRAM_MIN_THREAD_BYTES) {
+        thread_count = (int)(input_len / CPU_HISTOGRAM_MIN_THREAD_BYTES);
+    }
+    if (thread_count <= 1) {
+        pair_histogram(input, input_len, 0, freq);
+        return 0;
+    }
+
+    // Range 0 counts straight into freq, the others into 512 KiB tables of their own
+    PairRange ranges[CPU_HISTOGRAM_MAX_THREADS];
+    uint64_t* tables = malloc((size_t)(thread_count - 1) * PAIR_HISTOGRAM_SIZE * sizeof(*tables));
+    if (!tables) {
+        pair_histogram(input, input_len, 0, freq);
+        return -1;
+    }
+
+    pthread_t threads[CPU_HISTOGRAM_MAX_THREADS];
+    bool started[CPU_HISTOGRAM_MAX_THREADS];
+    size_t range_size = input_len / thread_count;
+    int status = 0;
+
+    for (int i = 0; i < thread_count; i++) {
+        ranges[i].input = input + i * range_size;
+        ranges[i].length = i == thread_count - 1 ? input_len - i * range_size : range_size;
+        ranges[i].previous = i > 0 ? input[i * range_size - 1] : 0;
+        ranges[i].freq = i > 0 ? tables + (size_t)(i - 1) * PAIR_HISTOGRAM_SIZE : freq;
+    }
+    for (int i = 1; i < thread_count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, count_pair_range, &ranges[i]) == 0;
+        if (!started[i]) {
+            status = -1;
+        }
+    }
+
+    count_pair_range(&ranges[0]);
+    for (int i = 1; i < thread_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            count_pair_range(&ranges[i]);
+        }
+        for (size_t p = 0; p < PAIR_HISTOGRAM_SIZE; p++) {
+            freq[p] += ranges[i].freq[p];
+        }
+    }
+
+    free(tables);
+    return status;
+}
@@ -0,0 +1,141 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86 1
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // reflected Castagnoli polynomial
+#define CRC32C_STRIPE 4096       // bytes of each of the three streams the SSE4.2 path interleaves
+
+// tables[k][b]: CRC of byte b followed by k zero bytes
+// shift_tables[s][k][b]: the CRC state of byte b of the state (byte k) after (s + 1) * CRC32C_STRIPE zero bytes
+static uint32_t tables[8][256];
+static uint32_t shift_tables[2][4][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// The state after length zero bytes; the CRC is linear, so this is what shift_tables tabulate
+static uint32_t zero_bytes(uint32_t crc, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ tables[0][crc & 0xFF];
+    }
+    return crc;
+}
+
+static void build_tables(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        tables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+        }
+    }
+
+    for (int s = 0; s < 2; s++) {
+        uint32_t bit_images[32];
+        for (int bit = 0; bit < 32; bit++) {
+            bit_images[bit] = zero_bytes(1u << bit, (size_t)(s + 1) * CRC32C_STRIPE);
+        }
+        for (int k = 0; k < 4; k++) {
+            for (uint32_t b = 0; b < 256; b++) {
+                uint32_t image = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if (b & (1u << bit)) {
+                        image ^= bit_images[8 * k + bit];
+                    }
+                }
+                shift_tables[s][k][b] = image;
+            }
+        }
+    }
+}
+
+static uint32_t shift(int s, uint32_t crc) {
+    return shift_tables[s][0][crc & 0xFF] ^ shift_tables[s][1][(crc >> 8) & 0xFF] ^
+           shift_tables[s][2][(crc >> 16) & 0xFF] ^ shift_tables[s][3][crc >> 24];
+}
+
+uint32_t crc32c_portable(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* p = data;
+    pthread_once(&tables_once, build_tables);
+
+    crc = ~crc;
+    for (; length >= 8; p += 8, length -= 8) {
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;  // little-endian words, as on every target of this program
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^
+              tables[4][low >> 24] ^ tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^
+              tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+    }
+    for (; length > 0; p++, length--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *p) & 0xFF];
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* p = data;
+    uint64_t crc64 = ~crc;
+    pthread_once(&tables_once, build_tables);
+
+    // crc32 has a latency of 3 cycles and a throughput of 1: three independent streams keep it
+    // busy, and their states are joined by shifting the first two over the bytes that follow them
+    for (; length >= 3 * CRC32C_STRIPE; p += 3 * CRC32C_STRIPE, length -= 3 * CRC32C_STRIPE) {
+        uint64_t crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < CRC32C_STRIPE; i += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, p + i, 8);
+            memcpy(&word1, p + CRC32C_STRIPE + i, 8);
+            memcpy(&word2, p + 2 * CRC32C_STRIPE + i, 8);
+            crc64 = _mm_crc32_u64(crc64, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc64 = shift(1, (uint32_t)crc64) ^ shift(0, (uint32_t)crc1) ^ (uint32_t)crc2;
+    }
+    for (; length >= 8; p += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    uint32_t crc32 = (uint32_t)crc64;
+    for (; length > 0; p++, length--) {
+        crc32 = _mm_crc32_u8(crc32, *p);
+    }
+    return ~crc32;
+}
+#endif
+
+static int has_sse42(void) {
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return 0;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+#ifdef CRC32C_X86
+    if (has_sse42()) {
+        return crc32c_sse42(crc, data, length);
+    }
+#endif
+    return crc32c_portable(crc, data, length);
+}
+
+const char* crc32c_path(void) {
+    return has_sse42() ? "sse4.2" : "slicing-by-8";
+}
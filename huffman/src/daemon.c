@@ -0,0 +1,721 @@
+#include "daemon.h"
+#include "cpu_histogram.h"
+#include "platform.h"
+#include "random_bytes.h"
+#include "stream.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+typedef SOCKET DaemonSocket;
+#define DAEMON_INVALID_SOCKET INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int DaemonSocket;
+#define DAEMON_INVALID_SOCKET -1
+#define close_socket close
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define DAEMON_SEND_FLAGS MSG_NOSIGNAL  // a client that went away is an error, not SIGPIPE
+#else
+#define DAEMON_SEND_FLAGS 0
+#endif
+
+#define DAEMON_IO_CHUNK (1 << 30)          // bytes per send / recv call
+#define DAEMON_OUTPUT_STEP (256 << 10)     // free space made before every encoder / decoder call
+
+static const char* operation_names[DAEMON_OPERATION_COUNT] = {"compress", "decompress", "histogram", "stats",
+                                                               "shutdown"};
+
+// The latest latencies of one operation, a ring of DAEMON_LATENCY_SAMPLES
+typedef struct LatencyLog {
+    uint64_t requests;
+    uint64_t failures;
+    double samples[DAEMON_LATENCY_SAMPLES];
+} LatencyLog;
+
+struct DaemonServer {
+    DaemonSocket listener;
+    char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    int thread_count;
+    Dispatcher* dispatcher;
+    FILE* log;
+    pthread_mutex_t device_lock;  // histogram jobs on the device: the kernels' arguments are shared
+    pthread_mutex_t stats_lock;
+    bool stopping;
+    LatencyLog latency[DAEMON_OPERATION_COUNT];
+};
+
+struct DaemonClient {
+    DaemonSocket socket;
+};
+
+// Request or result bytes, grown by doubling
+typedef struct ByteBuffer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+static void put_u32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(uint8_t* p, uint64_t value) {
+    put_u32(p, (uint32_t)value);
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+// Room for extra more bytes, at most DAEMON_MAX_PAYLOAD in all
+static int buffer_reserve(ByteBuffer* buffer, size_t extra) {
+    if (extra > DAEMON_MAX_PAYLOAD - buffer->size) {
+        return -1;
+    }
+    if (buffer->size + extra <= buffer->capacity) {
+        return 0;
+    }
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
+    }
+    uint8_t* data = realloc(buffer->data, capacity);
+    if (!data) {
+        return -1;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static void socket_startup(void) {
+#ifdef _WIN32
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+static void socket_cleanup(void) {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+static int socket_address(const char* path, struct sockaddr_un* address) {
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        return -1;
+    }
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+// Only the owner may connect: whoever reaches the socket can submit jobs and shut the daemon down.
+// Called between bind and listen, so nobody connects under the umask's mode. Windows does not use
+// the mode bits of AF_UNIX socket files; the directory's ACL decides there.
+static int restrict_socket(const char* path) {
+#ifdef _WIN32
+    (void)path;
+    return 0;
+#else
+    return chmod(path, S_IRUSR | S_IWUSR);
+#endif
+}
+
+static DaemonSocket connect_socket(const char* path) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) != 0) {
+        return DAEMON_INVALID_SOCKET;
+    }
+    DaemonSocket socket_handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_handle == DAEMON_INVALID_SOCKET) {
+        return DAEMON_INVALID_SOCKET;
+    }
+    if (connect(socket_handle, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close_socket(socket_handle);
+        return DAEMON_INVALID_SOCKET;
+    }
+    return socket_handle;
+}
+
+static int send_all(DaemonSocket socket_handle, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        int chunk = size > DAEMON_IO_CHUNK ? DAEMON_IO_CHUNK : (int)size;
+        long sent = send(socket_handle, (const char*)data, chunk, DAEMON_SEND_FLAGS);
+        if (sent <= 0) {
+#ifndef _WIN32
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            return -1;
+        }
+        data += sent;
+        size -= (size_t)sent;
+    }
+    return 0;
+}
+
+// Returns the bytes received: size, or less if the peer closed the connection or it broke
+static size_t recv_all(DaemonSocket socket_handle, uint8_t* data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        int chunk = size - received > DAEMON_IO_CHUNK ? DAEMON_IO_CHUNK : (int)(size - received);
+        long count = recv(socket_handle, (char*)data + received, chunk, 0);
+        if (count <= 0) {
+#ifndef _WIN32
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            break;
+        }
+        received += (size_t)count;
+    }
+    return received;
+}
+
+const char* daemon_operation_name(DaemonOperation operation) {
+    return operation >= 0 && operation < DAEMON_OPERATION_COUNT ? operation_names[operation] : "unknown";
+}
+
+int daemon_operation_parse(const char* name) {
+    for (int operation = 0; operation < DAEMON_OPERATION_COUNT; operation++) {
+        if (strcmp(name, operation_names[operation]) == 0) {
+            return operation;
+        }
+    }
+    return -1;
+}
+
+// A whole stream in memory, the output grown as the encoder fills it
+static int compress_job(const uint8_t* input, size_t input_size, int order, int streams, ByteBuffer* output) {
+    HuffmanStreamEncoder* encoder = huffman_stream_encoder_init(0, order, streams, NULL);
+    if (!encoder) {
+        return -1;
+    }
+
+    int rc = HUFFMAN_STREAM_OK;
+    bool finished = false;
+    while (rc != HUFFMAN_STREAM_ERROR && !finished) {
+        if (buffer_reserve(output, DAEMON_OUTPUT_STEP) != 0) {
+            rc = HUFFMAN_STREAM_ERROR;
+            break;
+        }
+        uint8_t* next = output->data + output->size;
+        size_t space = output->capacity - output->size;
+        if (input_size > 0) {
+            rc = huffman_stream_encoder_update(encoder, &input, &input_size, &next, &space);
+        } else {
+            rc = huffman_stream_encoder_finish(encoder, &next, &space);
+            finished = rc == HUFFMAN_STREAM_END;
+        }
+        output->size = (size_t)(next - output->data);
+    }
+
+    huffman_stream_encoder_release(encoder);
+    return rc == HUFFMAN_STREAM_ERROR ? -1 : 0;
+}
+
+// From the index when the stream has one, spread over the cores; version 1 streams block by block
+static int decompress_job(const uint8_t* input, size_t input_size, ByteBuffer* output) {
+    StreamIndex index = {0};
+    if (huffman_index_read(input, input_size, &index) == 0) {
+        int rc = -1;
+        if (index.total_size <= DAEMON_MAX_PAYLOAD && buffer_reserve(output, (size_t)index.total_size) == 0 &&
+            huffman_decompress_range(input, input_size, &index, 0, (size_t)index.total_size, output->data, 0) == 0) {
+            output->size = (size_t)index.total_size;
+            rc = 0;
+        }
+        huffman_index_free(&index);
+        return rc;
+    }
+
+    HuffmanStreamDecoder* decoder = huffman_stream_decoder_init(NULL);
+    if (!decoder) {
+        return -1;
+    }
+    int rc = HUFFMAN_STREAM_OK;
+    while (rc == HUFFMAN_STREAM_OK) {
+        if (buffer_reserve(output, DAEMON_OUTPUT_STEP) != 0) {
+            rc = HUFFMAN_STREAM_ERROR;
+            break;
+        }
+        uint8_t* next = output->data + output->size;
+        size_t space = output->capacity - output->size;
+        rc = huffman_stream_decoder_update(decoder, &input, &input_size, &next, &space);
+        output->size = (size_t)(next - output->data);
+        if (rc == HUFFMAN_STREAM_OK && input_size == 0 && space > 0) {
+            rc = HUFFMAN_STREAM_ERROR;  // truncated: it wants more input and there is none
+        }
+    }
+    huffman_stream_decoder_release(decoder);
+    return rc == HUFFMAN_STREAM_END ? 0 : -1;
+}
+
+static int histogram_job(DaemonServer* server, const uint8_t* input, size_t input_size, ByteBuffer* output) {
+    uint64_t freq[256];
+    bool device = dispatch_backend(server->dispatcher, DISPATCH_HISTOGRAM, input_size) == DISPATCH_OPENCL;
+    if (device) {
+        pthread_mutex_lock(&server->device_lock);
+    }
+    int rc = dispatch_histogram(server->dispatcher, input, input_size, freq);
+    if (device) {
+        pthread_mutex_unlock(&server->device_lock);
+    }
+    if (rc != 0 || buffer_reserve(output, sizeof(freq)) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < 256; i++) {
+        put_u64(output->data + 8 * i, freq[i]);
+    }
+    output->size = sizeof(freq);
+    return 0;
+}
+
+// requests, failures and the percentiles of the latest DAEMON_LATENCY_SAMPLES of every operation
+static size_t format_stats(DaemonServer* server, char* text, size_t size) {
+    double* samples = malloc(DAEMON_LATENCY_SAMPLES * sizeof(*samples));
+    size_t length = (size_t)snprintf(text, size, "%-10s %9s %8s %10s %10s %10s\n", "operation", "requests", "failed",
+                                     "p50 ms", "p99 ms", "max ms");
+    for (int operation = 0; operation < DAEMON_OPERATION_COUNT && samples && length < size; operation++) {
+        pthread_mutex_lock(&server->stats_lock);
+        const LatencyLog* log = &server->latency[operation];
+        uint64_t requests = log->requests, failures = log->failures;
+        int count = requests < DAEMON_LATENCY_SAMPLES ? (int)requests : DAEMON_LATENCY_SAMPLES;
+        memcpy(samples, log->samples, count * sizeof(*samples));
+        pthread_mutex_unlock(&server->stats_lock);
+
+        BenchStats stats;
+        bench_stats(samples, count, &stats);
+        length += (size_t)snprintf(text + length, size - length, "%-10s %9llu %8llu %10.3f %10.3f %10.3f\n",
+                                   operation_names[operation], (unsigned long long)requests,
+                                   (unsigned long long)failures, stats.median * 1e3, stats.p99 * 1e3, stats.max * 1e3);
+    }
+    free(samples);
+    return length < size ? length : size - 1;
+}
+
+static int stats_job(DaemonServer* server, ByteBuffer* output) {
+    char text[1024];
+    size_t length = format_stats(server, text, sizeof(text));
+    if (buffer_reserve(output, length) != 0) {
+        return -1;
+    }
+    memcpy(output->data, text, length);
+    output->size = length;
+    return 0;
+}
+
+static int run_job(DaemonServer* server, DaemonOperation operation, int order, int streams, const uint8_t* input,
+                   size_t input_size, ByteBuffer* output) {
+    switch (operation) {
+    case DAEMON_COMPRESS:
+        return compress_job(input, input_size, order, streams, output);
+    case DAEMON_DECOMPRESS:
+        return decompress_job(input, input_size, output);
+    case DAEMON_HISTOGRAM:
+        return histogram_job(server, input, input_size, output);
+    case DAEMON_STATS:
+        return stats_job(server, output);
+    default:
+        return 0;  // shutdown
+    }
+}
+
+static void record_latency(DaemonServer* server, DaemonOperation operation, double latency, bool failed) {
+    pthread_mutex_lock(&server->stats_lock);
+    LatencyLog* log = &server->latency[operation];
+    log->samples[log->requests % DAEMON_LATENCY_SAMPLES] = latency;
+    log->requests++;
+    log->failures += failed;
+    pthread_mutex_unlock(&server->stats_lock);
+}
+
+static bool is_stopping(DaemonServer* server) {
+    return __atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE);
+}
+
+// Every thread waiting in accept gets a connection of its own, sees the flag and returns
+static void stop_server(DaemonServer* server) {
+    __atomic_store_n(&server->stopping, true, __ATOMIC_RELEASE);
+    for (int t = 0; t < server->thread_count; t++) {
+        DaemonSocket wake = connect_socket(server->socket_path);
+        if (wake != DAEMON_INVALID_SOCKET) {
+            close_socket(wake);
+        }
+    }
+}
+
+static int send_response(DaemonSocket client, int status, const ByteBuffer* result) {
+    uint8_t header[DAEMON_HEADER_SIZE];
+    size_t size = status == 0 ? result->size : 0;
+    memcpy(header, DAEMON_MAGIC_RESPONSE, 4);
+    put_u32(header + 4, (uint32_t)status);
+    put_u64(header + 8, size);
+    return send_all(client, header, DAEMON_HEADER_SIZE) == 0 && send_all(client, result->data, size) == 0 ? 0 : -1;
+}
+
+// Requests of one connection until the client closes it; the latency runs from the request
+// header to the last byte of the answer
+static void serve_client(DaemonServer* server, DaemonSocket client) {
+    ByteBuffer request = {0}, result = {0};
+    uint8_t header[DAEMON_HEADER_SIZE];
+
+    while (recv_all(client, header, DAEMON_HEADER_SIZE) == DAEMON_HEADER_SIZE) {
+        double start = wall_time();
+        DaemonOperation operation = (DaemonOperation)header[4];
+        uint64_t size = get_u64(header + 8);
+        request.size = result.size = 0;
+        if (memcmp(header, DAEMON_MAGIC_REQUEST, 4) != 0 || operation >= DAEMON_OPERATION_COUNT || header[7] != 0 ||
+            size > DAEMON_MAX_PAYLOAD || buffer_reserve(&request, (size_t)size) != 0) {
+            send_response(client, -1, &result);
+            break;
+        }
+        if (recv_all(client, request.data, (size_t)size) != size) {
+            break;
+        }
+
+        int status = run_job(server, operation, header[5], header[6], request.data, (size_t)size, &result);
+        int sent = send_response(client, status, &result);
+        record_latency(server, operation, wall_time() - start, status != 0);
+        if (operation == DAEMON_SHUTDOWN) {
+            stop_server(server);
+            break;
+        }
+        if (sent != 0) {
+            break;
+        }
+    }
+
+    free(request.data);
+    free(result.data);
+}
+
+static void* serve_connections(void* arg) {
+    DaemonServer* server = (DaemonServer*)arg;
+    while (!is_stopping(server)) {
+        DaemonSocket client = accept(server->listener, NULL, NULL);
+        if (client == DAEMON_INVALID_SOCKET) {
+            sleep_microseconds(1000);  // e.g. out of descriptors; try again rather than spin
+            continue;
+        }
+        if (!is_stopping(server)) {
+            serve_client(server, client);
+        }
+        close_socket(client);
+    }
+    return NULL;
+}
+
+DaemonServer* daemon_open(const char* socket_path, int thread_count, Dispatcher* dispatcher, FILE* log) {
+    struct sockaddr_un address;
+    if (socket_address(socket_path, &address) != 0) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return NULL;
+    }
+    socket_startup();
+
+    // A socket file nobody answers on is left over from a daemon that did not shut down; anything
+    // else at the path is left alone and bind fails
+    DaemonSocket existing = connect_socket(socket_path);
+    if (existing != DAEMON_INVALID_SOCKET) {
+        close_socket(existing);
+        fprintf(stderr, "A daemon is already listening on %s\n", socket_path);
+        socket_cleanup();
+        return NULL;
+    }
+#ifndef _WIN32
+    struct stat status;
+    if (stat(socket_path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        remove(socket_path);
+    }
+#endif
+
+    DaemonServer* server = calloc(1, sizeof(*server));
+    DaemonSocket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool bound = listener != DAEMON_INVALID_SOCKET && bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0;
+    if (!server || !bound || restrict_socket(socket_path) != 0 || listen(listener, SOMAXCONN) != 0) {
+        perror(socket_path);
+        if (listener != DAEMON_INVALID_SOCKET) {
+            close_socket(listener);
+        }
+        if (bound) {
+            remove(socket_path);
+        }
+        free(server);
+        socket_cleanup();
+        return NULL;
+    }
+
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    server->listener = listener;
+    strcpy(server->socket_path, socket_path);
+    server->thread_count = thread_count < DAEMON_MAX_THREADS ? thread_count : DAEMON_MAX_THREADS;
+    server->dispatcher = dispatcher;
+    server->log = log;
+    pthread_mutex_init(&server->device_lock, NULL);
+    pthread_mutex_init(&server->stats_lock, NULL);
+    if (log) {
+        size_t opencl_from = dispatcher->profile.opencl_from[DISPATCH_HISTOGRAM];
+        if (dispatcher->runtime && opencl_from != SIZE_MAX) {
+            fprintf(log, "Listening on %s with %d threads, histograms on OpenCL from %zu bytes\n", socket_path,
+                    server->thread_count, opencl_from);
+        } else {
+            fprintf(log, "Listening on %s with %d threads, histograms on the CPU\n", socket_path,
+                    server->thread_count);
+        }
+        fflush(log);
+    }
+    return server;
+}
+
+int daemon_run(DaemonServer* server) {
+    // The first thread is the calling one; with fewer threads started the connections just wait longer
+    pthread_t threads[DAEMON_MAX_THREADS];
+    int started = 1;
+    while (started < server->thread_count &&
+           pthread_create(&threads[started], NULL, serve_connections, server) == 0) {
+        started++;
+    }
+    int status = started == server->thread_count ? 0 : -1;
+    if (status != 0 && server->log) {
+        fprintf(server->log, "Only %d of %d threads started\n", started, server->thread_count);
+    }
+
+    serve_connections(server);
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    return status;
+}
+
+void daemon_close(DaemonServer* server) {
+    if (!server) {
+        return;
+    }
+    if (server->log) {
+        char text[1024];
+        format_stats(server, text, sizeof(text));
+        fprintf(server->log, "%s", text);
+    }
+    close_socket(server->listener);
+    remove(server->socket_path);
+    pthread_mutex_destroy(&server->device_lock);
+    pthread_mutex_destroy(&server->stats_lock);
+    free(server);
+    socket_cleanup();
+}
+
+DaemonClient* daemon_client_connect(const char* socket_path) {
+    socket_startup();
+    DaemonClient* client = malloc(sizeof(*client));
+    DaemonSocket socket_handle = connect_socket(socket_path);
+    if (!client || socket_handle == DAEMON_INVALID_SOCKET) {
+        if (socket_handle != DAEMON_INVALID_SOCKET) {
+            close_socket(socket_handle);
+        }
+        free(client);
+        socket_cleanup();
+        return NULL;
+    }
+    client->socket = socket_handle;
+    return client;
+}
+
+int daemon_client_request(DaemonClient* client, DaemonOperation operation, int order, int streams,
+                          const uint8_t* payload, size_t payload_size, uint8_t** response, size_t* response_size) {
+    uint8_t header[DAEMON_HEADER_SIZE];
+    *response = NULL;
+    *response_size = 0;
+
+    memcpy(header, DAEMON_MAGIC_REQUEST, 4);
+    header[4] = (uint8_t)operation;
+    header[5] = (uint8_t)order;
+    header[6] = (uint8_t)streams;
+    header[7] = 0;
+    put_u64(header + 8, payload_size);
+    if (send_all(client->socket, header, DAEMON_HEADER_SIZE) != 0 ||
+        send_all(client->socket, payload, payload_size) != 0 ||
+        recv_all(client->socket, header, DAEMON_HEADER_SIZE) != DAEMON_HEADER_SIZE ||
+        memcmp(header, DAEMON_MAGIC_RESPONSE, 4) != 0) {
+        return -1;
+    }
+
+    int status = (int)get_u32(header + 4);
+    uint64_t size = get_u64(header + 8);
+    if (size > DAEMON_MAX_PAYLOAD) {
+        return -1;
+    }
+    uint8_t* data = size > 0 ? malloc((size_t)size) : NULL;
+    if ((size > 0 && !data) || recv_all(client->socket, data, (size_t)size) != size) {
+        free(data);
+        return -1;
+    }
+    *response = data;
+    *response_size = (size_t)size;
+    return status == 0 ? 0 : -1;
+}
+
+void daemon_client_close(DaemonClient* client) {
+    if (!client) {
+        return;
+    }
+    close_socket(client->socket);
+    free(client);
+    socket_cleanup();
+}
+
+// One client of the load generator, on its own connection
+typedef struct LoadClient {
+    const char* socket_path;
+    DaemonOperation operation;
+    const uint8_t* payload;
+    size_t payload_size;
+    const uint8_t* expected;   // NULL = any answer
+    size_t expected_size;
+    int requests;
+    double* latencies;
+    int completed;
+    int failures;
+    bool connected;
+} LoadClient;
+
+static void* run_load_client(void* arg) {
+    LoadClient* load = (LoadClient*)arg;
+    DaemonClient* client = daemon_client_connect(load->socket_path);
+    load->connected = client != NULL;
+    if (!client) {
+        return NULL;
+    }
+
+    for (int i = 0; i < load->requests; i++) {
+        uint8_t* response;
+        size_t response_size;
+        double start = wall_time();
+        int rc = daemon_client_request(client, load->operation, 0, 0, load->payload, load->payload_size,
+                                       &response, &response_size);
+        load->latencies[load->completed++] = wall_time() - start;
+        if (rc != 0 || (load->expected && (response_size != load->expected_size ||
+                                           memcmp(response, load->expected, response_size) != 0))) {
+            load->failures++;
+        }
+        free(response);
+    }
+    daemon_client_close(client);
+    return NULL;
+}
+
+int daemon_load_generate(const char* socket_path, DaemonOperation operation, int connections, int requests,
+                         size_t size, DaemonLoadStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (connections < 1) {
+        connections = 1;
+    }
+    if (connections > DAEMON_MAX_THREADS) {
+        connections = DAEMON_MAX_THREADS;
+    }
+
+    // The answers are known in advance: the encoder is deterministic and the counts are exact
+    RandomTables tables;
+    random_tables_init(&tables);
+    uint8_t* data = malloc(size > 0 ? size : 1);
+    ByteBuffer compressed = {0};
+    uint64_t freq[256];
+    uint8_t counts[sizeof(freq)];
+    double* latencies = malloc((size_t)connections * (requests > 0 ? requests : 1) * sizeof(*latencies));
+    LoadClient* loads = calloc(connections, sizeof(*loads));
+    if (!data || !latencies || !loads) {
+        free(data);
+        free(latencies);
+        free(loads);
+        return -1;
+    }
+    random_bytes(&tables, RANDOM_DEFAULT_SEED, 0, data, size);
+    byte_histogram(data, size, freq);
+    for (int i = 0; i < 256; i++) {
+        put_u64(counts + 8 * i, freq[i]);
+    }
+    int status = operation == DAEMON_COMPRESS || operation == DAEMON_DECOMPRESS ? compress_job(data, size, 0, 0, &compressed)
+                                                                                : 0;
+
+    const uint8_t* payload = operation == DAEMON_DECOMPRESS ? compressed.data : data;
+    size_t payload_size = operation == DAEMON_DECOMPRESS ? compressed.size : size;
+    const uint8_t* expected = operation == DAEMON_COMPRESS ? compressed.data
+                              : operation == DAEMON_DECOMPRESS ? data
+                              : operation == DAEMON_HISTOGRAM ? counts : NULL;
+    size_t expected_size = operation == DAEMON_COMPRESS ? compressed.size
+                           : operation == DAEMON_DECOMPRESS ? size : sizeof(counts);
+    for (int c = 0; c < connections; c++) {
+        LoadClient* load = &loads[c];
+        load->socket_path = socket_path;
+        load->operation = operation;
+        load->payload = payload;
+        load->payload_size = payload_size;
+        load->expected = expected;
+        load->expected_size = expected_size;
+        load->requests = requests;
+        load->latencies = latencies + (size_t)c * requests;
+    }
+
+    // The first client runs on the calling thread
+    pthread_t threads[DAEMON_MAX_THREADS];
+    bool started[DAEMON_MAX_THREADS] = {false};
+    double start = wall_time();
+    if (status == 0) {
+        for (int c = 1; c < connections; c++) {
+            started[c] = pthread_create(&threads[c], NULL, run_load_client, &loads[c]) == 0;
+        }
+        run_load_client(&loads[0]);
+        for (int c = 1; c < connections; c++) {
+            if (started[c]) {
+                pthread_join(threads[c], NULL);
+            } else {
+                run_load_client(&loads[c]);
+            }
+        }
+    }
+    stats->time = wall_time() - start;
+
+    // The latencies of every client side by side, for the percentiles over all of them
+    int count = 0;
+    for (int c = 0; c < connections; c++) {
+        if (!loads[c].connected) {
+            status = -1;
+        }
+        memmove(latencies + count, loads[c].latencies, loads[c].completed * sizeof(*latencies));
+        count += loads[c].completed;
+        stats->failures += loads[c].failures;
+    }
+    stats->requests = count;
+    bench_stats(latencies, count, &stats->latency);
+
+    free(data);
+    free(compressed.data);
+    free(latencies);
+    free(loads);
+    return status;
+}
@@ -0,0 +1,373 @@
+#include "dispatch.h"
+#include "bench.h"
+#include "cpu_histogram.h"
+#include "gpu_encode.h"
+#include "gpu_histogram.h"
+#include "gpu_random.h"
+#include "parallel_encode.h"
+#include "platform.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DISPATCH_DEFAULT_PARALLEL_FROM ((size_t)2 << 20)  // below this the threads do not pay off
+
+static const char* operation_names[DISPATCH_OPERATION_COUNT] = {"generate", "histogram", "encode"};
+static const char* backend_names[DISPATCH_BACKEND_COUNT] = {"cpu", "cpu-parallel", "opencl"};
+
+const char* dispatch_backend_name(DispatchBackend backend) {
+    return backend >= 0 && backend < DISPATCH_BACKEND_COUNT ? backend_names[backend] : "unknown";
+}
+
+static void device_name(const OpenCLRuntime* runtime, char name[256]) {
+    if (!runtime || clGetDeviceInfo(runtime->device, CL_DEVICE_NAME, 256, name, NULL) != CL_SUCCESS) {
+        strcpy(name, "none");
+    }
+}
+
+static void default_profile(DispatchProfile* profile, const OpenCLRuntime* runtime) {
+    memset(profile, 0, sizeof(*profile));
+    for (int i = 0; i < DISPATCH_OPERATION_COUNT; i++) {
+        profile->parallel_from[i] = cpu_count() > 1 ? DISPATCH_DEFAULT_PARALLEL_FROM : SIZE_MAX;
+        profile->opencl_from[i] = SIZE_MAX;
+    }
+    device_name(runtime, profile->device);
+}
+
+static bool parse_size(const char* text, size_t* size) {
+    if (strcmp(text, "never") == 0) {
+        *size = SIZE_MAX;
+        return true;
+    }
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    *size = (size_t)value;
+    return end != text && *end == '\0';
+}
+
+static int load_profile(DispatchProfile* profile, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    char line[512];
+    int found = 0;
+    memset(profile, 0, sizeof(*profile));
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "device ", 7) == 0) {
+            snprintf(profile->device, sizeof(profile->device), "%.255s", line + 7);
+            continue;
+        }
+
+        char name[32], parallel[32], opencl[32];
+        if (line[0] == '#' || sscanf(line, "%31s %31s %31s", name, parallel, opencl) != 3) {
+            continue;
+        }
+        for (int i = 0; i < DISPATCH_OPERATION_COUNT; i++) {
+            if (strcmp(name, operation_names[i]) == 0 &&
+                parse_size(parallel, &profile->parallel_from[i]) && parse_size(opencl, &profile->opencl_from[i])) {
+                found |= 1 << i;
+            }
+        }
+    }
+    fclose(file);
+
+    profile->calibrated = true;
+    return found == (1 << DISPATCH_OPERATION_COUNT) - 1 ? 0 : -1;
+}
+
+int dispatcher_init(Dispatcher* dispatcher, OpenCLRuntime* runtime, const char* profile_path) {
+    dispatcher->runtime = runtime;
+    default_profile(&dispatcher->profile, runtime);
+
+    // A profile of another device (or of no device) says nothing about this one
+    DispatchProfile stored;
+    if (!profile_path || load_profile(&stored, profile_path) != 0 ||
+        strcmp(stored.device, dispatcher->profile.device) != 0) {
+        return -1;
+    }
+    dispatcher->profile = stored;
+    return 0;
+}
+
+static void write_size(FILE* file, size_t size) {
+    if (size == SIZE_MAX) {
+        fprintf(file, " never");
+    } else {
+        fprintf(file, " %zu", size);
+    }
+}
+
+int dispatch_profile_save(const DispatchProfile* profile, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(file, "# Dispatch profile: operation, first size on all cores, first size on the device (bytes)\n");
+    fprintf(file, "device %s\n", profile->device);
+    for (int i = 0; i < DISPATCH_OPERATION_COUNT; i++) {
+        fprintf(file, "%s", operation_names[i]);
+        write_size(file, profile->parallel_from[i]);
+        write_size(file, profile->opencl_from[i]);
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+DispatchBackend dispatch_backend(const Dispatcher* dispatcher, DispatchOperation operation, size_t size) {
+    if (dispatcher->runtime && size >= dispatcher->profile.opencl_from[operation]) {
+        return DISPATCH_OPENCL;
+    }
+    if (size >= dispatcher->profile.parallel_from[operation]) {
+        return DISPATCH_CPU_PARALLEL;
+    }
+    return DISPATCH_CPU;
+}
+
+static int generate_on(const Dispatcher* dispatcher, DispatchBackend backend, const RandomTables* tables,
+                       uint64_t seed, uint8_t* output, size_t length) {
+    switch (backend) {
+    case DISPATCH_OPENCL:
+        return gpu_random_bytes(dispatcher->runtime, tables, seed, 0, output, length, NULL);
+    case DISPATCH_CPU_PARALLEL:
+        random_bytes_parallel(tables, seed, output, length, 0);
+        return 0;
+    default:
+        random_bytes(tables, seed, 0, output, length);
+        return 0;
+    }
+}
+
+static int histogram_on(const Dispatcher* dispatcher, DispatchBackend backend, const uint8_t* input,
+                        size_t input_len, uint64_t freq[256]) {
+    switch (backend) {
+    case DISPATCH_OPENCL:
+        return gpu_byte_histogram(dispatcher->runtime, GPU_HISTOGRAM_VECTOR, input, input_len, 0, freq, NULL);
+    case DISPATCH_CPU_PARALLEL:
+        byte_histogram_parallel(input, input_len, freq, 0);
+        return 0;
+    default:
+        byte_histogram(input, input_len, freq);
+        return 0;
+    }
+}
+
+static int encode_on(const Dispatcher* dispatcher, DispatchBackend backend, const char* input, size_t input_len,
+                     const HuffmanCode table[256], uint8_t* output, size_t* bit_len) {
+    if (backend == DISPATCH_OPENCL) {
+        if (input_len == 0) {
+            *bit_len = 0;
+            return 0;
+        }
+        cl_mem input_buffer = opencl_input_buffer(dispatcher->runtime, input, input_len, NULL);
+        if (!input_buffer) {
+            return -1;
+        }
+        double kernel_time;
+        int rc = gpu_huffman_encode(dispatcher->runtime, input_buffer, input_len, table, output, bit_len, &kernel_time);
+        clReleaseMemObject(input_buffer);
+        return rc;
+    }
+    if (backend == DISPATCH_CPU_PARALLEL) {
+        return encode_input_parallel(input, input_len, table, output, bit_len, 0);
+    }
+    return encode_input_with_huffman(input, input_len, table, output, bit_len);
+}
+
+static void report_fallback(DispatchOperation operation) {
+    fprintf(stderr, "OpenCL %s failed, running it on the CPU\n", operation_names[operation]);
+}
+
+int dispatch_generate(const Dispatcher* dispatcher, const RandomTables* tables, uint64_t seed,
+                      uint8_t* output, size_t length) {
+    DispatchBackend backend = dispatch_backend(dispatcher, DISPATCH_GENERATE, length);
+    if (generate_on(dispatcher, backend, tables, seed, output, length) == 0) {
+        return 0;
+    }
+    report_fallback(DISPATCH_GENERATE);
+    return generate_on(dispatcher, DISPATCH_CPU_PARALLEL, tables, seed, output, length);
+}
+
+int dispatch_histogram(const Dispatcher* dispatcher, const uint8_t* input, size_t input_len, uint64_t freq[256]) {
+    DispatchBackend backend = dispatch_backend(dispatcher, DISPATCH_HISTOGRAM, input_len);
+    if (histogram_on(dispatcher, backend, input, input_len, freq) == 0) {
+        return 0;
+    }
+    report_fallback(DISPATCH_HISTOGRAM);
+    return histogram_on(dispatcher, DISPATCH_CPU_PARALLEL, input, input_len, freq);
+}
+
+int dispatch_encode(const Dispatcher* dispatcher, const char* input, size_t input_len, const HuffmanCode table[256],
+                    uint8_t* output, size_t* bit_len) {
+    DispatchBackend backend = dispatch_backend(dispatcher, DISPATCH_ENCODE, input_len);
+    if (encode_on(dispatcher, backend, input, input_len, table, output, bit_len) == 0) {
+        return 0;
+    }
+    if (backend != DISPATCH_OPENCL) {
+        return -1;
+    }
+    report_fallback(DISPATCH_ENCODE);
+    return encode_on(dispatcher, DISPATCH_CPU_PARALLEL, input, input_len, table, output, bit_len);
+}
+
+// Median time of one operation on one backend, INFINITY if the backend fails
+static double measure(const Dispatcher* dispatcher, DispatchOperation operation, DispatchBackend backend,
+                      const RandomTables* tables, const uint8_t* input, size_t size,
+                      const HuffmanCode table[256], uint8_t* scratch) {
+    double samples[DISPATCH_CALIBRATION_RUNS];
+    for (int run = -1; run < DISPATCH_CALIBRATION_RUNS; run++) {
+        uint64_t freq[256];
+        size_t bit_len;
+        int rc;
+
+        double start = wall_time();
+        if (operation == DISPATCH_GENERATE) {
+            rc = generate_on(dispatcher, backend, tables, RANDOM_DEFAULT_SEED, scratch, size);
+        } else if (operation == DISPATCH_HISTOGRAM) {
+            rc = histogram_on(dispatcher, backend, input, size, freq);
+        } else {
+            rc = encode_on(dispatcher, backend, (const char*)input, size, table, scratch, &bit_len);
+        }
+        double time = wall_time() - start;
+
+        if (rc != 0) {
+            return INFINITY;
+        }
+        if (run >= 0) {
+            samples[run] = time;
+        }
+    }
+
+    BenchStats stats;
+    bench_stats(samples, DISPATCH_CALIBRATION_RUNS, &stats);
+    return stats.median;
+}
+
+int dispatch_calibrate(Dispatcher* dispatcher, FILE* log) {
+    size_t max_size = DISPATCH_CALIBRATION_MAX_SIZE;
+    // Page aligned like the callers' buffers, so a zero-copy device is measured in place
+    uint8_t* input = aligned_malloc(max_size, OPENCL_ZERO_COPY_ALIGNMENT);
+    uint8_t* scratch = aligned_malloc(max_size * HUFFMAN_DEFAULT_MAX_CODE_LENGTH / 8 + 16, OPENCL_ZERO_COPY_ALIGNMENT);
+    if (!input || !scratch) {
+        aligned_free(input);
+        aligned_free(scratch);
+        return -1;
+    }
+
+    // The test data; every prefix only has bytes of the whole, so one table encodes all sizes
+    RandomTables tables;
+    random_tables_init(&tables);
+    random_bytes_parallel(&tables, RANDOM_DEFAULT_SEED, input, max_size, 0);
+    uint64_t freq[256];
+    HuffmanCode table[256];
+    byte_histogram_parallel(input, max_size, freq, 0);
+    huffmanEncodingCanonical(freq, HUFFMAN_DEFAULT_MAX_CODE_LENGTH, table);
+
+    size_t sizes[32];
+    DispatchBackend best[DISPATCH_OPERATION_COUNT][32];
+    int size_count = 0;
+    for (size_t size = DISPATCH_CALIBRATION_MIN_SIZE; size <= max_size && size_count < 32; size *= 4) {
+        sizes[size_count++] = size;
+    }
+
+    for (int s = 0; s < size_count; s++) {
+        for (int op = 0; op < DISPATCH_OPERATION_COUNT; op++) {
+            double times[DISPATCH_BACKEND_COUNT];
+            best[op][s] = DISPATCH_CPU;
+            for (int b = 0; b < DISPATCH_BACKEND_COUNT; b++) {
+                times[b] = b == DISPATCH_OPENCL && !dispatcher->runtime
+                               ? INFINITY
+                               : measure(dispatcher, (DispatchOperation)op, (DispatchBackend)b, &tables, input,
+                                         sizes[s], table, scratch);
+                if (times[b] < times[best[op][s]]) {
+                    best[op][s] = (DispatchBackend)b;
+                }
+            }
+            if (log) {
+                fprintf(log, "%zu,%s,%.6f,%.6f,%.6f,%s\n", sizes[s], operation_names[op], times[DISPATCH_CPU],
+                        times[DISPATCH_CPU_PARALLEL], isinf(times[DISPATCH_OPENCL]) ? -1.0 : times[DISPATCH_OPENCL],
+                        backend_names[best[op][s]]);
+            }
+        }
+    }
+
+    // A backend takes over from the smallest size from which it stays the best at every larger size;
+    // in between the cheaper backend is kept
+    DispatchProfile* profile = &dispatcher->profile;
+    device_name(dispatcher->runtime, profile->device);
+    profile->calibrated = true;
+    for (int op = 0; op < DISPATCH_OPERATION_COUNT; op++) {
+        profile->opencl_from[op] = SIZE_MAX;
+        profile->parallel_from[op] = SIZE_MAX;
+        for (int s = size_count - 1; s >= 0 && best[op][s] == DISPATCH_OPENCL; s--) {
+            profile->opencl_from[op] = sizes[s];
+        }
+        for (int s = size_count - 1; s >= 0 && best[op][s] != DISPATCH_CPU; s--) {
+            profile->parallel_from[op] = sizes[s];
+        }
+    }
+
+    aligned_free(input);
+    aligned_free(scratch);
+    return 0;
+}
+
+static const char* size_text(size_t size, char* text, size_t capacity) {
+    if (size >= ((size_t)1 << 30)) {
+        snprintf(text, capacity, "%.1f GiB", size / (double)((size_t)1 << 30));
+    } else if (size >= ((size_t)1 << 20)) {
+        snprintf(text, capacity, "%.1f MiB", size / (double)((size_t)1 << 20));
+    } else if (size >= 1024) {
+        snprintf(text, capacity, "%.1f KiB", size / 1024.0);
+    } else {
+        snprintf(text, capacity, "%zu B", size);
+    }
+    return text;
+}
+
+void dispatch_print_profile(const Dispatcher* dispatcher, FILE* out) {
+    const DispatchProfile* profile = &dispatcher->profile;
+    fprintf(out, "Dispatch profile (%s, device: %s):\n", profile->calibrated ? "calibrated" : "defaults", profile->device);
+
+    for (int op = 0; op < DISPATCH_OPERATION_COUNT; op++) {
+        size_t from[DISPATCH_BACKEND_COUNT] = {0, profile->parallel_from[op],
+                                               dispatcher->runtime ? profile->opencl_from[op] : SIZE_MAX};
+        fprintf(out, "  %-10s", operation_names[op]);
+
+        // Every backend covers the sizes from its crossover to the next one; empty ranges are left out
+        bool first = true;
+        for (int b = 0; b < DISPATCH_BACKEND_COUNT; b++) {
+            size_t next = SIZE_MAX;
+            for (int later = b + 1; later < DISPATCH_BACKEND_COUNT; later++) {
+                if (from[later] < next) {
+                    next = from[later];
+                }
+            }
+            if (from[b] == SIZE_MAX || from[b] >= next) {
+                continue;
+            }
+            char text[32];
+            if (!first) {
+                fprintf(out, " < %s <=", size_text(from[b], text, sizeof(text)));
+            }
+            fprintf(out, " %s", backend_names[b]);
+            first = false;
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void dispatch_print_decision(const Dispatcher* dispatcher, size_t size, FILE* out) {
+    char text[32];
+    fprintf(out, "Dispatch for %s:", size_text(size, text, sizeof(text)));
+    for (int op = 0; op < DISPATCH_OPERATION_COUNT; op++) {
+        fprintf(out, "%s %s -> %s", op > 0 ? "," : "", operation_names[op],
+                backend_names[dispatch_backend(dispatcher, (DispatchOperation)op, size)]);
+    }
+    fprintf(out, "\n");
+}
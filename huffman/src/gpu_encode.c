@@ -0,0 +1,144 @@
+#include "gpu_encode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int gpu_huffman_encode(OpenCLRuntime* runtime, cl_mem input_buffer, cl_ulong input_len,
+                       const HuffmanCode table[256], uint8_t* output, size_t* bit_len, double* kernel_time) {
+    cl_int err;
+    int status = -1;
+
+    cl_uint codes[256];
+    cl_uchar lengths[256];
+    for (int i = 0; i < 256; i++) {
+        if (table[i].length > 32) {
+            return -1;
+        }
+        codes[i] = (cl_uint)table[i].code;
+        lengths[i] = table[i].length;
+    }
+
+    *bit_len = 0;
+    *kernel_time = 0.0;
+    if (input_len == 0) {
+        return 0;
+    }
+
+    cl_context context = runtime->context;
+    cl_command_queue queue = runtime->queue;
+    cl_kernel count_kernel = runtime->kernels[OPENCL_KERNEL_BIT_COUNT];
+    cl_kernel scan_kernel = runtime->kernels[OPENCL_KERNEL_SCAN];
+    cl_kernel encode_kernel = runtime->kernels[OPENCL_KERNEL_ENCODE];
+
+    // The count and encode kernels launch with the same work-group size, it has to suit both
+    size_t local_size = GPU_ENCODE_LOCAL_SIZE;
+    cl_kernel launched[] = {count_kernel, encode_kernel};
+    for (int i = 0; i < 2; i++) {
+        size_t max_local_size;
+        if (clGetKernelWorkGroupInfo(launched[i], runtime->device, CL_KERNEL_WORK_GROUP_SIZE,
+                                     sizeof(max_local_size), &max_local_size, NULL) == CL_SUCCESS &&
+            max_local_size < local_size) {
+            local_size = max_local_size;
+        }
+    }
+
+    cl_uint segment_size = GPU_ENCODE_SEGMENT_SIZE;
+    size_t items = (input_len + segment_size - 1) / segment_size;
+    size_t global_size = ((items + local_size - 1) / local_size) * local_size;
+    cl_uint group_count = (cl_uint)(global_size / local_size);
+
+    cl_mem codes_buffer = NULL, lengths_buffer = NULL, item_offsets = NULL, group_bits = NULL, total_bits = NULL;
+    cl_mem output_buffer = NULL;
+    cl_event events[3] = {NULL, NULL, NULL};
+
+    codes_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(codes), codes, &err);
+    if (err == CL_SUCCESS) {
+        lengths_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(lengths), lengths, &err);
+    }
+    if (err == CL_SUCCESS) {
+        item_offsets = clCreateBuffer(context, CL_MEM_READ_WRITE, global_size * sizeof(cl_uint), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        group_bits = clCreateBuffer(context, CL_MEM_READ_WRITE, group_count * sizeof(cl_ulong), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        total_bits = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong), NULL, &err);
+    }
+
+    if (err == CL_SUCCESS) {
+        clSetKernelArg(count_kernel, 0, sizeof(cl_mem), &input_buffer);
+        clSetKernelArg(count_kernel, 1, sizeof(cl_ulong), &input_len);
+        clSetKernelArg(count_kernel, 2, sizeof(cl_mem), &lengths_buffer);
+        clSetKernelArg(count_kernel, 3, sizeof(cl_uint), &segment_size);
+        clSetKernelArg(count_kernel, 4, sizeof(cl_mem), &item_offsets);
+        clSetKernelArg(count_kernel, 5, sizeof(cl_mem), &group_bits);
+        clSetKernelArg(count_kernel, 6, local_size * sizeof(cl_uint), NULL);
+
+        clSetKernelArg(scan_kernel, 0, sizeof(cl_mem), &group_bits);
+        clSetKernelArg(scan_kernel, 1, sizeof(cl_uint), &group_count);
+        clSetKernelArg(scan_kernel, 2, sizeof(cl_mem), &total_bits);
+    }
+
+    size_t scan_size = 1;
+    if (err == CL_SUCCESS) {
+        err = clEnqueueNDRangeKernel(queue, count_kernel, 1, NULL, &global_size, &local_size, 0, NULL, &events[0]);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueNDRangeKernel(queue, scan_kernel, 1, NULL, &scan_size, &scan_size, 0, NULL, &events[1]);
+    }
+
+    // The total decides the output size, it is the only value read back before encoding
+    cl_ulong total = 0;
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(queue, total_bits, CL_TRUE, 0, sizeof(total), &total, 0, NULL, NULL);
+    }
+
+    if (err == CL_SUCCESS) {
+        size_t words = (size_t)((total + 31) / 32);
+        output_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, (words > 0 ? words : 1) * sizeof(cl_uint), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        size_t words = (size_t)((total + 31) / 32);
+        err = clEnqueueFillBuffer(queue, output_buffer, &(cl_uint){0}, sizeof(cl_uint), 0,
+                                  (words > 0 ? words : 1) * sizeof(cl_uint), 0, NULL, NULL);
+    }
+
+    if (err == CL_SUCCESS) {
+        clSetKernelArg(encode_kernel, 0, sizeof(cl_mem), &input_buffer);
+        clSetKernelArg(encode_kernel, 1, sizeof(cl_ulong), &input_len);
+        clSetKernelArg(encode_kernel, 2, sizeof(cl_mem), &codes_buffer);
+        clSetKernelArg(encode_kernel, 3, sizeof(cl_mem), &lengths_buffer);
+        clSetKernelArg(encode_kernel, 4, sizeof(cl_uint), &segment_size);
+        clSetKernelArg(encode_kernel, 5, sizeof(cl_mem), &item_offsets);
+        clSetKernelArg(encode_kernel, 6, sizeof(cl_mem), &group_bits);
+        clSetKernelArg(encode_kernel, 7, sizeof(cl_mem), &output_buffer);
+        err = clEnqueueNDRangeKernel(queue, encode_kernel, 1, NULL, &global_size, &local_size, 0, NULL, &events[2]);
+    }
+
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(queue, output_buffer, CL_TRUE, 0, (size_t)((total + 7) / 8), output, 0, NULL, NULL);
+    }
+
+    if (err == CL_SUCCESS) {
+        *bit_len = (size_t)total;
+        for (int i = 0; i < 3; i++) {
+            *kernel_time += opencl_event_time(events[i]);
+        }
+        status = 0;
+    } else {
+        fprintf(stderr, "Huffman encode kernel error: %d\n", err);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (events[i]) {
+            clReleaseEvent(events[i]);
+        }
+    }
+    cl_mem buffers[] = {output_buffer, total_bits, group_bits, item_offsets, lengths_buffer, codes_buffer};
+    for (int i = 0; i < 6; i++) {
+        if (buffers[i]) {
+            clReleaseMemObject(buffers[i]);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,615 @@
+#include "gpu_histogram.h"
+#include "cpu_histogram.h"
+#include "gpu_random.h"
+#include "platform.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define GPU_HISTOGRAM_MAX_CHUNK_SIZE ((size_t)1 << 30)  // keeps the 32-bit counters of the kernels from overflowing
+
+typedef struct ChunkSlot {
+    cl_mem input_buffer;  // a device buffer, or the host memory of the chunk itself when used in place
+    cl_mem freq_buffer;  // int[256] counts (atomic) or uint[groups][256] partial counts (vector)
+    cl_event uploaded;
+    cl_event counted;
+    cl_event reduced;    // vector kernel only
+    cl_event read;       // atomic kernel only: counts holds the chunk's histogram once it completes
+    cl_uint counts[256];
+} ChunkSlot;
+
+// Launch shape of the histogram kernel of one chunk
+typedef struct LaunchSize {
+    size_t local_size;
+    size_t max_groups;
+} LaunchSize;
+
+static void release_events(ChunkSlot* slot) {
+    cl_event* events[] = {&slot->uploaded, &slot->counted, &slot->reduced, &slot->read};
+    for (int i = 0; i < 4; i++) {
+        if (*events[i]) {
+            clReleaseEvent(*events[i]);
+            *events[i] = NULL;
+        }
+    }
+}
+
+// Wait for the last chunk of a slot and add its counts and times, which frees the slot's buffers
+static cl_int collect(ChunkSlot* slot, uint64_t freq[256], GpuHistogramTiming* timing) {
+    cl_event done = slot->read ? slot->read : slot->reduced;
+    if (!done) {
+        return CL_SUCCESS;
+    }
+
+    cl_int err = clWaitForEvents(1, &done);
+    if (err == CL_SUCCESS) {
+        if (slot->read) {
+            for (int i = 0; i < 256; i++) {
+                freq[i] += slot->counts[i];
+            }
+        }
+        timing->transfer_time += opencl_event_time(slot->uploaded);
+        timing->kernel_time += opencl_event_time(slot->counted);
+        if (slot->reduced) {
+            timing->kernel_time += opencl_event_time(slot->reduced);
+        }
+        if (slot->read) {
+            timing->readback_time += opencl_event_time(slot->read);
+        }
+    }
+    release_events(slot);
+    return err;
+}
+
+// Blocking read of the 64-bit totals kept on the device
+static cl_int read_totals(OpenCLRuntime* runtime, cl_mem totals, uint64_t* freq, size_t count,
+                          GpuHistogramTiming* timing) {
+    cl_event read;
+    cl_int err = clEnqueueReadBuffer(runtime->queue, totals, CL_TRUE, 0, count * sizeof(cl_ulong), freq,
+                                     0, NULL, &read);
+    if (err == CL_SUCCESS) {
+        timing->readback_time += opencl_event_time(read);
+        clReleaseEvent(read);
+    }
+    return err;
+}
+
+// byte_frequency_kernel clears and flushes its histogram with the first 256 work-items,
+// it needs exactly this local size; its group count is not limited
+static const LaunchSize atomic_launch = {GPU_HISTOGRAM_LOCAL_SIZE, 0};
+
+// Grid-stride kernels: at most the kernel's work-group size, at most GPU_HISTOGRAM_GROUPS_PER_UNIT
+// groups per compute unit
+static LaunchSize launch_size(OpenCLRuntime* runtime, OpenCLKernelId kernel_id) {
+    LaunchSize size = {GPU_HISTOGRAM_LOCAL_SIZE, GPU_HISTOGRAM_GROUPS_PER_UNIT};
+
+    size_t max_local_size;
+    if (clGetKernelWorkGroupInfo(runtime->kernels[kernel_id], runtime->device,
+                                 CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local_size), &max_local_size, NULL) == CL_SUCCESS &&
+        max_local_size < size.local_size) {
+        size.local_size = max_local_size;
+    }
+
+    cl_uint compute_units;
+    if (clGetDeviceInfo(runtime->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL) == CL_SUCCESS &&
+        compute_units > 0) {
+        size.max_groups = (size_t)compute_units * GPU_HISTOGRAM_GROUPS_PER_UNIT;
+    }
+    return size;
+}
+
+// Chunks are used in place when the whole input is usable zero-copy and every chunk starts aligned
+static bool chunks_in_place(const OpenCLRuntime* runtime, const uint8_t* input, size_t input_len, size_t chunk_size) {
+    return opencl_zero_copy(runtime, input) &&
+           (chunk_size % OPENCL_ZERO_COPY_ALIGNMENT == 0 || chunk_size >= input_len);
+}
+
+// Make a chunk available to the kernel: uploaded into the slot's buffer on the transfer queue, or,
+// in place, a buffer over the host memory itself; then slot->uploaded is a marker, nothing is copied
+static cl_int stage_chunk(OpenCLRuntime* runtime, ChunkSlot* slot, bool in_place, const uint8_t* chunk, size_t length) {
+    cl_int err;
+    if (in_place) {
+        if (slot->input_buffer) {
+            clReleaseMemObject(slot->input_buffer);
+        }
+        slot->input_buffer = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, length,
+                                            (void*)chunk, &err);
+        if (err == CL_SUCCESS) {
+            err = clEnqueueMarkerWithWaitList(runtime->transfer_queue, 0, NULL, &slot->uploaded);
+        }
+    } else {
+        err = clEnqueueWriteBuffer(runtime->transfer_queue, slot->input_buffer, CL_FALSE, 0, length, chunk,
+                                   0, NULL, &slot->uploaded);
+    }
+    if (err == CL_SUCCESS) {
+        err = clFlush(runtime->transfer_queue);
+    }
+    return err;
+}
+
+static cl_int enqueue_atomic_kernel(OpenCLRuntime* runtime, ChunkSlot* slot, cl_ulong length, LaunchSize size) {
+    cl_kernel kernel = runtime->kernels[OPENCL_KERNEL_FREQUENCY];
+    size_t items = (size_t)((length + GPU_HISTOGRAM_BYTES_PER_ITEM - 1) / GPU_HISTOGRAM_BYTES_PER_ITEM);
+    size_t global_size = ((items + size.local_size - 1) / size.local_size) * size.local_size;
+
+    cl_int err = clEnqueueFillBuffer(runtime->queue, slot->freq_buffer, &(cl_uint){0}, sizeof(cl_uint), 0,
+                                     256 * sizeof(cl_uint), 0, NULL, NULL);
+    if (err == CL_SUCCESS) {
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &slot->input_buffer);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &slot->freq_buffer);
+        clSetKernelArg(kernel, 2, sizeof(cl_ulong), &length);
+        err = clEnqueueNDRangeKernel(runtime->queue, kernel, 1, NULL, &global_size, &size.local_size,
+                                     1, &slot->uploaded, &slot->counted);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(runtime->queue, slot->freq_buffer, CL_FALSE, 0, 256 * sizeof(cl_uint),
+                                  slot->counts, 0, NULL, &slot->read);
+    }
+    return err;
+}
+
+// One work-item per GPU_HISTOGRAM_VECTORS_PER_ITEM vectors up to max_groups work-groups;
+// beyond that the kernel's grid-stride loop covers the rest
+static cl_int enqueue_vector_kernel(OpenCLRuntime* runtime, ChunkSlot* slot, cl_ulong length, LaunchSize size,
+                                    cl_mem totals) {
+    cl_kernel kernel = runtime->kernels[OPENCL_KERNEL_FREQUENCY_VECTOR];
+    cl_kernel reduce_kernel = runtime->kernels[OPENCL_KERNEL_FREQUENCY_REDUCE];
+
+    size_t vectors = (size_t)((length + 15) / 16);
+    size_t items = (vectors + GPU_HISTOGRAM_VECTORS_PER_ITEM - 1) / GPU_HISTOGRAM_VECTORS_PER_ITEM;
+    size_t groups = (items + size.local_size - 1) / size.local_size;
+    if (groups > size.max_groups) {
+        groups = size.max_groups;
+    }
+    size_t global_size = groups * size.local_size;
+    cl_uint group_count = (cl_uint)groups;
+
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &slot->input_buffer);
+    clSetKernelArg(kernel, 1, sizeof(cl_ulong), &length);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &slot->freq_buffer);
+    cl_int err = clEnqueueNDRangeKernel(runtime->queue, kernel, 1, NULL, &global_size, &size.local_size,
+                                        1, &slot->uploaded, &slot->counted);
+
+    if (err == CL_SUCCESS) {
+        size_t reduce_size = 256;
+        clSetKernelArg(reduce_kernel, 0, sizeof(cl_mem), &slot->freq_buffer);
+        clSetKernelArg(reduce_kernel, 1, sizeof(cl_uint), &group_count);
+        clSetKernelArg(reduce_kernel, 2, sizeof(cl_mem), &totals);
+        err = clEnqueueNDRangeKernel(runtime->queue, reduce_kernel, 1, NULL, &reduce_size, NULL,
+                                     0, NULL, &slot->reduced);
+    }
+    return err;
+}
+
+int gpu_byte_histogram(OpenCLRuntime* runtime, GpuHistogramKernel kernel, const uint8_t* input, size_t input_len,
+                       size_t chunk_size, uint64_t freq[256], GpuHistogramTiming* timing) {
+    GpuHistogramTiming local_timing;
+    if (!timing) {
+        timing = &local_timing;
+    }
+    memset(timing, 0, sizeof(*timing));
+    memset(freq, 0, 256 * sizeof(freq[0]));
+    if (input_len == 0) {
+        return 0;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = GPU_HISTOGRAM_CHUNK_SIZE;
+    }
+    if (chunk_size > GPU_HISTOGRAM_MAX_CHUNK_SIZE) {
+        chunk_size = GPU_HISTOGRAM_MAX_CHUNK_SIZE;
+    }
+    if (chunk_size > input_len) {
+        chunk_size = input_len;
+    }
+
+    double start = wall_time();
+    LaunchSize size = kernel == GPU_HISTOGRAM_ATOMIC ? atomic_launch
+                                                     : launch_size(runtime, OPENCL_KERNEL_FREQUENCY_VECTOR);
+    size_t freq_size = kernel == GPU_HISTOGRAM_VECTOR ? size.max_groups * 256 * sizeof(cl_uint) : 256 * sizeof(cl_uint);
+    bool in_place = chunks_in_place(runtime, input, input_len, chunk_size);
+    ChunkSlot slots[GPU_HISTOGRAM_BUFFERS];
+    memset(slots, 0, sizeof(slots));
+    cl_mem totals = NULL;
+
+    cl_int err = CL_SUCCESS;
+    for (int i = 0; i < GPU_HISTOGRAM_BUFFERS && err == CL_SUCCESS; i++) {
+        if (!in_place) {
+            slots[i].input_buffer = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY, chunk_size, NULL, &err);
+        }
+        if (err == CL_SUCCESS) {
+            slots[i].freq_buffer = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, freq_size, NULL, &err);
+        }
+    }
+    if (err == CL_SUCCESS && kernel == GPU_HISTOGRAM_VECTOR) {
+        totals = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, 256 * sizeof(cl_ulong), NULL, &err);
+        if (err == CL_SUCCESS) {
+            err = clEnqueueFillBuffer(runtime->queue, totals, &(cl_ulong){0}, sizeof(cl_ulong), 0,
+                                      256 * sizeof(cl_ulong), 0, NULL, NULL);
+        }
+    }
+    timing->setup_time = wall_time() - start;
+
+    size_t chunk_index = 0;
+    for (size_t offset = 0; offset < input_len && err == CL_SUCCESS; offset += chunk_size, chunk_index++) {
+        ChunkSlot* slot = &slots[chunk_index % GPU_HISTOGRAM_BUFFERS];
+        cl_ulong length = input_len - offset < chunk_size ? input_len - offset : chunk_size;
+
+        // The slot is reused only after its previous chunk is counted;
+        // meanwhile the kernel of the other slot keeps the device busy
+        err = collect(slot, freq, timing);
+        if (err == CL_SUCCESS) {
+            err = stage_chunk(runtime, slot, in_place, input + offset, (size_t)length);
+        }
+        if (err == CL_SUCCESS) {
+            err = kernel == GPU_HISTOGRAM_VECTOR ? enqueue_vector_kernel(runtime, slot, length, size, totals)
+                                                 : enqueue_atomic_kernel(runtime, slot, length, size);
+        }
+        if (err == CL_SUCCESS) {
+            err = clFlush(runtime->queue);
+        }
+    }
+
+    // The slots hold the last chunks in order, collecting them finishes the histogram
+    for (size_t i = 0; i < GPU_HISTOGRAM_BUFFERS && err == CL_SUCCESS; i++) {
+        err = collect(&slots[(chunk_index + i) % GPU_HISTOGRAM_BUFFERS], freq, timing);
+    }
+    if (err == CL_SUCCESS && totals) {
+        err = read_totals(runtime, totals, freq, 256, timing);
+    }
+
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Byte histogram pipeline error: %d\n", err);
+        clFinish(runtime->transfer_queue);
+        clFinish(runtime->queue);
+    }
+    for (int i = 0; i < GPU_HISTOGRAM_BUFFERS; i++) {
+        release_events(&slots[i]);
+        if (slots[i].input_buffer) {
+            clReleaseMemObject(slots[i].input_buffer);
+        }
+        if (slots[i].freq_buffer) {
+            clReleaseMemObject(slots[i].freq_buffer);
+        }
+    }
+    if (totals) {
+        clReleaseMemObject(totals);
+    }
+
+    timing->wall_time = wall_time() - start;
+    return err == CL_SUCCESS ? 0 : -1;
+}
+
+static cl_int enqueue_pair_kernel(OpenCLRuntime* runtime, ChunkSlot* slot, cl_ulong length, cl_uint previous,
+                                  LaunchSize size, cl_mem counts, cl_mem totals) {
+    cl_kernel kernel = runtime->kernels[OPENCL_KERNEL_PAIR_FREQUENCY];
+    cl_kernel reduce_kernel = runtime->kernels[OPENCL_KERNEL_PAIR_REDUCE];
+
+    size_t vectors = (size_t)((length + 15) / 16);
+    size_t items = (vectors + GPU_HISTOGRAM_VECTORS_PER_ITEM - 1) / GPU_HISTOGRAM_VECTORS_PER_ITEM;
+    size_t groups = (items + size.local_size - 1) / size.local_size;
+    if (groups > size.max_groups) {
+        groups = size.max_groups;
+    }
+    size_t global_size = groups * size.local_size;
+
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &slot->input_buffer);
+    clSetKernelArg(kernel, 1, sizeof(cl_ulong), &length);
+    clSetKernelArg(kernel, 2, sizeof(cl_uint), &previous);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &counts);
+    cl_int err = clEnqueueNDRangeKernel(runtime->queue, kernel, 1, NULL, &global_size, &size.local_size,
+                                        1, &slot->uploaded, &slot->counted);
+
+    if (err == CL_SUCCESS) {
+        size_t reduce_size = PAIR_HISTOGRAM_SIZE;
+        clSetKernelArg(reduce_kernel, 0, sizeof(cl_mem), &counts);
+        clSetKernelArg(reduce_kernel, 1, sizeof(cl_mem), &totals);
+        err = clEnqueueNDRangeKernel(runtime->queue, reduce_kernel, 1, NULL, &reduce_size, NULL,
+                                     0, NULL, &slot->reduced);
+    }
+    return err;
+}
+
+int gpu_pair_histogram(OpenCLRuntime* runtime, const uint8_t* input, size_t input_len, size_t chunk_size,
+                       uint64_t* freq, GpuHistogramTiming* timing) {
+    GpuHistogramTiming local_timing;
+    if (!timing) {
+        timing = &local_timing;
+    }
+    memset(timing, 0, sizeof(*timing));
+    memset(freq, 0, PAIR_HISTOGRAM_SIZE * sizeof(freq[0]));
+    if (input_len == 0) {
+        return 0;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = GPU_HISTOGRAM_CHUNK_SIZE;
+    }
+    if (chunk_size > GPU_HISTOGRAM_MAX_CHUNK_SIZE) {
+        chunk_size = GPU_HISTOGRAM_MAX_CHUNK_SIZE;
+    }
+    if (chunk_size > input_len) {
+        chunk_size = input_len;
+    }
+
+    double start = wall_time();
+    LaunchSize size = launch_size(runtime, OPENCL_KERNEL_PAIR_FREQUENCY);
+    bool in_place = chunks_in_place(runtime, input, input_len, chunk_size);
+    ChunkSlot slots[GPU_HISTOGRAM_BUFFERS];
+    memset(slots, 0, sizeof(slots));
+    cl_mem counts = NULL, totals = NULL;
+
+    // The chunks share one set of 32-bit counts, cleared by the reduce kernel of each chunk;
+    // both kernels run in order on runtime->queue
+    cl_int err = CL_SUCCESS;
+    for (int i = 0; i < GPU_HISTOGRAM_BUFFERS && err == CL_SUCCESS && !in_place; i++) {
+        slots[i].input_buffer = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY, chunk_size, NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        counts = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, PAIR_HISTOGRAM_SIZE * sizeof(cl_uint), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        totals = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, PAIR_HISTOGRAM_SIZE * sizeof(cl_ulong), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(runtime->queue, counts, &(cl_uint){0}, sizeof(cl_uint), 0,
+                                  PAIR_HISTOGRAM_SIZE * sizeof(cl_uint), 0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(runtime->queue, totals, &(cl_ulong){0}, sizeof(cl_ulong), 0,
+                                  PAIR_HISTOGRAM_SIZE * sizeof(cl_ulong), 0, NULL, NULL);
+    }
+    timing->setup_time = wall_time() - start;
+
+    size_t chunk_index = 0;
+    for (size_t offset = 0; offset < input_len && err == CL_SUCCESS; offset += chunk_size, chunk_index++) {
+        ChunkSlot* slot = &slots[chunk_index % GPU_HISTOGRAM_BUFFERS];
+        cl_ulong length = input_len - offset < chunk_size ? input_len - offset : chunk_size;
+        cl_uint previous = offset > 0 ? input[offset - 1] : 0;
+
+        err = collect(slot, NULL, timing);
+        if (err == CL_SUCCESS) {
+            err = stage_chunk(runtime, slot, in_place, input + offset, (size_t)length);
+        }
+        if (err == CL_SUCCESS) {
+            err = enqueue_pair_kernel(runtime, slot, length, previous, size, counts, totals);
+        }
+        if (err == CL_SUCCESS) {
+            err = clFlush(runtime->queue);
+        }
+    }
+
+    for (size_t i = 0; i < GPU_HISTOGRAM_BUFFERS && err == CL_SUCCESS; i++) {
+        err = collect(&slots[(chunk_index + i) % GPU_HISTOGRAM_BUFFERS], NULL, timing);
+    }
+    if (err == CL_SUCCESS) {
+        err = read_totals(runtime, totals, freq, PAIR_HISTOGRAM_SIZE, timing);
+    }
+
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Pair histogram pipeline error: %d\n", err);
+        clFinish(runtime->transfer_queue);
+        clFinish(runtime->queue);
+    }
+    for (int i = 0; i < GPU_HISTOGRAM_BUFFERS; i++) {
+        release_events(&slots[i]);
+        if (slots[i].input_buffer) {
+            clReleaseMemObject(slots[i].input_buffer);
+        }
+    }
+    if (counts) {
+        clReleaseMemObject(counts);
+    }
+    if (totals) {
+        clReleaseMemObject(totals);
+    }
+
+    timing->wall_time = wall_time() - start;
+    return err == CL_SUCCESS ? 0 : -1;
+}
+
+int gpu_buffer_histogram(OpenCLRuntime* runtime, cl_mem input_buffer, size_t input_len, uint64_t freq[256],
+                         GpuHistogramTiming* timing) {
+    GpuHistogramTiming local_timing;
+    if (!timing) {
+        timing = &local_timing;
+    }
+    memset(timing, 0, sizeof(*timing));
+    memset(freq, 0, 256 * sizeof(freq[0]));
+    if (input_len == 0) {
+        return 0;
+    }
+
+    double start = wall_time();
+    LaunchSize size = launch_size(runtime, OPENCL_KERNEL_FREQUENCY_VECTOR);
+    ChunkSlot slot;
+    memset(&slot, 0, sizeof(slot));
+    cl_mem totals = NULL;
+
+    cl_int err;
+    slot.freq_buffer = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, size.max_groups * 256 * sizeof(cl_uint),
+                                      NULL, &err);
+    if (err == CL_SUCCESS) {
+        totals = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, 256 * sizeof(cl_ulong), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(runtime->queue, totals, &(cl_ulong){0}, sizeof(cl_ulong), 0,
+                                  256 * sizeof(cl_ulong), 0, NULL, NULL);
+    }
+    timing->setup_time = wall_time() - start;
+
+    // Sub-buffers of at most GPU_HISTOGRAM_MAX_CHUNK_SIZE bytes keep the 32-bit partial counts from
+    // overflowing; there is nothing to upload, a marker stands in for it
+    for (size_t offset = 0; offset < input_len && err == CL_SUCCESS; offset += GPU_HISTOGRAM_MAX_CHUNK_SIZE) {
+        cl_ulong length = input_len - offset < GPU_HISTOGRAM_MAX_CHUNK_SIZE ? input_len - offset
+                                                                             : GPU_HISTOGRAM_MAX_CHUNK_SIZE;
+        err = collect(&slot, freq, timing);
+        if (slot.input_buffer) {
+            clReleaseMemObject(slot.input_buffer);
+            slot.input_buffer = NULL;
+        }
+        if (err == CL_SUCCESS && length == input_len) {
+            clRetainMemObject(input_buffer);
+            slot.input_buffer = input_buffer;
+        } else if (err == CL_SUCCESS) {
+            cl_buffer_region region = {offset, (size_t)length};
+            slot.input_buffer = clCreateSubBuffer(input_buffer, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+        }
+        if (err == CL_SUCCESS) {
+            err = clEnqueueMarkerWithWaitList(runtime->queue, 0, NULL, &slot.uploaded);
+        }
+        if (err == CL_SUCCESS) {
+            err = enqueue_vector_kernel(runtime, &slot, length, size, totals);
+        }
+        if (err == CL_SUCCESS) {
+            err = clFlush(runtime->queue);
+        }
+    }
+
+    if (err == CL_SUCCESS) {
+        err = collect(&slot, freq, timing);
+    }
+    if (err == CL_SUCCESS) {
+        err = read_totals(runtime, totals, freq, 256, timing);
+    }
+
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Device buffer histogram error: %d\n", err);
+        clFinish(runtime->queue);
+    }
+    release_events(&slot);
+    if (slot.input_buffer) {
+        clReleaseMemObject(slot.input_buffer);
+    }
+    if (slot.freq_buffer) {
+        clReleaseMemObject(slot.freq_buffer);
+    }
+    if (totals) {
+        clReleaseMemObject(totals);
+    }
+
+    timing->wall_time = wall_time() - start;
+    return err == CL_SUCCESS ? 0 : -1;
+}
+
+int gpu_random_histogram(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                         uint64_t length, uint64_t freq[256], GpuHistogramTiming* timing) {
+    GpuHistogramTiming local_timing;
+    if (!timing) {
+        timing = &local_timing;
+    }
+    memset(timing, 0, sizeof(*timing));
+    memset(freq, 0, 256 * sizeof(freq[0]));
+
+    // The kernel starts at a pair boundary; an odd first byte is counted here
+    if (first % 2 == 1 && length > 0) {
+        uint8_t byte;
+        random_bytes(tables, seed, first, &byte, 1);
+        freq[byte]++;
+        first++;
+        length--;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    double start = wall_time();
+    LaunchSize size = launch_size(runtime, OPENCL_KERNEL_RANDOM_FREQUENCY);
+    cl_mem thresholds = NULL, buckets = NULL, partial_freq = NULL, totals = NULL;
+
+    cl_int err;
+    thresholds = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(tables->thresholds),
+                                (void*)tables->thresholds, &err);
+    if (err == CL_SUCCESS) {
+        buckets = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(tables->buckets),
+                                 (void*)tables->buckets, &err);
+    }
+    if (err == CL_SUCCESS) {
+        partial_freq = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, size.max_groups * 256 * sizeof(cl_uint),
+                                      NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        totals = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, 256 * sizeof(cl_ulong), NULL, &err);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(runtime->queue, totals, &(cl_ulong){0}, sizeof(cl_ulong), 0,
+                                  256 * sizeof(cl_ulong), 0, NULL, NULL);
+    }
+    timing->setup_time = wall_time() - start;
+
+    // Chunks of GPU_HISTOGRAM_MAX_CHUNK_SIZE bytes (even, so each starts at a pair boundary) keep the
+    // 32-bit partial counts from overflowing; the 64-bit totals add up any length. The events of a
+    // chunk are collected before the next one, a round trip per GiB.
+    cl_kernel kernel = runtime->kernels[OPENCL_KERNEL_RANDOM_FREQUENCY];
+    cl_kernel reduce_kernel = runtime->kernels[OPENCL_KERNEL_FREQUENCY_REDUCE];
+    for (uint64_t offset = 0; offset < length && err == CL_SUCCESS; offset += GPU_HISTOGRAM_MAX_CHUNK_SIZE) {
+        cl_ulong chunk_first = first + offset;
+        cl_ulong chunk_length = length - offset < GPU_HISTOGRAM_MAX_CHUNK_SIZE ? length - offset
+                                                                               : GPU_HISTOGRAM_MAX_CHUNK_SIZE;
+        cl_ulong seed_arg = seed;
+
+        size_t pairs = (size_t)((chunk_length + 1) / 2);
+        size_t items = (pairs + GPU_RANDOM_PAIRS_PER_ITEM - 1) / GPU_RANDOM_PAIRS_PER_ITEM;
+        size_t groups = (items + size.local_size - 1) / size.local_size;
+        if (groups > size.max_groups) {
+            groups = size.max_groups;
+        }
+        size_t global_size = groups * size.local_size;
+        cl_uint group_count = (cl_uint)groups;
+
+        clSetKernelArg(kernel, 0, sizeof(cl_ulong), &seed_arg);
+        clSetKernelArg(kernel, 1, sizeof(cl_ulong), &chunk_first);
+        clSetKernelArg(kernel, 2, sizeof(cl_ulong), &chunk_length);
+        clSetKernelArg(kernel, 3, sizeof(cl_mem), &thresholds);
+        clSetKernelArg(kernel, 4, sizeof(cl_mem), &buckets);
+        clSetKernelArg(kernel, 5, sizeof(cl_mem), &partial_freq);
+        cl_event counted = NULL, reduced = NULL;
+        err = clEnqueueNDRangeKernel(runtime->queue, kernel, 1, NULL, &global_size, &size.local_size,
+                                     0, NULL, &counted);
+
+        if (err == CL_SUCCESS) {
+            size_t reduce_size = 256;
+            clSetKernelArg(reduce_kernel, 0, sizeof(cl_mem), &partial_freq);
+            clSetKernelArg(reduce_kernel, 1, sizeof(cl_uint), &group_count);
+            clSetKernelArg(reduce_kernel, 2, sizeof(cl_mem), &totals);
+            err = clEnqueueNDRangeKernel(runtime->queue, reduce_kernel, 1, NULL, &reduce_size, NULL,
+                                         0, NULL, &reduced);
+        }
+        if (err == CL_SUCCESS) {
+            err = clWaitForEvents(1, &reduced);
+        }
+        if (err == CL_SUCCESS) {
+            timing->kernel_time += opencl_event_time(counted) + opencl_event_time(reduced);
+        }
+        if (counted) {
+            clReleaseEvent(counted);
+        }
+        if (reduced) {
+            clReleaseEvent(reduced);
+        }
+    }
+
+    if (err == CL_SUCCESS) {
+        // The totals are added to freq, which may already hold the odd first byte counted on the host
+        uint64_t counts[256];
+        err = read_totals(runtime, totals, counts, 256, timing);
+        for (int i = 0; i < 256 && err == CL_SUCCESS; i++) {
+            freq[i] += counts[i];
+        }
+    }
+
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Fused generation histogram error: %d\n", err);
+        clFinish(runtime->queue);
+    }
+    cl_mem buffers[] = {thresholds, buckets, partial_freq, totals};
+    for (int i = 0; i < 4; i++) {
+        if (buffers[i]) {
+            clReleaseMemObject(buffers[i]);
+        }
+    }
+
+    timing->wall_time = wall_time() - start;
+    return err == CL_SUCCESS ? 0 : -1;
+}
@@ -0,0 +1,282 @@
+#include "gpu_multi.h"
+#include "cpu_histogram.h"
+#include "gpu_histogram.h"
+#include "gpu_random.h"
+#include "platform.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GPU_MULTI_CALIBRATION_RUNS 3
+
+// The range of one device and its result
+typedef struct DeviceJob {
+    OpenCLRuntime* runtime;
+    const RandomTables* tables;  // generation only
+    uint64_t seed;
+    const uint8_t* input;        // histogram only
+    uint8_t* output;             // generation only
+    uint64_t first;
+    size_t length;
+    uint64_t freq[256];
+    int status;
+} DeviceJob;
+
+static bool is_cpu_device(cl_device_id device) {
+    cl_device_type type;
+    return clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, NULL) == CL_SUCCESS &&
+           (type & CL_DEVICE_TYPE_CPU);
+}
+
+static void add_device(GpuDeviceSet* set, cl_platform_id platform, cl_device_id device, const char* cache_dir) {
+    if (opencl_runtime_init_device(&set->runtimes[set->count], platform, device, cache_dir, false) == 0) {
+        set->count++;
+    }
+}
+
+// Sub-devices of sub_device_units compute units each; returns false if the device cannot be partitioned
+static bool add_sub_devices(GpuDeviceSet* set, cl_platform_id platform, cl_device_id device,
+                            cl_uint sub_device_units, const char* cache_dir) {
+    const cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, sub_device_units, 0};
+    cl_uint count;
+    if (clCreateSubDevices(device, properties, 0, NULL, &count) != CL_SUCCESS || count < 2) {
+        return false;
+    }
+
+    // All of them have to be created at once; the ones that do not fit into the set are released
+    cl_device_id* sub_devices = malloc(count * sizeof(*sub_devices));
+    if (!sub_devices || clCreateSubDevices(device, properties, count, sub_devices, NULL) != CL_SUCCESS) {
+        free(sub_devices);
+        return false;
+    }
+    for (cl_uint i = 0; i < count; i++) {
+        if (set->count < GPU_MULTI_MAX_DEVICES) {
+            add_device(set, platform, sub_devices[i], cache_dir);  // releases the sub-device on failure
+        } else {
+            clReleaseDevice(sub_devices[i]);
+        }
+    }
+    free(sub_devices);
+    return true;
+}
+
+static void equal_weights(double* weights, int count) {
+    for (int i = 0; i < count; i++) {
+        weights[i] = 1.0 / count;
+    }
+}
+
+int gpu_device_set_init(GpuDeviceSet* set, cl_device_type types, cl_uint sub_device_units, const char* cache_dir) {
+    cl_platform_id platforms[GPU_MULTI_MAX_DEVICES];
+    cl_device_id devices[GPU_MULTI_MAX_DEVICES];
+    int device_count = opencl_find_devices(types, platforms, devices, GPU_MULTI_MAX_DEVICES);
+
+    memset(set, 0, sizeof(*set));
+    for (int i = 0; i < device_count && set->count < GPU_MULTI_MAX_DEVICES; i++) {
+        if (sub_device_units > 0 && is_cpu_device(devices[i]) &&
+            add_sub_devices(set, platforms[i], devices[i], sub_device_units, cache_dir)) {
+            continue;
+        }
+        add_device(set, platforms[i], devices[i], cache_dir);
+    }
+
+    equal_weights(set->histogram_weights, set->count);
+    equal_weights(set->generate_weights, set->count);
+    return set->count;
+}
+
+void gpu_device_set_release(GpuDeviceSet* set) {
+    for (int i = 0; i < set->count; i++) {
+        opencl_runtime_release(&set->runtimes[i]);
+    }
+    set->count = 0;
+}
+
+// Weights proportional to the throughputs, equal if no device worked
+static void set_weights(double* weights, const double* throughputs, int count) {
+    double total = 0.0;
+    for (int i = 0; i < count; i++) {
+        total += throughputs[i];
+    }
+    if (total <= 0.0) {
+        equal_weights(weights, count);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        weights[i] = throughputs[i] / total;
+    }
+}
+
+void gpu_device_set_calibrate(GpuDeviceSet* set, const RandomTables* tables, size_t sample_size) {
+    // Aligned like the callers' buffers, so zero-copy devices are measured in place
+    uint8_t* sample = aligned_malloc(sample_size, OPENCL_ZERO_COPY_ALIGNMENT);
+    uint8_t* output = aligned_malloc(sample_size, OPENCL_ZERO_COPY_ALIGNMENT);
+    if (!sample || !output) {
+        aligned_free(sample);
+        aligned_free(output);
+        return;
+    }
+    random_bytes_parallel(tables, RANDOM_DEFAULT_SEED, sample, sample_size, 0);
+
+    // Fastest of a few runs after a warmup, so a stray slow run does not shift the split
+    double histogram_throughputs[GPU_MULTI_MAX_DEVICES];
+    double generate_throughputs[GPU_MULTI_MAX_DEVICES];
+    for (int d = 0; d < set->count; d++) {
+        double best_histogram = 0.0, best_generate = 0.0;
+        bool ok = true;
+        for (int run = -1; run < GPU_MULTI_CALIBRATION_RUNS && ok; run++) {
+            uint64_t freq[256];
+            double start = wall_time();
+            ok = gpu_byte_histogram(&set->runtimes[d], GPU_HISTOGRAM_VECTOR, sample, sample_size, 0, freq, NULL) == 0;
+            double histogram_time = wall_time() - start;
+
+            start = wall_time();
+            ok = ok && gpu_random_bytes(&set->runtimes[d], tables, RANDOM_DEFAULT_SEED, 0, output, sample_size, NULL) == 0;
+            double generate_time = wall_time() - start;
+
+            if (ok && run >= 0) {
+                if (best_histogram == 0.0 || histogram_time < best_histogram) {
+                    best_histogram = histogram_time;
+                }
+                if (best_generate == 0.0 || generate_time < best_generate) {
+                    best_generate = generate_time;
+                }
+            }
+        }
+        histogram_throughputs[d] = ok && best_histogram > 0.0 ? sample_size / best_histogram : 0.0;
+        generate_throughputs[d] = ok && best_generate > 0.0 ? sample_size / best_generate : 0.0;
+    }
+
+    set_weights(set->histogram_weights, histogram_throughputs, set->count);
+    set_weights(set->generate_weights, generate_throughputs, set->count);
+    aligned_free(sample);
+    aligned_free(output);
+}
+
+void gpu_device_set_print(const GpuDeviceSet* set, FILE* out) {
+    for (int i = 0; i < set->count; i++) {
+        const OpenCLRuntime* runtime = &set->runtimes[i];
+        char platform[128] = "unknown", name[128] = "unknown";
+        cl_uint compute_units = 0;
+        cl_device_id parent = NULL;
+        clGetPlatformInfo(runtime->platform, CL_PLATFORM_NAME, sizeof(platform), platform, NULL);
+        clGetDeviceInfo(runtime->device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+        clGetDeviceInfo(runtime->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+        clGetDeviceInfo(runtime->device, CL_DEVICE_PARENT_DEVICE, sizeof(parent), &parent, NULL);
+        fprintf(out, "  [%d] %s / %s%s, %u compute units, weight histogram %.3f, generate %.3f\n", i, platform, name,
+                parent ? " (sub-device)" : "", compute_units, set->histogram_weights[i], set->generate_weights[i]);
+    }
+}
+
+// Split length into count contiguous ranges by weight, every boundary a multiple of GPU_MULTI_ALIGNMENT
+static void split_ranges(const double* weights, int count, size_t length, DeviceJob* jobs) {
+    double cumulative = 0.0;
+    size_t start = 0;
+    for (int i = 0; i < count; i++) {
+        cumulative += weights[i];
+        size_t end = length;
+        if (i < count - 1) {
+            end = (size_t)(length * cumulative) / GPU_MULTI_ALIGNMENT * GPU_MULTI_ALIGNMENT;
+            if (end < start) {
+                end = start;
+            }
+            if (end > length) {
+                end = length;
+            }
+        }
+        jobs[i].first = start;
+        jobs[i].length = end - start;
+        start = end;
+    }
+}
+
+static void* histogram_job(void* arg) {
+    DeviceJob* job = (DeviceJob*)arg;
+    job->status = gpu_byte_histogram(job->runtime, GPU_HISTOGRAM_VECTOR, job->input + job->first, job->length,
+                                     0, job->freq, NULL);
+    return NULL;
+}
+
+static void* generate_job(void* arg) {
+    DeviceJob* job = (DeviceJob*)arg;
+    job->status = gpu_random_bytes(job->runtime, job->tables, job->seed, job->first, job->output + job->first,
+                                   job->length, NULL);
+    return NULL;
+}
+
+// One host thread per device (the first device on the calling thread), as the device calls block
+static void run_jobs(DeviceJob* jobs, int count, void* (*function)(void*)) {
+    pthread_t threads[GPU_MULTI_MAX_DEVICES];
+    bool started[GPU_MULTI_MAX_DEVICES];
+
+    for (int i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, function, &jobs[i]) == 0;
+    }
+    function(&jobs[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            function(&jobs[i]);
+        }
+    }
+}
+
+int gpu_multi_histogram(GpuDeviceSet* set, const uint8_t* input, size_t input_len, uint64_t freq[256]) {
+    if (set->count == 0) {
+        byte_histogram_parallel(input, input_len, freq, 0);
+        return -1;
+    }
+
+    DeviceJob jobs[GPU_MULTI_MAX_DEVICES];
+    memset(jobs, 0, sizeof(jobs));
+    split_ranges(set->histogram_weights, set->count, input_len, jobs);
+    for (int i = 0; i < set->count; i++) {
+        jobs[i].runtime = &set->runtimes[i];
+        jobs[i].input = input;
+    }
+    run_jobs(jobs, set->count, histogram_job);
+
+    int status = 0;
+    memset(freq, 0, 256 * sizeof(freq[0]));
+    for (int i = 0; i < set->count; i++) {
+        if (jobs[i].status != 0) {
+            byte_histogram_parallel(input + jobs[i].first, jobs[i].length, jobs[i].freq, 0);
+            status = -1;
+        }
+        for (int b = 0; b < 256; b++) {
+            freq[b] += jobs[i].freq[b];
+        }
+    }
+    return status;
+}
+
+int gpu_multi_random_bytes(GpuDeviceSet* set, const RandomTables* tables, uint64_t seed,
+                           uint8_t* output, size_t length) {
+    if (set->count == 0) {
+        random_bytes_parallel(tables, seed, output, length, 0);
+        return -1;
+    }
+
+    DeviceJob jobs[GPU_MULTI_MAX_DEVICES];
+    memset(jobs, 0, sizeof(jobs));
+    split_ranges(set->generate_weights, set->count, length, jobs);
+    for (int i = 0; i < set->count; i++) {
+        jobs[i].runtime = &set->runtimes[i];
+        jobs[i].tables = tables;
+        jobs[i].seed = seed;
+        jobs[i].output = output;
+    }
+    run_jobs(jobs, set->count, generate_job);
+
+    int status = 0;
+    for (int i = 0; i < set->count; i++) {
+        if (jobs[i].status != 0) {
+            random_bytes(tables, seed, jobs[i].first, output + jobs[i].first, jobs[i].length);
+            status = -1;
+        }
+    }
+    return status;
+}
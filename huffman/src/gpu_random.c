@@ -0,0 +1,127 @@
+#include "gpu_random.h"
+#include "platform.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Generate length bytes from first (even) into output_buffer on runtime->queue; the tables are
+// uploaded for this call and released once the kernel is enqueued
+static cl_int enqueue_random(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                             cl_mem output_buffer, size_t length) {
+    cl_int err = CL_SUCCESS;
+    cl_mem thresholds = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       sizeof(tables->thresholds), (void*)tables->thresholds, NULL);
+    cl_mem buckets = clCreateBuffer(runtime->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    sizeof(tables->buckets), (void*)tables->buckets, NULL);
+    if (!thresholds || !buckets) {
+        err = CL_OUT_OF_RESOURCES;
+    }
+
+    if (err == CL_SUCCESS) {
+        cl_kernel kernel = runtime->kernels[OPENCL_KERNEL_RANDOM];
+        cl_ulong seed_arg = seed;
+        cl_ulong first_arg = first;
+        cl_ulong length_arg = length;
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &output_buffer);
+        clSetKernelArg(kernel, 1, sizeof(cl_ulong), &seed_arg);
+        clSetKernelArg(kernel, 2, sizeof(cl_ulong), &first_arg);
+        clSetKernelArg(kernel, 3, sizeof(cl_ulong), &length_arg);
+        clSetKernelArg(kernel, 4, sizeof(cl_mem), &thresholds);
+        clSetKernelArg(kernel, 5, sizeof(cl_mem), &buckets);
+
+        size_t pairs = (length + 1) / 2;
+        size_t items = (pairs + GPU_RANDOM_PAIRS_PER_ITEM - 1) / GPU_RANDOM_PAIRS_PER_ITEM;
+        size_t local_size = GPU_RANDOM_LOCAL_SIZE;
+        size_t global_size = ((items + local_size - 1) / local_size) * local_size;
+        err = clEnqueueNDRangeKernel(runtime->queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+    }
+
+    // The kernel keeps the tables alive until it has run
+    if (buckets) {
+        clReleaseMemObject(buckets);
+    }
+    if (thresholds) {
+        clReleaseMemObject(thresholds);
+    }
+    return err;
+}
+
+int gpu_random_bytes(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                     uint8_t* output, size_t length, double* time) {
+    if (time) {
+        *time = 0.0;
+    }
+    // The kernel starts at a pair boundary; an odd first byte is made here
+    if (first % 2 == 1 && length > 0) {
+        random_bytes(tables, seed, first, output, 1);
+        first++;
+        output++;
+        length--;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    // On a device sharing the host's memory the kernel writes straight into output
+    bool in_place = opencl_zero_copy(runtime, output);
+    cl_int err;
+    cl_mem output_buffer = clCreateBuffer(runtime->context, CL_MEM_WRITE_ONLY | (in_place ? CL_MEM_USE_HOST_PTR : 0),
+                                          length, in_place ? output : NULL, &err);
+
+    if (err == CL_SUCCESS) {
+        double start = wall_time();
+        err = enqueue_random(runtime, tables, seed, first, output_buffer, length);
+        if (err == CL_SUCCESS && in_place) {
+            // Mapping only makes the kernel's writes visible to the host, nothing is copied
+            void* mapped = clEnqueueMapBuffer(runtime->queue, output_buffer, CL_TRUE, CL_MAP_READ, 0, length,
+                                              0, NULL, NULL, &err);
+            if (err == CL_SUCCESS) {
+                err = clEnqueueUnmapMemObject(runtime->queue, output_buffer, mapped, 0, NULL, NULL);
+            }
+            if (err == CL_SUCCESS) {
+                err = clFinish(runtime->queue);
+            }
+        } else if (err == CL_SUCCESS) {
+            err = clEnqueueReadBuffer(runtime->queue, output_buffer, CL_TRUE, 0, length, output, 0, NULL, NULL);
+        }
+        if (err == CL_SUCCESS && time) {
+            *time = wall_time() - start;
+        }
+    }
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Random generation error: %d\n", err);
+    }
+
+    if (output_buffer) {
+        clReleaseMemObject(output_buffer);
+    }
+    return err == CL_SUCCESS ? 0 : -1;
+}
+
+int gpu_random_buffer(OpenCLRuntime* runtime, const RandomTables* tables, uint64_t seed, uint64_t first,
+                      cl_mem output_buffer, size_t length, double* time) {
+    if (time) {
+        *time = 0.0;
+    }
+    if (first % 2 == 1) {
+        fprintf(stderr, "Random generation error: odd first byte %llu\n", (unsigned long long)first);
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    double start = wall_time();
+    cl_int err = enqueue_random(runtime, tables, seed, first, output_buffer, length);
+    if (err == CL_SUCCESS) {
+        err = clFinish(runtime->queue);
+    }
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Random generation error: %d\n", err);
+        return -1;
+    }
+    if (time) {
+        *time = wall_time() - start;
+    }
+    return 0;
+}
@@ -4,72 +4,100 @@
 #include <stdbool.h>
 #include "huffman.h"
 
-#define MAX_INPUT_SIZE 100000000
+typedef struct SymbolFrequency {
+    uint64_t freq;
+    int symbol;
+} SymbolFrequency;
 
-static Node* nodes[256];
-static int nodeCount = 0;
+// Stable bottom-up merge sort by ascending frequency (ties by byte value), no heap allocation
+static void sortByFrequency(SymbolFrequency* items, int n) {
+    SymbolFrequency buffer[256];
+    SymbolFrequency* from = items;
+    SymbolFrequency* to = buffer;
 
-static void calculateFrequencies(const char* word, size_t length) {
-    int frequencies[256] = {0};
+    for (int width = 1; width < n; width *= 2) {
+        for (int begin = 0; begin < n; begin += 2 * width) {
+            int mid = begin + width < n ? begin + width : n;
+            int end = begin + 2 * width < n ? begin + 2 * width : n;
+            int i = begin, j = mid, k = begin;
 
-    for (size_t i = 0; i < length; i++) {
-        frequencies[(unsigned char)word[i]]++;
+            while (i < mid && j < end) {
+                to[k++] = from[j].freq < from[i].freq ? from[j++] : from[i++];
+            }
+            while (i < mid) to[k++] = from[i++];
+            while (j < end) to[k++] = from[j++];
+        }
+        SymbolFrequency* tmp = from;
+        from = to;
+        to = tmp;
     }
 
-    for (int i = 0; i < 256; i++) {
-        if (frequencies[i] > 0) {
-            nodes[nodeCount] = (Node*)malloc(sizeof(Node));
-            nodes[nodeCount]->charValue = (char)i;
-            nodes[nodeCount]->freq = frequencies[i];
-            nodes[nodeCount]->left = NULL;
-            nodes[nodeCount]->right = NULL;
-            nodeCount++;
-        }
+    if (from != items) {
+        memcpy(items, from, (size_t)n * sizeof(*items));
     }
 }
 
-static void insertionSort(Node* arr[], int n) {
-    for (int i = 1; i < n; i++) {
-        Node* key = arr[i];
-        int j = i - 1;
+Node* huffman_build_tree(const uint64_t freq[256], Node arena[HUFFMAN_MAX_NODES]) {
+    SymbolFrequency leaves[256];
+    int leafCount = 0;
 
-        while (j >= 0 && arr[j]->freq > key->freq) {
-            arr[j + 1] = arr[j];
-            j--;
+    for (int i = 0; i < 256; i++) {
+        if (freq[i] > 0) {
+            leaves[leafCount].freq = freq[i];
+            leaves[leafCount].symbol = i;
+            leafCount++;
         }
-        arr[j + 1] = key;
     }
-}
-
-static Node* buildHuffmanTree() {
-    while (nodeCount > 1) {
-        insertionSort(nodes, nodeCount);
+    if (leafCount == 0) {
+        return NULL;
+    }
+    sortByFrequency(leaves, leafCount);
 
-        Node* left = nodes[0];
-        Node* right = nodes[1];
+    for (int i = 0; i < leafCount; i++) {
+        arena[i].charValue = (char)leaves[i].symbol;
+        arena[i].freq = leaves[i].freq;
+        arena[i].left = NULL;
+        arena[i].right = NULL;
+    }
 
-        Node* merged = (Node*)malloc(sizeof(Node));
-        merged->charValue = '\0';
-        merged->freq = left->freq + right->freq;
-        merged->left = left;
-        merged->right = right;
+    // Two queues: the sorted leaves and the merged nodes, which are created in
+    // non-decreasing frequency order, so the two smallest are always at the fronts
+    int leafHead = 0;
+    int mergedHead = leafCount;
+    int mergedTail = leafCount;
 
-        for (int i = 2; i < nodeCount; i++) {
-            nodes[i - 2] = nodes[i];
+    while ((leafCount - leafHead) + (mergedTail - mergedHead) > 1) {
+        Node* pair[2];
+        for (int k = 0; k < 2; k++) {
+            if (mergedHead == mergedTail ||
+                (leafHead < leafCount && arena[leafHead].freq <= arena[mergedHead].freq)) {
+                pair[k] = &arena[leafHead++];
+            } else {
+                pair[k] = &arena[mergedHead++];
+            }
         }
-        nodeCount -= 2;
-        nodes[nodeCount++] = merged;
+
+        Node* merged = &arena[mergedTail++];
+        merged->charValue = '\0';
+        merged->freq = pair[0]->freq + pair[1]->freq;
+        merged->left = pair[0];
+        merged->right = pair[1];
     }
 
-    return nodes[0];
+    return mergedTail > leafCount ? &arena[mergedTail - 1] : &arena[0];
 }
 
-static void generateHuffmanCodes(Node* node, char* currentCode, int depth, char codes[256][256]) {
+static void generateHuffmanCodes(const Node* node, char* currentCode, int depth, char codes[256][256]) {
     if (node == NULL) return;
 
-    if (node->charValue != '\0' && node->left == NULL && node->right == NULL) {
-        strncpy(codes[(unsigned char)node->charValue], currentCode, depth);
+    if (node->left == NULL && node->right == NULL) {
+        // A lone symbol still needs one bit
+        if (depth == 0) {
+            currentCode[depth++] = '0';
+        }
+        memcpy(codes[(unsigned char)node->charValue], currentCode, depth);
         codes[(unsigned char)node->charValue][depth] = '\0';
+        return;
     }
 
     if (node->left) {
@@ -84,58 +112,676 @@ static void generateHuffmanCodes(Node* node, char* currentCode, int depth, char
 }
 
 void huffmanEncoding(const char* word, size_t length, char codes[256][256]) {
-    nodeCount = 0;
-    memset(nodes, 0, sizeof(nodes));
-    calculateFrequencies(word, length);
-    Node* root = buildHuffmanTree();
+    uint64_t freq[256] = {0};
+
+    for (size_t i = 0; i < length; i++) {
+        freq[(unsigned char)word[i]]++;
+    }
+    huffmanEncoding2(freq, codes);
+}
 
+void huffmanEncoding2(const uint64_t freq[256], char codes[256][256]) {
+    Node arena[HUFFMAN_MAX_NODES];
+    Node* root = huffman_build_tree(freq, arena);
     char currentCode[256];
     generateHuffmanCodes(root, currentCode, 0, codes);
 }
 
-void huffmanEncoding2(const int freq[256], char codes[256][256]) {
-    nodeCount = 0;
-    memset(nodes, 0, sizeof(nodes));
+static void collectCodeLengths(const Node* node, int depth, int lengths[256]) {
+    if (node->left == NULL && node->right == NULL) {
+        lengths[(unsigned char)node->charValue] = depth > 0 ? depth : 1;
+        return;
+    }
+    if (node->left) {
+        collectCodeLengths(node->left, depth + 1, lengths);
+    }
+    if (node->right) {
+        collectCodeLengths(node->right, depth + 1, lengths);
+    }
+}
+
+int huffman_limit_code_lengths(const uint64_t freq[256], int max_length, uint8_t lengths[256]) {
+    int optimal[256] = {0};
+    SymbolFrequency symbols[256];
+    int symbolCount = 0;
+
+    memset(lengths, 0, 256);
+    if (max_length < 1 || max_length > HUFFMAN_MAX_CODE_LENGTH) {
+        return -1;
+    }
 
     for (int i = 0; i < 256; i++) {
         if (freq[i] > 0) {
-            nodes[nodeCount] = (Node*)malloc(sizeof(Node));
-            nodes[nodeCount]->charValue = (char)i;
-            nodes[nodeCount]->freq = freq[i];
-            nodes[nodeCount]->left = NULL;
-            nodes[nodeCount]->right = NULL;
-            nodeCount++;
+            symbols[symbolCount].freq = freq[i];
+            symbols[symbolCount].symbol = i;
+            symbolCount++;
         }
     }
+    if (symbolCount == 0) {
+        return 0;
+    }
+    if (max_length < 31 && symbolCount > (1 << max_length)) {
+        return -1;
+    }
 
-    Node* root = buildHuffmanTree();
-    char currentCode[256];
-    generateHuffmanCodes(root, currentCode, 0, codes);
+    Node arena[HUFFMAN_MAX_NODES];
+    collectCodeLengths(huffman_build_tree(freq, arena), 0, optimal);
+
+    // Number of codes per length, everything deeper than the limit moved up to it
+    unsigned lengthCount[HUFFMAN_MAX_CODE_LENGTH + 1] = {0};
+    for (int i = 0; i < symbolCount; i++) {
+        int length = optimal[symbols[i].symbol];
+        lengthCount[length > max_length ? max_length : length]++;
+    }
+
+    // Kraft sum in units of 2^-max_length; while it exceeds 1 move a leaf from the
+    // limit level under a shorter one (the shorter leaf becomes an internal node)
+    uint64_t total = 0;
+    for (int length = max_length; length > 0; length--) {
+        total += (uint64_t)lengthCount[length] << (max_length - length);
+    }
+    while (total > ((uint64_t)1 << max_length)) {
+        lengthCount[max_length]--;
+        for (int length = max_length - 1; length > 0; length--) {
+            if (lengthCount[length] != 0) {
+                lengthCount[length]--;
+                lengthCount[length + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // Hand out the lengths again, the shortest ones to the most frequent bytes
+    sortByFrequency(symbols, symbolCount);
+    int next = symbolCount - 1;
+    for (int length = 1; length <= max_length; length++) {
+        for (unsigned j = 0; j < lengthCount[length]; j++) {
+            lengths[symbols[next--].symbol] = (uint8_t)length;
+        }
+    }
+    return 0;
+}
+
+int huffman_canonical_codes(const uint8_t lengths[256], HuffmanCode table[256]) {
+    unsigned lengthCount[HUFFMAN_MAX_CODE_LENGTH + 1] = {0};
+    uint64_t nextCode[HUFFMAN_MAX_CODE_LENGTH + 2];
+
+    for (int i = 0; i < 256; i++) {
+        if (lengths[i] > HUFFMAN_MAX_CODE_LENGTH) {
+            return -1;
+        }
+        lengthCount[lengths[i]]++;
+    }
+    lengthCount[0] = 0;
+
+    uint64_t code = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        table[i].length = lengths[i];
+        table[i].code = lengths[i] ? nextCode[lengths[i]]++ : 0;
+        if (lengths[i] && table[i].code >> lengths[i]) {
+            return -1; // oversubscribed
+        }
+    }
+    return 0;
+}
+
+int huffmanEncodingCanonical(const uint64_t freq[256], int max_length, HuffmanCode table[256]) {
+    uint8_t lengths[256];
+    if (huffman_limit_code_lengths(freq, max_length, lengths) != 0) {
+        return -1;
+    }
+    return huffman_canonical_codes(lengths, table);
+}
+
+int build_code_table(char codes[256][256], HuffmanCode table[256]) {
+    for (int i = 0; i < 256; i++) {
+        size_t length = strlen(codes[i]);
+        if (length > 64) {
+            return -1;
+        }
+
+        uint64_t code = 0;
+        for (size_t j = 0; j < length; j++) {
+            code = (code << 1) | (uint64_t)(codes[i][j] == '1');
+        }
+        table[i].code = code;
+        table[i].length = (uint8_t)length;
+    }
+    return 0;
 }
 
-void encode_input_with_huffman(const char* input, size_t input_len, char codes[256][256], char* output_bits, size_t* output_bit_len) {
-    size_t bit_index = 0;
+size_t huffman_encoded_bits(const uint64_t freq[256], const HuffmanCode table[256]) {
+    size_t bits = 0;
+    for (int i = 0; i < 256; i++) {
+        bits += (size_t)(freq[i] * table[i].length);
+    }
+    return bits;
+}
+
+// Bitstream writer: the pending bits are collected right-aligned in a 64-bit accumulator
+// and written out 32 bits at a time, most significant bit first.
+typedef struct BitWriter {
+    uint8_t* out;
+    uint64_t acc;
+    unsigned count;
+} BitWriter;
+
+static inline void store_be32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// count < 32 here, so a code of at most 32 bits always fits into the accumulator
+static inline void bitWriterPutShort(BitWriter* w, uint64_t code, unsigned length) {
+    w->acc = (w->acc << length) | code;
+    w->count += length;
+    if (w->count >= 32) {
+        w->count -= 32;
+        store_be32(w->out, (uint32_t)(w->acc >> w->count));
+        w->out += 4;
+    }
+}
+
+static inline void bitWriterPut(BitWriter* w, uint64_t code, unsigned length) {
+    if (length > 32) {
+        bitWriterPutShort(w, code >> 32, length - 32);
+        code &= 0xFFFFFFFFULL;
+        length = 32;
+    }
+    bitWriterPutShort(w, code, length);
+}
+
+// Write out the whole bytes and return the bits of the last partial byte, left-aligned
+static inline uint8_t bitWriterFinish(BitWriter* w) {
+    while (w->count >= 8) {
+        w->count -= 8;
+        *w->out++ = (uint8_t)(w->acc >> w->count);
+    }
+    uint8_t tail = w->count > 0 ? (uint8_t)(w->acc << (8 - w->count)) : 0;
+    w->count = 0;
+    return tail;
+}
+
+int huffman_encode_range(const char* input, size_t input_len, const HuffmanCode table[256],
+                         uint8_t* output, size_t bit_offset, size_t* bit_len, uint8_t* tail) {
+    // The bits ahead of bit_offset in the first byte start out as zeros in the accumulator
+    BitWriter writer = { output + (bit_offset >> 3), 0, (unsigned)(bit_offset & 7) };
+    size_t total_bits = 0;
+
     for (size_t i = 0; i < input_len; i++) {
-        unsigned char byte = (unsigned char)input[i];
-        const char* code = codes[byte];
+        const HuffmanCode* code = &table[(unsigned char)input[i]];
+        if (code->length == 0) {
+            *bit_len = total_bits;
+            return -1;
+        }
+        total_bits += code->length;
+        bitWriterPut(&writer, code->code, code->length);
+    }
+
+    *tail = bitWriterFinish(&writer);
+    *bit_len = total_bits;
+    return 0;
+}
+
+int encode_input_with_huffman(const char* input, size_t input_len, const HuffmanCode table[256], uint8_t* output, size_t* bit_len) {
+    uint8_t tail;
+    if (huffman_encode_range(input, input_len, table, output, 0, bit_len, &tail) != 0) {
+        return -1;
+    }
+    if (*bit_len & 7) {
+        output[*bit_len >> 3] = tail;
+    }
+    return 0;
+}
+
+static int insertTreeCode(HuffmanDecoder* decoder, int symbol, uint64_t code, unsigned length) {
+    int node = 0;
+    for (unsigned i = 0; i < length; i++) {
+        int bit = (int)((code >> (length - 1 - i)) & 1);
+        int16_t* child = &decoder->tree[node][bit];
+
+        if (i == length - 1) {
+            if (*child != 0) {
+                return -1;
+            }
+            *child = (int16_t)-(symbol + 1);
+            return 0;
+        }
+
+        if (*child < 0) {
+            return -1;
+        }
+        if (*child == 0) {
+            if (decoder->tree_size >= HUFFMAN_MAX_NODES) {
+                return -1;
+            }
+            decoder->tree[decoder->tree_size][0] = 0;
+            decoder->tree[decoder->tree_size][1] = 0;
+            *child = (int16_t)decoder->tree_size++;
+        }
+        node = *child;
+    }
+    return -1;
+}
+
+int huffman_decoder_init(HuffmanDecoder* decoder, const HuffmanCode table[256]) {
+    enum { TABLE_SIZE = 1 << HUFFMAN_DECODE_BITS };
+    uint8_t first_symbol[TABLE_SIZE];
+    uint8_t first_length[TABLE_SIZE] = {0};
 
-        if (code == NULL || code[0] == '\0') {
-            printf("[ERROR] Missing Huffman code for byte %d (char: '%c')\n", byte, byte);
+    decoder->tree[0][0] = 0;
+    decoder->tree[0][1] = 0;
+    decoder->tree_size = 1;
+
+    for (int i = 0; i < 256; i++) {
+        unsigned length = table[i].length;
+        if (length == 0) {
             continue;
-            //return 1;
         }
+        if (length > HUFFMAN_DECODE_MAX_CODE_LENGTH || insertTreeCode(decoder, i, table[i].code, length) != 0) {
+            return -1;
+        }
+
+        if (length <= HUFFMAN_DECODE_BITS) {
+            unsigned shift = HUFFMAN_DECODE_BITS - length;
+            size_t first = (size_t)table[i].code << shift;
+            for (size_t j = 0; j < ((size_t)1 << shift); j++) {
+                first_symbol[first + j] = (uint8_t)i;
+                first_length[first + j] = (uint8_t)length;
+            }
+        }
+    }
 
-        for (int j = 0; code[j] != '\0'; j++) {
-            output_bits[bit_index++] = code[j];
+    // Every entry takes as many whole codes as fit into its index bits
+    for (size_t index = 0; index < TABLE_SIZE; index++) {
+        HuffmanDecodeEntry* entry = &decoder->table[index];
+        unsigned used = 0;
 
-            if (bit_index >= MAX_INPUT_SIZE * 20 - 1) {
-                printf("[WARN] Output bitstream buffer full!\n");
+        memset(entry, 0, sizeof(*entry));
+        while (entry->count < HUFFMAN_DECODE_SYMBOLS) {
+            size_t next = (index << used) & (TABLE_SIZE - 1);
+            unsigned length = first_length[next];
+            if (length == 0 || used + length > HUFFMAN_DECODE_BITS) {
                 break;
             }
+            entry->symbols[entry->count++] = first_symbol[next];
+            used += length;
+        }
+        entry->bits = (uint8_t)used;
+    }
+    return 0;
+}
+
+static inline uint64_t load_be64(const uint8_t* p) {
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+// Next 57+ bits of the stream starting at bit_pos, left-aligned and zero padded past the end
+static inline uint64_t peekBits(const uint8_t* input, size_t input_bytes, size_t bit_pos) {
+    size_t byte = bit_pos >> 3;
+    uint64_t window = 0;
+
+    if (byte + 8 <= input_bytes) {
+        window = load_be64(input + byte);
+    } else {
+        for (size_t i = 0; i < 8; i++) {
+            window = (window << 8) | (byte + i < input_bytes ? input[byte + i] : 0);
+        }
+    }
+    return window << (bit_pos & 7);
+}
+
+// Walk the code tree for one symbol, returns the byte or -1
+static int decodeSlow(const HuffmanDecoder* decoder, uint64_t window, unsigned* length) {
+    int node = 0;
+    for (unsigned n = 1; n <= HUFFMAN_DECODE_MAX_CODE_LENGTH; n++) {
+        int next = decoder->tree[node][window >> 63];
+        window <<= 1;
+        if (next < 0) {
+            *length = n;
+            return -next - 1;
+        }
+        if (next == 0) {
+            return -1;
+        }
+        node = next;
+    }
+    return -1;
+}
+
+int huffman_decode_from(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len,
+                        size_t* position, uint8_t* output, size_t output_len) {
+    const size_t input_bytes = (bit_len + 7) / 8;
+    size_t bit_pos = *position;
+    size_t out = 0;
+
+    // Fast path: one 64-bit load serves four table lookups (4 * 11 bits <= 57 bits). The window
+    // shifts by the bits of each entry, so a lookup waits for one shift and one load only. An entry
+    // without symbols consumes no bits: the lookups after it repeat it, and the long code is left
+    // to the tree walk
+    while (out + 4 * HUFFMAN_DECODE_SYMBOLS <= output_len && (bit_pos >> 3) + 8 <= input_bytes) {
+        uint64_t window = load_be64(input + (bit_pos >> 3)) << (bit_pos & 7);
+
+        for (int lookup = 0; lookup < 4; lookup++) {
+            const HuffmanDecodeEntry* entry = &decoder->table[window >> (64 - HUFFMAN_DECODE_BITS)];
+            memcpy(output + out, entry->symbols, HUFFMAN_DECODE_SYMBOLS);
+            out += entry->count;
+            bit_pos += entry->bits;
+            window <<= entry->bits;
+        }
+
+        // The lookups may have used up to 44 bits of the window, too many for a long code: reload it
+        if (decoder->table[window >> (64 - HUFFMAN_DECODE_BITS)].count == 0 && out < output_len) {
+            unsigned length;
+            int symbol = decodeSlow(decoder, peekBits(input, input_bytes, bit_pos), &length);
+            if (symbol < 0) {
+                return -1;
+            }
+            output[out++] = (uint8_t)symbol;
+            bit_pos += length;
+        }
+    }
+
+    // Tail: one symbol at a time with bounds checks
+    while (out < output_len) {
+        unsigned length;
+        int symbol = decodeSlow(decoder, peekBits(input, input_bytes, bit_pos), &length);
+        if (symbol < 0 || bit_pos + length > bit_len) {
+            return -1;
+        }
+        output[out++] = (uint8_t)symbol;
+        bit_pos += length;
+    }
+
+    *position = bit_pos;
+    return bit_pos <= bit_len ? 0 : -1;
+}
+
+int huffman_decode(const HuffmanDecoder* decoder, const uint8_t* input, size_t bit_len, uint8_t* output, size_t output_len) {
+    size_t position = 0;
+    return huffman_decode_from(decoder, input, bit_len, &position, output, output_len);
+}
+
+size_t huffman_streams_size(size_t bit_len, int stream_count) {
+    // Every stream pads at most 7 bits
+    return 4 * (size_t)stream_count + (bit_len + 7) / 8 + (size_t)stream_count;
+}
+
+static inline size_t segmentBegin(size_t length, int segment, int count) {
+    return (size_t)((uint64_t)length * (uint64_t)segment / (uint64_t)count);
+}
+
+static inline void storeLe32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t loadLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_be64(uint8_t* p, uint64_t value) {
+    store_be32(p, (uint32_t)(value >> 32));
+    store_be32(p + 4, (uint32_t)value);
+}
+
+// Branchless form for the interleaved encoder: the whole bytes are stored after every code and
+// fewer than 8 bits stay pending. It stores 8 bytes at a time, so it needs 8 bytes of room.
+static inline void bitWriterPutFast(BitWriter* w, uint64_t code, unsigned length) {
+    w->acc = (w->acc << length) | code;
+    w->count += length;
+    store_be64(w->out, w->acc << (64 - w->count));
+    w->out += w->count >> 3;
+    w->count &= 7;
+}
+
+// The first shortest bytes of every segment, a byte of each in turn, as long as the writers
+// have room for the branchless stores (a round adds at most max_length bits to a stream, at most
+// 32). The common counts are passed as constants, so the loop over the streams is unrolled and
+// the writers are kept in registers. Returns the number of bytes done per segment.
+static inline size_t encodeRoundRobin(const uint8_t* input, const size_t* begin, size_t shortest,
+                                      const HuffmanCode table[256], unsigned max_length, BitWriter* writers,
+                                      uint8_t* const* ends, int count) {
+    BitWriter local[HUFFMAN_MAX_STREAMS];
+    size_t position = 0;
+    memcpy(local, writers, count * sizeof(*writers));
+    while (position < shortest) {
+        size_t rounds = shortest - position;
+        for (int s = 0; s < count; s++) {
+            size_t room = (size_t)(ends[s] - local[s].out);
+            size_t safe = room > 8 ? (room - 8) * 8 / max_length : 0;
+            rounds = safe < rounds ? safe : rounds;
+        }
+        if (rounds == 0) {
+            break;
+        }
+        for (size_t i = position; i < position + rounds; i++) {
+            for (int s = 0; s < count; s++) {
+                const HuffmanCode* code = &table[input[begin[s] + i]];
+                bitWriterPutFast(&local[s], code->code, code->length);
+            }
+        }
+        position += rounds;
+    }
+    memcpy(writers, local, count * sizeof(*writers));
+    return position;
+}
+
+int huffman_encode_streams(const uint8_t* input, size_t input_len, const HuffmanCode table[256], int stream_count,
+                           uint8_t* output, size_t* output_size) {
+    if (stream_count < 1 || stream_count > HUFFMAN_MAX_STREAMS) {
+        return -1;
+    }
+
+    // The exact length of every stream first, so they can be written side by side in one pass
+    size_t begin[HUFFMAN_MAX_STREAMS + 1];
+    uint64_t bits[HUFFMAN_MAX_STREAMS];
+    BitWriter writers[HUFFMAN_MAX_STREAMS];
+    uint8_t* out = output + 4 * stream_count;
+    for (int s = 0; s <= stream_count; s++) {
+        begin[s] = segmentBegin(input_len, s, stream_count);
+    }
+    unsigned max_length = 0;
+    for (int i = 0; i < 256; i++) {
+        max_length = table[i].length > max_length ? table[i].length : max_length;
+    }
+    for (int s = 0; s < stream_count; s++) {
+        bits[s] = 0;
+        for (size_t i = begin[s]; i < begin[s + 1]; i++) {
+            unsigned length = table[input[i]].length;
+            if (length == 0) {
+                return -1;
+            }
+            bits[s] += length;
+        }
+        if (bits[s] > UINT32_MAX) {
+            return -1;
         }
+        storeLe32(output + 4 * s, (uint32_t)bits[s]);
+        writers[s] = (BitWriter){ out, 0, 0 };
+        out += (bits[s] + 7) / 8;
     }
 
-    output_bits[bit_index] = '\0';
-    *output_bit_len = bit_index;
-    //printf("[DEBUG] Huffman bitstream length: %zu\n", bit_index);
+    // Round robin over the streams: each writer is an independent dependency chain
+    size_t shortest = begin[1] - begin[0];
+    for (int s = 1; s < stream_count; s++) {
+        if (begin[s + 1] - begin[s] < shortest) {
+            shortest = begin[s + 1] - begin[s];
+        }
+    }
+    uint8_t* ends[HUFFMAN_MAX_STREAMS];
+    for (int s = 0; s < stream_count; s++) {
+        ends[s] = s + 1 < stream_count ? writers[s + 1].out : out;
+    }
+    size_t done = 0;
+    switch (max_length == 0 || max_length > 32 ? 0 : stream_count) {
+    case 0:
+        break;  // no input, or long codes: every stream on its own below
+    case 2:
+        done = encodeRoundRobin(input, begin, shortest, table, max_length, writers, ends, 2);
+        break;
+    case 4:
+        done = encodeRoundRobin(input, begin, shortest, table, max_length, writers, ends, 4);
+        break;
+    case 8:
+        done = encodeRoundRobin(input, begin, shortest, table, max_length, writers, ends, 8);
+        break;
+    default:
+        done = encodeRoundRobin(input, begin, shortest, table, max_length, writers, ends, stream_count);
+        break;
+    }
+
+    // The ends of the streams, where the branchless stores would run into the next stream
+    for (int s = 0; s < stream_count; s++) {
+        for (size_t i = begin[s] + done; i < begin[s + 1]; i++) {
+            const HuffmanCode* code = &table[input[i]];
+            bitWriterPut(&writers[s], code->code, code->length);
+        }
+        uint8_t tail = bitWriterFinish(&writers[s]);
+        if (bits[s] & 7) {
+            *writers[s].out = tail;
+        }
+    }
+
+    *output_size = (size_t)(out - output);
+    return 0;
+}
+
+// Read position of one stream of the interleaved form
+typedef struct StreamReader {
+    const uint8_t* input;
+    size_t input_bytes;
+    size_t bit_len;
+    size_t position;
+    uint8_t* out;
+    uint8_t* end;
+} StreamReader;
+
+// Room for a whole round of the fast path (up to 4 table entries and a slow symbol) in every stream
+static inline bool streamsHaveRoom(const StreamReader* readers, int count) {
+    for (int s = 0; s < count; s++) {
+        const StreamReader* r = &readers[s];
+        if ((size_t)(r->end - r->out) < 4 * HUFFMAN_DECODE_SYMBOLS + 1 || (r->position >> 3) + 8 > r->input_bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fast path as in huffman_decode_from, with the lookups of the streams side by side: a lookup
+// waits for the one before it in the same stream only. Constant counts unroll the stream loops as
+// in encodeRoundRobin, and the windows, positions and output pointers of a round stay in registers
+// (stores through the byte output could alias the readers). Returns 0, or -1 on a corrupt code.
+static inline int decodeRoundRobin(const HuffmanDecoder* decoder, StreamReader* readers, int count) {
+    while (streamsHaveRoom(readers, count)) {
+        uint64_t window[HUFFMAN_MAX_STREAMS];
+        size_t position[HUFFMAN_MAX_STREAMS];
+        uint8_t* out[HUFFMAN_MAX_STREAMS];
+        for (int s = 0; s < count; s++) {
+            const StreamReader* r = &readers[s];
+            window[s] = load_be64(r->input + (r->position >> 3)) << (r->position & 7);
+            position[s] = r->position;
+            out[s] = r->out;
+        }
+
+        for (int lookup = 0; lookup < 4; lookup++) {
+            for (int s = 0; s < count; s++) {
+                const HuffmanDecodeEntry* entry = &decoder->table[window[s] >> (64 - HUFFMAN_DECODE_BITS)];
+                memcpy(out[s], entry->symbols, HUFFMAN_DECODE_SYMBOLS);
+                out[s] += entry->count;
+                position[s] += entry->bits;
+                window[s] <<= entry->bits;
+            }
+        }
+
+        for (int s = 0; s < count; s++) {
+            StreamReader* r = &readers[s];
+            r->position = position[s];
+            r->out = out[s];
+            if (decoder->table[window[s] >> (64 - HUFFMAN_DECODE_BITS)].count == 0) {
+                unsigned length;
+                int symbol = decodeSlow(decoder, peekBits(r->input, r->input_bytes, r->position), &length);
+                if (symbol < 0) {
+                    return -1;
+                }
+                *r->out++ = (uint8_t)symbol;
+                r->position += length;
+            }
+        }
+    }
+    return 0;
+}
+
+int huffman_decode_streams(const HuffmanDecoder* decoder, const uint8_t* input, size_t input_size, int stream_count,
+                           uint8_t* output, size_t output_len) {
+    if (stream_count < 1 || stream_count > HUFFMAN_MAX_STREAMS || input_size < 4 * (size_t)stream_count) {
+        return -1;
+    }
+
+    StreamReader readers[HUFFMAN_MAX_STREAMS];
+    const uint8_t* data = input + 4 * stream_count;
+    size_t left = input_size - 4 * stream_count;
+    for (int s = 0; s < stream_count; s++) {
+        StreamReader* r = &readers[s];
+        r->bit_len = loadLe32(input + 4 * s);
+        r->input_bytes = (r->bit_len + 7) / 8;
+        if (r->input_bytes > left) {
+            return -1;
+        }
+        r->input = data;
+        r->position = 0;
+        r->out = output + segmentBegin(output_len, s, stream_count);
+        r->end = output + segmentBegin(output_len, s + 1, stream_count);
+        data += r->input_bytes;
+        left -= r->input_bytes;
+    }
+    if (left != 0) {
+        return -1;
+    }
+
+    int rc = 0;
+    switch (stream_count) {
+    case 1:
+        break;  // huffman_decode_from below is the single stream decoder
+    case 2:
+        rc = decodeRoundRobin(decoder, readers, 2);
+        break;
+    case 4:
+        rc = decodeRoundRobin(decoder, readers, 4);
+        break;
+    case 8:
+        // Two groups of four: eight windows, positions and output pointers do not fit the registers
+        rc = decodeRoundRobin(decoder, readers, 4);
+        if (rc == 0) {
+            rc = decodeRoundRobin(decoder, readers + 4, 4);
+        }
+        break;
+    default:
+        rc = decodeRoundRobin(decoder, readers, stream_count);
+        break;
+    }
+    if (rc != 0) {
+        return -1;
+    }
+
+    // The rest of every stream on its own, with bounds checks; each has to end at its bit count
+    for (int s = 0; s < stream_count; s++) {
+        StreamReader* r = &readers[s];
+        if (huffman_decode_from(decoder, r->input, r->bit_len, &r->position, r->out, (size_t)(r->end - r->out)) != 0 ||
+            r->position != r->bit_len) {
+            return -1;
+        }
+    }
+    return 0;
 }
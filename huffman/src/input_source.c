@@ -0,0 +1,151 @@
+#include "input_source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int read_source(InputSource* source, const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    size_t capacity = 1 << 20;
+    size_t used = 0;
+    uint8_t* data = malloc(capacity);
+    while (data) {
+        used += fread(data + used, 1, capacity - used, fp);
+        if (used < capacity) {
+            break;
+        }
+        uint8_t* grown = realloc(data, capacity * 2);
+        if (!grown) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = grown;
+        capacity *= 2;
+    }
+
+    if (data && ferror(fp)) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+
+    if (!data) {
+        return -1;
+    }
+    source->data = data;
+    source->size = used;
+    source->mapped = 0;
+    return 0;
+}
+
+#ifdef _WIN32
+static int map_source(InputSource* source, const char* path) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return -1;
+    }
+
+    source->size = (size_t)size.QuadPart;
+    source->mapped = 1;
+    if (source->size == 0) {
+        CloseHandle(file);
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return -1;
+    }
+    source->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!source->data) {
+        CloseHandle(mapping);
+        return -1;
+    }
+    source->handle = mapping;
+    return 0;
+}
+#else
+static int map_source(InputSource* source, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    source->size = (size_t)info.st_size;
+    source->mapped = 1;
+    if (source->size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    // Aggressive read-ahead, and huge pages behind the mapping where the kernel supports them
+    madvise(data, source->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(data, source->size, MADV_HUGEPAGE);
+#endif
+    source->data = data;
+    return 0;
+}
+#endif
+
+int input_source_open(InputSource* source, const char* path, int use_mmap) {
+    source->data = NULL;
+    source->size = 0;
+    source->mapped = 0;
+    source->handle = NULL;
+    return use_mmap ? map_source(source, path) : read_source(source, path);
+}
+
+void input_source_close(InputSource* source) {
+    if (source->mapped) {
+#ifdef _WIN32
+        if (source->data) {
+            UnmapViewOfFile(source->data);
+        }
+        if (source->handle) {
+            CloseHandle(source->handle);
+        }
+#else
+        if (source->data) {
+            munmap((void*)source->data, source->size);
+        }
+#endif
+    } else {
+        free((void*)source->data);
+    }
+    source->data = NULL;
+    source->size = 0;
+}
@@ -1,9 +1,27 @@
-#include "kernel_loader.h"
 #include "huffman.h"
+#include "parallel_encode.h"
+#include "block_index.h"
+#include "stream.h"
+#include "pipeline.h"
+#include "daemon.h"
+#include "crc32c.h"
+#include "input_source.h"
+#include "opencl_runtime.h"
+#include "gpu_encode.h"
+#include "gpu_histogram.h"
+#include "gpu_random.h"
+#include "gpu_multi.h"
+#include "context_model.h"
+#include "cpu_histogram.h"
+#include "random_bytes.h"
+#include "dispatch.h"
+#include "bench.h"
+#include "platform.h"
 
 #define CL_TARGET_OPENCL_VERSION 220
 
 #include <CL/cl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,17 +30,35 @@
 #include <math.h>
 #include <stdint.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 int  manual(int input_size);
-int  test(size_t input_size, FILE *f_gen, FILE *f_freq, FILE *f_comp);
+int  test(OpenCLRuntime* runtime, size_t input_size, FILE *f_gen, FILE *f_freq, FILE *f_hist, FILE *f_comp, FILE *f_par, FILE *f_idx, FILE *f_src, FILE *f_ctx, FILE *f_zc, FILE *f_dev, FILE *f_cnt, FILE *f_ms, FILE *f_pipe);
 int  exponential(double start, double end, int n, size_t *out);
+int  benchmark(int warmup, int repetitions, size_t max_size);
+void daemon_latency_comparison(OpenCLRuntime* runtime, Dispatcher* dispatcher, FILE* f_dmn);
+void long_code_round_trip(FILE* f_long);
 
 #define MAX_INPUT_SIZE 100000000 // max 100000000
-#define CHUNK_SIZE 1024
+#define BENCH_SIZE_COUNT 8        // input sizes of the benchmark, exponential from BENCH_MIN_SIZE
+#define BENCH_MIN_SIZE 1024
+#define MULTI_DEVICE_SIZE_COUNT 6  // input sizes of the multi-device comparison, exponential from 1 MiB
+#define SYNTHETIC_DEFAULT_SIZE ((uint64_t)16 << 30)  // synthetic load, more than most devices hold
+#define DAEMON_TEST_SOCKET "output/daemon_test.sock"
+#define DAEMON_TEST_SIZE_COUNT 4    // request sizes of the daemon test, 1 KiB times powers of 16
+#define DECOMPRESS_WINDOW_SIZE (64 << 20)  // indexed decompression: uncompressed bytes decoded per round
+#define CONTAINER_RANDOM_ACCESS_SIZE 4096   // bytes read from the middle of a container in test mode
+#define LONG_CODE_SYMBOLS 34                // Fibonacci frequencies of this many bytes need 33-bit codes unlimited
+#define LONG_CODE_INPUT_SIZE (1 << 16)
+#define DECODE_TARGET_GBS 1.0               // decode throughput goal per core, met or missed in multi_stream_results
 
 int mode() {
     char mode[16];
     while (1) {
-        printf("Select mode [manual/test]: ");
+        printf("Select mode [manual/test/bench]: ");
         if (scanf("%15s", mode) != 1) {
             int c; while ((c = getchar()) != '\n' && c != EOF) {}
             continue;
@@ -32,19 +68,81 @@ int mode() {
         if (strcmp(mode, "manual") == 0) {
             return manual(MAX_INPUT_SIZE);
 
+        } else if (strcmp(mode, "bench") == 0) {
+            return benchmark(BENCH_DEFAULT_WARMUP, BENCH_DEFAULT_REPETITIONS, MAX_INPUT_SIZE);
+
         } else if (strcmp(mode, "test") == 0) {
 
             FILE *f_gen  = fopen("output/generation_results.txt", "w");
             FILE *f_freq = fopen("output/byte_frequencies_results.txt", "w");
+            FILE *f_hist = fopen("output/histogram_kernel_results.txt", "w");
             FILE *f_comp = fopen("output/compression_results.txt", "w");
-            if (!f_gen || !f_freq || !f_comp) {
+            FILE *f_par  = fopen("output/parallel_encode_results.txt", "w");
+            FILE *f_idx  = fopen("output/block_index_results.txt", "w");
+            FILE *f_src  = fopen("output/input_source_results.txt", "w");
+            FILE *f_init = fopen("output/startup_results.txt", "w");
+            FILE *f_disp = fopen("output/dispatch_results.txt", "w");
+            FILE *f_ctx  = fopen("output/context_model_results.txt", "w");
+            FILE *f_zc   = fopen("output/zero_copy_results.txt", "w");
+            FILE *f_dev  = fopen("output/device_pipeline_results.txt", "w");
+            FILE *f_cnt  = fopen("output/container_results.txt", "w");
+            FILE *f_ms   = fopen("output/multi_stream_results.txt", "w");
+            FILE *f_pipe = fopen("output/pipeline_results.txt", "w");
+            FILE *f_dmn  = fopen("output/daemon_results.txt", "w");
+            FILE *f_long = fopen("output/long_code_results.txt", "w");
+            if (!f_gen || !f_freq || !f_hist || !f_comp || !f_par || !f_idx || !f_src || !f_init || !f_disp || !f_ctx ||
+                !f_zc || !f_dev || !f_cnt || !f_ms || !f_pipe || !f_dmn || !f_long) {
                 perror("Failed to open result files");
                 return 1;
             }
 
-            fprintf(f_gen,  "Size,SeqGenTime,OpenCLGenTime\n");
-            fprintf(f_freq, "Size,SeqFreqTime,OpenCLFreqTime\n");
-            fprintf(f_comp, "Size,CompressionRatio%%\n");
+            fprintf(f_gen,  "Size,SeqGenTime,ParallelGenTime,OpenCLGenTime,Identical,EdgeValues\n");
+            fprintf(f_freq, "Size,SeqFreqTime,OpenCLFreqTime,CpuFreqTime,OpenCLTransferTime,OpenCLWallTime,"
+                            "InterleavedFreqTime,CpuPath,SeqGBs,InterleavedGBs,CpuGBs\n");
+            fprintf(f_hist, "Size,Input,AtomicKernelTime,VectorKernelTime,Speedup,Identical\n");
+            fprintf(f_comp, "Size,CompressionRatio%%,Limit11Ratio%%,Limit12Ratio%%,Limit15Ratio%%,EncodeTime,DecodeTime,RoundTrip,OpenCLEncodeTime,OpenCLIdentical\n");
+            fprintf(f_par,  "Size,Threads,EncodeTime,Speedup,Identical\n");
+            fprintf(f_idx,  "Size,BlockSize,IndexOverhead%%,SerialDecodeTime,ParallelDecodeTime,RangeDecodeTime,RoundTrip\n");
+            fprintf(f_src,  "Size,Method,OpenTime,FirstOutputTime,TotalTime,RSSGrowthMB\n");
+            fprintf(f_init, "Startup,Time,CachedPrograms\n");
+            fprintf(f_disp, "Size,Operation,Cpu,CpuParallel,OpenCL,Best\n");
+            fprintf(f_ctx,  "Size,Input,Order0Ratio,Order1Ratio,Tables,ModelBytes,PairHistTime,OpenCLPairHistTime,PairIdentical,"
+                            "Order0CompressMBs,Order1CompressMBs,Order0DecodeMBs,Order1DecodeMBs,RoundTrip\n");
+            fprintf(f_zc,   "Size,ZeroCopy,CopyGenTime,ZeroCopyGenTime,CopyHistTime,ZeroCopyHistTime,CopyUploadTime,"
+                            "ZeroCopyUploadTime,Identical\n");
+            fprintf(f_dev,  "Size,HostRoundTripTime,DeviceResidentTime,FusedTime,DeviceEncodeTime,HistIdentical,EncodeIdentical\n");
+            fprintf(f_cnt,  "Size,EncodeTime,Crc32cTime,Crc32cPortableTime,ChecksumShare%%,StreamDecodeTime,ParallelDecodeTime,"
+                            "RandomAccessTime,Identical\n");
+            fprintf(f_ms,   "Size,Streams,EncodeTime,DecodeTime,DecodeSpeedup,ExtraBytes,DecodeGBs,TargetMet,Identical\n");
+            fprintf(f_pipe, "Size,Threads,SerialTime,PipelineTime,Speedup,ReadUtil%%,HistogramUtil%%,EncodeUtil%%,WriteUtil%%,"
+                            "HistogramQueueMean,EncodeQueueMean,WriteQueueMean,PoolMB,Identical\n");
+            fprintf(f_dmn,  "Size,Operation,Requests,P50,P99,Max,PerProcessStartup,Failures\n");
+            fprintf(f_long, "MaxLength,Streams,RoundTrip\n");
+
+            // Cold start compiles every program and refills the binary cache, the warm start loads it.
+            // The warm runtime is shared by all sizes below.
+            OpenCLRuntime runtime;
+            if (opencl_runtime_init(&runtime, OPENCL_RUNTIME_CACHE_DIR, true) != 0) {
+                return 1;
+            }
+            double time_cold = runtime.startup_time;
+            opencl_runtime_release(&runtime);
+            if (opencl_runtime_init(&runtime, OPENCL_RUNTIME_CACHE_DIR, false) != 0) {
+                return 1;
+            }
+            printf("OpenCL startup time: cold %.4f sec, warm %.4f sec (%d/%d programs from cache)\n",
+                   time_cold, runtime.startup_time, runtime.cached_programs, OPENCL_PROGRAM_COUNT);
+            fprintf(f_init, "cold,%.6f,0\n", time_cold);
+            fprintf(f_init, "warm,%.6f,%d\n", runtime.startup_time, runtime.cached_programs);
+
+            // Calibration of the dispatcher: its crossover points are stored for manual mode and library callers
+            Dispatcher dispatcher;
+            dispatcher_init(&dispatcher, &runtime, NULL);
+            if (dispatch_calibrate(&dispatcher, f_disp) == 0) {
+                dispatch_profile_save(&dispatcher.profile, DISPATCH_PROFILE_PATH);
+            }
+            dispatch_print_profile(&dispatcher, stdout);
+            long_code_round_trip(f_long);
 
             int n = 100;
             double start = 100.0;
@@ -63,14 +161,30 @@ int mode() {
 
             for (int i = 0; i < n; ++i) {
                 printf("  [%2d] %zu\n", i, exp[i]);
-                test(exp[i], f_gen, f_freq, f_comp);
+                test(&runtime, exp[i], f_gen, f_freq, f_hist, f_comp, f_par, f_idx, f_src, f_ctx, f_zc, f_dev, f_cnt, f_ms, f_pipe);
             }
 
             free(exp);
+            daemon_latency_comparison(&runtime, &dispatcher, f_dmn);
+            opencl_runtime_release(&runtime);
 
             fclose(f_gen);
             fclose(f_freq);
+            fclose(f_hist);
             fclose(f_comp);
+            fclose(f_par);
+            fclose(f_idx);
+            fclose(f_src);
+            fclose(f_init);
+            fclose(f_disp);
+            fclose(f_ctx);
+            fclose(f_zc);
+            fclose(f_dev);
+            fclose(f_cnt);
+            fclose(f_ms);
+            fclose(f_pipe);
+            fclose(f_dmn);
+            fclose(f_long);
             return 0;
         }
 
@@ -89,39 +203,1104 @@ int exponential(double start, double end, int n, size_t *out) {
     return 0;
 }
 
-void generate_random_seq(unsigned char *output, uint64_t length) {
-    const uint64_t a = 1664525ULL;
-    const uint64_t c = 1013904223ULL;
-    cl_ulong seed = (cl_ulong)time(NULL);
-    
-    for (uint64_t i = 0; i < length; ++i) {;
-        uint64_t local_seed = seed ^ (i * 0x5DEECE66DULL + 0xBULL);
-        for (int j = 0; j < 10; ++j) {
-            local_seed = a * local_seed + c;
+// The generator maps the smallest and largest uniform values to 1 and 254, and both sides of
+// every threshold to the bytes it separates
+bool random_edge_values_check(const RandomTables* tables) {
+    if (random_byte_of(tables, 0) != 1 || random_byte_of(tables, UINT32_MAX) != 254) {
+        return false;
+    }
+    for (int k = 1; k < 254; k++) {
+        uint32_t threshold = tables->thresholds[k];
+        if (random_byte_of(tables, threshold - 1) != k || random_byte_of(tables, threshold) != k + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decode the bitstream again and compare it with the original input
+bool verify_round_trip(const char* input, size_t input_len, const HuffmanCode table[256],
+                       const uint8_t* encoded, size_t bit_len, double* decode_time) {
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    uint8_t* decoded = malloc(input_len + 1);
+    bool ok = false;
+
+    if (decoder && decoded && huffman_decoder_init(decoder, table) == 0) {
+        double start = wall_time();
+        int rc = huffman_decode(decoder, encoded, bit_len, decoded, input_len);
+        *decode_time = wall_time() - start;
+        ok = rc == 0 && memcmp(decoded, input, input_len) == 0;
+    }
+
+    free(decoder);
+    free(decoded);
+    return ok;
+}
+
+// Round trip with canonical codes of every length limit above the lookup table width, up to
+// HUFFMAN_MAX_CODE_LENGTH, in one bitstream and in 2, 4 and 8 sub-streams: most bytes get 4-7 bit
+// codes that fill the lookup entries, so the long codes come right after several lookups of the same window
+void long_code_round_trip(FILE* f_long) {
+    uint64_t freq[256] = {0};
+    uint64_t a = 1, b = 1;
+    for (int i = 0; i < LONG_CODE_SYMBOLS; i++) {
+        freq[i] = a;
+        uint64_t next = a + b;
+        a = b;
+        b = next;
+    }
+
+    size_t max_bits = (size_t)LONG_CODE_INPUT_SIZE * HUFFMAN_MAX_CODE_LENGTH;
+    char* input = malloc(LONG_CODE_INPUT_SIZE);
+    uint8_t* encoded = malloc(huffman_streams_size(max_bits, HUFFMAN_MAX_STREAMS));
+    uint8_t* decoded = malloc(LONG_CODE_INPUT_SIZE);
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    if (!input || !encoded || !decoded || !decoder) {
+        fprintf(stderr, "Memory allocation failed for the long code round trip!\n");
+        free(input);
+        free(encoded);
+        free(decoded);
+        free(decoder);
+        return;
+    }
+    for (size_t i = 0; i < LONG_CODE_INPUT_SIZE; i++) {
+        uint32_t r = (uint32_t)(i * 2654435761u) >> 7;
+        input[i] = (char)(r % 5 ? LONG_CODE_SYMBOLS - 3 - (r / 5) % 6 : (r / 5) % LONG_CODE_SYMBOLS);
+    }
+
+    for (int max_length = HUFFMAN_DECODE_BITS + 1; max_length <= HUFFMAN_MAX_CODE_LENGTH; max_length++) {
+        HuffmanCode table[256];
+        size_t bit_len = 0;
+        double time_decode;
+        bool ok = huffmanEncodingCanonical(freq, max_length, table) == 0 &&
+                  encode_input_with_huffman(input, LONG_CODE_INPUT_SIZE, table, encoded, &bit_len) == 0 &&
+                  verify_round_trip(input, LONG_CODE_INPUT_SIZE, table, encoded, bit_len, &time_decode);
+        fprintf(f_long, "%d,1,%s\n", max_length, ok ? "OK" : "FAILED");
+        if (!ok) {
+            printf("Round trip with %d-bit codes FAILED\n", max_length);
+        }
+
+        for (int streams = 2; streams <= HUFFMAN_MAX_STREAMS; streams *= 2) {
+            size_t size = 0;
+            memset(decoded, 0, LONG_CODE_INPUT_SIZE);
+            ok = huffmanEncodingCanonical(freq, max_length, table) == 0 && huffman_decoder_init(decoder, table) == 0 &&
+                 huffman_encode_streams((const uint8_t*)input, LONG_CODE_INPUT_SIZE, table, streams, encoded, &size) == 0 &&
+                 huffman_decode_streams(decoder, encoded, size, streams, decoded, LONG_CODE_INPUT_SIZE) == 0 &&
+                 memcmp(decoded, input, LONG_CODE_INPUT_SIZE) == 0;
+            fprintf(f_long, "%d,%d,%s\n", max_length, streams, ok ? "OK" : "FAILED");
+            if (!ok) {
+                printf("Round trip with %d-bit codes in %d streams FAILED\n", max_length, streams);
+            }
+        }
+    }
+
+    free(input);
+    free(encoded);
+    free(decoded);
+    free(decoder);
+}
+
+// Compression ratio of canonical codes limited to max_length bits, computed from the histogram
+double limited_compression_ratio(const uint64_t freq[256], size_t input_len, int max_length) {
+    HuffmanCode table[256];
+    if (input_len == 0 || huffmanEncodingCanonical(freq, max_length, table) != 0) {
+        return -1.0;
+    }
+    size_t compressed_bytes = (huffman_encoded_bits(freq, table) + 7) / 8;
+    return (double)compressed_bytes / (double)input_len;
+}
+
+// Time the parallel encoder with 1, 2, 4, ... threads up to the number of cores and check
+// that its output matches the sequential bitstream
+void parallel_encode_scaling(const char* input, size_t input_len, const HuffmanCode table[256],
+                             const uint8_t* expected, size_t expected_bits, FILE* f_par) {
+    size_t encoded_bytes = (expected_bits + 7) / 8;
+    uint8_t* encoded = malloc(encoded_bytes + 1);
+    if (!encoded) {
+        fprintf(stderr, "Memory allocation failed for parallel encoding!\n");
+        return;
+    }
+
+    int max_threads = cpu_count();
+    double single_time = 0.0;
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        size_t bit_len = 0;
+        double start = wall_time();
+        int rc = encode_input_parallel(input, input_len, table, encoded, &bit_len, threads);
+        double time = wall_time() - start;
+        if (threads == 1) {
+            single_time = time;
+        }
+
+        bool identical = rc == 0 && bit_len == expected_bits && memcmp(encoded, expected, encoded_bytes) == 0;
+        fprintf(f_par, "%zu,%d,%.6f,%.3f,%s\n", input_len, threads, time,
+                time > 0.0 ? single_time / time : 0.0, identical ? "OK" : "FAILED");
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    free(encoded);
+}
+
+// Encode an input already on the device with kernels/huffman_encode.cl and compare it with the CPU bitstream.
+// Returns the kernel time, or -1 if the OpenCL encoder could not run.
+double gpu_encode_buffer_check(OpenCLRuntime* runtime, cl_mem input_buffer, size_t input_len,
+                               const HuffmanCode table[256], const uint8_t* expected, size_t expected_bits,
+                               bool* identical) {
+    *identical = false;
+    size_t encoded_bytes = (expected_bits + 7) / 8;
+    uint8_t* encoded = malloc(encoded_bytes + 1);
+    size_t bit_len = 0;
+    double time = -1.0;
+
+    if (encoded && gpu_huffman_encode(runtime, input_buffer, input_len, table,
+                                      encoded, &bit_len, &time) == 0) {
+        *identical = bit_len == expected_bits && memcmp(encoded, expected, encoded_bytes) == 0;
+    } else {
+        time = -1.0;
+    }
+
+    free(encoded);
+    return time;
+}
+
+// Upload the input, then gpu_encode_buffer_check
+double gpu_encode_check(OpenCLRuntime* runtime, const char* input, size_t input_len,
+                        const HuffmanCode table[256], const uint8_t* expected, size_t expected_bits, bool* identical) {
+    *identical = false;
+    if (input_len == 0) {
+        *identical = expected_bits == 0;
+        return 0.0;
+    }
+
+    cl_mem input_buffer = opencl_input_buffer(runtime, input, input_len, NULL);
+    if (!input_buffer) {
+        return -1.0;
+    }
+    double time = gpu_encode_buffer_check(runtime, input_buffer, input_len, table, expected, expected_bits, identical);
+    clReleaseMemObject(input_buffer);
+    return time;
+}
+
+// Index overhead and decode speed for a few block sizes: the whole stream serially, the whole
+// stream in parallel using the index, and a 4 KiB range from the middle by random access
+void block_index_tradeoff(const char* input, size_t input_len, const HuffmanCode table[256],
+                          const uint8_t* encoded, size_t bit_len, FILE* f_idx) {
+    static const size_t block_sizes[] = {4096, 65536, 1048576};
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    uint8_t* decoded = malloc(input_len + 1);
+
+    if (!decoder || !decoded || huffman_decoder_init(decoder, table) != 0) {
+        free(decoder);
+        free(decoded);
+        return;
+    }
+
+    double start = wall_time();
+    huffman_decode(decoder, encoded, bit_len, decoded, input_len);
+    double time_serial = wall_time() - start;
+
+    for (size_t i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        BlockIndex index;
+        if (block_index_build(input, input_len, table, block_sizes[i], &index) != 0) {
+            continue;
+        }
+
+        memset(decoded, 0, input_len);
+        start = wall_time();
+        int rc = huffman_decode_parallel(decoder, encoded, bit_len, &index, decoded, input_len, 0);
+        double time_parallel = wall_time() - start;
+        bool ok = rc == 0 && memcmp(decoded, input, input_len) == 0;
+
+        size_t range_len = input_len < 4096 ? input_len : 4096;
+        size_t range_begin = (input_len - range_len) / 2;
+        start = wall_time();
+        rc = huffman_decode_range(decoder, encoded, bit_len, &index, range_begin, range_len, decoded);
+        double time_range = wall_time() - start;
+        ok = ok && rc == 0 && memcmp(decoded, input + range_begin, range_len) == 0;
+
+        size_t compressed_bytes = (bit_len + 7) / 8;
+        fprintf(f_idx, "%zu,%zu,%.4f,%.6f,%.6f,%.6f,%s\n", input_len, block_sizes[i],
+                compressed_bytes > 0 ? 100.0 * block_index_size(&index) / compressed_bytes : 0.0,
+                time_serial, time_parallel, time_range, ok ? "OK" : "FAILED");
+        block_index_free(&index);
+    }
+
+    free(decoder);
+    free(decoded);
+}
+
+// One bitstream against 2, 4 and 8 interleaved sub-streams of the same data and table, on one
+// thread: encode and decode time, decode speedup over the single stream, the bytes the
+// sub-streams add (bit counts and padding) and the decode throughput against DECODE_TARGET_GBS
+void multi_stream_comparison(const char* input, size_t input_len, const HuffmanCode table[256],
+                             const uint8_t* encoded, size_t bit_len, FILE* f_ms) {
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    uint8_t* decoded = malloc(input_len + 1);
+    uint8_t* streams_encoded = malloc(huffman_streams_size(bit_len, HUFFMAN_MAX_STREAMS));
+    uint8_t* single = malloc((bit_len + 7) / 8 + 1);
+
+    if (!decoder || !decoded || !streams_encoded || !single || huffman_decoder_init(decoder, table) != 0) {
+        fprintf(stderr, "Memory allocation failed for the multi-stream comparison!\n");
+        free(decoder);
+        free(decoded);
+        free(streams_encoded);
+        free(single);
+        return;
+    }
+
+    size_t single_bits = 0;
+    double start = wall_time();
+    encode_input_with_huffman(input, input_len, table, single, &single_bits);
+    double time_encode = wall_time() - start;
+
+    start = wall_time();
+    int rc = huffman_decode(decoder, encoded, bit_len, decoded, input_len);
+    double time_single = wall_time() - start;
+    bool ok = rc == 0 && single_bits == bit_len && memcmp(decoded, input, input_len) == 0;
+    double gbs = bench_throughput(input_len, time_single);
+    fprintf(f_ms, "%zu,1,%.6f,%.6f,1.00,0,%.3f,%s,%s\n", input_len, time_encode, time_single, gbs,
+            gbs >= DECODE_TARGET_GBS ? "yes" : "no", ok ? "OK" : "FAILED");
+
+    for (int streams = 2; streams <= HUFFMAN_MAX_STREAMS; streams *= 2) {
+        size_t size = 0;
+        start = wall_time();
+        rc = huffman_encode_streams((const uint8_t*)input, input_len, table, streams, streams_encoded, &size);
+        time_encode = wall_time() - start;
+
+        memset(decoded, 0, input_len);
+        start = wall_time();
+        ok = rc == 0 && huffman_decode_streams(decoder, streams_encoded, size, streams, decoded, input_len) == 0;
+        double time_decode = wall_time() - start;
+        ok = ok && memcmp(decoded, input, input_len) == 0;
+
+        gbs = bench_throughput(input_len, time_decode);
+        fprintf(f_ms, "%zu,%d,%.6f,%.6f,%.2f,%zu,%.3f,%s,%s\n", input_len, streams, time_encode, time_decode,
+                time_decode > 0.0 ? time_single / time_decode : 0.0, rc == 0 ? size - (bit_len + 7) / 8 : 0, gbs,
+                gbs >= DECODE_TARGET_GBS ? "yes" : "no", ok ? "OK" : "FAILED");
+    }
+
+    free(decoder);
+    free(decoded);
+    free(streams_encoded);
+    free(single);
+}
+
+// Manual mode input is either an aligned heap buffer or the data of a file (mapped or read)
+void free_manual_input(char* input, InputSource* source) {
+    if (source->data) {
+        input_source_close(source);
+    } else {
+        aligned_free(input);
+    }
+}
+
+// fread vs mmap on the same file: time until the first compressed block is out, total time
+// and resident memory growth. The file was just written, so both read from the page cache.
+void input_source_benchmark(const char* input, size_t input_len, FILE* f_src) {
+    const char* path = "output/input_source_bench.bin";
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return;
+    }
+    size_t written = fwrite(input, 1, input_len, fp);
+    fclose(fp);
+    if (written != input_len) {
+        remove(path);
+        return;
+    }
+
+    for (int use_mmap = 0; use_mmap <= 1; use_mmap++) {
+        FILE* sink = fopen("output/input_source_bench.huf", "wb");
+        if (!sink) {
+            break;
+        }
+
+        size_t rss_before = current_rss();
+        double start = wall_time();
+        InputSource source;
+        if (input_source_open(&source, path, use_mmap) != 0) {
+            fclose(sink);
+            break;
+        }
+        double time_open = wall_time() - start;
+
+        size_t first = source.size < STREAM_DEFAULT_BLOCK_SIZE ? source.size : STREAM_DEFAULT_BLOCK_SIZE;
+        huffman_compress_buffer(source.data, first, sink, 0, 0, 0);
+        double time_first = wall_time() - start;
+        huffman_compress_buffer(source.data + first, source.size - first, sink, 0, 0, 0);
+        double time_total = wall_time() - start;
+
+        size_t rss_after = current_rss();
+        fprintf(f_src, "%zu,%s,%.6f,%.6f,%.6f,%.2f\n", input_len, use_mmap ? "mmap" : "fread",
+                time_open, time_first, time_total,
+                rss_after > rss_before ? (rss_after - rss_before) / 1048576.0 : 0.0);
+
+        input_source_close(&source);
+        fclose(sink);
+    }
+
+    remove("output/input_source_bench.huf");
+    remove(path);
+}
+
+// The container format in memory: encode time and the share of it spent on the CRC-32C of the
+// blocks (hardware and portable), decoding streamed on one thread, from the index on all cores,
+// and of CONTAINER_RANDOM_ACCESS_SIZE bytes from the middle through the index
+void container_benchmark(const uint8_t* input, size_t input_len, FILE* f_cnt) {
+    size_t capacity = input_len * 2 + (input_len / STREAM_DEFAULT_BLOCK_SIZE + 1) * 256 + 64;
+    uint8_t* compressed = malloc(capacity);
+    uint8_t* decoded = malloc(input_len + 1);
+    HuffmanStreamEncoder* encoder = huffman_stream_encoder_init(0, 0, 0, NULL);
+    HuffmanStreamDecoder* decoder = huffman_stream_decoder_init(NULL);
+    if (!compressed || !decoded || !encoder || !decoder) {
+        fprintf(stderr, "Memory allocation failed for the container benchmark!\n");
+        free(compressed);
+        free(decoded);
+        huffman_stream_encoder_release(encoder);
+        huffman_stream_decoder_release(decoder);
+        return;
+    }
+
+    const uint8_t* next_in = input;
+    size_t input_left = input_len;
+    uint8_t* next_out = compressed;
+    size_t space = capacity;
+    double start = wall_time();
+    bool ok = huffman_stream_encoder_update(encoder, &next_in, &input_left, &next_out, &space) == HUFFMAN_STREAM_OK &&
+              huffman_stream_encoder_finish(encoder, &next_out, &space) == HUFFMAN_STREAM_END;
+    double time_encode = wall_time() - start;
+    size_t compressed_len = capacity - space;
+
+    start = wall_time();
+    volatile uint32_t crc = crc32c(0, input, input_len);
+    double time_crc = wall_time() - start;
+    start = wall_time();
+    crc = crc32c_portable(0, input, input_len);
+    double time_crc_portable = wall_time() - start;
+    (void)crc;
+
+    next_in = compressed;
+    input_left = compressed_len;
+    next_out = decoded;
+    space = input_len + 1;
+    start = wall_time();
+    ok = ok && huffman_stream_decoder_update(decoder, &next_in, &input_left, &next_out, &space) == HUFFMAN_STREAM_END &&
+         space == 1 && memcmp(decoded, input, input_len) == 0;
+    double time_stream = wall_time() - start;
+
+    StreamIndex index = {0};
+    memset(decoded, 0, input_len);
+    start = wall_time();
+    ok = ok && huffman_index_read(compressed, compressed_len, &index) == 0;
+    ok = ok && huffman_decompress_range(compressed, compressed_len, &index, 0, input_len, decoded, 0) == 0 &&
+         memcmp(decoded, input, input_len) == 0;
+    double time_parallel = wall_time() - start;
+
+    size_t range = input_len < CONTAINER_RANDOM_ACCESS_SIZE ? input_len : CONTAINER_RANDOM_ACCESS_SIZE;
+    size_t begin = (input_len - range) / 2;
+    start = wall_time();
+    ok = ok && huffman_decompress_range(compressed, compressed_len, &index, begin, range, decoded, 1) == 0 &&
+         memcmp(decoded, input + begin, range) == 0;
+    double time_random = wall_time() - start;
+    huffman_index_free(&index);
+
+    fprintf(f_cnt, "%zu,%.6f,%.6f,%.6f,%.2f,%.6f,%.6f,%.6f,%s\n", input_len, time_encode, time_crc, time_crc_portable,
+            time_encode > 0.0 ? 100.0 * time_crc / time_encode : 0.0, time_stream, time_parallel, time_random,
+            ok ? "OK" : "FAILED");
+
+    free(compressed);
+    free(decoded);
+    huffman_stream_encoder_release(encoder);
+    huffman_stream_decoder_release(decoder);
+}
+
+// Compare two files byte by byte
+bool files_identical(const char* path_a, const char* path_b) {
+    FILE* a = fopen(path_a, "rb");
+    FILE* b = fopen(path_b, "rb");
+    uint8_t* chunk_a = malloc(1 << 16);
+    uint8_t* chunk_b = malloc(1 << 16);
+    bool identical = a && b && chunk_a && chunk_b;
+    while (identical) {
+        size_t read_a = fread(chunk_a, 1, 1 << 16, a);
+        size_t read_b = fread(chunk_b, 1, 1 << 16, b);
+        identical = read_a == read_b && memcmp(chunk_a, chunk_b, read_a) == 0;
+        if (read_a == 0) {
+            break;
+        }
+    }
+    if (a) fclose(a);
+    if (b) fclose(b);
+    free(chunk_a);
+    free(chunk_b);
+    return identical;
+}
+
+// The same file compressed by huffman_compress_stream (read, count, encode, write one block after the
+// other) and by the threaded pipeline; the outputs must be byte-identical
+void pipeline_comparison(const char* input, size_t input_len, FILE* f_pipe) {
+    const char* path = "output/pipeline_input.bin";
+    const char* outputs[2] = {"output/pipeline_serial.huf", "output/pipeline.huf"};
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return;
+    }
+    size_t written = fwrite(input, 1, input_len, fp);
+    fclose(fp);
+
+    double times[2] = {0.0, 0.0};
+    PipelineStats stats = {0};
+    bool ok = written == input_len;
+    for (int run = 0; run < 2 && ok; run++) {
+        FILE* in = fopen(path, "rb");
+        FILE* out = fopen(outputs[run], "wb");
+        ok = in && out;
+        if (ok) {
+            double start = wall_time();
+            ok = (run == 0 ? huffman_compress_stream(in, out, 0, 0, 0)
+                           : huffman_compress_pipeline(in, out, 0, 0, 0, 0, &stats)) == 0;
+            times[run] = wall_time() - start;
+        }
+        if (in) fclose(in);
+        if (out && fclose(out) != 0) {
+            ok = false;
+        }
+    }
+    ok = ok && files_identical(outputs[0], outputs[1]);
+
+    if (written == input_len) {
+        fprintf(f_pipe, "%zu,%d,%.6f,%.6f,%.2f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.1f,%s\n", input_len,
+                stats.stages[PIPELINE_ENCODE].threads, times[0], times[1], times[1] > 0.0 ? times[0] / times[1] : 0.0,
+                100.0 * stats.stages[PIPELINE_READ].utilization, 100.0 * stats.stages[PIPELINE_HISTOGRAM].utilization,
+                100.0 * stats.stages[PIPELINE_ENCODE].utilization, 100.0 * stats.stages[PIPELINE_WRITE].utilization,
+                stats.queues[0].mean, stats.queues[1].mean, stats.queues[2].mean, stats.memory / 1048576.0,
+                ok ? "OK" : "FAILED");
+    }
+    remove(outputs[0]);
+    remove(outputs[1]);
+    remove(path);
+}
+
+void* daemon_thread(void* server) {
+    daemon_run((DaemonServer*)server);
+    return NULL;
+}
+
+// Request latency of a daemon that keeps this process's warm runtime, against the OpenCL startup
+// every separate invocation pays before its first byte (with the binary cache already filled)
+void daemon_latency_comparison(OpenCLRuntime* runtime, Dispatcher* dispatcher, FILE* f_dmn) {
+    static const DaemonOperation operations[] = {DAEMON_COMPRESS, DAEMON_DECOMPRESS, DAEMON_HISTOGRAM};
+    DaemonServer* server = daemon_open(DAEMON_TEST_SOCKET, 0, dispatcher, NULL);
+    pthread_t thread;
+    if (!server) {
+        return;
+    }
+    if (pthread_create(&thread, NULL, daemon_thread, server) != 0) {
+        daemon_close(server);
+        return;
+    }
+
+    size_t size = 1024;
+    for (int i = 0; i < DAEMON_TEST_SIZE_COUNT; i++, size *= 16) {
+        int requests = size <= (64 << 10) ? 200 : size <= (1 << 20) ? 50 : 10;
+        for (size_t op = 0; op < sizeof(operations) / sizeof(operations[0]); op++) {
+            DaemonLoadStats stats;
+            if (daemon_load_generate(DAEMON_TEST_SOCKET, operations[op], 1, requests, size, &stats) != 0) {
+                stats.failures = requests;
+            }
+            fprintf(f_dmn, "%zu,%s,%d,%.6f,%.6f,%.6f,%.6f,%d\n", size, daemon_operation_name(operations[op]),
+                    stats.requests, stats.latency.median, stats.latency.p99, stats.latency.max,
+                    runtime->startup_time, stats.failures);
+        }
+    }
+
+    DaemonClient* client = daemon_client_connect(DAEMON_TEST_SOCKET);
+    uint8_t* response;
+    size_t response_size;
+    if (client) {
+        daemon_client_request(client, DAEMON_SHUTDOWN, 0, 0, NULL, 0, &response, &response_size);
+        daemon_client_close(client);
+    }
+    pthread_join(thread, NULL);
+    daemon_close(server);
+}
+
+// Both histogram kernels side by side, on the generated (skewed) input and on uniform random bytes
+void histogram_kernel_comparison(OpenCLRuntime* runtime, const char* input, size_t input_len, FILE* f_hist) {
+    uint8_t* uniform = malloc(input_len + 1);
+    if (!uniform) {
+        return;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ input_len;
+    for (size_t i = 0; i < input_len; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uniform[i] = (uint8_t)(state >> 56);
+    }
+
+    const uint8_t* inputs[] = {(const uint8_t*)input, uniform};
+    const char* names[] = {"skewed", "uniform"};
+    for (int i = 0; i < 2; i++) {
+        uint64_t freq_atomic[256], freq_vector[256];
+        GpuHistogramTiming atomic_timing, vector_timing;
+        if (gpu_byte_histogram(runtime, GPU_HISTOGRAM_ATOMIC, inputs[i], input_len, 0, freq_atomic, &atomic_timing) != 0 ||
+            gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, inputs[i], input_len, 0, freq_vector, &vector_timing) != 0) {
+            break;
         }
-        local_seed = a * local_seed + c;
-        uint64_t mixed = local_seed;
-        mixed ^= mixed >> 33;
-        mixed ^= mixed << 21;
-        mixed ^= mixed >> 11;
-        float r = (float)(mixed & 0xFFFFFFFFULL) / 4294967295.0f;
-        float r_updated = powf(r, 2.5f);
-        unsigned char val = (unsigned char)(r_updated * 254.0f) + 1;
-        output[i] = val;
+        fprintf(f_hist, "%zu,%s,%.6f,%.6f,%.2f,%s\n", input_len, names[i], atomic_timing.kernel_time,
+                vector_timing.kernel_time,
+                vector_timing.kernel_time > 0.0 ? atomic_timing.kernel_time / vector_timing.kernel_time : 0.0,
+                memcmp(freq_atomic, freq_vector, sizeof(freq_atomic)) == 0 ? "OK" : "FAILED");
     }
+
+    free(uniform);
+}
+
+// Log-like text of the given length: timestamped lines of a few levels, words and numbers,
+// the kind of data order-1 modelling is meant for
+void log_like_input(uint8_t* output, size_t length) {
+    static const char* levels[] = {"INFO", "INFO", "INFO", "WARN", "ERROR"};
+    static const char* words[] = {"request", "worker", "done", "connection", "closed", "user", "GET", "POST",
+                                  "/api/v1/items", "status", "timeout", "retry", "cache", "miss", "hit"};
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    size_t position = 0;
+    char line[160];
+
+    while (position < length) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int line_len = snprintf(line, sizeof(line), "2024-05-%02u %02u:%02u:%02u.%03u %s %s %s %s %u\n",
+                                (unsigned)(state % 28) + 1, (unsigned)(state >> 8) % 24, (unsigned)(state >> 16) % 60,
+                                (unsigned)(state >> 24) % 60, (unsigned)(state >> 32) % 1000, levels[(state >> 42) % 5],
+                                words[(state >> 45) % 15], words[(state >> 49) % 15], words[(state >> 53) % 15],
+                                (unsigned)(state >> 57) * 37);
+        size_t count = length - position < (size_t)line_len ? length - position : (size_t)line_len;
+        memcpy(output + position, line, count);
+        position += count;
+    }
+}
+
+static double megabytes_per_second(size_t bytes, double seconds) {
+    return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0;
+}
+
+// Order-0 (one 11-bit limited table) against order-1 (a table per previous byte) on the generated
+// input and on log-like text: size with the tables included, compression and decode throughput,
+// and the pair histogram on the CPU and on the device
+void context_model_comparison(OpenCLRuntime* runtime, const char* input, size_t input_len, FILE* f_ctx) {
+    uint8_t* text = malloc(input_len + 1);
+    uint8_t* encoded = malloc(input_len * 2 + 8);
+    uint8_t* decoded = malloc(input_len + 1);
+    uint64_t* pair_freq = malloc(PAIR_HISTOGRAM_SIZE * sizeof(*pair_freq));
+    uint64_t* pair_freq_gpu = malloc(PAIR_HISTOGRAM_SIZE * sizeof(*pair_freq_gpu));
+    ContextModel* model = malloc(sizeof(*model));
+    ContextDecoder* context_decoder = malloc(sizeof(*context_decoder));
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    uint8_t* model_bytes = malloc(CONTEXT_MODEL_MAX_SIZE);
+
+    if (text && encoded && decoded && pair_freq && pair_freq_gpu && model && context_decoder && decoder && model_bytes) {
+        log_like_input(text, input_len);
+        const uint8_t* inputs[] = {(const uint8_t*)input, text};
+        const char* names[] = {"generated", "log"};
+
+        for (int i = 0; i < 2; i++) {
+            const uint8_t* data = inputs[i];
+            bool round_trip = true;
+
+            // Order 0
+            uint64_t freq[256];
+            HuffmanCode table[256];
+            size_t bits0;
+            double start = wall_time();
+            byte_histogram_parallel(data, input_len, freq, 0);
+            round_trip = huffmanEncodingCanonical(freq, HUFFMAN_DEFAULT_MAX_CODE_LENGTH, table) == 0 &&
+                         encode_input_with_huffman((const char*)data, input_len, table, encoded, &bits0) == 0;
+            double time_compress0 = wall_time() - start;
+
+            start = wall_time();
+            round_trip = round_trip && huffman_decoder_init(decoder, table) == 0 &&
+                         huffman_decode(decoder, encoded, bits0, decoded, input_len) == 0 &&
+                         memcmp(decoded, data, input_len) == 0;
+            double time_decode0 = wall_time() - start;
+
+            // Order 1
+            size_t bits1 = 0, model_size = 0;
+            int tables = 0;
+            start = wall_time();
+            pair_histogram_parallel(data, input_len, pair_freq, 0);
+            double time_pair = wall_time() - start;
+            round_trip = round_trip && context_model_build(pair_freq, model) == 0 &&
+                         context_encode(model, data, input_len, encoded, &bits1) == 0;
+            if (round_trip) {
+                model_size = context_model_write(model, model_bytes);
+                tables = model->table_count;
+            }
+            double time_compress1 = wall_time() - start;
+
+            start = wall_time();
+            if (round_trip) {
+                context_decoder_init(context_decoder, model);
+                round_trip = context_decode(context_decoder, encoded, bits1, decoded, input_len) == 0 &&
+                             memcmp(decoded, data, input_len) == 0;
+            }
+            double time_decode1 = wall_time() - start;
+
+            GpuHistogramTiming gpu_timing;
+            double time_pair_gpu = -1.0;
+            bool pair_identical = false;
+            if (gpu_pair_histogram(runtime, data, input_len, 0, pair_freq_gpu, &gpu_timing) == 0) {
+                time_pair_gpu = gpu_timing.wall_time;
+                pair_identical = memcmp(pair_freq, pair_freq_gpu, PAIR_HISTOGRAM_SIZE * sizeof(*pair_freq)) == 0;
+            }
+
+            // The order-0 table takes 128 bytes (4-bit lengths), as in the .huf blocks
+            fprintf(f_ctx, "%zu,%s,%.4f,%.4f,%d,%zu,%.6f,%.6f,%s,%.1f,%.1f,%.1f,%.1f,%s\n", input_len, names[i],
+                    (double)((bits0 + 7) / 8 + 128) / input_len, (double)((bits1 + 7) / 8 + model_size) / input_len,
+                    tables, model_size, time_pair, time_pair_gpu, pair_identical ? "OK" : "FAILED",
+                    megabytes_per_second(input_len, time_compress0), megabytes_per_second(input_len, time_compress1),
+                    megabytes_per_second(input_len, time_decode0), megabytes_per_second(input_len, time_decode1),
+                    round_trip ? "OK" : "FAILED");
+        }
+    } else {
+        fprintf(stderr, "Memory allocation failed for the context model comparison!\n");
+    }
+
+    free(text);
+    free(encoded);
+    free(decoded);
+    free(pair_freq);
+    free(pair_freq_gpu);
+    free(model);
+    free(context_decoder);
+    free(decoder);
+    free(model_bytes);
+}
+
+// Device generation and histogram of the same data with copies and, if the device shares the
+// host's memory, in place (ZeroCopy 0: the in-place columns are -1); wall times, setup included
+void zero_copy_comparison(OpenCLRuntime* runtime, const RandomTables* tables, const uint8_t* input,
+                          size_t input_len, FILE* f_zc) {
+    uint8_t* output = aligned_malloc(input_len, OPENCL_ZERO_COPY_ALIGNMENT);
+    if (!output) {
+        fprintf(stderr, "Memory allocation failed for the zero-copy comparison!\n");
+        return;
+    }
+
+    bool zero_copy = runtime->zero_copy;
+    double generate_times[2] = {-1.0, -1.0};
+    double histogram_times[2] = {-1.0, -1.0};
+    double upload_times[2] = {-1.0, -1.0};
+    bool identical = true;
+    uint64_t freq[256];
+    byte_histogram_parallel(input, input_len, freq, 0);
+
+    for (int in_place = 0; in_place <= (zero_copy ? 1 : 0); in_place++) {
+        runtime->zero_copy = in_place;
+        memset(output, 0, input_len);
+        double start = wall_time();
+        bool ok = gpu_random_bytes(runtime, tables, RANDOM_DEFAULT_SEED, 0, output, input_len, NULL) == 0;
+        generate_times[in_place] = wall_time() - start;
+
+        uint64_t freq_gpu[256];
+        GpuHistogramTiming timing;
+        ok = ok && memcmp(output, input, input_len) == 0 &&
+             gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, output, input_len, 0, freq_gpu, &timing) == 0 &&
+             memcmp(freq, freq_gpu, sizeof(freq)) == 0;
+        if (ok) {
+            histogram_times[in_place] = timing.wall_time;
+            upload_times[in_place] = timing.transfer_time;
+        }
+        identical = identical && ok;
+    }
+    runtime->zero_copy = zero_copy;
+
+    fprintf(f_zc, "%zu,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%s\n", input_len, zero_copy ? 1 : 0,
+            generate_times[0], generate_times[1], histogram_times[0], histogram_times[1],
+            upload_times[0], upload_times[1], identical ? "OK" : "FAILED");
+    aligned_free(output);
+}
+
+// Device generation followed by the histogram, three ways: through the host (generated, read back,
+// counted from host memory), device resident (counted and encoded from the generated buffer) and
+// fused (counted while generated, never stored); wall times, -1 if a way failed.
+// freq, table, expected: histogram, codes and CPU bitstream of the same data
+void device_pipeline_comparison(OpenCLRuntime* runtime, const RandomTables* tables, size_t input_len,
+                                const uint64_t freq[256], const HuffmanCode table[256], const uint8_t* expected,
+                                size_t expected_bits, FILE* f_dev) {
+    uint8_t* host = aligned_malloc(input_len, OPENCL_ZERO_COPY_ALIGNMENT);
+    if (!host) {
+        fprintf(stderr, "Memory allocation failed for the device pipeline comparison!\n");
+        return;
+    }
+
+    uint64_t freq_gpu[256];
+    double start = wall_time();
+    bool ok = gpu_random_bytes(runtime, tables, RANDOM_DEFAULT_SEED, 0, host, input_len, NULL) == 0 &&
+              gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, host, input_len, 0, freq_gpu, NULL) == 0;
+    double time_host = ok ? wall_time() - start : -1.0;
+    bool hist_identical = ok && memcmp(freq, freq_gpu, sizeof(freq_gpu)) == 0;
+
+    cl_mem device_data = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, input_len, NULL, NULL);
+    start = wall_time();
+    ok = device_data && gpu_random_buffer(runtime, tables, RANDOM_DEFAULT_SEED, 0, device_data, input_len, NULL) == 0 &&
+         gpu_buffer_histogram(runtime, device_data, input_len, freq_gpu, NULL) == 0;
+    double time_device = ok ? wall_time() - start : -1.0;
+    hist_identical = hist_identical && ok && memcmp(freq, freq_gpu, sizeof(freq_gpu)) == 0;
+
+    double time_encode = -1.0;
+    bool encode_identical = false;
+    if (ok) {
+        time_encode = gpu_encode_buffer_check(runtime, device_data, input_len, table, expected, expected_bits,
+                                              &encode_identical);
+    }
+    if (device_data) {
+        clReleaseMemObject(device_data);
+    }
+
+    start = wall_time();
+    ok = gpu_random_histogram(runtime, tables, RANDOM_DEFAULT_SEED, 0, input_len, freq_gpu, NULL) == 0;
+    double time_fused = ok ? wall_time() - start : -1.0;
+    hist_identical = hist_identical && ok && memcmp(freq, freq_gpu, sizeof(freq_gpu)) == 0;
+
+    fprintf(f_dev, "%zu,%.6f,%.6f,%.6f,%.6f,%s,%s\n", input_len, time_host, time_device, time_fused, time_encode,
+            hist_identical ? "OK" : "FAILED", encode_identical ? "OK" : "FAILED");
+    aligned_free(host);
+}
+
+// Phases of one benchmark run, in the order they run
+typedef enum BenchPhase {
+    BENCH_GENERATE,
+    BENCH_GENERATE_OPENCL,
+    BENCH_GENERATE_COPY,
+    BENCH_HISTOGRAM_CPU,
+    BENCH_OPENCL_SETUP,
+    BENCH_OPENCL_UPLOAD,
+    BENCH_OPENCL_KERNEL,
+    BENCH_OPENCL_READBACK,
+    BENCH_HISTOGRAM_OPENCL,
+    BENCH_HISTOGRAM_COPY_UPLOAD,
+    BENCH_HISTOGRAM_COPY,
+    BENCH_PIPELINE_DEVICE,
+    BENCH_PIPELINE_FUSED,
+    BENCH_TREE_BUILD,
+    BENCH_ENCODE,
+    BENCH_DECODE,
+    BENCH_ENCODE_STREAMS,
+    BENCH_DECODE_STREAMS,
+    BENCH_CRC32C,
+    BENCH_ENCODE_PARALLEL,
+    BENCH_ENCODE_OPENCL,
+    BENCH_PHASE_COUNT
+} BenchPhase;
+
+typedef struct BenchPhaseInfo {
+    const char* name;
+    const char* clock;  // "wall" or "device"
+    bool per_byte;      // throughput is meaningful
+    bool opencl;        // left out if the device is missing or fails
+    bool copy;          // copies forced on a zero-copy device, for comparison; left out on other devices
+} BenchPhaseInfo;
+
+static const BenchPhaseInfo bench_phases[BENCH_PHASE_COUNT] = {
+    [BENCH_GENERATE]              = {"generate_cpu",              "wall",   true,  false, false},
+    [BENCH_GENERATE_OPENCL]       = {"generate_opencl",           "wall",   true,  true,  false},
+    [BENCH_GENERATE_COPY]         = {"generate_copy",             "wall",   true,  true,  true},
+    [BENCH_HISTOGRAM_CPU]         = {"histogram_cpu",             "wall",   true,  false, false},
+    [BENCH_OPENCL_SETUP]          = {"histogram_setup",           "wall",   false, true,  false},
+    [BENCH_OPENCL_UPLOAD]         = {"histogram_upload",          "device", true,  true,  false},
+    [BENCH_OPENCL_KERNEL]         = {"histogram_kernel",          "device", true,  true,  false},
+    [BENCH_OPENCL_READBACK]       = {"histogram_readback",        "device", false, true,  false},
+    [BENCH_HISTOGRAM_OPENCL]      = {"histogram_opencl",          "wall",   true,  true,  false},
+    [BENCH_HISTOGRAM_COPY_UPLOAD] = {"histogram_copy_upload",     "device", true,  true,  true},
+    [BENCH_HISTOGRAM_COPY]        = {"histogram_copy",            "wall",   true,  true,  true},
+    [BENCH_PIPELINE_DEVICE]       = {"generate_histogram_device", "wall",   true,  true,  false},
+    [BENCH_PIPELINE_FUSED]        = {"generate_histogram_fused",  "wall",   true,  true,  false},
+    [BENCH_TREE_BUILD]            = {"tree_build",                "wall",   false, false, false},
+    [BENCH_ENCODE]                = {"encode_cpu",                "wall",   true,  false, false},
+    [BENCH_DECODE]                = {"decode_cpu",                "wall",   true,  false, false},
+    [BENCH_ENCODE_STREAMS]        = {"encode_streams",            "wall",   true,  false, false},
+    [BENCH_DECODE_STREAMS]        = {"decode_streams",            "wall",   true,  false, false},
+    [BENCH_CRC32C]                = {"crc32c",                    "wall",   true,  false, false},
+    [BENCH_ENCODE_PARALLEL]       = {"encode_parallel",           "wall",   true,  false, false},
+    [BENCH_ENCODE_OPENCL]         = {"encode_kernel",             "device", true,  true,  false},
+};
+
+// Device generation into output, checked against input; wall time with the buffer setup, or -1 on failure
+static double bench_generate_opencl(OpenCLRuntime* runtime, const RandomTables* tables, const uint8_t* input,
+                                    uint8_t* output, size_t length) {
+    double start = wall_time();
+    if (gpu_random_bytes(runtime, tables, RANDOM_DEFAULT_SEED, 0, output, length, NULL) != 0) {
+        return -1.0;
+    }
+    double time = wall_time() - start;
+    return memcmp(output, input, length) == 0 ? time : -1.0;
+}
+
+// One input size: warmup + repetitions runs of every phase on the same generated input; the
+// one-off setup (allocations, device input of the encoder, decoder table) is outside the timed regions.
+// The buffers are page aligned, so on a zero-copy device the default OpenCL phases run in place.
+// Returns 0 on success, -1 on allocation failure or if a result does not match the CPU.
+int bench_size(OpenCLRuntime* runtime, const RandomTables* tables, size_t input_size,
+               int warmup, int repetitions, BenchReport* report) {
+    uint8_t* input = aligned_malloc(input_size + 1, OPENCL_ZERO_COPY_ALIGNMENT);
+    uint8_t* encoded = malloc(huffman_streams_size(input_size * HUFFMAN_DEFAULT_MAX_CODE_LENGTH, HUFFMAN_DEFAULT_STREAMS) + 16);
+    uint8_t* decoded = aligned_malloc(input_size + 1, OPENCL_ZERO_COPY_ALIGNMENT);
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    double* samples = malloc(BENCH_PHASE_COUNT * repetitions * sizeof(*samples));
+    cl_mem device_input = NULL;
+    cl_mem device_generated = NULL;
+    bool opencl_ok = runtime != NULL;
+    bool zero_copy = runtime != NULL && runtime->zero_copy;
+    int status = 0;
+
+    if (!input || !encoded || !decoded || !decoder || !samples) {
+        fprintf(stderr, "Memory allocation failed for the benchmark!\n");
+        status = -1;
+    } else {
+        random_bytes_parallel(tables, RANDOM_DEFAULT_SEED, input, input_size, 0);
+    }
+    if (status == 0 && opencl_ok) {
+        device_input = opencl_input_buffer(runtime, input, input_size, NULL);
+        device_generated = clCreateBuffer(runtime->context, CL_MEM_READ_WRITE, input_size, NULL, NULL);
+        opencl_ok = device_input != NULL && device_generated != NULL;
+    }
+
+    for (int run = -warmup; run < repetitions && status == 0; run++) {
+        double times[BENCH_PHASE_COUNT] = {0};
+
+        double start = wall_time();
+        random_bytes_parallel(tables, RANDOM_DEFAULT_SEED, input, input_size, 0);
+        times[BENCH_GENERATE] = wall_time() - start;
+
+        uint64_t freq[256];
+        start = wall_time();
+        byte_histogram_parallel(input, input_size, freq, 0);
+        times[BENCH_HISTOGRAM_CPU] = wall_time() - start;
+
+        if (opencl_ok) {
+            uint64_t freq_gpu[256];
+            GpuHistogramTiming timing;
+            if (gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, input, input_size, 0, freq_gpu, &timing) != 0 ||
+                memcmp(freq, freq_gpu, sizeof(freq)) != 0) {
+                fprintf(stderr, "OpenCL histogram failed or differs, OpenCL phases left out\n");
+                opencl_ok = false;
+            }
+            times[BENCH_OPENCL_SETUP] = timing.setup_time;
+            times[BENCH_OPENCL_UPLOAD] = timing.transfer_time;
+            times[BENCH_OPENCL_KERNEL] = timing.kernel_time;
+            times[BENCH_OPENCL_READBACK] = timing.readback_time;
+            times[BENCH_HISTOGRAM_OPENCL] = timing.wall_time;
+
+            // decoded is free until the decode phase
+            times[BENCH_GENERATE_OPENCL] = bench_generate_opencl(runtime, tables, input, decoded, input_size);
+            opencl_ok = opencl_ok && times[BENCH_GENERATE_OPENCL] >= 0.0;
+
+            // Generation and histogram with the data left on the device, and fused without storing it
+            start = wall_time();
+            opencl_ok = opencl_ok &&
+                        gpu_random_buffer(runtime, tables, RANDOM_DEFAULT_SEED, 0, device_generated, input_size, NULL) == 0 &&
+                        gpu_buffer_histogram(runtime, device_generated, input_size, freq_gpu, NULL) == 0 &&
+                        memcmp(freq, freq_gpu, sizeof(freq)) == 0;
+            times[BENCH_PIPELINE_DEVICE] = wall_time() - start;
+
+            start = wall_time();
+            opencl_ok = opencl_ok &&
+                        gpu_random_histogram(runtime, tables, RANDOM_DEFAULT_SEED, 0, input_size, freq_gpu, NULL) == 0 &&
+                        memcmp(freq, freq_gpu, sizeof(freq)) == 0;
+            times[BENCH_PIPELINE_FUSED] = wall_time() - start;
+            if (!opencl_ok) {
+                fprintf(stderr, "OpenCL generation or device histogram failed or differs, OpenCL phases left out\n");
+            }
+        }
+
+        // The same with copies: the difference is what zero-copy saves
+        if (opencl_ok && zero_copy) {
+            uint64_t freq_gpu[256];
+            GpuHistogramTiming timing;
+            runtime->zero_copy = false;
+            opencl_ok = gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, input, input_size, 0, freq_gpu, &timing) == 0 &&
+                        memcmp(freq, freq_gpu, sizeof(freq)) == 0;
+            times[BENCH_HISTOGRAM_COPY_UPLOAD] = timing.transfer_time;
+            times[BENCH_HISTOGRAM_COPY] = timing.wall_time;
+            times[BENCH_GENERATE_COPY] = bench_generate_opencl(runtime, tables, input, decoded, input_size);
+            opencl_ok = opencl_ok && times[BENCH_GENERATE_COPY] >= 0.0;
+            runtime->zero_copy = true;
+            if (!opencl_ok) {
+                fprintf(stderr, "OpenCL run with copies failed or differs, OpenCL phases left out\n");
+            }
+        }
+
+        HuffmanCode table[256];
+        start = wall_time();
+        int rc = huffmanEncodingCanonical(freq, HUFFMAN_DEFAULT_MAX_CODE_LENGTH, table);
+        times[BENCH_TREE_BUILD] = wall_time() - start;
+        if (rc != 0 || huffman_decoder_init(decoder, table) != 0) {
+            status = -1;
+            break;
+        }
+
+        size_t bit_len = 0;
+        start = wall_time();
+        encode_input_with_huffman((const char*)input, input_size, table, encoded, &bit_len);
+        times[BENCH_ENCODE] = wall_time() - start;
+
+        start = wall_time();
+        rc = huffman_decode(decoder, encoded, bit_len, decoded, input_size);
+        times[BENCH_DECODE] = wall_time() - start;
+        if (rc != 0 || memcmp(decoded, input, input_size) != 0) {
+            fprintf(stderr, "Benchmark round trip failed at %zu bytes\n", input_size);
+            status = -1;
+            break;
+        }
+
+        // The same with interleaved sub-streams, encoded over the single bitstream
+        size_t streams_size = 0;
+        start = wall_time();
+        rc = huffman_encode_streams(input, input_size, table, HUFFMAN_DEFAULT_STREAMS, encoded, &streams_size);
+        times[BENCH_ENCODE_STREAMS] = wall_time() - start;
+
+        start = wall_time();
+        int decode_rc = huffman_decode_streams(decoder, encoded, streams_size, HUFFMAN_DEFAULT_STREAMS, decoded, input_size);
+        times[BENCH_DECODE_STREAMS] = wall_time() - start;
+        if (rc != 0 || decode_rc != 0 || memcmp(decoded, input, input_size) != 0) {
+            fprintf(stderr, "Benchmark multi-stream round trip failed at %zu bytes\n", input_size);
+            status = -1;
+            break;
+        }
+
+        // Checksum of the container blocks over the same data, the cost it adds to encoding
+        start = wall_time();
+        volatile uint32_t crc = crc32c(0, input, input_size);
+        times[BENCH_CRC32C] = wall_time() - start;
+        (void)crc;
+
+        size_t parallel_bits = 0;
+        start = wall_time();
+        encode_input_parallel((const char*)input, input_size, table, encoded, &parallel_bits, 0);
+        times[BENCH_ENCODE_PARALLEL] = wall_time() - start;
+
+        size_t gpu_bits = 0;
+        if (opencl_ok && (gpu_huffman_encode(runtime, device_input, input_size, table, encoded, &gpu_bits,
+                                             &times[BENCH_ENCODE_OPENCL]) != 0 || gpu_bits != bit_len)) {
+            fprintf(stderr, "OpenCL encode failed or differs, OpenCL phases left out\n");
+            opencl_ok = false;
+        }
+
+        if (run >= 0) {
+            for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+                samples[phase * repetitions + run] = times[phase];
+            }
+        }
+    }
+
+    if (status == 0) {
+        BenchStats stats[BENCH_PHASE_COUNT];
+        for (int phase = 0; phase < BENCH_PHASE_COUNT; phase++) {
+            bench_stats(&samples[phase * repetitions], repetitions, &stats[phase]);
+            if ((!bench_phases[phase].opencl || opencl_ok) && (!bench_phases[phase].copy || zero_copy)) {
+                bench_report_add(report, input_size, bench_phases[phase].name, bench_phases[phase].clock,
+                                 bench_phases[phase].per_byte ? input_size : 0, &stats[phase]);
+            }
+        }
+
+        printf("  %10zu bytes  histogram cpu %6.2f GB/s", input_size,
+               bench_throughput(input_size, stats[BENCH_HISTOGRAM_CPU].median));
+        if (opencl_ok) {
+            printf(", opencl %6.2f GB/s (kernel %6.2f GB/s)",
+                   bench_throughput(input_size, stats[BENCH_HISTOGRAM_OPENCL].median),
+                   bench_throughput(input_size, stats[BENCH_OPENCL_KERNEL].median));
+        }
+        if (opencl_ok && zero_copy) {
+            printf(", with copies %6.2f GB/s", bench_throughput(input_size, stats[BENCH_HISTOGRAM_COPY].median));
+        }
+        printf("  encode %6.2f GB/s, parallel %6.2f GB/s  (median of %d, p95/median %.2f)\n",
+               bench_throughput(input_size, stats[BENCH_ENCODE].median),
+               bench_throughput(input_size, stats[BENCH_ENCODE_PARALLEL].median), repetitions,
+               stats[BENCH_ENCODE].median > 0.0 ? stats[BENCH_ENCODE].p95 / stats[BENCH_ENCODE].median : 0.0);
+    }
+
+    if (device_input) {
+        clReleaseMemObject(device_input);
+    }
+    if (device_generated) {
+        clReleaseMemObject(device_generated);
+    }
+    free(samples);
+    free(decoder);
+    aligned_free(decoded);
+    free(encoded);
+    aligned_free(input);
+    return status;
+}
+
+// Benchmark run over BENCH_SIZE_COUNT sizes up to max_size, written to output/bench-<time>.json.
+// Without a usable OpenCL device only the CPU phases are measured.
+int benchmark(int warmup, int repetitions, size_t max_size) {
+    if (warmup < 0) {
+        warmup = 0;
+    }
+    if (repetitions < 1 || repetitions > BENCH_MAX_REPETITIONS) {
+        repetitions = repetitions < 1 ? 1 : BENCH_MAX_REPETITIONS;
+    }
+    if (max_size < BENCH_MIN_SIZE * 2) {
+        max_size = BENCH_MIN_SIZE * 2;
+    }
+
+    OpenCLRuntime runtime_storage;
+    OpenCLRuntime* runtime = &runtime_storage;
+    if (opencl_runtime_init(runtime, OPENCL_RUNTIME_CACHE_DIR, false) != 0) {
+        fprintf(stderr, "No OpenCL runtime, measuring the CPU phases only\n");
+        runtime = NULL;
+    }
+
+    char path[64];
+    time_t now = time(NULL);
+    strftime(path, sizeof(path), "output/bench-%Y%m%d-%H%M%S.json", localtime(&now));
+
+    size_t sizes[BENCH_SIZE_COUNT];
+    RandomTables tables;
+    BenchReport report;
+    int status = exponential(BENCH_MIN_SIZE, (double)max_size, BENCH_SIZE_COUNT, sizes);
+    if (status == 0) {
+        status = bench_report_open(&report, path, runtime, warmup, repetitions, RANDOM_DEFAULT_SEED);
+    }
+
+    if (status == 0) {
+        printf("Benchmark: %d warmup + %d measured runs per size, results in %s\n", warmup, repetitions, path);
+        random_tables_init(&tables);
+        for (int i = 0; i < BENCH_SIZE_COUNT && status == 0; i++) {
+            status = bench_size(runtime, &tables, sizes[i], warmup, repetitions, &report);
+        }
+        if (bench_report_close(&report) != 0) {
+            status = -1;
+        }
+    }
+
+    if (runtime) {
+        opencl_runtime_release(runtime);
+    }
+    return status == 0 ? 0 : 1;
 }
 
 int compare_freq(const void* a, const void* b) {
-    const int* fa = (const int*)a;
-    const int* fb = (const int*)b;
-    return fb[1] - fa[1];
+    const uint64_t* fa = (const uint64_t*)a;
+    const uint64_t* fb = (const uint64_t*)b;
+    return fa[1] < fb[1] ? 1 : (fa[1] > fb[1] ? -1 : 0);
 }
 
 int manual(int input_size) {
-    cl_int err;
-    int error_code;
-
-    char* input = malloc(input_size);
+    InputSource source = {0};
+    cl_mem device_input = NULL;  // generated input, kept on the device for the histogram and the encoder
+    char* input = aligned_malloc(input_size, OPENCL_ZERO_COPY_ALIGNMENT);
     if (!input) {
         fprintf(stderr, "Memory allocation failed!\n");
         return 1;
@@ -137,82 +1316,55 @@ int manual(int input_size) {
     scanf("%d", &choice);
     getchar();
 
-    // OpenCL early setup
-    cl_platform_id platform_id;
-    cl_uint n_platforms;
-    err = clGetPlatformIDs(1, &platform_id, &n_platforms);
-
-    cl_device_id device_id;
-    cl_uint n_devices;
-    err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_GPU, 1, &device_id, &n_devices);
-
-    cl_context context = clCreateContext(NULL, n_devices, &device_id, NULL, NULL, NULL);
-    cl_queue_properties props[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,0};
-    cl_command_queue command_queue = clCreateCommandQueueWithProperties(context, device_id, props, NULL);
+    // OpenCL setup: programs come from the binary cache after the first run
+    OpenCLRuntime runtime;
+    if (opencl_runtime_init(&runtime, OPENCL_RUNTIME_CACHE_DIR, false) != 0) {
+        aligned_free(input);
+        return 1;
+    }
+    printf("OpenCL startup time: %.4f sec (%d/%d programs from cache)\n",
+           runtime.startup_time, runtime.cached_programs, OPENCL_PROGRAM_COUNT);
 
     if (choice == 1) {
-        FILE* fp = fopen("input/input.txt", "rb");
-        if (!fp) {
+        // Mapped straight from the page cache, no copy before the histogram and the upload
+        aligned_free(input);
+        if (input_source_open(&source, "input/input.txt", 1) != 0) {
             perror("Cannot open input.txt");
-            free(input);
             return 1;
         }
-        input_len = fread(input, 1, input_size, fp);
-        fclose(fp);
-        printf("Loaded %zu bytes from file.\n", input_len);
+        input = (char*)source.data;
+        input_len = source.size;
+        printf("Mapped %zu bytes from file.\n", input_len);
     } else if (choice == 2) {
 
-        //Seq
-        unsigned char *input_seq = malloc(input_size);
-        clock_t start_seq = clock();
-        generate_random_seq(input_seq, input_size);
-        clock_t end_seq = clock();
-        double time_seq = (double)(end_seq - start_seq) / CLOCKS_PER_SEC;
-        printf("Seq generation time: %.4f sec\n", time_seq);
-
-        //OpenCL
+        // Same seed on the CPU and the device: the two outputs must be identical
+        RandomTables tables;
+        random_tables_init(&tables);
+        uint64_t seed = RANDOM_DEFAULT_SEED;
         input_len = input_size;
-        const char* rand_kernel_code = load_kernel_source("kernels/random_generator.cl", &error_code);
-        if (error_code != 0) {
-            fprintf(stderr, "Random kernel load error!\n");
-            free(input);
-            return 1;
-        }
 
-        cl_program rand_program = clCreateProgramWithSource(context, 1, &rand_kernel_code, NULL, NULL);
-        err = clBuildProgram(rand_program, 1, &device_id, "", NULL, NULL);
-        if (err != CL_SUCCESS) {
-            size_t log_size;
-            clGetProgramBuildInfo(rand_program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-            char* build_log = (char*)malloc(log_size);
-            clGetProgramBuildInfo(rand_program, device_id, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
-            fprintf(stderr, "Random kernel build error:\n%s\n", build_log);
-            free(build_log);
-            return 1;
+        //Seq
+        unsigned char *input_seq = malloc(input_size);
+        double start_seq = wall_time();
+        random_bytes_parallel(&tables, seed, input_seq, input_len, 0);
+        double time_seq = wall_time() - start_seq;
+        printf("Seq generation time (%d threads): %.4f sec\n", cpu_count(), time_seq);
+
+        //OpenCL: the data stays on the device, the host only gets one copy for the CPU paths
+        double time_gpu;
+        device_input = clCreateBuffer(runtime.context, CL_MEM_READ_WRITE, input_len, NULL, NULL);
+        if (device_input && gpu_random_buffer(&runtime, &tables, seed, 0, device_input, input_len, &time_gpu) == 0 &&
+            clEnqueueReadBuffer(runtime.queue, device_input, CL_TRUE, 0, input_len, input, 0, NULL, NULL) == CL_SUCCESS) {
+            printf("OpenCL generation time: %.4f sec (seed %llu, %s)\n", time_gpu, (unsigned long long)seed,
+                   memcmp(input, input_seq, input_len) == 0 ? "identical" : "MISMATCH");
+        } else {
+            if (device_input) {
+                clReleaseMemObject(device_input);
+                device_input = NULL;
+            }
+            memcpy(input, input_seq, input_len);
         }
-
-        cl_kernel rand_kernel = clCreateKernel(rand_program, "generate_random_kernel", NULL);
-        cl_mem rand_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, input_len, NULL, NULL);
-
-        cl_ulong seed = (cl_ulong)time(NULL);
-        clSetKernelArg(rand_kernel, 0, sizeof(cl_mem), &rand_buffer);
-        clSetKernelArg(rand_kernel, 1, sizeof(cl_ulong), &seed);
-        clSetKernelArg(rand_kernel, 2, sizeof(cl_ulong), &input_len);
-
-        size_t local_size = 256;
-        size_t global_size = ((input_len + local_size - 1) / local_size) * local_size;
-
-        clock_t start_gpu = clock();
-        clEnqueueNDRangeKernel(command_queue, rand_kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
-        clFinish(command_queue);
-        clEnqueueReadBuffer(command_queue, rand_buffer, CL_TRUE, 0, input_len, input, 0, NULL, NULL);
-        clock_t end_gpu = clock();
-        double time_gpu = (double)(end_gpu - start_gpu) / CLOCKS_PER_SEC;
-        printf("OpenCL generation time: %.4f sec\n", time_gpu);
-
-        clReleaseKernel(rand_kernel);
-        clReleaseProgram(rand_program);
-        clReleaseMemObject(rand_buffer);
+        free(input_seq);
 
         //printf("Generated %zu random bytes with OpenCL.\n", input_len);
     } else {
@@ -225,67 +1377,40 @@ int manual(int input_size) {
     }
 
     // Seq
-    clock_t start_seq = clock();
-    int freq_seq[256] = {0};
+    double start_seq = wall_time();
+    uint64_t freq_seq[256] = {0};
     for (size_t i = 0; i < input_len; i++) {
         unsigned char byte = (unsigned char)input[i];
         freq_seq[byte]++;
     }
-    clock_t end_seq = clock();
-    double time_seq = (double)(end_seq - start_seq) / CLOCKS_PER_SEC;
-
-    // OpenCL
-    const char* kernel_code = load_kernel_source("kernels/byte_frequency.cl", &error_code);
-    if (error_code != 0) {
-        fprintf(stderr, "Kernel source load error!\n");
-        free(input);
-        return 1;
-    }
-
-    cl_program program = clCreateProgramWithSource(context, 1, &kernel_code, NULL, NULL);
-    err = clBuildProgram(program, 1, &device_id, "", NULL, NULL);
-    if (err != CL_SUCCESS) {
-        size_t log_size;
-        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        char* build_log = (char*)malloc(log_size);
-        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
-        fprintf(stderr, "Build error:\n%s\n", build_log);
-        free(build_log);
-        free(input);
+    double time_seq = wall_time() - start_seq;
+
+    // CPU: interleaved tables, every core
+    uint64_t freq_cpu[256];
+    double start_cpu = wall_time();
+    byte_histogram_parallel((const uint8_t*)input, input_len, freq_cpu, 0);
+    double time_cpu = wall_time() - start_cpu;
+
+    // OpenCL: generated data is counted where it already is, anything else is uploaded in chunks
+    // overlapped with the histogram kernel
+    uint64_t freq_gpu[256];
+    GpuHistogramTiming gpu_timing;
+    int rc_gpu = device_input
+                     ? gpu_buffer_histogram(&runtime, device_input, input_len, freq_gpu, &gpu_timing)
+                     : gpu_byte_histogram(&runtime, GPU_HISTOGRAM_VECTOR, (const uint8_t*)input, input_len, 0,
+                                          freq_gpu, &gpu_timing);
+    if (rc_gpu != 0) {
+        if (device_input) {
+            clReleaseMemObject(device_input);
+        }
+        free_manual_input(input, &source);
+        opencl_runtime_release(&runtime);
         return 1;
     }
+    double time_gpu = gpu_timing.kernel_time;
 
-    cl_kernel kernel = clCreateKernel(program, "byte_frequency_kernel", NULL);
-    cl_mem input_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, input_len, NULL, NULL);
-    cl_mem freq_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 256 * sizeof(int), NULL, NULL);
-
-    clEnqueueWriteBuffer(command_queue, input_buffer, CL_TRUE, 0, input_len, input, 0, NULL, NULL);
-    clEnqueueFillBuffer(command_queue, freq_buffer, &(int){0}, sizeof(int), 0, 256 * sizeof(int), 0, NULL, NULL);
-
-    clSetKernelArg(kernel, 0, sizeof(cl_mem), &input_buffer);
-    clSetKernelArg(kernel, 1, sizeof(cl_mem), &freq_buffer);
-    clSetKernelArg(kernel, 2, sizeof(cl_ulong), &input_len);
-
-    size_t num_chunks = (input_len + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    size_t local_work_size = 256;
-    size_t global_work_size = ((num_chunks + local_work_size - 1) / local_work_size) * local_work_size;
-
-    cl_event event;
-    clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
-                           &global_work_size, &local_work_size,
-                           0, NULL, &event);
-    clFinish(command_queue);
-
-    cl_ulong start, end;
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
-    double time_gpu = (end - start) / 1e9;
-
-    int freq_gpu[256];
-    clEnqueueReadBuffer(command_queue, freq_buffer, CL_TRUE, 0, 256 * sizeof(int), freq_gpu, 0, NULL, NULL);
-
-    int freq_seq_top[256][2];
-    int freq_gpu_top[256][2];
+    uint64_t freq_seq_top[256][2];
+    uint64_t freq_gpu_top[256][2];
     for (int i = 0; i < 256; i++) {
         freq_seq_top[i][0] = i;
         freq_seq_top[i][1] = freq_seq[i];
@@ -297,56 +1422,114 @@ int manual(int input_size) {
     qsort(freq_seq_top, 256, sizeof(freq_seq_top[0]), compare_freq);
     qsort(freq_gpu_top, 256, sizeof(freq_gpu_top[0]), compare_freq);
 
+    // The codes come from the histogram of the backend the dispatcher picks for this size
+    Dispatcher dispatcher;
+    dispatcher_init(&dispatcher, &runtime, DISPATCH_PROFILE_PATH);
+    dispatch_print_profile(&dispatcher, stdout);
+    dispatch_print_decision(&dispatcher, input_len, stdout);
+    uint64_t freq[256];
+    dispatch_histogram(&dispatcher, (const uint8_t*)input, input_len, freq);
+
     char codes[256][256] = {{0}};
     //huffmanEncoding(input, input_len, codes);
-    huffmanEncoding2(freq_gpu, codes);
+    huffmanEncoding2(freq, codes);
     
 	printf("\nSeq: Top 10 byte frequencies:\n");
 	for (int i = 0; i < 10; i++) {
-		int byteVal = freq_seq_top[i][0];
-		int count = freq_seq_top[i][1];
-		printf("Byte %3d: %d\n", byteVal, count);
+		int byteVal = (int)freq_seq_top[i][0];
+		uint64_t count = freq_seq_top[i][1];
+		printf("Byte %3d: %llu\n", byteVal, (unsigned long long)count);
 		if (codes[byteVal][0] != '\0') {
 			printf("Code: %s\n", codes[byteVal]);
 		}
 	}
 	printf("Seq: Runtime: %.6f sec\n", time_seq);
+	printf("CPU (%s, %d threads): Runtime: %.6f sec (%s)\n", byte_histogram_path(), cpu_count(), time_cpu,
+	       memcmp(freq_cpu, freq_seq, sizeof(freq_seq)) == 0 ? "identical" : "MISMATCH");
 
 	printf("\nOpenCL: Top 10 byte frequencies:\n");
 	for (int i = 0; i < 10; i++) {
-		int byteVal = freq_gpu_top[i][0];
-		int count = freq_gpu_top[i][1];
-		printf("Byte %3d: %d\n", byteVal, count);
+		int byteVal = (int)freq_gpu_top[i][0];
+		uint64_t count = freq_gpu_top[i][1];
+		printf("Byte %3d: %llu\n", byteVal, (unsigned long long)count);
 		if (codes[byteVal][0] != '\0') {
 			printf("Code: %s\n", codes[byteVal]);
 		}
 	}
 	printf("OpenCL: Runtime: %.6f sec\n", time_gpu);
+	printf("OpenCL: Transfer: %.6f sec, wall time: %.6f sec (%d buffers of %d MiB)\n", gpu_timing.transfer_time,
+	       gpu_timing.wall_time, GPU_HISTOGRAM_BUFFERS, GPU_HISTOGRAM_CHUNK_SIZE >> 20);
 
 	// Huffman seq
-
-	//char* encoded_bits_seq = malloc(MAX_INPUT_SIZE * 20);
-    //char encoded_bits_seq[4096];
-
-    size_t total_bits = 0;
-    for (size_t i = 0; i < input_len; i++) {
-        total_bits += strlen(codes[(unsigned char)input[i]]);
+    HuffmanCode code_table[256];
+    if (build_code_table(codes, code_table) != 0) {
+        fprintf(stderr, "Huffman code longer than 64 bits!\n");
+        free_manual_input(input, &source);
+        return 1;
     }
-    char* encoded_bits_seq = malloc(total_bits + 1);
+
+    size_t total_bits = huffman_encoded_bits(freq_seq, code_table);
+    uint8_t* encoded_bits_seq = malloc((total_bits + 7) / 8 + 1);
     if (!encoded_bits_seq) {
         fprintf(stderr, "Memory allocation failed for encoded bits!\n");
-        free(input);
+        free_manual_input(input, &source);
         return 1;
     }
 
 	size_t bitlen_seq = 0;
-	clock_t start_huff_seq = clock();
-	encode_input_with_huffman(input, input_len, codes, encoded_bits_seq, &bitlen_seq);
-	clock_t end_huff_seq = clock();
-	double time_huff_seq = (double)(end_huff_seq - start_huff_seq) / CLOCKS_PER_SEC;
+	double start_huff_seq = wall_time();
+	if (encode_input_with_huffman(input, input_len, code_table, encoded_bits_seq, &bitlen_seq) != 0) {
+		fprintf(stderr, "[ERROR] Missing Huffman code for a byte of the input!\n");
+	}
+	double time_huff_seq = wall_time() - start_huff_seq;
 
     printf("Huffman encoding runtime: %.6f sec\n", time_huff_seq);
 
+    double time_decode = 0.0;
+    bool round_trip = verify_round_trip(input, input_len, code_table, encoded_bits_seq, bitlen_seq, &time_decode);
+    printf("Huffman decoding runtime: %.6f sec (round trip %s)\n", time_decode, round_trip ? "OK" : "FAILED");
+
+    BlockIndex block_index;
+    HuffmanDecoder* decoder = malloc(sizeof(*decoder));
+    uint8_t* decoded = malloc(input_len + 1);
+    if (decoder && decoded && huffman_decoder_init(decoder, code_table) == 0 &&
+        block_index_build(input, input_len, code_table, BLOCK_INDEX_DEFAULT_BLOCK_SIZE, &block_index) == 0) {
+        double start_par_decode = wall_time();
+        int rc = huffman_decode_parallel(decoder, encoded_bits_seq, bitlen_seq, &block_index, decoded, input_len, 0);
+        double time_par_decode = wall_time() - start_par_decode;
+        printf("Parallel Huffman decoding runtime (%zu blocks, %zu index bytes): %.6f sec (%s)\n",
+               block_index.count, block_index_size(&block_index), time_par_decode,
+               rc == 0 && memcmp(decoded, input, input_len) == 0 ? "OK" : "FAILED");
+        block_index_free(&block_index);
+    }
+    free(decoder);
+    free(decoded);
+
+    uint8_t* encoded_bits_par = malloc((total_bits + 7) / 8 + 1);
+    if (encoded_bits_par) {
+        size_t bitlen_par = 0;
+        double start_huff_par = wall_time();
+        int rc = encode_input_parallel(input, input_len, code_table, encoded_bits_par, &bitlen_par, 0);
+        double time_huff_par = wall_time() - start_huff_par;
+        bool identical = rc == 0 && bitlen_par == bitlen_seq &&
+                         memcmp(encoded_bits_par, encoded_bits_seq, (bitlen_seq + 7) / 8) == 0;
+        printf("Parallel Huffman encoding runtime (%d threads): %.6f sec (%s)\n", cpu_count(), time_huff_par,
+               identical ? "identical" : "MISMATCH");
+        free(encoded_bits_par);
+    }
+
+    bool gpu_identical;
+    double time_huff_gpu = device_input ? gpu_encode_buffer_check(&runtime, device_input, input_len, code_table,
+                                                                  encoded_bits_seq, bitlen_seq, &gpu_identical)
+                                        : gpu_encode_check(&runtime, input, input_len, code_table,
+                                                           encoded_bits_seq, bitlen_seq, &gpu_identical);
+    if (time_huff_gpu >= 0.0) {
+        printf("OpenCL Huffman encoding runtime: %.6f sec (%s)\n", time_huff_gpu,
+               gpu_identical ? "identical" : "MISMATCH");
+    } else {
+        printf("OpenCL Huffman encoding skipped (codes longer than 32 bits or OpenCL error)\n");
+    }
+
     size_t compressed_bytes = (bitlen_seq + 7) / 8; // byte-ra kerekítés felfelé
     double compression_ratio = (double)compressed_bytes / (double)input_len;
     double saving = 100.0 - (compression_ratio * 100.0);
@@ -354,120 +1537,93 @@ int manual(int input_size) {
     printf("Original size: %zu bytes\n", input_len);
     printf("Compressed size: %zu bytes (%.0f bits)\n", compressed_bytes, (double)bitlen_seq);
     printf("Compression ratio: %.2f%%\n", compression_ratio * 100.0);
+    printf("Compression ratio with %d-bit canonical codes: %.2f%%\n", HUFFMAN_DEFAULT_MAX_CODE_LENGTH,
+           limited_compression_ratio(freq_seq, input_len, HUFFMAN_DEFAULT_MAX_CODE_LENGTH) * 100.0);
     printf("Space saved: %.2f%%\n", saving);
 
-    printf("\nIn which do you want to get the first 100 bits of the Huffman code?\n");
-	printf("1. Print to screen\n");
-	printf("2. Save to output.txt\n");
+    printf("\nWhat do you want to do with the Huffman code?\n");
+	printf("1. Print the first 100 bits to screen\n");
+	printf("2. Save the compressed file to output/output.huf\n");
 	printf("Enter choice [1/2]: ");
 	int output_choice;
 	scanf("%d", &output_choice);
 	getchar();
 
+    char first_bits[101];
+    size_t first_bits_len = bitlen_seq > 100 ? 100 : bitlen_seq;
+    for (size_t i = 0; i < first_bits_len; i++) {
+        first_bits[i] = ((encoded_bits_seq[i / 8] >> (7 - i % 8)) & 1) ? '1' : '0';
+    }
+    first_bits[first_bits_len] = '\0';
+
 	if (output_choice == 1) {
 		printf("First 100 bits:\n");
-		for (int i = 0; i < 100 && i < bitlen_seq; i++) {
-			putchar(encoded_bits_seq[i]);
-		}
-		putchar('\n');
+		printf("%s\n", first_bits);
 	} else {
-		FILE* out = fopen("output/output.txt", "w");
+		FILE* out = fopen("output/output.huf", "wb");
 		if (out) {
-			fwrite(encoded_bits_seq, 1, (bitlen_seq > 100 ? 100 : bitlen_seq), out);
+			if (huffman_compress_buffer((const uint8_t*)input, input_len, out, 0, 0, 0) == 0) {
+				printf("Compressed file written to output/output.huf\n");
+			} else {
+				fprintf(stderr, "Failed to write output/output.huf\n");
+			}
 			fclose(out);
-			printf("First 100 bits written to output.txt\n");
 		} else {
-			perror("Failed to open output.txt for writing");
+			perror("Failed to open output.huf for writing");
 		}
 	}
 
-    clReleaseKernel(kernel);
-    clReleaseProgram(program);
-    clReleaseContext(context);
-    clReleaseDevice(device_id);
-    clReleaseMemObject(input_buffer);
-    clReleaseMemObject(freq_buffer);
-    clReleaseCommandQueue(command_queue);
-    free(input);
+    if (device_input) {
+        clReleaseMemObject(device_input);
+    }
+    opencl_runtime_release(&runtime);
+    free(encoded_bits_seq);
+    free_manual_input(input, &source);
 
     return 0;
 }
 
-int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
-    cl_int err;
-    int error_code;
-
-    char* input = malloc(input_size);
+int test(OpenCLRuntime* runtime, size_t input_size, FILE *f_gen, FILE *f_freq, FILE *f_hist, FILE *f_comp, FILE *f_par, FILE *f_idx, FILE *f_src, FILE *f_ctx, FILE *f_zc, FILE *f_dev, FILE *f_cnt, FILE *f_ms, FILE *f_pipe) {
+    // Page aligned, so a device sharing the host's memory reads it in place
+    char* input = aligned_malloc(input_size, OPENCL_ZERO_COPY_ALIGNMENT);
     if (!input) {
         fprintf(stderr, "Memory allocation failed!\n");
         return 1;
     }
 
-    // OpenCL early setup
-    cl_platform_id platform_id;
-    cl_uint n_platforms;
-    err = clGetPlatformIDs(1, &platform_id, &n_platforms);
-
-    cl_device_id device_id;
-    cl_uint n_devices;
-    err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_GPU, 1, &device_id, &n_devices);
-
-    cl_context context = clCreateContext(NULL, n_devices, &device_id, NULL, NULL, NULL);
-    cl_queue_properties props[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,0};
-    cl_command_queue command_queue = clCreateCommandQueueWithProperties(context, device_id, props, NULL);
-    
     #pragma region Generation
      //Generation start
 
+    // Explicit seed, so the data of every run and of the CPU and the device is the same
+    RandomTables tables;
+    random_tables_init(&tables);
+    uint64_t seed = RANDOM_DEFAULT_SEED;
+    cl_ulong input_len = (cl_ulong)input_size;
+
     //Seq
     unsigned char *input_seq = malloc(input_size);
-    clock_t start_gen_seq = clock();
-    generate_random_seq(input_seq, input_size);
-    clock_t end_gen_seq = clock();
-    double time_gen_seq = (double)(end_gen_seq - start_gen_seq) / CLOCKS_PER_SEC;
-    //printf("Seq generation time: %.4f sec\n", time_seq);
+    double start_gen_seq = wall_time();
+    random_bytes(&tables, seed, 0, input_seq, input_size);
+    double time_gen_seq = wall_time() - start_gen_seq;
 
-    //OpenCL
-    cl_ulong input_len = (cl_ulong)input_size;
-    const char* rand_kernel_code = load_kernel_source("kernels/random_generator.cl", &error_code);
-    if (error_code != 0) {
-        fprintf(stderr, "Random kernel load error!\n");
-        free(input);
-        return 1;
-    }
+    double start_gen_par = wall_time();
+    random_bytes_parallel(&tables, seed, input_seq, input_size, 0);
+    double time_gen_par = wall_time() - start_gen_par;
 
-    cl_program rand_program = clCreateProgramWithSource(context, 1, &rand_kernel_code, NULL, NULL);
-    err = clBuildProgram(rand_program, 1, &device_id, "", NULL, NULL);
-    if (err != CL_SUCCESS) {
-        size_t log_size;
-        clGetProgramBuildInfo(rand_program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        char* build_log = (char*)malloc(log_size);
-        clGetProgramBuildInfo(rand_program, device_id, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
-        fprintf(stderr, "Random kernel build error:\n%s\n", build_log);
-        free(build_log);
-        return 1;
+    //OpenCL
+    double time_gen_gpu = -1.0;
+    bool gen_identical = false;
+    if (gpu_random_bytes(runtime, &tables, seed, 0, (uint8_t*)input, input_size, &time_gen_gpu) == 0) {
+        gen_identical = memcmp(input, input_seq, input_size) == 0;
+    } else {
+        time_gen_gpu = -1.0;
+        memcpy(input, input_seq, input_size);
     }
 
-    cl_kernel rand_kernel = clCreateKernel(rand_program, "generate_random_kernel", NULL);
-    cl_mem rand_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, input_len, NULL, NULL);
-
-    cl_ulong seed = (cl_ulong)time(NULL);
-    clSetKernelArg(rand_kernel, 0, sizeof(cl_mem), &rand_buffer);
-    clSetKernelArg(rand_kernel, 1, sizeof(cl_ulong), &seed);
-    clSetKernelArg(rand_kernel, 2, sizeof(cl_ulong), &input_len);
-
-    size_t local_size = 256;
-    size_t global_size = ((input_len + local_size - 1) / local_size) * local_size;
-
-    clock_t start_gen_gpu = clock();
-    clEnqueueNDRangeKernel(command_queue, rand_kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
-    clFinish(command_queue);
-    clEnqueueReadBuffer(command_queue, rand_buffer, CL_TRUE, 0, input_len, input, 0, NULL, NULL);
-    clock_t end_gen_gpu = clock();
-    double time_gen_gpu = (double)(end_gen_gpu - start_gen_gpu) / CLOCKS_PER_SEC;
-    //printf("OpenCL generation time: %.4f sec\n", time_gpu);
-
-    fprintf(f_gen, "%zu,%.4f,%.4f\n", input_size,    time_gen_seq, time_gen_gpu);
+    bool edges = random_edge_values_check(&tables) && !memchr(input_seq, 0, input_size) &&
+                 !memchr(input_seq, 255, input_size);
+    fprintf(f_gen, "%zu,%.4f,%.4f,%.4f,%s,%s\n", input_size, time_gen_seq, time_gen_par, time_gen_gpu,
+            gen_identical ? "OK" : "FAILED", edges ? "OK" : "FAILED");
 
     free(input_seq);
 
@@ -476,72 +1632,36 @@ int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
 
     #pragma region Byte frequency
 
-    clReleaseKernel(rand_kernel);
-    clReleaseProgram(rand_program);
-    clReleaseMemObject(rand_buffer);
-
     // Seq
-    clock_t start_seq = clock();
-    int freq_seq[256] = {0};
+    double start_seq = wall_time();
+    uint64_t freq_seq[256] = {0};
     for (size_t i = 0; i < input_len; i++) {
         unsigned char byte = (unsigned char)input[i];
         freq_seq[byte]++;
     }
-    clock_t end_seq = clock();
-    double time_seq = (double)(end_seq - start_seq) / CLOCKS_PER_SEC;
-
-    // OpenCL 
-    const char* kernel_code = load_kernel_source("kernels/byte_frequency.cl", &error_code);
-    if (error_code != 0) {
-        fprintf(stderr, "Kernel source load error!\n");
-        free(input);
+    double time_seq = wall_time() - start_seq;
+
+    // CPU: interleaved tables on one thread, then on every core
+    uint64_t freq_cpu[256];
+    double start_interleaved = wall_time();
+    byte_histogram((const uint8_t*)input, input_len, freq_cpu);
+    double time_interleaved = wall_time() - start_interleaved;
+
+    double start_cpu = wall_time();
+    byte_histogram_parallel((const uint8_t*)input, input_len, freq_cpu, 0);
+    double time_cpu = wall_time() - start_cpu;
+
+    // OpenCL: chunked upload overlapped with the histogram kernel
+    uint64_t freq_gpu[256];
+    GpuHistogramTiming gpu_timing;
+    if (gpu_byte_histogram(runtime, GPU_HISTOGRAM_VECTOR, (const uint8_t*)input, input_len, 0, freq_gpu, &gpu_timing) != 0) {
+        aligned_free(input);
         return 1;
     }
+    double time_gpu = gpu_timing.kernel_time;
 
-    cl_program program = clCreateProgramWithSource(context, 1, &kernel_code, NULL, NULL);
-    err = clBuildProgram(program, 1, &device_id, "", NULL, NULL);
-    if (err != CL_SUCCESS) {
-        size_t log_size;
-        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        char* build_log = (char*)malloc(log_size);
-        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
-        fprintf(stderr, "Build error:\n%s\n", build_log);
-        free(build_log);
-        free(input);
-        return 1;
-    }
-
-    cl_kernel kernel = clCreateKernel(program, "byte_frequency_kernel", NULL);
-    cl_mem input_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY, input_len, NULL, NULL);
-    cl_mem freq_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, 256 * sizeof(int), NULL, NULL);
-
-    clEnqueueWriteBuffer(command_queue, input_buffer, CL_TRUE, 0, input_len, input, 0, NULL, NULL);
-    clEnqueueFillBuffer(command_queue, freq_buffer, &(int){0}, sizeof(int), 0, 256 * sizeof(int), 0, NULL, NULL);
-
-    clSetKernelArg(kernel, 0, sizeof(cl_mem), &input_buffer);
-    clSetKernelArg(kernel, 1, sizeof(cl_mem), &freq_buffer);
-    clSetKernelArg(kernel, 2, sizeof(cl_ulong), &input_len);
-
-    size_t num_chunks = (input_len + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    size_t local_work_size = 256;
-    size_t global_work_size = ((num_chunks + local_work_size - 1) / local_work_size) * local_work_size;
-
-    cl_event event;
-    clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL,
-                           &global_work_size, &local_work_size,
-                           0, NULL, &event);
-    clFinish(command_queue);
-
-    cl_ulong start, end;
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
-    double time_gpu = (end - start) / 1e9;
-
-    int freq_gpu[256];
-    clEnqueueReadBuffer(command_queue, freq_buffer, CL_TRUE, 0, 256 * sizeof(int), freq_gpu, 0, NULL, NULL);
-
-    int freq_seq_top[256][2];
-    int freq_gpu_top[256][2];
+    uint64_t freq_seq_top[256][2];
+    uint64_t freq_gpu_top[256][2];
     for (int i = 0; i < 256; i++) {
         freq_seq_top[i][0] = i;
         freq_seq_top[i][1] = freq_seq[i];
@@ -558,8 +1678,8 @@ int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
     
 	//printf("\nSeq: Top 10 byte frequencies:\n");
 	for (int i = 0; i < 10; i++) {
-		int byteVal = freq_seq_top[i][0];
-		int count = freq_seq_top[i][1];
+		int byteVal = (int)freq_seq_top[i][0];
+		uint64_t count = freq_seq_top[i][1];
 		// printf("Byte %3d: %d\n", byteVal, count);
 		// if (codes[byteVal][0] != '\0') {
 		// 	printf("Code: %s\n", codes[byteVal]);
@@ -569,8 +1689,8 @@ int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
 
 	//printf("\nOpenCL: Top 10 byte frequencies:\n");
 	for (int i = 0; i < 10; i++) {
-		int byteVal = freq_gpu_top[i][0];
-		int count = freq_gpu_top[i][1];
+		int byteVal = (int)freq_gpu_top[i][0];
+		uint64_t count = freq_gpu_top[i][1];
 		// printf("Byte %3d: %d\n", byteVal, count);
 		// if (codes[byteVal][0] != '\0') {
 		// 	//printf("Code: %s\n", codes[byteVal]);
@@ -578,31 +1698,41 @@ int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
 	}
 	//printf("OpenCL: Runtime: %.6f sec\n", time_gpu);
 
-    fprintf(f_freq, "%zu,%.4f,%.4f\n", input_size, time_seq, time_gpu);
+    fprintf(f_freq, "%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%s,%.2f,%.2f,%.2f\n", input_size, time_seq, time_gpu, time_cpu,
+            gpu_timing.transfer_time, gpu_timing.wall_time, time_interleaved, byte_histogram_path(),
+            bench_throughput(input_len, time_seq), bench_throughput(input_len, time_interleaved),
+            bench_throughput(input_len, time_cpu));
+    histogram_kernel_comparison(runtime, input, input_len, f_hist);
 
     #pragma endregion
 
     #pragma region Huffman
     
-    size_t total_bits = 0;
-    for (size_t i = 0; i < input_len; i++) {
-        total_bits += strlen(codes[(unsigned char)input[i]]);
+    HuffmanCode code_table[256];
+    if (build_code_table(codes, code_table) != 0) {
+        fprintf(stderr, "Huffman code longer than 64 bits!\n");
+        aligned_free(input);
+        return 1;
     }
-    char* encoded_bits_seq = malloc(total_bits + 1);
+
+    size_t total_bits = huffman_encoded_bits(freq_seq, code_table);
+    uint8_t* encoded_bits_seq = malloc((total_bits + 7) / 8 + 1);
     if (!encoded_bits_seq) {
         fprintf(stderr, "Memory allocation failed for encoded bits!\n");
-        free(input);
+        aligned_free(input);
         return 1;
     }
 
 	size_t bitlen_seq = 0;
-	clock_t start_huff_seq = clock();
-	encode_input_with_huffman(input, input_len, codes, encoded_bits_seq, &bitlen_seq);
-	clock_t end_huff_seq = clock();
-	double time_huff_seq = (double)(end_huff_seq - start_huff_seq) / CLOCKS_PER_SEC;
+	double start_huff_seq = wall_time();
+	encode_input_with_huffman(input, input_len, code_table, encoded_bits_seq, &bitlen_seq);
+	double time_huff_seq = wall_time() - start_huff_seq;
 
     //printf("Huffman encoding runtime: %.6f sec\n", time_huff_seq);
 
+    double time_decode = 0.0;
+    bool round_trip = verify_round_trip(input, input_len, code_table, encoded_bits_seq, bitlen_seq, &time_decode);
+
     #pragma endregion
 
     #pragma region Compression
@@ -616,24 +1746,695 @@ int test(size_t input_size, FILE *f_gen,FILE *f_freq, FILE *f_comp) {
     // printf("Compression ratio: %.2f%%\n", compression_ratio * 100.0);
     // printf("Space saved: %.2f%%\n", saving);
 
-    fprintf(f_comp, "%zu,%.4f\n", input_size, compression_ratio);
+    bool gpu_identical;
+    double time_huff_gpu = gpu_encode_check(runtime, input, input_len, code_table,
+                                            encoded_bits_seq, bitlen_seq, &gpu_identical);
+
+    fprintf(f_comp, "%zu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%s,%.4f,%s\n", input_size, compression_ratio,
+            limited_compression_ratio(freq_seq, input_len, 11),
+            limited_compression_ratio(freq_seq, input_len, 12),
+            limited_compression_ratio(freq_seq, input_len, 15),
+            time_huff_seq, time_decode, round_trip ? "OK" : "FAILED",
+            time_huff_gpu, gpu_identical ? "OK" : "FAILED");
+
+    parallel_encode_scaling(input, input_len, code_table, encoded_bits_seq, bitlen_seq, f_par);
+    block_index_tradeoff(input, input_len, code_table, encoded_bits_seq, bitlen_seq, f_idx);
+    multi_stream_comparison(input, input_len, code_table, encoded_bits_seq, bitlen_seq, f_ms);
+    input_source_benchmark(input, input_len, f_src);
+    context_model_comparison(runtime, input, input_len, f_ctx);
+    zero_copy_comparison(runtime, &tables, (const uint8_t*)input, input_len, f_zc);
+    device_pipeline_comparison(runtime, &tables, input_len, freq_seq, code_table, encoded_bits_seq, bitlen_seq, f_dev);
+    container_benchmark((const uint8_t*)input, input_len, f_cnt);
+    pipeline_comparison(input, input_len, f_pipe);
 
     free(encoded_bits_seq);
 
     #pragma endregion
 
-    clReleaseKernel(kernel);
-    clReleaseProgram(program);
-    clReleaseContext(context);
-    clReleaseDevice(device_id);
-    clReleaseMemObject(input_buffer);
-    clReleaseMemObject(freq_buffer);
-    clReleaseCommandQueue(command_queue);
-    free(input);
+    aligned_free(input);
+
+    return 0;
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr,
+            "Usage:\n"
+            "  %s                                         interactive mode\n"
+            "  %s compress [input|-] [output|-] [--block-size N] [--order 0|1] [--streams N] [--threads N] [--stats]\n"
+            "  %s decompress [input|-] [output|-]\n"
+            "  %s extract input [output|-] [--offset N] [--length N]\n"
+            "  %s bench [--warmup N] [--repetitions N] [--max-size N]\n"
+            "  %s devices [--sub-devices N] [--max-size N]\n"
+            "  %s synthetic [--size N] [--seed N] [--verify]\n"
+            "  %s daemon [--socket PATH] [--threads N]\n"
+            "  %s client compress|decompress|histogram|stats|shutdown [input|-] [output|-] [--socket PATH]"
+            " [--order N] [--streams N]\n"
+            "  %s loadgen [--socket PATH] [--operation compress|decompress|histogram] [--connections N]"
+            " [--requests N] [--size N]\n"
+            "Missing or \"-\" paths mean stdin / stdout.\n",
+            program, program, program, program, program, program, program, program, program, program);
+}
+
+// Every OpenCL device of every platform (CPU devices optionally split into sub-devices of
+// sub_device_units compute units), weighted by measured throughput, against one device and the CPU.
+// Results go to output/multi_device_results.txt.
+int multi_device_comparison(cl_uint sub_device_units, size_t max_size) {
+    GpuDeviceSet* set = malloc(sizeof(*set));
+    if (!set) {
+        return 1;
+    }
+    if (gpu_device_set_init(set, CL_DEVICE_TYPE_ALL, sub_device_units, OPENCL_RUNTIME_CACHE_DIR) == 0) {
+        fprintf(stderr, "No usable OpenCL device on any platform\n");
+        free(set);
+        return 1;
+    }
+
+    RandomTables tables;
+    random_tables_init(&tables);
+    gpu_device_set_calibrate(set, &tables, GPU_MULTI_CALIBRATION_SIZE);
+    printf("%d OpenCL device(s):\n", set->count);
+    gpu_device_set_print(set, stdout);
+
+    size_t sizes[MULTI_DEVICE_SIZE_COUNT];
+    FILE* f_multi = fopen("output/multi_device_results.txt", "w");
+    uint8_t* reference = max_size >= (1 << 21) ? aligned_malloc(max_size, OPENCL_ZERO_COPY_ALIGNMENT) : NULL;
+    uint8_t* output = reference ? aligned_malloc(max_size, OPENCL_ZERO_COPY_ALIGNMENT) : NULL;
+    int status = 1;
+
+    if (f_multi && output && exponential(1 << 20, (double)max_size, MULTI_DEVICE_SIZE_COUNT, sizes) == 0) {
+        status = 0;
+        fprintf(f_multi, "Size,Devices,CpuHistTime,OneDeviceHistTime,MultiHistTime,CpuGenTime,OneDeviceGenTime,MultiGenTime,Identical\n");
+        for (int i = 0; i < MULTI_DEVICE_SIZE_COUNT; i++) {
+            size_t size = sizes[i];
+            double start = wall_time();
+            random_bytes_parallel(&tables, RANDOM_DEFAULT_SEED, reference, size, 0);
+            double time_cpu_gen = wall_time() - start;
+
+            start = wall_time();
+            int rc = gpu_random_bytes(&set->runtimes[0], &tables, RANDOM_DEFAULT_SEED, 0, output, size, NULL);
+            double time_one_gen = rc == 0 ? wall_time() - start : -1.0;
+
+            start = wall_time();
+            rc = gpu_multi_random_bytes(set, &tables, RANDOM_DEFAULT_SEED, output, size);
+            double time_multi_gen = wall_time() - start;
+            bool identical = rc == 0 && memcmp(output, reference, size) == 0;
+
+            uint64_t freq_cpu[256], freq_one[256], freq_multi[256];
+            start = wall_time();
+            byte_histogram_parallel(reference, size, freq_cpu, 0);
+            double time_cpu_hist = wall_time() - start;
+
+            start = wall_time();
+            rc = gpu_byte_histogram(&set->runtimes[0], GPU_HISTOGRAM_VECTOR, reference, size, 0, freq_one, NULL);
+            double time_one_hist = rc == 0 ? wall_time() - start : -1.0;
+
+            start = wall_time();
+            rc = gpu_multi_histogram(set, reference, size, freq_multi);
+            double time_multi_hist = wall_time() - start;
+            identical = identical && rc == 0 && memcmp(freq_multi, freq_cpu, sizeof(freq_cpu)) == 0;
+
+            fprintf(f_multi, "%zu,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%s\n", size, set->count, time_cpu_hist,
+                    time_one_hist, time_multi_hist, time_cpu_gen, time_one_gen, time_multi_gen,
+                    identical ? "OK" : "FAILED");
+            printf("  %10zu bytes  histogram: cpu %.4f s, one device %.4f s, %d devices %.4f s;"
+                   "  generation: cpu %.4f s, one device %.4f s, %d devices %.4f s  (%s)\n",
+                   size, time_cpu_hist, time_one_hist, set->count, time_multi_hist, time_cpu_gen, time_one_gen,
+                   set->count, time_multi_gen, identical ? "identical" : "MISMATCH");
+        }
+    } else {
+        fprintf(stderr, "Cannot run the multi-device comparison (output/ missing, out of memory or size below 2 MiB)\n");
+    }
+
+    if (f_multi) {
+        fclose(f_multi);
+    }
+    aligned_free(output);
+    aligned_free(reference);
+    gpu_device_set_release(set);
+    free(set);
+    return status;
+}
+
+int devices_command(int argc, char* argv[]) {
+    cl_uint sub_device_units = 0;
+    size_t max_size = MAX_INPUT_SIZE;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--sub-devices") == 0 && i + 1 < argc) {
+            sub_device_units = (cl_uint)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    return multi_device_comparison(sub_device_units, max_size);
+}
+
+// Histogram of the CPU generator's stream in GPU_HISTOGRAM_CHUNK_SIZE pieces, for checking the synthetic load
+int synthetic_cpu_histogram(const RandomTables* tables, uint64_t seed, uint64_t size, uint64_t freq[256]) {
+    uint8_t* chunk = malloc(GPU_HISTOGRAM_CHUNK_SIZE);
+    if (!chunk) {
+        return -1;
+    }
+    memset(freq, 0, 256 * sizeof(freq[0]));
+    for (uint64_t offset = 0; offset < size; offset += GPU_HISTOGRAM_CHUNK_SIZE) {
+        size_t length = size - offset < GPU_HISTOGRAM_CHUNK_SIZE ? (size_t)(size - offset) : GPU_HISTOGRAM_CHUNK_SIZE;
+        uint64_t chunk_freq[256];
+        random_bytes(tables, seed, offset, chunk, length);
+        byte_histogram_parallel(chunk, length, chunk_freq, 0);
+        for (int i = 0; i < 256; i++) {
+            freq[i] += chunk_freq[i];
+        }
+    }
+    free(chunk);
+    return 0;
+}
+
+// Synthetic load: the test data is generated and counted on the device in one pass and never
+// stored, so --size may exceed host and device memory; --verify repeats it on the CPU
+int synthetic_command(int argc, char* argv[]) {
+    uint64_t size = SYNTHETIC_DEFAULT_SIZE;
+    uint64_t seed = RANDOM_DEFAULT_SEED;
+    bool verify = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    OpenCLRuntime runtime;
+    if (opencl_runtime_init(&runtime, OPENCL_RUNTIME_CACHE_DIR, false) != 0) {
+        return 1;
+    }
+    RandomTables tables;
+    random_tables_init(&tables);
+
+    uint64_t freq[256];
+    GpuHistogramTiming timing;
+    int status = gpu_random_histogram(&runtime, &tables, seed, 0, size, freq, &timing) == 0 ? 0 : 1;
+    if (status == 0) {
+        HuffmanCode table[256];
+        double encoded = huffmanEncodingCanonical(freq, HUFFMAN_DEFAULT_MAX_CODE_LENGTH, table) == 0 && size > 0
+                             ? (double)huffman_encoded_bits(freq, table) / 8 / size * 100.0
+                             : 0.0;
+        printf("Synthetic load: %llu bytes (seed %llu) in %.4f sec, %.2f GB/s (kernels %.4f sec)\n",
+               (unsigned long long)size, (unsigned long long)seed, timing.wall_time,
+               timing.wall_time > 0.0 ? size / timing.wall_time / 1e9 : 0.0, timing.kernel_time);
+        printf("Huffman encoded size with %d-bit codes: %.2f%%\n", HUFFMAN_DEFAULT_MAX_CODE_LENGTH, encoded);
+    }
+
+    if (status == 0 && verify) {
+        uint64_t freq_cpu[256];
+        double start = wall_time();
+        if (synthetic_cpu_histogram(&tables, seed, size, freq_cpu) != 0) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            status = 1;
+        } else {
+            bool identical = memcmp(freq, freq_cpu, sizeof(freq)) == 0;
+            printf("CPU: %.4f sec (%s)\n", wall_time() - start, identical ? "identical" : "MISMATCH");
+            status = identical ? 0 : 1;
+        }
+    }
 
+    opencl_runtime_release(&runtime);
+    return status;
+}
+
+// Non-interactive benchmark run, the defaults of the interactive bench mode can be overridden
+int bench_command(int argc, char* argv[]) {
+    int warmup = BENCH_DEFAULT_WARMUP;
+    int repetitions = BENCH_DEFAULT_REPETITIONS;
+    size_t max_size = MAX_INPUT_SIZE;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    return benchmark(warmup, repetitions, max_size);
+}
+
+// Uncompressed bytes [begin, begin + length) of an indexed file to out, a window at a time with
+// the blocks of each window decoded in parallel; windows end on block boundaries where they can
+int decompress_indexed(const InputSource* source, const StreamIndex* index, uint64_t begin, uint64_t length,
+                       FILE* out) {
+    size_t window = length < DECOMPRESS_WINDOW_SIZE ? (size_t)length : DECOMPRESS_WINDOW_SIZE;
+    uint8_t* buffer = malloc(window > 0 ? window : 1);
+    if (!buffer) {
+        return -1;
+    }
+
+    int status = 0;
+    uint64_t end = begin + length;
+    size_t block = 0;  // the first block that ends past the window end; windows only move forward
+    while (status == 0 && begin < end) {
+        uint64_t next = end - begin > window ? begin + window : end;
+        while (block < index->count && index->entries[block].data_offset + index->entries[block].size <= next) {
+            block++;
+        }
+        if (next < end && block < index->count) {
+            const StreamIndexEntry* entry = &index->entries[block];
+            if (entry->data_offset < next && entry->data_offset > begin) {
+                next = entry->data_offset;
+            }
+        }
+        size_t count = (size_t)(next - begin);
+        if (huffman_decompress_range(source->data, source->size, index, begin, count, buffer, 0) != 0 ||
+            fwrite(buffer, 1, count, out) != count) {
+            status = -1;
+        }
+        begin = next;
+    }
+
+    free(buffer);
+    return status == 0 && fflush(out) == 0 ? 0 : -1;
+}
+
+// Random access into a compressed file through its index: only the blocks covering the range are decoded
+int extract_command(int argc, char* argv[]) {
+    const char* paths[2] = {NULL, NULL};
+    int path_count = 0;
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            offset = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+            length = strtoull(argv[++i], NULL, 10);
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!paths[0] || strcmp(paths[0], "-") == 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    InputSource source;
+    StreamIndex index;
+    if (input_source_open(&source, paths[0], 1) != 0) {
+        perror(paths[0]);
+        return 1;
+    }
+    if (huffman_index_read(source.data, source.size, &index) != 0) {
+        fprintf(stderr, "%s: no index (version 1 file or corrupt input)\n", paths[0]);
+        input_source_close(&source);
+        return 1;
+    }
+
+    int rc = -1;
+    bool use_stdout = paths[1] == NULL || strcmp(paths[1], "-") == 0;
+    FILE* out = use_stdout ? stdout : fopen(paths[1], "wb");
+    if (!out) {
+        perror(paths[1]);
+    } else if (offset > index.total_size) {
+        fprintf(stderr, "extract failed: offset beyond the %llu uncompressed bytes\n",
+                (unsigned long long)index.total_size);
+    } else {
+        if (length > index.total_size - offset) {
+            length = index.total_size - offset;
+        }
+        rc = decompress_indexed(&source, &index, offset, length, out);
+        if (rc != 0) {
+            fprintf(stderr, "extract failed: I/O error or corrupt input\n");
+        }
+    }
+
+    if (out && !use_stdout && fclose(out) != 0) {
+        rc = -1;
+    }
+    huffman_index_free(&index);
+    input_source_close(&source);
+    return rc == 0 ? 0 : 1;
+}
+
+// Compression service: the OpenCL runtime, its programs and the dispatcher profile are set up once
+// and every request on the socket uses them warm
+int daemon_command(int argc, char* argv[]) {
+    const char* socket_path = DAEMON_DEFAULT_SOCKET;
+    int threads = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 0 || threads > DAEMON_MAX_THREADS) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    OpenCLRuntime runtime;
+    bool have_runtime = opencl_runtime_init(&runtime, OPENCL_RUNTIME_CACHE_DIR, false) == 0;
+    if (have_runtime) {
+        printf("OpenCL runtime ready in %.4f sec\n", runtime.startup_time);
+    } else {
+        printf("No OpenCL runtime, histograms run on the CPU\n");
+    }
+    Dispatcher dispatcher;
+    dispatcher_init(&dispatcher, have_runtime ? &runtime : NULL, DISPATCH_PROFILE_PATH);
+
+    int rc = -1;
+    DaemonServer* server = daemon_open(socket_path, threads, &dispatcher, stdout);
+    if (server) {
+        rc = daemon_run(server);
+        daemon_close(server);
+    }
+    if (have_runtime) {
+        opencl_runtime_release(&runtime);
+    }
+    return rc == 0 ? 0 : 1;
+}
+
+// All of file into a malloc'd buffer
+int read_whole_file(FILE* file, uint8_t** data, size_t* size) {
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    uint8_t* buffer = malloc(capacity);
+    while (buffer) {
+        length += fread(buffer + length, 1, capacity - length, file);
+        if (length < capacity) {
+            break;
+        }
+        uint8_t* grown = realloc(buffer, capacity * 2);
+        if (!grown) {
+            free(buffer);
+            buffer = NULL;
+        } else {
+            buffer = grown;
+            capacity *= 2;
+        }
+    }
+    if (!buffer || ferror(file)) {
+        free(buffer);
+        return -1;
+    }
+    *data = buffer;
+    *size = length;
     return 0;
 }
 
-int main() {
-    mode();
+// One request to a running daemon: the input is sent whole, the answer written to the output
+int client_command(int argc, char* argv[]) {
+    const char* socket_path = DAEMON_DEFAULT_SOCKET;
+    const char* paths[2] = {NULL, NULL};
+    int path_count = 0;
+    int order = 0;
+    int streams = 0;
+    int operation = argc > 2 ? daemon_operation_parse(argv[2]) : -1;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc) {
+            order = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            streams = atoi(argv[++i]);
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (operation < 0 || order < 0 || order > STREAM_MAX_ORDER || streams < 0 || streams > HUFFMAN_MAX_STREAMS) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    uint8_t* payload = NULL;
+    size_t payload_size = 0;
+    bool has_input = operation == DAEMON_COMPRESS || operation == DAEMON_DECOMPRESS || operation == DAEMON_HISTOGRAM;
+    if (has_input) {
+        bool use_stdin = paths[0] == NULL || strcmp(paths[0], "-") == 0;
+        FILE* in = use_stdin ? stdin : fopen(paths[0], "rb");
+        if (!in) {
+            perror(paths[0]);
+            return 1;
+        }
+        int rc = read_whole_file(in, &payload, &payload_size);
+        if (!use_stdin) fclose(in);
+        if (rc != 0) {
+            fprintf(stderr, "%s: read failed\n", paths[0] ? paths[0] : "stdin");
+            return 1;
+        }
+    }
+
+    DaemonClient* client = daemon_client_connect(socket_path);
+    if (!client) {
+        fprintf(stderr, "No daemon listening on %s\n", socket_path);
+        free(payload);
+        return 1;
+    }
+    uint8_t* response = NULL;
+    size_t response_size = 0;
+    int rc = daemon_client_request(client, (DaemonOperation)operation, order, streams, payload, payload_size,
+                                   &response, &response_size);
+    daemon_client_close(client);
+    free(payload);
+    if (rc != 0) {
+        fprintf(stderr, "%s failed\n", argv[2]);
+        free(response);
+        return 1;
+    }
+
+    const char* output = has_input ? paths[1] : paths[0];
+    bool use_stdout = output == NULL || strcmp(output, "-") == 0;
+    FILE* out = use_stdout ? stdout : fopen(output, "wb");
+    if (!out) {
+        perror(output);
+        free(response);
+        return 1;
+    }
+    if (operation == DAEMON_HISTOGRAM && response_size == 256 * sizeof(uint64_t)) {
+        for (int i = 0; i < 256; i++) {
+            uint64_t count = 0;
+            for (int b = 0; b < 8; b++) {
+                count |= (uint64_t)response[i * 8 + b] << (8 * b);
+            }
+            if (count > 0) {
+                fprintf(out, "%d %llu\n", i, (unsigned long long)count);
+            }
+        }
+    } else if (response_size > 0 && fwrite(response, 1, response_size, out) != response_size) {
+        rc = -1;
+    }
+    if (!use_stdout) {
+        if (fclose(out) != 0) rc = -1;
+    } else if (fflush(out) != 0) {
+        rc = -1;
+    }
+    free(response);
+    return rc == 0 ? 0 : 1;
+}
+
+// Closed-loop load on a running daemon, then the latency table the daemon keeps
+int loadgen_command(int argc, char* argv[]) {
+    const char* socket_path = DAEMON_DEFAULT_SOCKET;
+    int operation = DAEMON_COMPRESS;
+    int connections = 1;
+    int requests = 100;
+    size_t size = 1 << 16;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--operation") == 0 && i + 1 < argc) {
+            operation = daemon_operation_parse(argv[++i]);
+        } else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            requests = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = (size_t)strtoull(argv[++i], NULL, 10);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((operation != DAEMON_COMPRESS && operation != DAEMON_DECOMPRESS && operation != DAEMON_HISTOGRAM) ||
+        connections < 1 || connections > DAEMON_MAX_THREADS || requests < 1 || size > DAEMON_MAX_PAYLOAD) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    DaemonLoadStats stats;
+    if (daemon_load_generate(socket_path, (DaemonOperation)operation, connections, requests, size, &stats) != 0) {
+        fprintf(stderr, "No daemon listening on %s\n", socket_path);
+        return 1;
+    }
+    printf("%d %s requests of %zu bytes on %d connection(s) in %.4f sec, %.1f req/s\n", stats.requests,
+           daemon_operation_name((DaemonOperation)operation), size, connections, stats.time,
+           stats.time > 0.0 ? stats.requests / stats.time : 0.0);
+    printf("Latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms; %d failed\n", stats.latency.median * 1e3,
+           stats.latency.p99 * 1e3, stats.latency.max * 1e3, stats.failures);
+
+    DaemonClient* client = daemon_client_connect(socket_path);
+    uint8_t* response = NULL;
+    size_t response_size = 0;
+    if (client && daemon_client_request(client, DAEMON_STATS, 0, 0, NULL, 0, &response, &response_size) == 0) {
+        printf("\nDaemon:\n");
+        fwrite(response, 1, response_size, stdout);
+    }
+    if (client) daemon_client_close(client);
+    free(response);
+    return stats.failures == 0 ? 0 : 1;
+}
+
+// Non-interactive compress / decompress, streamed block by block
+int command_line(int argc, char* argv[]) {
+    if (strcmp(argv[1], "bench") == 0) {
+        return bench_command(argc, argv);
+    }
+    if (strcmp(argv[1], "devices") == 0) {
+        return devices_command(argc, argv);
+    }
+    if (strcmp(argv[1], "synthetic") == 0) {
+        return synthetic_command(argc, argv);
+    }
+    if (strcmp(argv[1], "extract") == 0) {
+        return extract_command(argc, argv);
+    }
+    if (strcmp(argv[1], "daemon") == 0) {
+        return daemon_command(argc, argv);
+    }
+    if (strcmp(argv[1], "client") == 0) {
+        return client_command(argc, argv);
+    }
+    if (strcmp(argv[1], "loadgen") == 0) {
+        return loadgen_command(argc, argv);
+    }
+
+    const char* paths[2] = {NULL, NULL};
+    int path_count = 0;
+    size_t block_size = 0;
+    int order = 0;
+    int streams = 0;
+    int threads = 0;
+    bool show_stats = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            block_size = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc) {
+            order = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc) {
+            streams = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    bool compress = strcmp(argv[1], "compress") == 0;
+    if ((!compress && strcmp(argv[1], "decompress") != 0) || order < 0 || order > STREAM_MAX_ORDER || streams < 0 ||
+        streams > HUFFMAN_MAX_STREAMS || threads < 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    bool use_stdin = paths[0] == NULL || strcmp(paths[0], "-") == 0;
+    bool use_stdout = paths[1] == NULL || strcmp(paths[1], "-") == 0;
+    FILE* in = use_stdin ? stdin : fopen(paths[0], "rb");
+    if (!in) {
+        perror(paths[0]);
+        return 1;
+    }
+    FILE* out = use_stdout ? stdout : fopen(paths[1], "wb");
+    if (!out) {
+        perror(paths[1]);
+        if (!use_stdin) fclose(in);
+        return 1;
+    }
+
+    // With more than one thread compression runs through the pipeline. Otherwise regular input files are
+    // compressed straight from a mapping; with an index and more than one core they are decompressed from
+    // it in parallel. The rest is streamed with fread
+    InputSource source;
+    StreamIndex index;
+    PipelineStats stats;
+    int rc;
+    if (threads == 0) {
+        threads = cpu_count();
+    }
+    if (compress && threads > 1) {
+        rc = huffman_compress_pipeline(in, out, block_size, order, streams, threads, &stats);
+        if (show_stats) {
+            pipeline_stats_print(&stats, stderr);
+        }
+    } else if (!use_stdin && input_source_open(&source, paths[0], 1) == 0) {
+        if (compress) {
+            rc = huffman_compress_buffer(source.data, source.size, out, block_size, order, streams);
+        } else if (cpu_count() > 1 && huffman_index_read(source.data, source.size, &index) == 0) {
+            rc = decompress_indexed(&source, &index, 0, index.total_size, out);
+            huffman_index_free(&index);
+        } else {
+            rc = huffman_decompress_stream(in, out);
+        }
+        input_source_close(&source);
+    } else {
+        rc = compress ? huffman_compress_stream(in, out, block_size, order, streams) : huffman_decompress_stream(in, out);
+    }
+    if (rc != 0) {
+        fprintf(stderr, "%s failed: %s\n", argv[1], compress ? "I/O error" : "I/O error or corrupt input");
+    }
+
+    if (!use_stdin) fclose(in);
+    if (!use_stdout && fclose(out) != 0) {
+        rc = -1;
+    }
+    return rc == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        return command_line(argc, argv);
+    }
+    return mode();
 }
\ No newline at end of file
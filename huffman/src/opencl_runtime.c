@@ -0,0 +1,350 @@
+#include "opencl_runtime.h"
+#include "kernel_loader.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ProgramSource {
+    const char* name;     // kernels/<name>.cl, also the name of the cache file
+    const char* options;  // clBuildProgram options
+} ProgramSource;
+
+typedef struct KernelSource {
+    const char* name;
+    OpenCLProgramId program;
+} KernelSource;
+
+static const ProgramSource program_sources[OPENCL_PROGRAM_COUNT] = {
+    [OPENCL_PROGRAM_RANDOM]    = {"random_generator", ""},
+    [OPENCL_PROGRAM_FREQUENCY] = {"byte_frequency", ""},
+    [OPENCL_PROGRAM_ENCODE]    = {"huffman_encode", ""},
+};
+
+static const KernelSource kernel_sources[OPENCL_KERNEL_COUNT] = {
+    [OPENCL_KERNEL_RANDOM]           = {"generate_random_kernel", OPENCL_PROGRAM_RANDOM},
+    [OPENCL_KERNEL_RANDOM_FREQUENCY] = {"random_frequency_kernel", OPENCL_PROGRAM_RANDOM},
+    [OPENCL_KERNEL_FREQUENCY]        = {"byte_frequency_kernel", OPENCL_PROGRAM_FREQUENCY},
+    [OPENCL_KERNEL_FREQUENCY_VECTOR] = {"byte_frequency_vec_kernel", OPENCL_PROGRAM_FREQUENCY},
+    [OPENCL_KERNEL_FREQUENCY_REDUCE] = {"byte_frequency_reduce_kernel", OPENCL_PROGRAM_FREQUENCY},
+    [OPENCL_KERNEL_PAIR_FREQUENCY]   = {"pair_frequency_kernel", OPENCL_PROGRAM_FREQUENCY},
+    [OPENCL_KERNEL_PAIR_REDUCE]      = {"pair_frequency_reduce_kernel", OPENCL_PROGRAM_FREQUENCY},
+    [OPENCL_KERNEL_BIT_COUNT]        = {"huffman_bit_count_kernel", OPENCL_PROGRAM_ENCODE},
+    [OPENCL_KERNEL_SCAN]             = {"huffman_scan_kernel", OPENCL_PROGRAM_ENCODE},
+    [OPENCL_KERNEL_ENCODE]           = {"huffman_encode_kernel", OPENCL_PROGRAM_ENCODE},
+};
+
+// 64-bit FNV-1a, including the terminating zero so that "ab" + "c" and "a" + "bc" differ
+static uint64_t fnv1a(uint64_t hash, const char* text) {
+    do {
+        hash ^= (unsigned char)*text;
+        hash *= 0x100000001b3ULL;
+    } while (*text++);
+    return hash;
+}
+
+static uint64_t device_hash(cl_device_id device) {
+    static const cl_device_info params[] = {CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    char value[1024];
+
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        if (clGetDeviceInfo(device, params[i], sizeof(value), value, NULL) != CL_SUCCESS) {
+            value[0] = '\0';
+        }
+        value[sizeof(value) - 1] = '\0';
+        hash = fnv1a(hash, value);
+    }
+    return hash;
+}
+
+static unsigned char* read_binary(const char* path, size_t* size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+
+    unsigned char* binary = NULL;
+    long file_size;
+    if (fseek(fp, 0, SEEK_END) == 0 && (file_size = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        binary = malloc((size_t)file_size);
+        if (binary && fread(binary, 1, (size_t)file_size, fp) != (size_t)file_size) {
+            free(binary);
+            binary = NULL;
+        }
+        *size = (size_t)file_size;
+    }
+
+    fclose(fp);
+    return binary;
+}
+
+// Written under a temporary name first, so a concurrent or interrupted run never sees half a binary
+static void store_binary(cl_program program, const char* path) {
+    char temp_path[1024];
+    int length = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if (length < 0 || (size_t)length >= sizeof(temp_path)) {
+        return;  // a cut name could rename some other file over the binary, so nothing is cached
+    }
+
+    size_t size = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0) {
+        return;
+    }
+
+    unsigned char* binary = malloc(size);
+    if (!binary || clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) != CL_SUCCESS) {
+        free(binary);
+        return;
+    }
+
+    FILE* fp = fopen(temp_path, "wb");
+    if (fp) {
+        bool written = fwrite(binary, 1, size, fp) == size;
+        if (fclose(fp) == 0 && written) {
+            remove(path);
+            rename(temp_path, path);
+        } else {
+            remove(temp_path);
+        }
+    }
+    free(binary);
+}
+
+static cl_program load_cached_program(OpenCLRuntime* runtime, const char* path, const char* options) {
+    size_t size = 0;
+    unsigned char* binary = read_binary(path, &size);
+    if (!binary) {
+        return NULL;
+    }
+
+    cl_int binary_status, err;
+    const unsigned char* binaries[] = {binary};
+    cl_program program = clCreateProgramWithBinary(runtime->context, 1, &runtime->device, &size, binaries,
+                                                   &binary_status, &err);
+    free(binary);
+    if (err != CL_SUCCESS || binary_status != CL_SUCCESS) {
+        if (program) {
+            clReleaseProgram(program);
+        }
+        return NULL;
+    }
+
+    // A binary still has to be built, but it is only linked for the device, not compiled
+    if (clBuildProgram(program, 1, &runtime->device, options, NULL, NULL) != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+static cl_program build_program(OpenCLRuntime* runtime, const char* name, const char* source, const char* options) {
+    cl_program program = clCreateProgramWithSource(runtime->context, 1, &source, NULL, NULL);
+    if (!program) {
+        fprintf(stderr, "Kernel program create error: %s\n", name);
+        return NULL;
+    }
+
+    if (clBuildProgram(program, 1, &runtime->device, options, NULL, NULL) != CL_SUCCESS) {
+        size_t log_size;
+        clGetProgramBuildInfo(program, runtime->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+        char* build_log = (char*)malloc(log_size);
+        clGetProgramBuildInfo(program, runtime->device, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
+        fprintf(stderr, "Kernel build error (%s):\n%s\n", name, build_log);
+        free(build_log);
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+static int init_program(OpenCLRuntime* runtime, OpenCLProgramId id, const char* cache_dir, bool rebuild,
+                        uint64_t device_key) {
+    const ProgramSource* program_source = &program_sources[id];
+    char path[1024];
+    int error_code;
+
+    snprintf(path, sizeof(path), "kernels/%s.cl", program_source->name);
+    char* source = load_kernel_source(path, &error_code);
+    if (error_code != 0) {
+        fprintf(stderr, "Kernel source load error: %s\n", path);
+        return -1;
+    }
+
+    char cache_path[1024];
+    if (cache_dir) {
+        uint64_t key = fnv1a(fnv1a(device_key, program_source->options), source);
+        snprintf(cache_path, sizeof(cache_path), "%s/%s-%016llx.bin", cache_dir, program_source->name,
+                 (unsigned long long)key);
+    }
+
+    cl_program program = NULL;
+    if (cache_dir && !rebuild) {
+        program = load_cached_program(runtime, cache_path, program_source->options);
+        if (program) {
+            runtime->cached_programs++;
+        }
+    }
+    if (!program) {
+        program = build_program(runtime, path, source, program_source->options);
+        if (program && cache_dir) {
+            store_binary(program, cache_path);
+        }
+    }
+
+    free(source);
+    runtime->programs[id] = program;
+    return program ? 0 : -1;
+}
+
+int opencl_find_devices(cl_device_type types, cl_platform_id* platforms, cl_device_id* devices, int max_devices) {
+    cl_platform_id all_platforms[OPENCL_MAX_PLATFORMS];
+    cl_uint platform_count;
+    int count = 0;
+
+    if (clGetPlatformIDs(OPENCL_MAX_PLATFORMS, all_platforms, &platform_count) != CL_SUCCESS) {
+        return 0;
+    }
+    if (platform_count > OPENCL_MAX_PLATFORMS) {
+        platform_count = OPENCL_MAX_PLATFORMS;
+    }
+
+    for (cl_uint p = 0; p < platform_count && count < max_devices; p++) {
+        cl_uint device_count;
+        if (clGetDeviceIDs(all_platforms[p], types, (cl_uint)(max_devices - count), devices + count,
+                           &device_count) != CL_SUCCESS) {
+            continue;  // CL_DEVICE_NOT_FOUND: no device of these types on this platform
+        }
+        if (device_count > (cl_uint)(max_devices - count)) {
+            device_count = (cl_uint)(max_devices - count);
+        }
+        for (cl_uint d = 0; d < device_count; d++) {
+            platforms[count++] = all_platforms[p];
+        }
+    }
+    return count;
+}
+
+int opencl_runtime_init(OpenCLRuntime* runtime, const char* cache_dir, bool rebuild) {
+    cl_platform_id platform;
+    cl_device_id device;
+
+    // The first GPU of any platform; CPU-only implementations (e.g. PoCL) have none, then any device
+    if (opencl_find_devices(CL_DEVICE_TYPE_GPU, &platform, &device, 1) == 0 &&
+        opencl_find_devices(CL_DEVICE_TYPE_ALL, &platform, &device, 1) == 0) {
+        memset(runtime, 0, sizeof(*runtime));
+        fprintf(stderr, "No OpenCL device on any platform\n");
+        return -1;
+    }
+    return opencl_runtime_init_device(runtime, platform, device, cache_dir, rebuild);
+}
+
+int opencl_runtime_init_device(OpenCLRuntime* runtime, cl_platform_id platform, cl_device_id device,
+                               const char* cache_dir, bool rebuild) {
+    double start = wall_time();
+    cl_int err;
+
+    memset(runtime, 0, sizeof(*runtime));
+    runtime->platform = platform;
+    runtime->device = device;
+
+    runtime->context = clCreateContext(NULL, 1, &runtime->device, NULL, NULL, &err);
+    cl_queue_properties props[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    if (err == CL_SUCCESS) {
+        runtime->queue = clCreateCommandQueueWithProperties(runtime->context, runtime->device, props, &err);
+    }
+    if (err == CL_SUCCESS) {
+        runtime->transfer_queue = clCreateCommandQueueWithProperties(runtime->context, runtime->device, props, &err);
+    }
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL context error: %d\n", err);
+        opencl_runtime_release(runtime);
+        return -1;
+    }
+
+    if (cache_dir && make_directory(cache_dir) != 0) {
+        cache_dir = NULL;
+    }
+
+    uint64_t device_key = device_hash(runtime->device);
+    for (int i = 0; i < OPENCL_PROGRAM_COUNT; i++) {
+        if (init_program(runtime, (OpenCLProgramId)i, cache_dir, rebuild, device_key) != 0) {
+            opencl_runtime_release(runtime);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < OPENCL_KERNEL_COUNT; i++) {
+        runtime->kernels[i] = clCreateKernel(runtime->programs[kernel_sources[i].program], kernel_sources[i].name, &err);
+        if (err != CL_SUCCESS) {
+            fprintf(stderr, "Kernel create error (%s): %d\n", kernel_sources[i].name, err);
+            opencl_runtime_release(runtime);
+            return -1;
+        }
+    }
+
+    // CL_DEVICE_HOST_UNIFIED_MEMORY is deprecated since OpenCL 2.0 but still reported;
+    // a CPU device shares the host's memory in any case
+    cl_bool unified_memory = CL_FALSE;
+    cl_device_type type = 0;
+    clGetDeviceInfo(runtime->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified_memory), &unified_memory, NULL);
+    clGetDeviceInfo(runtime->device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+    runtime->zero_copy = unified_memory || (type & CL_DEVICE_TYPE_CPU);
+
+    runtime->startup_time = wall_time() - start;
+    return 0;
+}
+
+void opencl_runtime_release(OpenCLRuntime* runtime) {
+    for (int i = 0; i < OPENCL_KERNEL_COUNT; i++) {
+        if (runtime->kernels[i]) {
+            clReleaseKernel(runtime->kernels[i]);
+            runtime->kernels[i] = NULL;
+        }
+    }
+    for (int i = 0; i < OPENCL_PROGRAM_COUNT; i++) {
+        if (runtime->programs[i]) {
+            clReleaseProgram(runtime->programs[i]);
+            runtime->programs[i] = NULL;
+        }
+    }
+    if (runtime->transfer_queue) {
+        clReleaseCommandQueue(runtime->transfer_queue);
+        runtime->transfer_queue = NULL;
+    }
+    if (runtime->queue) {
+        clReleaseCommandQueue(runtime->queue);
+        runtime->queue = NULL;
+    }
+    if (runtime->context) {
+        clReleaseContext(runtime->context);
+        runtime->context = NULL;
+    }
+    if (runtime->device) {
+        clReleaseDevice(runtime->device);  // only sub-devices are counted, for root devices this does nothing
+        runtime->device = NULL;
+    }
+}
+
+bool opencl_zero_copy(const OpenCLRuntime* runtime, const void* host) {
+    return runtime->zero_copy && (uintptr_t)host % OPENCL_ZERO_COPY_ALIGNMENT == 0;
+}
+
+cl_mem opencl_input_buffer(OpenCLRuntime* runtime, const void* host, size_t size, cl_int* err) {
+    cl_mem_flags flags = CL_MEM_READ_ONLY | (opencl_zero_copy(runtime, host) ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR);
+    return clCreateBuffer(runtime->context, flags, size, (void*)host, err);
+}
+
+double opencl_event_time(cl_event event) {
+    cl_ulong start = 0, end = 0;
+    cl_int err = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    if (err == CL_SUCCESS) {
+        err = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    }
+    if (err != CL_SUCCESS || end < start) {
+        return 0.0;
+    }
+    return (end - start) / 1e9;
+}
@@ -0,0 +1,124 @@
+#include "parallel_encode.h"
+#include "platform.h"
+#include "cpu_histogram.h"
+
+#include <pthread.h>
+
+typedef struct EncodeChunk {
+    const char* input;
+    size_t length;
+    const HuffmanCode* table;
+    uint8_t* output;
+    size_t bit_offset;
+    size_t bit_len;
+    uint8_t tail;
+    int status;
+} EncodeChunk;
+
+static void* count_chunk_bits(void* arg) {
+    EncodeChunk* chunk = (EncodeChunk*)arg;
+    uint64_t freq[256];
+
+    byte_histogram((const uint8_t*)chunk->input, chunk->length, freq);
+
+    chunk->bit_len = 0;
+    chunk->status = 0;
+    for (int i = 0; i < 256; i++) {
+        if (freq[i] > 0 && chunk->table[i].length == 0) {
+            chunk->status = -1;
+        }
+        chunk->bit_len += freq[i] * chunk->table[i].length;
+    }
+    return NULL;
+}
+
+static void* encode_chunk(void* arg) {
+    EncodeChunk* chunk = (EncodeChunk*)arg;
+    size_t bit_len;
+    chunk->status = huffman_encode_range(chunk->input, chunk->length, chunk->table,
+                                         chunk->output, chunk->bit_offset, &bit_len, &chunk->tail);
+    return NULL;
+}
+
+// Run worker on every chunk, the first one on the calling thread
+static int run_chunks(void* (*worker)(void*), EncodeChunk* chunks, int count) {
+    pthread_t threads[PARALLEL_ENCODE_MAX_THREADS];
+    int started = 0;
+    int status = 0;
+
+    for (int i = 1; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &chunks[i]) != 0) {
+            status = -1;
+            break;
+        }
+        started = i;
+    }
+    worker(&chunks[0]);
+    for (int i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i <= started; i++) {
+        if (chunks[i].status != 0) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+int encode_input_parallel(const char* input, size_t input_len, const HuffmanCode table[256],
+                          uint8_t* output, size_t* bit_len, int thread_count) {
+    EncodeChunk chunks[PARALLEL_ENCODE_MAX_THREADS];
+
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > PARALLEL_ENCODE_MAX_THREADS) {
+        thread_count = PARALLEL_ENCODE_MAX_THREADS;
+    }
+    if ((size_t)thread_count > input_len) {
+        thread_count = input_len > 0 ? (int)input_len : 1;
+    }
+    if (thread_count == 1) {
+        return encode_input_with_huffman(input, input_len, table, output, bit_len);
+    }
+
+    size_t chunk_size = input_len / thread_count;
+    for (int i = 0; i < thread_count; i++) {
+        chunks[i].input = input + i * chunk_size;
+        chunks[i].length = i == thread_count - 1 ? input_len - i * chunk_size : chunk_size;
+        chunks[i].table = table;
+        chunks[i].output = output;
+    }
+
+    // 1. Exact bit length of every chunk
+    if (run_chunks(count_chunk_bits, chunks, thread_count) != 0) {
+        return -1;
+    }
+
+    // 2. Exclusive prefix sum -> bit offsets. The byte a chunk ends in is shared with the next
+    // chunk (or nobody writes it), so clear it before the workers start and OR the tails in later.
+    size_t offset = 0;
+    for (int i = 0; i < thread_count; i++) {
+        chunks[i].bit_offset = offset;
+        offset += chunks[i].bit_len;
+        if (offset & 7) {
+            output[offset >> 3] = 0;
+        }
+    }
+    *bit_len = offset;
+
+    // 3. Encode every chunk at its own offset
+    if (run_chunks(encode_chunk, chunks, thread_count) != 0) {
+        return -1;
+    }
+
+    // 4. Merge the boundary bytes
+    for (int i = 0; i < thread_count; i++) {
+        size_t end = chunks[i].bit_offset + chunks[i].bit_len;
+        if (end & 7) {
+            output[end >> 3] |= chunks[i].tail;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,529 @@
+#include "pipeline.h"
+#include "huffman.h"
+#include "platform.h"
+#include "stream.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PIPELINE_END -1                 // queue token: no more blocks for the thread that pops it
+#define PIPELINE_SPIN_COUNT 64          // empty polls before a waiting thread yields, then sleeps
+#define PIPELINE_MAX_SLEEP_SHIFT 9      // the longest sleep between polls is 2^9 microseconds
+#define PIPELINE_EXTRA_BUFFERS 4        // buffers beyond one per worker: the reader and writer keep ahead
+#define PIPELINE_CACHE_LINE 64
+
+// One cell of a bounded multi-producer multi-consumer queue: its sequence says whether the cell
+// is free for the push at a position (sequence == position) or holds the value for the pop of it
+// (sequence == position + 1)
+typedef struct QueueCell {
+    size_t sequence;
+    int value;
+} QueueCell;
+
+// Block numbers handed between stages without a lock; push and pop positions on their own cache lines
+typedef struct BlockQueue {
+    QueueCell* cells;
+    size_t mask;
+    char pad0[PIPELINE_CACHE_LINE];
+    size_t push_position;
+    char pad1[PIPELINE_CACHE_LINE];
+    size_t pop_position;
+    char pad2[PIPELINE_CACHE_LINE];
+    uint64_t samples;    // occupancy seen by the pushes of blocks
+    uint64_t occupancy;
+    size_t max;
+} BlockQueue;
+
+// One pooled buffer: a block of input and its encoded form, with the model between the two stages
+typedef struct PipelineBlock {
+    uint8_t* input;
+    size_t length;
+    uint64_t sequence;
+    HuffmanBlockModel* model;
+    uint8_t* output;
+    size_t size;
+} PipelineBlock;
+
+typedef struct Pipeline {
+    FILE* in;
+    FILE* out;
+    size_t block_size;
+    int order;
+    int streams;
+    PipelineBlock* blocks;
+    int block_count;
+    BlockQueue free_blocks;   // writer -> reader
+    BlockQueue queues[PIPELINE_STAGE_COUNT - 1];  // in front of the histogram, encode and write stages
+    int threads[PIPELINE_STAGE_COUNT];
+    int finished[PIPELINE_STAGE_COUNT];  // threads of a pool that got their end token
+    bool failed;
+    int* reorder;             // writer: block waiting at sequence % block_count, or -1
+    StreamIndexEntry* entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    uint64_t position;        // output bytes written
+    uint64_t input_size;
+} Pipeline;
+
+typedef struct PipelineWorker {
+    Pipeline* pipeline;
+    double busy;
+} PipelineWorker;
+
+static int queue_init(BlockQueue* queue, size_t min_capacity) {
+    size_t capacity = 1;
+    while (capacity < min_capacity) {
+        capacity *= 2;
+    }
+    memset(queue, 0, sizeof(*queue));
+    queue->cells = malloc(capacity * sizeof(*queue->cells));
+    if (!queue->cells) {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->mask = capacity - 1;
+    return 0;
+}
+
+static void queue_release(BlockQueue* queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+static void queue_sample(BlockQueue* queue, size_t position) {
+    // Pushes after this one may already have been popped, so the count can come out negative
+    size_t popped = __atomic_load_n(&queue->pop_position, __ATOMIC_RELAXED);
+    size_t occupancy = popped <= position + 1 ? position + 1 - popped : 0;
+    __atomic_fetch_add(&queue->samples, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&queue->occupancy, occupancy, __ATOMIC_RELAXED);
+    size_t max = __atomic_load_n(&queue->max, __ATOMIC_RELAXED);
+    while (occupancy > max &&
+           !__atomic_compare_exchange_n(&queue->max, &max, occupancy, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static bool queue_try_push(BlockQueue* queue, int value) {
+    size_t position = __atomic_load_n(&queue->push_position, __ATOMIC_RELAXED);
+    while (true) {
+        QueueCell* cell = &queue->cells[position & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position) {
+            // A failed exchange loads the current position for the next try
+            if (__atomic_compare_exchange_n(&queue->push_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->value = value;
+                __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+                if (value != PIPELINE_END) {
+                    queue_sample(queue, position);
+                }
+                return true;
+            }
+        } else if ((ptrdiff_t)(sequence - position) < 0) {
+            return false;  // full: the cell still holds the value pushed one lap ago
+        } else {
+            position = __atomic_load_n(&queue->push_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static bool queue_try_pop(BlockQueue* queue, int* value) {
+    size_t position = __atomic_load_n(&queue->pop_position, __ATOMIC_RELAXED);
+    while (true) {
+        QueueCell* cell = &queue->cells[position & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position + 1) {
+            if (__atomic_compare_exchange_n(&queue->pop_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *value = cell->value;
+                __atomic_store_n(&cell->sequence, position + queue->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if ((ptrdiff_t)(sequence - (position + 1)) < 0) {
+            return false;  // empty
+        } else {
+            position = __atomic_load_n(&queue->pop_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Poll, then yield, then sleep longer and longer: a stage that waits long gives its core away
+static void backoff(unsigned* polls) {
+    unsigned poll = (*polls)++;
+    if (poll < PIPELINE_SPIN_COUNT) {
+        return;
+    }
+    if (poll < 2 * PIPELINE_SPIN_COUNT) {
+        sleep_microseconds(0);
+        return;
+    }
+    unsigned shift = poll - 2 * PIPELINE_SPIN_COUNT;
+    sleep_microseconds(1u << (shift < PIPELINE_MAX_SLEEP_SHIFT ? shift : PIPELINE_MAX_SLEEP_SHIFT));
+}
+
+static void queue_push(BlockQueue* queue, int value) {
+    unsigned polls = 0;
+    while (!queue_try_push(queue, value)) {
+        backoff(&polls);
+    }
+}
+
+static int queue_pop(BlockQueue* queue) {
+    unsigned polls = 0;
+    int value;
+    while (!queue_try_pop(queue, &value)) {
+        backoff(&polls);
+    }
+    return value;
+}
+
+static bool has_failed(Pipeline* pipeline) {
+    return __atomic_load_n(&pipeline->failed, __ATOMIC_RELAXED);
+}
+
+static void set_failed(Pipeline* pipeline) {
+    __atomic_store_n(&pipeline->failed, true, __ATOMIC_RELAXED);
+}
+
+// After a failure the blocks still travel through every stage, untouched, so no stage waits forever
+static void* read_blocks(void* arg) {
+    PipelineWorker* worker = (PipelineWorker*)arg;
+    Pipeline* pipeline = worker->pipeline;
+    uint64_t sequence = 0;
+
+    while (!has_failed(pipeline)) {
+        int b = queue_pop(&pipeline->free_blocks);
+        PipelineBlock* block = &pipeline->blocks[b];
+        double start = wall_time();
+        block->length = fread(block->input, 1, pipeline->block_size, pipeline->in);
+        worker->busy += wall_time() - start;
+        if (ferror(pipeline->in)) {
+            set_failed(pipeline);
+        }
+        if (block->length == 0) {
+            queue_push(&pipeline->free_blocks, b);
+            break;
+        }
+        block->sequence = sequence++;
+        queue_push(&pipeline->queues[0], b);
+    }
+
+    for (int t = 0; t < pipeline->threads[PIPELINE_HISTOGRAM]; t++) {
+        queue_push(&pipeline->queues[0], PIPELINE_END);
+    }
+    return NULL;
+}
+
+// The last thread of a pool to get its end token passes one on to every thread of the next stage
+static void finish_pool(Pipeline* pipeline, PipelineStage stage) {
+    if (__atomic_add_fetch(&pipeline->finished[stage], 1, __ATOMIC_ACQ_REL) == pipeline->threads[stage]) {
+        int next_threads = stage + 1 == PIPELINE_WRITE ? 1 : pipeline->threads[stage + 1];
+        for (int t = 0; t < next_threads; t++) {
+            queue_push(&pipeline->queues[stage], PIPELINE_END);
+        }
+    }
+}
+
+static void* count_blocks(void* arg) {
+    PipelineWorker* worker = (PipelineWorker*)arg;
+    Pipeline* pipeline = worker->pipeline;
+    int b;
+
+    while ((b = queue_pop(&pipeline->queues[0])) != PIPELINE_END) {
+        PipelineBlock* block = &pipeline->blocks[b];
+        if (!has_failed(pipeline)) {
+            double start = wall_time();
+            if (huffman_block_model_build(block->model, block->input, block->length) != 0) {
+                set_failed(pipeline);
+            }
+            worker->busy += wall_time() - start;
+        }
+        queue_push(&pipeline->queues[1], b);
+    }
+    finish_pool(pipeline, PIPELINE_HISTOGRAM);
+    return NULL;
+}
+
+static void* encode_blocks(void* arg) {
+    PipelineWorker* worker = (PipelineWorker*)arg;
+    Pipeline* pipeline = worker->pipeline;
+    int b;
+
+    while ((b = queue_pop(&pipeline->queues[1])) != PIPELINE_END) {
+        PipelineBlock* block = &pipeline->blocks[b];
+        if (!has_failed(pipeline)) {
+            double start = wall_time();
+            if (huffman_block_encode(block->model, block->input, block->length, pipeline->streams, block->output,
+                                     &block->size) != 0) {
+                set_failed(pipeline);
+            }
+            worker->busy += wall_time() - start;
+        }
+        queue_push(&pipeline->queues[2], b);
+    }
+    finish_pool(pipeline, PIPELINE_ENCODE);
+    return NULL;
+}
+
+static int write_output(Pipeline* pipeline, const uint8_t* data, size_t size) {
+    if (fwrite(data, 1, size, pipeline->out) != size) {
+        return -1;
+    }
+    pipeline->position += size;
+    return 0;
+}
+
+// Write an encoded block and note it in the index, doubling the entries as needed
+static int write_block(Pipeline* pipeline, const PipelineBlock* block) {
+    if (pipeline->entry_count == pipeline->entry_capacity) {
+        size_t capacity = pipeline->entry_capacity ? pipeline->entry_capacity * 2 : 1024;
+        StreamIndexEntry* entries = realloc(pipeline->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            return -1;
+        }
+        pipeline->entries = entries;
+        pipeline->entry_capacity = capacity;
+    }
+
+    StreamIndexEntry* entry = &pipeline->entries[pipeline->entry_count++];
+    entry->offset = pipeline->position;
+    entry->data_offset = pipeline->input_size;
+    entry->size = (uint32_t)block->length;
+    pipeline->input_size += block->length;
+    return write_output(pipeline, block->output, block->size);
+}
+
+static int write_tail(Pipeline* pipeline) {
+    uint8_t* tail = malloc(STREAM_TAIL_SIZE(pipeline->entry_count));
+    if (!tail) {
+        return -1;
+    }
+    size_t size = huffman_stream_tail(pipeline->entries, pipeline->entry_count, pipeline->position, tail);
+    int rc = write_output(pipeline, tail, size);
+    free(tail);
+    return rc == 0 && fflush(pipeline->out) == 0 ? 0 : -1;
+}
+
+// The blocks come from the encoders in any order and are written in the order they were read;
+// a buffer goes back to the reader only once its block is out
+static void write_blocks(PipelineWorker* worker) {
+    Pipeline* pipeline = worker->pipeline;
+    uint64_t next = 0;
+    int b;
+
+    uint8_t header[STREAM_HEADER_SIZE];
+    huffman_stream_header(pipeline->order, pipeline->streams, header);
+    double start = wall_time();
+    if (write_output(pipeline, header, STREAM_HEADER_SIZE) != 0) {
+        set_failed(pipeline);
+    }
+    worker->busy += wall_time() - start;
+
+    while ((b = queue_pop(&pipeline->queues[2])) != PIPELINE_END) {
+        pipeline->reorder[pipeline->blocks[b].sequence % pipeline->block_count] = b;
+        int* ready;
+        while (*(ready = &pipeline->reorder[next % pipeline->block_count]) >= 0) {
+            PipelineBlock* block = &pipeline->blocks[*ready];
+            if (!has_failed(pipeline)) {
+                start = wall_time();
+                if (write_block(pipeline, block) != 0) {
+                    set_failed(pipeline);
+                }
+                worker->busy += wall_time() - start;
+            }
+            queue_push(&pipeline->free_blocks, *ready);
+            *ready = -1;
+            next++;
+        }
+    }
+
+    if (!has_failed(pipeline)) {
+        start = wall_time();
+        if (write_tail(pipeline) != 0) {
+            set_failed(pipeline);
+        }
+        worker->busy += wall_time() - start;
+    }
+}
+
+static void pipeline_release(Pipeline* pipeline) {
+    if (pipeline->blocks) {
+        for (int b = 0; b < pipeline->block_count; b++) {
+            free(pipeline->blocks[b].input);
+            free(pipeline->blocks[b].output);
+            huffman_block_model_release(pipeline->blocks[b].model);
+        }
+    }
+    free(pipeline->blocks);
+    free(pipeline->reorder);
+    free(pipeline->entries);
+    queue_release(&pipeline->free_blocks);
+    for (int q = 0; q < PIPELINE_STAGE_COUNT - 1; q++) {
+        queue_release(&pipeline->queues[q]);
+    }
+}
+
+// Every queue can hold all the buffers and the end tokens of a pool, so a push never has to wait
+static int pipeline_init(Pipeline* pipeline, int block_count, int max_threads) {
+    pipeline->block_count = block_count;
+    pipeline->blocks = calloc(block_count, sizeof(*pipeline->blocks));
+    pipeline->reorder = malloc(block_count * sizeof(*pipeline->reorder));
+    if (!pipeline->blocks || !pipeline->reorder || queue_init(&pipeline->free_blocks, block_count) != 0) {
+        return -1;
+    }
+    for (int q = 0; q < PIPELINE_STAGE_COUNT - 1; q++) {
+        if (queue_init(&pipeline->queues[q], block_count + max_threads) != 0) {
+            return -1;
+        }
+    }
+
+    for (int b = 0; b < block_count; b++) {
+        PipelineBlock* block = &pipeline->blocks[b];
+        block->input = malloc(pipeline->block_size);
+        block->output = malloc(huffman_block_bound(pipeline->block_size));
+        block->model = huffman_block_model_init(pipeline->order, NULL);
+        if (!block->input || !block->output || !block->model) {
+            return -1;
+        }
+        pipeline->reorder[b] = -1;
+        queue_push(&pipeline->free_blocks, b);
+    }
+    return 0;
+}
+
+// Start up to count threads; returns how many started
+static int start_threads(pthread_t* threads, PipelineWorker* workers, int count, void* (*function)(void*)) {
+    int started = 0;
+    while (started < count && pthread_create(&threads[started], NULL, function, &workers[started]) == 0) {
+        started++;
+    }
+    return started;
+}
+
+static void fill_stats(const Pipeline* pipeline, const PipelineWorker* workers[PIPELINE_STAGE_COUNT],
+                       double time, PipelineStats* stats) {
+    stats->time = time;
+    stats->input_size = pipeline->input_size;
+    stats->output_size = pipeline->position;
+    stats->blocks = pipeline->entry_count;
+    stats->buffers = pipeline->block_count;
+    stats->memory = (size_t)pipeline->block_count * (pipeline->block_size + huffman_block_bound(pipeline->block_size));
+
+    for (int s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+        PipelineStageStats* stage = &stats->stages[s];
+        stage->threads = pipeline->threads[s];
+        for (int t = 0; t < stage->threads; t++) {
+            stage->busy += workers[s][t].busy;
+        }
+        stage->utilization = stage->threads > 0 && time > 0.0 ? stage->busy / (stage->threads * time) : 0.0;
+    }
+    for (int q = 0; q < PIPELINE_STAGE_COUNT - 1; q++) {
+        const BlockQueue* queue = &pipeline->queues[q];
+        stats->queues[q].capacity = queue->mask + 1;
+        stats->queues[q].mean = queue->samples > 0 ? (double)queue->occupancy / queue->samples : 0.0;
+        stats->queues[q].max = queue->max;
+    }
+}
+
+int huffman_compress_pipeline(FILE* in, FILE* out, size_t block_size, int order, int streams, int thread_count,
+                              PipelineStats* stats) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (order < 0 || order > STREAM_MAX_ORDER || streams < 0 || streams > HUFFMAN_MAX_STREAMS) {
+        return -1;
+    }
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > PIPELINE_MAX_THREADS) {
+        thread_count = PIPELINE_MAX_THREADS;
+    }
+    int histogram_threads = (thread_count + 7) / 8;
+
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.in = in;
+    pipeline.out = out;
+    pipeline.block_size = block_size == 0 ? STREAM_DEFAULT_BLOCK_SIZE
+                          : block_size > STREAM_MAX_BLOCK_SIZE ? STREAM_MAX_BLOCK_SIZE : block_size;
+    pipeline.order = order;
+    pipeline.streams = streams;
+    if (pipeline_init(&pipeline, histogram_threads + thread_count + PIPELINE_EXTRA_BUFFERS, thread_count) != 0) {
+        pipeline_release(&pipeline);
+        return -1;
+    }
+
+    PipelineWorker reader = {&pipeline, 0.0}, writer = {&pipeline, 0.0};
+    PipelineWorker counters[PIPELINE_MAX_THREADS], encoders[PIPELINE_MAX_THREADS];
+    pthread_t reader_thread, counter_threads[PIPELINE_MAX_THREADS], encoder_threads[PIPELINE_MAX_THREADS];
+    for (int t = 0; t < thread_count; t++) {
+        counters[t] = reader;
+        encoders[t] = reader;
+    }
+
+    // The pools are complete before the first block is read, so their end tokens are counted right.
+    // Without a pool nothing can be encoded: the pipeline is wound down with the tokens it would have passed on.
+    double start = wall_time();
+    pipeline.threads[PIPELINE_ENCODE] = start_threads(encoder_threads, encoders, thread_count, encode_blocks);
+    pipeline.threads[PIPELINE_HISTOGRAM] = start_threads(counter_threads, counters, histogram_threads, count_blocks);
+    pipeline.threads[PIPELINE_WRITE] = 1;
+    if (pipeline.threads[PIPELINE_HISTOGRAM] == 0) {
+        set_failed(&pipeline);
+        for (int t = 0; t < pipeline.threads[PIPELINE_ENCODE]; t++) {
+            queue_push(&pipeline.queues[1], PIPELINE_END);
+        }
+    }
+    if (pipeline.threads[PIPELINE_ENCODE] == 0) {
+        set_failed(&pipeline);
+        queue_push(&pipeline.queues[2], PIPELINE_END);
+    }
+    pipeline.threads[PIPELINE_READ] = pthread_create(&reader_thread, NULL, read_blocks, &reader) == 0;
+    if (!pipeline.threads[PIPELINE_READ]) {
+        set_failed(&pipeline);
+        read_blocks(&reader);  // reads nothing, only hands out the end tokens
+    }
+
+    write_blocks(&writer);
+
+    if (pipeline.threads[PIPELINE_READ]) {
+        pthread_join(reader_thread, NULL);
+    }
+    for (int t = 0; t < pipeline.threads[PIPELINE_HISTOGRAM]; t++) {
+        pthread_join(counter_threads[t], NULL);
+    }
+    for (int t = 0; t < pipeline.threads[PIPELINE_ENCODE]; t++) {
+        pthread_join(encoder_threads[t], NULL);
+    }
+    double time = wall_time() - start;
+
+    int status = has_failed(&pipeline) ? -1 : 0;
+    if (stats) {
+        const PipelineWorker* workers[PIPELINE_STAGE_COUNT] = {&reader, counters, encoders, &writer};
+        fill_stats(&pipeline, workers, time, stats);
+    }
+    pipeline_release(&pipeline);
+    return status;
+}
+
+void pipeline_stats_print(const PipelineStats* stats, FILE* file) {
+    static const char* names[PIPELINE_STAGE_COUNT] = {"read", "histogram", "encode", "write"};
+
+    fprintf(file, "Pipeline: %zu blocks, %llu -> %llu bytes in %.3f sec (%.1f MB/s), %d buffers (%.1f MiB)\n",
+            stats->blocks, (unsigned long long)stats->input_size, (unsigned long long)stats->output_size, stats->time,
+            stats->time > 0.0 ? stats->input_size / stats->time / 1e6 : 0.0, stats->buffers,
+            stats->memory / 1048576.0);
+    for (int s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+        const PipelineStageStats* stage = &stats->stages[s];
+        fprintf(file, "  %-9s %2d thread%s  busy %8.3f sec  utilization %5.1f%%\n", names[s], stage->threads,
+                stage->threads == 1 ? " " : "s", stage->busy, 100.0 * stage->utilization);
+    }
+    for (int q = 0; q < PIPELINE_STAGE_COUNT - 1; q++) {
+        const PipelineQueueStats* queue = &stats->queues[q];
+        fprintf(file, "  queue to %-9s mean %5.2f  max %zu of %zu\n", names[q + 1], queue->mean, queue->max,
+                queue->capacity);
+    }
+}
@@ -0,0 +1,114 @@
+#include "platform.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#else
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+int cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+double wall_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+void sleep_microseconds(unsigned microseconds)
+{
+#ifdef _WIN32
+    if (microseconds == 0) {
+        SwitchToThread();
+    } else {
+        Sleep((microseconds + 999) / 1000);
+    }
+#else
+    if (microseconds == 0) {
+        sched_yield();
+    } else {
+        struct timespec duration = {microseconds / 1000000, (long)(microseconds % 1000000) * 1000};
+        nanosleep(&duration, NULL);
+    }
+#endif
+}
+
+size_t current_rss(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    FILE* statm = fopen("/proc/self/statm", "r");
+    unsigned long size, resident;
+    size_t rss = 0;
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &size, &resident) == 2) {
+            rss = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    }
+    return rss;
+#endif
+}
+
+int make_directory(const char* path)
+{
+#ifdef _WIN32
+    int rc = _mkdir(path);
+#else
+    int rc = mkdir(path, 0755);
+#endif
+    return rc == 0 || errno == EEXIST ? 0 : -1;
+}
+
+void* aligned_malloc(size_t size, size_t alignment)
+{
+    if (size == 0) {
+        size = 1;
+    }
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* memory = NULL;
+    return posix_memalign(&memory, alignment, size) == 0 ? memory : NULL;
+#endif
+}
+
+void aligned_free(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
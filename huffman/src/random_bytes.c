@@ -0,0 +1,162 @@
+#include "random_bytes.h"
+#include "platform.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define RANDOM_BYTES_X86 1
+#endif
+
+#define RANDOM_BATCH 64          // bytes generated per batch: hashes first, then the lookups
+#define RANDOM_MIN_THREAD_BYTES (1 << 20)
+
+void random_tables_init(RandomTables* tables) {
+    // u >= thresholds[k]  <=>  254 * (u / 2^32)^2.5 >= k
+    tables->thresholds[0] = 0;
+    for (int k = 1; k < 256; k++) {
+        tables->thresholds[k] = UINT32_MAX;
+        if (k < 254) {
+            tables->thresholds[k] = (uint32_t)ceil(pow(k / 254.0, 0.4) * 4294967296.0);
+        }
+    }
+
+    int byte = 1;
+    for (int bucket = 0; bucket < (1 << RANDOM_BUCKET_BITS); bucket++) {
+        uint32_t low = (uint32_t)bucket << (32 - RANDOM_BUCKET_BITS);
+        while (byte < 254 && low >= tables->thresholds[byte]) {
+            byte++;
+        }
+        tables->buckets[bucket] = (uint8_t)byte;
+    }
+}
+
+static inline uint64_t splitmix64(uint64_t seed, uint64_t counter) {
+    uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// thresholds[254] is UINT32_MAX, which u = UINT32_MAX reaches: 254 is the last byte, never raised
+static inline uint8_t lookup(const RandomTables* tables, uint32_t u) {
+    uint8_t byte = tables->buckets[u >> (32 - RANDOM_BUCKET_BITS)];
+    return byte + (byte < 254 && u >= tables->thresholds[byte]);
+}
+
+uint8_t random_byte_of(const RandomTables* tables, uint32_t u) {
+    return lookup(tables, u);
+}
+
+// One batch of RANDOM_BATCH bytes starting at an even index: the hash loop has no table
+// accesses, so the compiler can vectorize it for the instruction set of the caller
+static inline void batch(const RandomTables* tables, uint64_t seed, uint64_t first, uint8_t* output) {
+    uint32_t uniforms[RANDOM_BATCH];
+    for (int i = 0; i < RANDOM_BATCH / 2; i++) {
+        uint64_t hash = splitmix64(seed, first / 2 + i);
+        uniforms[2 * i] = (uint32_t)hash;
+        uniforms[2 * i + 1] = (uint32_t)(hash >> 32);
+    }
+    for (int i = 0; i < RANDOM_BATCH; i++) {
+        output[i] = lookup(tables, uniforms[i]);
+    }
+}
+
+static void batches_default(const RandomTables* tables, uint64_t seed, uint64_t first, uint8_t* output, size_t count) {
+    for (size_t b = 0; b < count; b++) {
+        batch(tables, seed, first + b * RANDOM_BATCH, output + b * RANDOM_BATCH);
+    }
+}
+
+#ifdef RANDOM_BYTES_X86
+__attribute__((target("avx2")))
+static void batches_avx2(const RandomTables* tables, uint64_t seed, uint64_t first, uint8_t* output, size_t count) {
+    for (size_t b = 0; b < count; b++) {
+        batch(tables, seed, first + b * RANDOM_BATCH, output + b * RANDOM_BATCH);
+    }
+}
+#endif
+
+static uint8_t single(const RandomTables* tables, uint64_t seed, uint64_t index) {
+    uint64_t hash = splitmix64(seed, index / 2);
+    return lookup(tables, (uint32_t)(index & 1 ? hash >> 32 : hash));
+}
+
+void random_bytes(const RandomTables* tables, uint64_t seed, uint64_t first, uint8_t* output, size_t length) {
+    void (*batches)(const RandomTables*, uint64_t, uint64_t, uint8_t*, size_t) = batches_default;
+#ifdef RANDOM_BYTES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        batches = batches_avx2;
+    }
+#endif
+
+    size_t i = 0;
+    if (first % 2 == 1 && length > 0) {
+        output[i++] = single(tables, seed, first);
+    }
+    size_t count = (length - i) / RANDOM_BATCH;
+    batches(tables, seed, first + i, output + i, count);
+    for (i += count * RANDOM_BATCH; i < length; i++) {
+        output[i] = single(tables, seed, first + i);
+    }
+}
+
+typedef struct RandomRange {
+    const RandomTables* tables;
+    uint64_t seed;
+    uint64_t first;
+    uint8_t* output;
+    size_t length;
+} RandomRange;
+
+static void* generate_range(void* arg) {
+    RandomRange* range = (RandomRange*)arg;
+    random_bytes(range->tables, range->seed, range->first, range->output, range->length);
+    return NULL;
+}
+
+int random_bytes_parallel(const RandomTables* tables, uint64_t seed, uint8_t* output, size_t length, int thread_count) {
+    RandomRange ranges[RANDOM_MAX_THREADS];
+    pthread_t threads[RANDOM_MAX_THREADS];
+    bool started[RANDOM_MAX_THREADS];
+    int status = 0;
+
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > RANDOM_MAX_THREADS) {
+        thread_count = RANDOM_MAX_THREADS;
+    }
+    if ((size_t)thread_count > length / RANDOM_MIN_THREAD_BYTES) {
+        thread_count = length / RANDOM_MIN_THREAD_BYTES > 0 ? (int)(length / RANDOM_MIN_THREAD_BYTES) : 1;
+    }
+
+    // Ranges of whole batches, so only the last one has a scalar tail
+    size_t range_size = length / thread_count / RANDOM_BATCH * RANDOM_BATCH;
+    for (int i = 0; i < thread_count; i++) {
+        ranges[i].tables = tables;
+        ranges[i].seed = seed;
+        ranges[i].first = (uint64_t)i * range_size;
+        ranges[i].output = output + i * range_size;
+        ranges[i].length = i == thread_count - 1 ? length - i * range_size : range_size;
+    }
+
+    for (int i = 1; i < thread_count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, generate_range, &ranges[i]) == 0;
+        if (!started[i]) {
+            status = -1;
+        }
+    }
+    generate_range(&ranges[0]);
+    for (int i = 1; i < thread_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            generate_range(&ranges[i]);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,1076 @@
+#include "stream.h"
+#include "huffman.h"
+#include "context_model.h"
+#include "cpu_histogram.h"
+#include "crc32c.h"
+#include "platform.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_MAX_CODE_LENGTH 15                                  // code lengths are stored in 4 bits
+#define STREAM_BLOCK_HEADER_SIZE (12 + 128)                        // order 0: sizes, checksum and code lengths
+#define STREAM_CONTEXT_HEADER_SIZE (16 + CONTEXT_MODEL_MAX_SIZE)   // order 1: sizes, checksum and the largest model
+#define STREAM_IO_SIZE (256 << 10)                                 // FILE wrappers: bytes per fwrite
+#define STREAM_PAYLOAD_SLACK (5 * HUFFMAN_MAX_STREAMS)              // bit counts and padding of the sub-streams
+#define STREAM_INDEX_INITIAL_SIZE 1024
+
+static void put_u32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64(uint8_t* p, uint64_t value) {
+    put_u32(p, (uint32_t)value);
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void* default_alloc(void* opaque, size_t size) {
+    (void)opaque;
+    return malloc(size);
+}
+
+static void default_free(void* opaque, void* memory) {
+    (void)opaque;
+    free(memory);
+}
+
+static const HuffmanAllocator default_allocator = {default_alloc, default_free, NULL};
+
+static void* stream_alloc(const HuffmanAllocator* allocator, size_t size) {
+    return allocator->alloc(allocator->opaque, size);
+}
+
+static void stream_free(const HuffmanAllocator* allocator, void* memory) {
+    if (memory) {
+        allocator->free(allocator->opaque, memory);
+    }
+}
+
+// Work memory of order-1 blocks, about 2.6 MiB, allocated once per stream
+typedef struct ContextWork {
+    uint64_t pair_freq[PAIR_HISTOGRAM_SIZE];
+    ContextModel model;
+    ContextDecoder decoder;
+} ContextWork;
+
+struct HuffmanStreamEncoder {
+    HuffmanAllocator allocator;
+    size_t block_size;
+    int streams;           // sub-streams of order-0 blocks
+    uint8_t* block;        // input of the next block, when it arrives in pieces
+    size_t block_len;
+    uint8_t* buffer;       // the stream header or the last encoded block
+    const uint8_t* pending;  // bytes not handed out yet: buffer, or index at the end
+    size_t pending_len;
+    size_t pending_pos;
+    uint64_t position;     // stream bytes produced so far, handed out or pending
+    uint8_t* index;        // the end mark and an entry per block, the tail of the stream
+    size_t index_len;
+    size_t index_capacity;
+    HuffmanBlockModel* model;
+    bool finished;
+};
+
+typedef enum DecoderState {
+    DECODE_HEADER,
+    DECODE_BLOCK_SIZE,
+    DECODE_BLOCK_HEADER,
+    DECODE_MODEL,
+    DECODE_PAYLOAD,
+    DECODE_OUTPUT,
+    DECODE_INDEX,
+    DECODE_TRAILER,
+    DECODE_END,
+    DECODE_ERROR
+} DecoderState;
+
+struct HuffmanStreamDecoder {
+    HuffmanAllocator allocator;
+    DecoderState state;
+    int version;
+    int order;
+    int streams;
+    uint8_t stage[STREAM_CONTEXT_HEADER_SIZE];  // the header, model or index entry being gathered
+    size_t stage_len;
+    uint32_t length;       // uncompressed size of the current block
+    uint32_t bit_len;      // with sub-streams: 8 * payload bytes
+    uint32_t crc;
+    uint32_t model_size;
+    uint8_t* block;        // decoded block, handed out from output_pos
+    uint8_t* encoded;      // bitstream of the block, gathered up to (bit_len + 7) / 8 bytes
+    size_t encoded_len;
+    size_t output_pos;
+    size_t capacity;       // bytes of block, grown to the largest block seen
+    uint64_t position;     // stream bytes consumed
+    uint64_t blocks;       // blocks decoded, and their total size
+    uint64_t total_size;
+    uint64_t index_offset; // where the index starts, once the end mark is read
+    uint64_t index_entries;
+    uint64_t index_size;   // sum of the sizes in the index entries read
+    uint64_t last_offset;
+    uint32_t index_crc;
+    HuffmanDecoder* decoder;  // order 0
+    ContextWork* work;        // order 1
+};
+
+struct HuffmanBlockModel {
+    HuffmanAllocator allocator;
+    uint8_t lengths[256];     // order 0
+    HuffmanCode table[256];
+    ContextWork* work;        // order 1
+};
+
+// Sub-streams actually used by blocks of order
+static int block_streams(int order, int streams) {
+    return order == 1 ? 1 : streams == 0 ? HUFFMAN_DEFAULT_STREAMS : streams;
+}
+
+HuffmanBlockModel* huffman_block_model_init(int order, const HuffmanAllocator* allocator) {
+    if (order < 0 || order > STREAM_MAX_ORDER) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &default_allocator;
+    }
+    HuffmanBlockModel* model = stream_alloc(allocator, sizeof(*model));
+    if (!model) {
+        return NULL;
+    }
+    memset(model, 0, sizeof(*model));
+    model->allocator = *allocator;
+    if (order == 1 && !(model->work = stream_alloc(allocator, sizeof(*model->work)))) {
+        huffman_block_model_release(model);
+        return NULL;
+    }
+    return model;
+}
+
+void huffman_block_model_release(HuffmanBlockModel* model) {
+    if (!model) {
+        return;
+    }
+    HuffmanAllocator allocator = model->allocator;
+    stream_free(&allocator, model->work);
+    stream_free(&allocator, model);
+}
+
+int huffman_block_model_build(HuffmanBlockModel* model, const uint8_t* data, size_t length) {
+    // Order 1: the table of every byte is chosen by the byte before it (0 at the block start)
+    if (model->work) {
+        pair_histogram(data, length, 0, model->work->pair_freq);
+        return context_model_build(model->work->pair_freq, &model->work->model);
+    }
+
+    uint64_t freq[256];
+    byte_histogram(data, length, freq);
+    if (huffman_limit_code_lengths(freq, STREAM_MAX_CODE_LENGTH, model->lengths) != 0 ||
+        huffman_canonical_codes(model->lengths, model->table) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+size_t huffman_block_bound(size_t length) {
+    return STREAM_CONTEXT_HEADER_SIZE + length * STREAM_MAX_CODE_LENGTH / 8 + 1 + STREAM_PAYLOAD_SLACK;
+}
+
+// Order 0: the code lengths, then one bitstream or streams interleaved sub-streams
+static int encode_block(const HuffmanBlockModel* model, const uint8_t* data, size_t length, int streams,
+                        uint8_t* out, size_t* size) {
+    size_t bit_len;
+    if (streams > 1) {
+        size_t payload;
+        if (huffman_encode_streams(data, length, model->table, streams, out + STREAM_BLOCK_HEADER_SIZE,
+                                   &payload) != 0) {
+            return -1;
+        }
+        bit_len = payload * 8;
+    } else if (encode_input_with_huffman((const char*)data, length, model->table, out + STREAM_BLOCK_HEADER_SIZE,
+                                         &bit_len) != 0) {
+        return -1;
+    }
+
+    put_u32(out, (uint32_t)length);
+    put_u32(out + 4, (uint32_t)bit_len);
+    put_u32(out + 8, crc32c(0, data, length));
+    for (int i = 0; i < 128; i++) {
+        out[12 + i] = (uint8_t)((model->lengths[2 * i] << 4) | model->lengths[2 * i + 1]);
+    }
+    *size = STREAM_BLOCK_HEADER_SIZE + (bit_len + 7) / 8;
+    return 0;
+}
+
+// Order 1: the context model, then its bitstream
+static int encode_context_block(const ContextWork* work, const uint8_t* data, size_t length, uint8_t* out,
+                                size_t* size) {
+    size_t model_size = context_model_write(&work->model, out + 16);
+    size_t bit_len;
+    if (context_encode(&work->model, data, length, out + 16 + model_size, &bit_len) != 0) {
+        return -1;
+    }
+
+    put_u32(out, (uint32_t)length);
+    put_u32(out + 4, (uint32_t)bit_len);
+    put_u32(out + 8, crc32c(0, data, length));
+    put_u32(out + 12, (uint32_t)model_size);
+    *size = 16 + model_size + (bit_len + 7) / 8;
+    return 0;
+}
+
+int huffman_block_encode(const HuffmanBlockModel* model, const uint8_t* data, size_t length, int streams,
+                         uint8_t* output, size_t* size) {
+    if (streams < 0 || streams > HUFFMAN_MAX_STREAMS) {
+        return -1;
+    }
+    return model->work ? encode_context_block(model->work, data, length, output, size)
+                       : encode_block(model, data, length, block_streams(0, streams), output, size);
+}
+
+void huffman_stream_header(int order, int streams, uint8_t header[STREAM_HEADER_SIZE]) {
+    memset(header, 0, STREAM_HEADER_SIZE);
+    memcpy(header, STREAM_MAGIC, 4);
+    header[4] = STREAM_VERSION;
+    header[5] = (uint8_t)order;
+    header[6] = (uint8_t)block_streams(order, streams);
+}
+
+// The trailer after the index entries at index (the end mark before them); index_offset is where they start
+static void write_trailer(uint8_t* index, size_t count, uint64_t index_offset) {
+    uint8_t* trailer = index + 4 + count * STREAM_INDEX_ENTRY_SIZE;
+    put_u32(trailer, (uint32_t)count);
+    put_u64(trailer + 4, index_offset);
+    put_u32(trailer + 12, crc32c(0, index + 4, count * STREAM_INDEX_ENTRY_SIZE + 12));
+    memcpy(trailer + 16, STREAM_INDEX_MAGIC, 4);
+}
+
+size_t huffman_stream_tail(const StreamIndexEntry* entries, size_t count, uint64_t end, uint8_t* output) {
+    memset(output, 0, 4);
+    for (size_t i = 0; i < count; i++) {
+        put_u64(output + 4 + i * STREAM_INDEX_ENTRY_SIZE, entries[i].offset);
+        put_u32(output + 4 + i * STREAM_INDEX_ENTRY_SIZE + 8, entries[i].size);
+    }
+    write_trailer(output, count, end + 4);
+    return STREAM_TAIL_SIZE(count);
+}
+
+static size_t checked_block_size(size_t block_size) {
+    if (block_size == 0) {
+        return STREAM_DEFAULT_BLOCK_SIZE;
+    }
+    return block_size > STREAM_MAX_BLOCK_SIZE ? STREAM_MAX_BLOCK_SIZE : block_size;
+}
+
+HuffmanStreamEncoder* huffman_stream_encoder_init(size_t block_size, int order, int streams,
+                                                  const HuffmanAllocator* allocator) {
+    if (order < 0 || order > STREAM_MAX_ORDER || streams < 0 || streams > HUFFMAN_MAX_STREAMS) {
+        return NULL;
+    }
+    if (!allocator) {
+        allocator = &default_allocator;
+    }
+    HuffmanStreamEncoder* encoder = stream_alloc(allocator, sizeof(*encoder));
+    if (!encoder) {
+        return NULL;
+    }
+
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->allocator = *allocator;
+    encoder->block_size = checked_block_size(block_size);
+    encoder->streams = block_streams(order, streams);
+    encoder->block = stream_alloc(allocator, encoder->block_size);
+    encoder->buffer = stream_alloc(allocator, huffman_block_bound(encoder->block_size));
+    encoder->index = stream_alloc(allocator, STREAM_INDEX_INITIAL_SIZE);
+    encoder->model = huffman_block_model_init(order, allocator);
+    if (!encoder->block || !encoder->buffer || !encoder->index || !encoder->model) {
+        huffman_stream_encoder_release(encoder);
+        return NULL;
+    }
+
+    // The stream header is the first output, the index starts with the end mark
+    huffman_stream_header(order, streams, encoder->buffer);
+    encoder->pending = encoder->buffer;
+    encoder->pending_len = STREAM_HEADER_SIZE;
+    encoder->position = STREAM_HEADER_SIZE;
+    memset(encoder->index, 0, 4);
+    encoder->index_len = 4;
+    encoder->index_capacity = STREAM_INDEX_INITIAL_SIZE;
+    return encoder;
+}
+
+void huffman_stream_encoder_release(HuffmanStreamEncoder* encoder) {
+    if (!encoder) {
+        return;
+    }
+    HuffmanAllocator allocator = encoder->allocator;
+    stream_free(&allocator, encoder->block);
+    stream_free(&allocator, encoder->buffer);
+    stream_free(&allocator, encoder->index);
+    huffman_block_model_release(encoder->model);
+    stream_free(&allocator, encoder);
+}
+
+static bool has_pending(const HuffmanStreamEncoder* encoder) {
+    return encoder->pending_pos < encoder->pending_len;
+}
+
+static void drain(HuffmanStreamEncoder* encoder, uint8_t** output, size_t* output_len) {
+    size_t count = encoder->pending_len - encoder->pending_pos;
+    if (count > *output_len) {
+        count = *output_len;
+    }
+    memcpy(*output, encoder->pending + encoder->pending_pos, count);
+    encoder->pending_pos += count;
+    *output += count;
+    *output_len -= count;
+}
+
+// Room for length more bytes of index, doubling the allocation
+static int index_reserve(HuffmanStreamEncoder* encoder, size_t length) {
+    if (encoder->index_len + length <= encoder->index_capacity) {
+        return 0;
+    }
+    size_t capacity = encoder->index_capacity * 2;
+    while (capacity < encoder->index_len + length) {
+        capacity *= 2;
+    }
+    uint8_t* index = stream_alloc(&encoder->allocator, capacity);
+    if (!index) {
+        return -1;
+    }
+    memcpy(index, encoder->index, encoder->index_len);
+    stream_free(&encoder->allocator, encoder->index);
+    encoder->index = index;
+    encoder->index_capacity = capacity;
+    return 0;
+}
+
+// Encode a block into the (drained) buffer and note it in the index
+static int queue_block(HuffmanStreamEncoder* encoder, const uint8_t* data, size_t length) {
+    size_t size;
+    if (huffman_block_model_build(encoder->model, data, length) != 0 ||
+        huffman_block_encode(encoder->model, data, length, encoder->streams, encoder->buffer, &size) != 0 ||
+        index_reserve(encoder, STREAM_INDEX_ENTRY_SIZE) != 0) {
+        encoder->pending_len = encoder->pending_pos = 0;
+        return -1;
+    }
+
+    put_u64(encoder->index + encoder->index_len, encoder->position);
+    put_u32(encoder->index + encoder->index_len + 8, (uint32_t)length);
+    encoder->index_len += STREAM_INDEX_ENTRY_SIZE;
+    encoder->position += size;
+
+    encoder->pending = encoder->buffer;
+    encoder->pending_pos = 0;
+    encoder->pending_len = size;
+    return 0;
+}
+
+int huffman_stream_encoder_update(HuffmanStreamEncoder* encoder, const uint8_t** input, size_t* input_len,
+                                  uint8_t** output, size_t* output_len) {
+    if (encoder->finished) {
+        return HUFFMAN_STREAM_ERROR;
+    }
+
+    while (true) {
+        drain(encoder, output, output_len);
+        if (has_pending(encoder) || *input_len == 0) {
+            return HUFFMAN_STREAM_OK;
+        }
+
+        // Whole blocks are encoded where they are; only pieces are collected in block
+        if (encoder->block_len == 0 && *input_len >= encoder->block_size) {
+            if (queue_block(encoder, *input, encoder->block_size) != 0) {
+                return HUFFMAN_STREAM_ERROR;
+            }
+            *input += encoder->block_size;
+            *input_len -= encoder->block_size;
+            continue;
+        }
+
+        size_t count = encoder->block_size - encoder->block_len;
+        if (count > *input_len) {
+            count = *input_len;
+        }
+        memcpy(encoder->block + encoder->block_len, *input, count);
+        encoder->block_len += count;
+        *input += count;
+        *input_len -= count;
+        if (encoder->block_len == encoder->block_size) {
+            encoder->block_len = 0;
+            if (queue_block(encoder, encoder->block, encoder->block_size) != 0) {
+                return HUFFMAN_STREAM_ERROR;
+            }
+        }
+    }
+}
+
+int huffman_stream_encoder_flush(HuffmanStreamEncoder* encoder, uint8_t** output, size_t* output_len) {
+    drain(encoder, output, output_len);
+    if (has_pending(encoder)) {
+        return HUFFMAN_STREAM_OK;
+    }
+    if (encoder->block_len > 0) {
+        size_t length = encoder->block_len;
+        encoder->block_len = 0;
+        if (queue_block(encoder, encoder->block, length) != 0) {
+            return HUFFMAN_STREAM_ERROR;
+        }
+        drain(encoder, output, output_len);
+    }
+    return has_pending(encoder) ? HUFFMAN_STREAM_OK : HUFFMAN_STREAM_END;
+}
+
+int huffman_stream_encoder_finish(HuffmanStreamEncoder* encoder, uint8_t** output, size_t* output_len) {
+    int rc = huffman_stream_encoder_flush(encoder, output, output_len);
+    if (rc != HUFFMAN_STREAM_END) {
+        return rc;
+    }
+    if (!encoder->finished) {
+        if (index_reserve(encoder, STREAM_TRAILER_SIZE) != 0) {
+            return HUFFMAN_STREAM_ERROR;
+        }
+        encoder->finished = true;
+
+        write_trailer(encoder->index, (encoder->index_len - 4) / STREAM_INDEX_ENTRY_SIZE, encoder->position + 4);
+        encoder->index_len += STREAM_TRAILER_SIZE;
+
+        encoder->pending = encoder->index;
+        encoder->pending_pos = 0;
+        encoder->pending_len = encoder->index_len;
+        drain(encoder, output, output_len);
+    }
+    return has_pending(encoder) ? HUFFMAN_STREAM_OK : HUFFMAN_STREAM_END;
+}
+
+HuffmanStreamDecoder* huffman_stream_decoder_init(const HuffmanAllocator* allocator) {
+    if (!allocator) {
+        allocator = &default_allocator;
+    }
+    HuffmanStreamDecoder* decoder = stream_alloc(allocator, sizeof(*decoder));
+    if (!decoder) {
+        return NULL;
+    }
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->allocator = *allocator;
+    decoder->state = DECODE_HEADER;
+    return decoder;
+}
+
+void huffman_stream_decoder_release(HuffmanStreamDecoder* decoder) {
+    if (!decoder) {
+        return;
+    }
+    HuffmanAllocator allocator = decoder->allocator;
+    stream_free(&allocator, decoder->block);
+    stream_free(&allocator, decoder->encoded);
+    stream_free(&allocator, decoder->decoder);
+    stream_free(&allocator, decoder->work);
+    stream_free(&allocator, decoder);
+}
+
+// Collect want bytes in target across calls; returns true once they are all there
+static bool gather(HuffmanStreamDecoder* decoder, uint8_t* target, size_t* have, size_t want,
+                   const uint8_t** input, size_t* input_len) {
+    size_t count = want - *have;
+    if (count > *input_len) {
+        count = *input_len;
+    }
+    memcpy(target + *have, *input, count);
+    *have += count;
+    *input += count;
+    *input_len -= count;
+    decoder->position += count;
+    return *have == want;
+}
+
+// The buffers grow to the largest block seen, so memory follows the block size, not the stream size
+static int reserve(HuffmanStreamDecoder* decoder, size_t length) {
+    if (length <= decoder->capacity) {
+        return 0;
+    }
+    stream_free(&decoder->allocator, decoder->block);
+    stream_free(&decoder->allocator, decoder->encoded);
+    decoder->block = stream_alloc(&decoder->allocator, length);
+    decoder->encoded = stream_alloc(&decoder->allocator, length * STREAM_MAX_CODE_LENGTH / 8 + 1 + STREAM_PAYLOAD_SLACK);
+    decoder->capacity = decoder->block && decoder->encoded ? length : 0;
+    return decoder->capacity ? 0 : -1;
+}
+
+// Decoder of the 128 bytes of packed code lengths of an order-0 block
+static int load_table(const uint8_t* packed, HuffmanDecoder* decoder) {
+    uint8_t lengths[256];
+    HuffmanCode table[256];
+    for (int i = 0; i < 128; i++) {
+        lengths[2 * i] = packed[i] >> 4;
+        lengths[2 * i + 1] = packed[i] & 0x0F;
+    }
+    if (huffman_canonical_codes(lengths, table) != 0 || huffman_decoder_init(decoder, table) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int load_model(const uint8_t* model, size_t model_size, ContextWork* work) {
+    size_t used;
+    if (context_model_read(&work->model, model, model_size, &used) != 0 || used != model_size) {
+        return -1;
+    }
+    context_decoder_init(&work->decoder, &work->model);
+    return 0;
+}
+
+// Sub-streams of the order-0 blocks of a file, from its header (0 before they existed), or -1
+static int header_streams(const uint8_t* header) {
+    int streams = header[6] == 0 ? 1 : header[6];
+    if (streams > HUFFMAN_MAX_STREAMS || (streams > 1 && header[5] != 0) || header[7] != 0) {
+        return -1;
+    }
+    return streams;
+}
+
+// Largest bit count field of an order-0 block of length bytes
+static uint64_t max_block_bits(uint32_t length, int streams) {
+    return (uint64_t)length * STREAM_MAX_CODE_LENGTH + (streams > 1 ? 8 * STREAM_PAYLOAD_SLACK : 0);
+}
+
+static int decode_block_payload(const HuffmanDecoder* decoder, int streams, const uint8_t* payload, uint64_t bit_len,
+                                uint8_t* output, size_t length) {
+    if (streams > 1) {
+        return bit_len % 8 == 0 ? huffman_decode_streams(decoder, payload, bit_len / 8, streams, output, length) : -1;
+    }
+    return huffman_decode(decoder, payload, bit_len, output, length);
+}
+
+static DecoderState read_header(HuffmanStreamDecoder* decoder) {
+    const uint8_t* header = decoder->stage;
+    if (memcmp(header, STREAM_MAGIC, 4) != 0 || header[4] < 1 || header[4] > STREAM_VERSION ||
+        header[5] > STREAM_MAX_ORDER || header_streams(header) < 0) {
+        return DECODE_ERROR;
+    }
+    decoder->version = header[4];
+    decoder->order = header[5];
+    decoder->streams = header_streams(header);
+    if (decoder->order == 0) {
+        decoder->decoder = stream_alloc(&decoder->allocator, sizeof(*decoder->decoder));
+    } else {
+        decoder->work = stream_alloc(&decoder->allocator, sizeof(*decoder->work));
+    }
+    return decoder->decoder || decoder->work ? DECODE_BLOCK_SIZE : DECODE_ERROR;
+}
+
+static DecoderState read_block_size(HuffmanStreamDecoder* decoder) {
+    decoder->length = get_u32(decoder->stage);
+    if (decoder->length == 0) {
+        // Version 2 goes on with the index of the blocks just read
+        decoder->index_offset = decoder->position;
+        if (decoder->version == 1) {
+            return DECODE_END;
+        }
+        return decoder->blocks > 0 ? DECODE_INDEX : DECODE_TRAILER;
+    }
+    if (decoder->length > STREAM_MAX_BLOCK_SIZE || reserve(decoder, decoder->length) != 0) {
+        return DECODE_ERROR;
+    }
+    return DECODE_BLOCK_HEADER;
+}
+
+// Size of the rest of a block header after its size: the table of order 0, the sizes of order 1
+static size_t block_header_size(const HuffmanStreamDecoder* decoder) {
+    size_t checksum = decoder->version >= 2 ? 4 : 0;
+    return decoder->order == 0 ? 4 + checksum + 128 : 8 + checksum;
+}
+
+static DecoderState read_block_header(HuffmanStreamDecoder* decoder) {
+    const uint8_t* header = decoder->stage;
+    decoder->bit_len = get_u32(header);
+    header += 4;
+    if (decoder->version >= 2) {
+        decoder->crc = get_u32(header);
+        header += 4;
+    }
+
+    if (decoder->order == 1) {
+        decoder->model_size = get_u32(header);
+        if (decoder->bit_len > (uint64_t)decoder->length * CONTEXT_MAX_CODE_LENGTH ||
+            decoder->model_size > CONTEXT_MODEL_MAX_SIZE) {
+            return DECODE_ERROR;
+        }
+        return DECODE_MODEL;
+    }
+
+    if (decoder->bit_len > max_block_bits(decoder->length, decoder->streams) ||
+        load_table(header, decoder->decoder) != 0) {
+        return DECODE_ERROR;
+    }
+    return DECODE_PAYLOAD;
+}
+
+static DecoderState read_model(HuffmanStreamDecoder* decoder) {
+    return load_model(decoder->stage, decoder->model_size, decoder->work) == 0 ? DECODE_PAYLOAD : DECODE_ERROR;
+}
+
+static DecoderState decode_payload(HuffmanStreamDecoder* decoder) {
+    int rc = decoder->order == 0
+                 ? decode_block_payload(decoder->decoder, decoder->streams, decoder->encoded, decoder->bit_len,
+                                        decoder->block, decoder->length)
+                 : context_decode(&decoder->work->decoder, decoder->encoded, decoder->bit_len, decoder->block,
+                                  decoder->length);
+    if (rc != 0 || (decoder->version >= 2 && crc32c(0, decoder->block, decoder->length) != decoder->crc)) {
+        return DECODE_ERROR;
+    }
+    decoder->blocks++;
+    decoder->total_size += decoder->length;
+    decoder->output_pos = 0;
+    return DECODE_OUTPUT;
+}
+
+// Index entries follow the blocks in order and add up to what was decoded
+static DecoderState read_index_entry(HuffmanStreamDecoder* decoder) {
+    uint64_t offset = get_u64(decoder->stage);
+    uint32_t size = get_u32(decoder->stage + 8);
+    if ((decoder->index_entries == 0 ? offset != STREAM_HEADER_SIZE : offset <= decoder->last_offset) ||
+        offset >= decoder->index_offset || size == 0) {
+        return DECODE_ERROR;
+    }
+    decoder->index_crc = crc32c(decoder->index_crc, decoder->stage, STREAM_INDEX_ENTRY_SIZE);
+    decoder->last_offset = offset;
+    decoder->index_size += size;
+    decoder->index_entries++;
+    return decoder->index_entries == decoder->blocks ? DECODE_TRAILER : DECODE_INDEX;
+}
+
+static DecoderState read_trailer(HuffmanStreamDecoder* decoder) {
+    const uint8_t* trailer = decoder->stage;
+    uint32_t crc = crc32c(decoder->index_crc, trailer, 12);
+    if (get_u32(trailer) != decoder->blocks || get_u64(trailer + 4) != decoder->index_offset ||
+        get_u32(trailer + 12) != crc || memcmp(trailer + 16, STREAM_INDEX_MAGIC, 4) != 0 ||
+        decoder->index_size != decoder->total_size) {
+        return DECODE_ERROR;
+    }
+    return DECODE_END;
+}
+
+int huffman_stream_decoder_update(HuffmanStreamDecoder* decoder, const uint8_t** input, size_t* input_len,
+                                  uint8_t** output, size_t* output_len) {
+    while (true) {
+        DecoderState next = decoder->state;
+        size_t want = 0;
+
+        switch (decoder->state) {
+        case DECODE_HEADER:
+            want = STREAM_HEADER_SIZE;
+            break;
+        case DECODE_BLOCK_SIZE:
+            want = 4;
+            break;
+        case DECODE_BLOCK_HEADER:
+            want = block_header_size(decoder);
+            break;
+        case DECODE_MODEL:
+            want = decoder->model_size;
+            break;
+        case DECODE_INDEX:
+            want = STREAM_INDEX_ENTRY_SIZE;
+            break;
+        case DECODE_TRAILER:
+            want = STREAM_TRAILER_SIZE;
+            break;
+        case DECODE_PAYLOAD:
+            if (!gather(decoder, decoder->encoded, &decoder->encoded_len, ((size_t)decoder->bit_len + 7) / 8,
+                        input, input_len)) {
+                return HUFFMAN_STREAM_OK;
+            }
+            decoder->encoded_len = 0;
+            next = decode_payload(decoder);
+            break;
+        case DECODE_OUTPUT: {
+            size_t count = decoder->length - decoder->output_pos;
+            if (count > *output_len) {
+                count = *output_len;
+            }
+            memcpy(*output, decoder->block + decoder->output_pos, count);
+            decoder->output_pos += count;
+            *output += count;
+            *output_len -= count;
+            if (decoder->output_pos < decoder->length) {
+                return HUFFMAN_STREAM_OK;
+            }
+            next = DECODE_BLOCK_SIZE;
+            break;
+        }
+        case DECODE_END:
+            return HUFFMAN_STREAM_END;
+        case DECODE_ERROR:
+            return HUFFMAN_STREAM_ERROR;
+        }
+
+        // Headers, the model and the index are collected in stage, then parsed
+        if (want > 0 || decoder->state == DECODE_MODEL) {
+            if (!gather(decoder, decoder->stage, &decoder->stage_len, want, input, input_len)) {
+                return HUFFMAN_STREAM_OK;
+            }
+            decoder->stage_len = 0;
+            switch (decoder->state) {
+            case DECODE_HEADER:
+                next = read_header(decoder);
+                break;
+            case DECODE_BLOCK_SIZE:
+                next = read_block_size(decoder);
+                break;
+            case DECODE_BLOCK_HEADER:
+                next = read_block_header(decoder);
+                break;
+            case DECODE_MODEL:
+                next = read_model(decoder);
+                break;
+            case DECODE_INDEX:
+                next = read_index_entry(decoder);
+                break;
+            default:
+                next = read_trailer(decoder);
+                break;
+            }
+        }
+        decoder->state = next;
+    }
+}
+
+int huffman_index_read(const uint8_t* data, size_t size, StreamIndex* index) {
+    memset(index, 0, sizeof(*index));
+    if (size < STREAM_HEADER_SIZE + 4 + STREAM_TRAILER_SIZE || memcmp(data, STREAM_MAGIC, 4) != 0 ||
+        data[4] != STREAM_VERSION || data[5] > STREAM_MAX_ORDER || header_streams(data) < 0) {
+        return -1;
+    }
+
+    const uint8_t* trailer = data + size - STREAM_TRAILER_SIZE;
+    uint64_t count = get_u32(trailer);
+    uint64_t index_offset = get_u64(trailer + 4);
+    if (memcmp(trailer + 16, STREAM_INDEX_MAGIC, 4) != 0 || index_offset < STREAM_HEADER_SIZE + 4 ||
+        index_offset > size - STREAM_TRAILER_SIZE ||
+        size - STREAM_TRAILER_SIZE - index_offset != count * STREAM_INDEX_ENTRY_SIZE ||
+        get_u32(data + index_offset - 4) != 0 ||
+        crc32c(0, data + index_offset, count * STREAM_INDEX_ENTRY_SIZE + 12) != get_u32(trailer + 12)) {
+        return -1;
+    }
+
+    index->entries = malloc((count > 0 ? count : 1) * sizeof(*index->entries));
+    if (!index->entries) {
+        return -1;
+    }
+    index->order = data[5];
+    index->streams = header_streams(data);
+    index->count = count;
+    index->index_offset = index_offset;
+
+    // The blocks follow each other from the header to the end mark without gaps
+    uint64_t end = STREAM_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* entry = data + index_offset + i * STREAM_INDEX_ENTRY_SIZE;
+        StreamIndexEntry* block = &index->entries[i];
+        block->offset = get_u64(entry);
+        block->size = get_u32(entry + 8);
+        block->data_offset = index->total_size;
+        uint64_t next = i + 1 < count ? get_u64(entry + STREAM_INDEX_ENTRY_SIZE) : index_offset - 4;
+        if (block->offset != end || next <= block->offset || next > index_offset - 4 ||
+            block->size == 0 || block->size > STREAM_MAX_BLOCK_SIZE) {
+            huffman_index_free(index);
+            return -1;
+        }
+        end = next;
+        index->total_size += block->size;
+    }
+    if (end != index_offset - 4) {
+        huffman_index_free(index);
+        return -1;
+    }
+    return 0;
+}
+
+void huffman_index_free(StreamIndex* index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+// A thread of huffman_decompress_range: its own decoder, and room for a block that is only partly wanted
+typedef struct RangeWorker {
+    const uint8_t* data;
+    const StreamIndex* index;
+    size_t last_block;
+    size_t* next_block;      // shared, the blocks are taken in order
+    uint64_t begin;
+    size_t length;
+    uint8_t* output;
+    HuffmanDecoder* decoder;
+    ContextWork* work;
+    uint8_t* scratch;
+    int status;
+} RangeWorker;
+
+// Decode block i of the file into output (its whole uncompressed size) and check its CRC-32C
+static int decode_stored_block(RangeWorker* worker, size_t i, uint8_t* output) {
+    const StreamIndex* index = worker->index;
+    const StreamIndexEntry* entry = &index->entries[i];
+    const uint8_t* block = worker->data + entry->offset;
+    uint64_t stored = (i + 1 < index->count ? index->entries[i + 1].offset : index->index_offset - 4) - entry->offset;
+    uint64_t header_size = index->order == 0 ? STREAM_BLOCK_HEADER_SIZE : 16;
+    if (stored < header_size || get_u32(block) != entry->size) {
+        return -1;
+    }
+
+    uint64_t bit_len = get_u32(block + 4);
+    uint32_t crc = get_u32(block + 8);
+    int rc;
+    if (index->order == 0) {
+        if (bit_len > max_block_bits(entry->size, index->streams) || header_size + (bit_len + 7) / 8 > stored ||
+            load_table(block + 12, worker->decoder) != 0) {
+            return -1;
+        }
+        rc = decode_block_payload(worker->decoder, index->streams, block + header_size, bit_len, output, entry->size);
+    } else {
+        uint64_t model_size = get_u32(block + 12);
+        if (bit_len > (uint64_t)entry->size * CONTEXT_MAX_CODE_LENGTH || model_size > CONTEXT_MODEL_MAX_SIZE ||
+            header_size + model_size + (bit_len + 7) / 8 > stored ||
+            load_model(block + header_size, model_size, worker->work) != 0) {
+            return -1;
+        }
+        rc = context_decode(&worker->work->decoder, block + header_size + model_size, bit_len, output, entry->size);
+    }
+    return rc == 0 && crc32c(0, output, entry->size) == crc ? 0 : -1;
+}
+
+static void* decode_range_blocks(void* arg) {
+    RangeWorker* worker = (RangeWorker*)arg;
+    worker->status = 0;
+
+    while (worker->status == 0) {
+        size_t i = __atomic_fetch_add(worker->next_block, 1, __ATOMIC_RELAXED);
+        if (i > worker->last_block) {
+            break;
+        }
+
+        // Blocks inside the range are decoded in place, the partial ones at its ends through scratch
+        const StreamIndexEntry* entry = &worker->index->entries[i];
+        uint64_t from = entry->data_offset > worker->begin ? entry->data_offset : worker->begin;
+        uint64_t to = entry->data_offset + entry->size;
+        if (to > worker->begin + worker->length) {
+            to = worker->begin + worker->length;
+        }
+        uint8_t* target = worker->output + (from - worker->begin);
+        if (from == entry->data_offset && to == entry->data_offset + entry->size) {
+            worker->status = decode_stored_block(worker, i, target);
+        } else {
+            worker->status = decode_stored_block(worker, i, worker->scratch);
+            memcpy(target, worker->scratch + (from - entry->data_offset), to - from);
+        }
+    }
+    return NULL;
+}
+
+// The block holding uncompressed byte position
+static size_t find_block(const StreamIndex* index, uint64_t position) {
+    size_t low = 0, high = index->count - 1;
+    while (low < high) {
+        size_t middle = (low + high + 1) / 2;
+        if (index->entries[middle].data_offset <= position) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+int huffman_decompress_range(const uint8_t* data, size_t size, const StreamIndex* index, uint64_t begin,
+                             size_t length, uint8_t* output, int thread_count) {
+    (void)size;  // the blocks were bounded by huffman_index_read
+    if (begin > index->total_size || length > index->total_size - begin) {
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    size_t first_block = find_block(index, begin);
+    size_t last_block = find_block(index, begin + length - 1);
+    if (thread_count <= 0) {
+        thread_count = cpu_count();
+    }
+    if (thread_count > STREAM_MAX_THREADS) {
+        thread_count = STREAM_MAX_THREADS;
+    }
+    if ((size_t)thread_count > last_block - first_block + 1) {
+        thread_count = (int)(last_block - first_block + 1);
+    }
+
+    // Only the blocks at the two ends can be partly wanted, scratch holds the larger of them
+    size_t scratch_size = index->entries[first_block].size;
+    if (index->entries[last_block].size > scratch_size) {
+        scratch_size = index->entries[last_block].size;
+    }
+
+    RangeWorker workers[STREAM_MAX_THREADS];
+    pthread_t threads[STREAM_MAX_THREADS];
+    size_t next_block = first_block;
+    int status = 0;
+    memset(workers, 0, thread_count * sizeof(workers[0]));
+    for (int t = 0; t < thread_count; t++) {
+        RangeWorker* worker = &workers[t];
+        worker->data = data;
+        worker->index = index;
+        worker->last_block = last_block;
+        worker->next_block = &next_block;
+        worker->begin = begin;
+        worker->length = length;
+        worker->output = output;
+        worker->decoder = index->order == 0 ? malloc(sizeof(*worker->decoder)) : NULL;
+        worker->work = index->order == 1 ? malloc(sizeof(*worker->work)) : NULL;
+        worker->scratch = malloc(scratch_size);
+        if ((!worker->decoder && !worker->work) || !worker->scratch) {
+            status = -1;
+        }
+    }
+
+    // The first worker runs on the calling thread
+    if (status == 0) {
+        int started = 0;
+        for (int t = 1; t < thread_count; t++) {
+            if (pthread_create(&threads[t], NULL, decode_range_blocks, &workers[t]) != 0) {
+                break;
+            }
+            started = t;
+        }
+        decode_range_blocks(&workers[0]);
+        for (int t = 1; t <= started; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        for (int t = 0; t <= started; t++) {
+            if (workers[t].status != 0) {
+                status = -1;
+            }
+        }
+    }
+
+    for (int t = 0; t < thread_count; t++) {
+        free(workers[t].decoder);
+        free(workers[t].work);
+        free(workers[t].scratch);
+    }
+    return status;
+}
+
+// Run the encoder over data (or finish it) and write everything it produces to out
+static int encode_to_file(HuffmanStreamEncoder* encoder, const uint8_t* data, size_t length, bool finish,
+                          FILE* out, uint8_t* buffer) {
+    int rc;
+    size_t space;
+    do {
+        uint8_t* next = buffer;
+        space = STREAM_IO_SIZE;
+        rc = finish ? huffman_stream_encoder_finish(encoder, &next, &space)
+                    : huffman_stream_encoder_update(encoder, &data, &length, &next, &space);
+        size_t produced = (size_t)(next - buffer);
+        if (rc == HUFFMAN_STREAM_ERROR || fwrite(buffer, 1, produced, out) != produced) {
+            return -1;
+        }
+    } while (finish ? rc == HUFFMAN_STREAM_OK : length > 0 || space == 0);
+    return 0;
+}
+
+int huffman_compress_stream(FILE* in, FILE* out, size_t block_size, int order, int streams) {
+    // Read a block at a time, so every block is encoded straight from the read buffer
+    block_size = checked_block_size(block_size);
+    HuffmanStreamEncoder* encoder = huffman_stream_encoder_init(block_size, order, streams, NULL);
+    uint8_t* block = malloc(block_size);
+    uint8_t* buffer = malloc(STREAM_IO_SIZE);
+    int status = -1;
+
+    if (encoder && block && buffer) {
+        status = 0;
+        size_t length;
+        while ((length = fread(block, 1, block_size, in)) > 0) {
+            if (encode_to_file(encoder, block, length, false, out, buffer) != 0) {
+                status = -1;
+                break;
+            }
+        }
+        if (status == 0 && (ferror(in) || encode_to_file(encoder, NULL, 0, true, out, buffer) != 0 ||
+                            fflush(out) != 0)) {
+            status = -1;
+        }
+    }
+
+    huffman_stream_encoder_release(encoder);
+    free(block);
+    free(buffer);
+    return status;
+}
+
+int huffman_compress_buffer(const uint8_t* data, size_t length, FILE* out, size_t block_size, int order,
+                            int streams) {
+    HuffmanStreamEncoder* encoder = huffman_stream_encoder_init(block_size, order, streams, NULL);
+    uint8_t* buffer = malloc(STREAM_IO_SIZE);
+    int status = -1;
+
+    if (encoder && buffer && encode_to_file(encoder, data, length, false, out, buffer) == 0 &&
+        encode_to_file(encoder, NULL, 0, true, out, buffer) == 0 && fflush(out) == 0) {
+        status = 0;
+    }
+
+    huffman_stream_encoder_release(encoder);
+    free(buffer);
+    return status;
+}
+
+int huffman_decompress_stream(FILE* in, FILE* out) {
+    HuffmanStreamDecoder* decoder = huffman_stream_decoder_init(NULL);
+    uint8_t* input = malloc(STREAM_IO_SIZE);
+    uint8_t* output = malloc(STREAM_IO_SIZE);
+    int status = decoder && input && output ? 0 : -1;
+
+    const uint8_t* next_in = input;
+    size_t input_len = 0;
+    size_t space = STREAM_IO_SIZE;
+    int rc = HUFFMAN_STREAM_OK;
+    while (status == 0 && rc == HUFFMAN_STREAM_OK) {
+        // More input is needed once the decoder has taken everything without filling the output;
+        // a truncated stream ends at EOF
+        if (input_len == 0 && space > 0) {
+            next_in = input;
+            input_len = fread(input, 1, STREAM_IO_SIZE, in);
+            if (input_len == 0) {
+                status = -1;
+                break;
+            }
+        }
+        uint8_t* next_out = output;
+        space = STREAM_IO_SIZE;
+        rc = huffman_stream_decoder_update(decoder, &next_in, &input_len, &next_out, &space);
+        size_t produced = (size_t)(next_out - output);
+        if (rc == HUFFMAN_STREAM_ERROR || fwrite(output, 1, produced, out) != produced) {
+            status = -1;
+        }
+    }
+
+    if (status == 0 && fflush(out) != 0) {
+        status = -1;
+    }
+
+    huffman_stream_decoder_release(decoder);
+    free(input);
+    free(output);
+    return status;
+}